@@ -0,0 +1,40 @@
+// GPIO driver of the host simulation: levels are kept in memory, virtualGpioTrigger() (host_sim.h) calls the ISR.
+#pragma once
+#include <stdint.h>
+#include "esp_err.h"
+
+#define GPIO_PIN_COUNT 40
+
+typedef enum
+{
+    GPIO_NUM_NC = -1,
+    GPIO_NUM_21 = 21,
+    GPIO_NUM_22 = 22,
+    GPIO_NUM_MAX = GPIO_PIN_COUNT,
+} gpio_num_t;
+
+typedef enum
+{
+    GPIO_MODE_DISABLE,
+    GPIO_MODE_INPUT,
+    GPIO_MODE_OUTPUT,
+} gpio_mode_t;
+
+typedef enum
+{
+    GPIO_INTR_DISABLE,
+    GPIO_INTR_POSEDGE,
+    GPIO_INTR_NEGEDGE,
+    GPIO_INTR_ANYEDGE,
+} gpio_int_type_t;
+
+typedef void (*gpio_isr_t)(void *arg);
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode);
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level);
+int gpio_get_level(gpio_num_t gpio_num);
+esp_err_t gpio_pullup_en(gpio_num_t gpio_num);
+esp_err_t gpio_pulldown_dis(gpio_num_t gpio_num);
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type);
+esp_err_t gpio_install_isr_service(int intr_alloc_flags);
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void *args);
@@ -0,0 +1,72 @@
+// esp_http_client of the host simulation: the calls the uploader makes, as a plain HTTP/1.1 client over the sockets
+// of the host (virtual_http_client.c). http:// URLs only, the request body is set with esp_http_client_set_post_field()
+// and the response body is read and dropped (HTTP_EVENT_ON_DATA), as the uploader only looks at the headers.
+// As with esp-idf, the connection is kept between two requests when keep_alive_enable is set, and opened again when
+// the server closed it in the meantime. A request that fails (connection refused, dropped, timeout) closes it.
+#pragma once
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define ESP_ERR_HTTP_BASE 0x7000
+#define ESP_ERR_HTTP_CONNECT (ESP_ERR_HTTP_BASE + 2)
+#define ESP_ERR_HTTP_WRITE_DATA (ESP_ERR_HTTP_BASE + 3)
+#define ESP_ERR_HTTP_FETCH_HEADER (ESP_ERR_HTTP_BASE + 4)
+#define ESP_ERR_HTTP_INVALID_TRANSPORT (ESP_ERR_HTTP_BASE + 5)
+
+typedef struct esp_http_client *esp_http_client_handle_t;
+
+typedef enum
+{
+    HTTP_EVENT_ERROR,
+    HTTP_EVENT_ON_CONNECTED,
+    HTTP_EVENT_HEADERS_SENT,
+    HTTP_EVENT_ON_HEADER,
+    HTTP_EVENT_ON_DATA,
+    HTTP_EVENT_ON_FINISH,
+    HTTP_EVENT_DISCONNECTED,
+} esp_http_client_event_id_t;
+
+typedef struct esp_http_client_event
+{
+    esp_http_client_event_id_t event_id;
+    esp_http_client_handle_t client;
+    void *data;
+    int data_len;
+    void *user_data;
+    char *header_key;
+    char *header_value;
+} esp_http_client_event_t;
+
+typedef esp_err_t (*http_event_handle_cb)(esp_http_client_event_t *evt);
+
+typedef enum
+{
+    HTTP_METHOD_GET = 0,
+    HTTP_METHOD_POST,
+    HTTP_METHOD_PUT,
+    HTTP_METHOD_PATCH,
+    HTTP_METHOD_DELETE,
+    HTTP_METHOD_HEAD,
+    HTTP_METHOD_MAX,
+} esp_http_client_method_t;
+
+typedef struct
+{
+    const char *url;
+    int timeout_ms;
+    bool keep_alive_enable;
+    http_event_handle_cb event_handler;
+    void *user_data;
+    esp_http_client_method_t method;
+} esp_http_client_config_t;
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config);
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char *url);
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t client, esp_http_client_method_t method);
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value);
+/// @brief Body of the next requests, not copied: data must stay valid until they are performed.
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client, const char *data, int len);
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client);
+int esp_http_client_get_status_code(esp_http_client_handle_t client);
+esp_err_t esp_http_client_close(esp_http_client_handle_t client);
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client);
@@ -0,0 +1,5 @@
+// esp_timer of the host simulation: the monotonic clock of the host, in µs.
+#pragma once
+#include <stdint.h>
+
+int64_t esp_timer_get_time(void);
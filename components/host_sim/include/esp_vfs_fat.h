@@ -0,0 +1,45 @@
+// SD card mount of the host simulation: the mount point is a host directory, created if needed. fopen() and the other
+// stdio calls reach it directly, the FatFs calls through virtual_card.c.
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "driver/spi_master.h"
+#include "ff.h"
+
+#define SDSPI_DEFAULT_DMA SPI_DMA_CH_AUTO
+
+typedef struct
+{
+    int slot;
+} sdmmc_host_t;
+
+typedef struct
+{
+    uint64_t capacity_bytes;
+} sdmmc_card_t;
+
+typedef struct
+{
+    spi_host_device_t host_id;
+    int gpio_cs;
+    int gpio_cd;
+    int gpio_wp;
+    int gpio_int;
+} sdspi_device_config_t;
+
+typedef struct
+{
+    bool format_if_mount_failed;
+    int max_files;
+    size_t allocation_unit_size;
+} esp_vfs_fat_sdmmc_mount_config_t;
+
+#define SDSPI_HOST_DEFAULT() {.slot = SPI2_HOST}
+#define SDSPI_DEVICE_CONFIG_DEFAULT() {.host_id = SPI2_HOST, .gpio_cs = 13, .gpio_cd = -1, .gpio_wp = -1, .gpio_int = -1}
+
+/// @brief Mount a host directory as the card. The size of the card is CONFIG_DATAFLY_HOST_CARD_MB (the free space
+/// of the host file system if 0).
+esp_err_t esp_vfs_fat_sdspi_mount(const char *base_path, const sdmmc_host_t *host_config_input,
+                                  const sdspi_device_config_t *slot_config,
+                                  const esp_vfs_fat_sdmmc_mount_config_t *mount_config, sdmmc_card_t **out_card);
@@ -0,0 +1,76 @@
+// FatFs calls of the host simulation, over the host directory mounted by esp_vfs_fat_sdspi_mount() (virtual_card.c).
+// As on the card (long file names disabled): names are matched without case and directories are created upper case.
+// f_readdir() returns the names as the host directory holds them, not upper case as the card does: what the logger
+// lists it may open with fopen(), which matches names without case on the card but not on the host.
+// The archive attribute is kept in memory, for the files of the current run.
+#pragma once
+#include <stdint.h>
+
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef uint32_t FSIZE_t;
+
+typedef enum
+{
+    FR_OK = 0,
+    FR_DISK_ERR,
+    FR_INT_ERR,
+    FR_NOT_READY,
+    FR_NO_FILE,
+    FR_NO_PATH,
+    FR_INVALID_NAME,
+    FR_DENIED,
+    FR_EXIST,
+    FR_INVALID_OBJECT,
+    FR_WRITE_PROTECTED,
+    FR_INVALID_DRIVE,
+    FR_NOT_ENABLED,
+    FR_NO_FILESYSTEM,
+    FR_MKFS_ABORTED,
+    FR_TIMEOUT,
+    FR_LOCKED,
+    FR_NOT_ENOUGH_CORE,
+    FR_TOO_MANY_OPEN_FILES,
+    FR_INVALID_PARAMETER
+} FRESULT;
+
+#define AM_RDO 0x01
+#define AM_HID 0x02
+#define AM_SYS 0x04
+#define AM_DIR 0x10
+#define AM_ARC 0x20
+
+typedef struct
+{
+    WORD csize; // Sectors per cluster.
+    WORD ssize; // Bytes per sector.
+    DWORD n_fatent; // Clusters + 2.
+    DWORD free_clst;
+} FATFS;
+
+#define FF_HOST_PATH_SIZE 256
+
+typedef struct
+{
+    void *dir; // DIR of the host.
+    char path[FF_HOST_PATH_SIZE];
+} FF_DIR;
+
+typedef struct
+{
+    FSIZE_t fsize;
+    WORD fdate;
+    WORD ftime;
+    BYTE fattrib;
+    char fname[13];
+} FILINFO;
+
+FRESULT f_mkdir(const char *path);
+FRESULT f_unlink(const char *path);
+FRESULT f_stat(const char *path, FILINFO *fno);
+FRESULT f_chmod(const char *path, BYTE attr, BYTE mask);
+FRESULT f_opendir(FF_DIR *dp, const char *path);
+FRESULT f_readdir(FF_DIR *dp, FILINFO *fno);
+FRESULT f_closedir(FF_DIR *dp);
+FRESULT f_getfree(const char *path, DWORD *nclst, FATFS **fatfs);
@@ -0,0 +1,86 @@
+// Host simulation (linux target only): what stands in for the hardware of the logger.
+// - two virtual CAN buses, read through the usual drivers: twai_receive() for the TWAI controller, and the MCP2515
+//   registers behind spi_device_transmit(), so that the MCP2515 driver itself runs unchanged.
+// - the card: a host directory, mounted by esp_vfs_fat_sdspi_mount() and reached through the FatFs calls (f_*).
+// - the GPIOs: levels are kept, and the ISR of an input is called by virtualGpioTrigger().
+// - the UARTs: bytes written go to a peer in the host, which answers through virtualUartReceive(). The SIM7080G is
+//   such a peer (virtual_modem.c): it answers the AT commands of sim7080g.h, and sends URCs and bursts on demand.
+// - the network: esp_http_client (virtual_http_client.c) is a plain HTTP/1.1 client over the sockets of the host, for
+//   the uploader, and esp-mqtt (virtual_mqtt_client.c) a plain MQTT 3.1.1 one, for the MQTT publisher.
+// Frames come from sources (virtual_can_source_t) attached to a bus. A frame due at a time is delivered once that time
+// has passed, the frames due while the receive buffer of the controller is full are lost (and counted), as on the
+// bus. A frame due at 0 is delivered as soon as the buffer has room: nothing is lost, the logger sets the pace.
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum
+{
+    VIRTUAL_CAN_TWAI,
+    VIRTUAL_CAN_MCP2515,
+    VIRTUAL_CAN_BUS_COUNT
+} virtual_can_bus_t;
+
+typedef struct
+{
+    uint32_t identifier; // 11 or 29 bits.
+    bool extended;
+    bool rtr;
+    uint8_t dlc;
+    uint8_t data[8];
+    int64_t due_us; // esp_timer_get_time() at which the frame is on the bus, 0: as soon as there is room.
+} virtual_can_frame_t;
+
+/// @brief Next frame of a source, in due order.
+/// @return false once the source is exhausted.
+typedef bool (*virtual_can_source_t)(void *context, virtual_can_frame_t *frame);
+
+typedef struct
+{
+    bool finished;      // The source is exhausted and every frame was read or lost.
+    uint64_t delivered; // Frames read by the driver.
+    uint64_t overrun;   // Frames lost because the receive buffer was full.
+} virtual_can_stats_t;
+
+/// @brief Attach a source to a bus, replacing the previous one. Frames are read from it as the driver polls.
+void virtualCanAttach(virtual_can_bus_t bus, virtual_can_source_t source, void *context);
+void virtualCanGetStats(virtual_can_bus_t bus, virtual_can_stats_t *stats);
+
+/// @brief Call the ISR attached to an input, as an edge on the pin would.
+void virtualGpioTrigger(int gpio_num);
+int virtualGpioGetLevel(int gpio_num);
+
+/// @brief Bytes written by the driver to a UART, passed to its peer by uart_write_bytes().
+typedef void (*virtual_uart_peer_t)(void *context, const uint8_t *bytes, size_t length);
+
+/// @brief Connect a peer to a UART, replacing the previous one.
+void virtualUartAttach(int uart_num, virtual_uart_peer_t peer, void *context);
+/// @brief The peer sends bytes: they go to the RX buffer of the driver and a UART_DATA event is posted. The bytes that
+/// do not fit are lost, and a UART_BUFFER_FULL event is posted.
+/// @return the bytes stored.
+size_t virtualUartReceive(int uart_num, const void *bytes, size_t length);
+
+#define VIRTUAL_MODEM_IMEI "869951030000000" // Answer of AT+CGSN.
+#define VIRTUAL_MODEM_MAX_PAYLOAD 1460       // Largest AT+CASEND payload.
+
+typedef struct
+{
+    bool echo;              // Commands are echoed (until ATE0).
+    uint32_t commands;      // Command lines answered.
+    uint32_t payloads;      // AT+CASEND payloads received.
+    uint64_t payload_bytes;
+} virtual_modem_stats_t;
+
+/// @brief Put the virtual SIM7080G, freshly powered on (echo on, no connection), at the other end of a UART.
+void virtualModemAttach(int uart_num);
+/// @brief The modem sends bytes on its own (a URC, a burst).
+void virtualModemSend(const void *bytes, size_t length);
+/// @brief Send a URC line right before the next final result, i.e. while a command is in flight.
+void virtualModemDeferUrc(const char *line);
+/// @brief A muted modem ignores everything it receives, as one that is off or asleep.
+void virtualModemMute(bool muted);
+void virtualModemGetStats(virtual_modem_stats_t *stats);
+/// @brief Copy the last AT+CASEND payload received.
+/// @return its length.
+size_t virtualModemLastPayload(uint8_t *buffer, size_t size);
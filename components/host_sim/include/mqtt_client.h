@@ -0,0 +1,73 @@
+// esp-mqtt of the host simulation: the calls the MQTT publisher makes, as a plain MQTT 3.1.1 client over the sockets
+// of the host (virtual_mqtt_client.c). mqtt:// URIs only, no TLS, no subscriptions.
+// As with esp-mqtt, a task of the client connects (clean session, keepalive and last will of the config), pings the
+// broker, and connects again MQTT_CLIENT_RECONNECT_MS after the connection was lost, posting MQTT_EVENT_CONNECTED and
+// MQTT_EVENT_DISCONNECTED to the handler registered. Messages are sent at once, QoS 1 ones are not kept for a resend.
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// The esp_event types the handler is registered with (esp-mqtt takes them from esp_event).
+typedef const char *esp_event_base_t;
+typedef void (*esp_event_handler_t)(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id,
+                                    void *event_data);
+#define ESP_EVENT_ANY_ID -1
+
+typedef struct esp_mqtt_client *esp_mqtt_client_handle_t;
+
+typedef enum
+{
+    MQTT_EVENT_ANY = -1,
+    MQTT_EVENT_ERROR = 0,
+    MQTT_EVENT_CONNECTED,
+    MQTT_EVENT_DISCONNECTED,
+    MQTT_EVENT_SUBSCRIBED,
+    MQTT_EVENT_UNSUBSCRIBED,
+    MQTT_EVENT_PUBLISHED,
+    MQTT_EVENT_DATA,
+} esp_mqtt_event_id_t;
+
+typedef struct
+{
+    esp_mqtt_event_id_t event_id;
+    esp_mqtt_client_handle_t client;
+    int msg_id;
+} esp_mqtt_event_t;
+
+typedef esp_mqtt_event_t *esp_mqtt_event_handle_t;
+
+typedef struct
+{
+    struct
+    {
+        struct
+        {
+            const char *uri;
+        } address;
+    } broker;
+    struct
+    {
+        const char *client_id;
+    } credentials;
+    struct
+    {
+        struct
+        {
+            const char *topic;
+            const char *msg;
+            int msg_len; // 0: strlen(msg).
+            int qos;
+            int retain;
+        } last_will;
+        int keepalive; // Seconds, 0 for the esp-mqtt default of 120.
+    } session;
+} esp_mqtt_client_config_t;
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config);
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+                                         esp_event_handler_t event_handler, void *event_handler_arg);
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client);
+/// @return the message id (0 for QoS 0), -1 if the client is not connected or the message could not be sent.
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos,
+                            int retain);
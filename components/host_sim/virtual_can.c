@@ -0,0 +1,371 @@
+// Virtual CAN buses of the host simulation (see host_sim.h), and the two controllers reading them:
+// - TWAI: a receive buffer of rx_queue_len frames, read by twai_receive().
+// - MCP2515: its registers, read and written by the MCP2515 driver through spi_device_transmit(). Frames land in RXB0,
+//   then RXB1 when rollover (BUKT) is on, the RXnIF flags hold them until the driver clears them, RX0OVR/RX1OVR are
+//   set when a frame finds both buffers full.
+// Frames are taken from the sources lazily, whenever a controller is polled: everything due since the last poll is
+// stored or lost in due order, as if it had arrived on time.
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "driver/twai.h"
+#include "driver/spi_master.h"
+#include "host_sim.h"
+
+#define TWAI_RX_BUFFER_MAX 64
+
+// MCP2515 instructions and registers (datasheet), only those the driver uses.
+#define MCP2515_INSTRUCTION_WRITE 0x02
+#define MCP2515_INSTRUCTION_READ 0x03
+#define MCP2515_INSTRUCTION_BITMOD 0x05
+#define MCP2515_INSTRUCTION_READ_STATUS 0xA0
+#define MCP2515_INSTRUCTION_RESET 0xC0
+#define MCP2515_CANSTAT 0x0E
+#define MCP2515_CANCTRL 0x0F
+#define MCP2515_CANINTF 0x2C
+#define MCP2515_EFLG 0x2D
+#define MCP2515_RXB0CTRL 0x60
+#define MCP2515_RXB1CTRL 0x70
+#define MCP2515_RXB0CTRL_BUKT 0x04
+#define MCP2515_RXBNCTRL_RXRTR 0x08
+#define MCP2515_CANINTF_RX0IF 0x01
+#define MCP2515_CANINTF_RX1IF 0x02
+#define MCP2515_CANINTF_ERRIF 0x20
+#define MCP2515_EFLG_RX0OVR 0x40
+#define MCP2515_EFLG_RX1OVR 0x80
+#define MCP2515_REQOP_MASK 0xE0
+#define MCP2515_REQOP_CONFIG 0x80
+#define MCP2515_REQOP_SLEEP 0x20
+
+typedef struct
+{
+    virtual_can_source_t source;
+    void *context;
+    bool exhausted;
+    bool has_next;
+    virtual_can_frame_t next;
+    int64_t lossless_until_us; // Frames due before this are kept, not lost, when the buffer is full.
+    bool (*store)(const virtual_can_frame_t *frame); // Into the controller, false if its buffer is full.
+    void (*overrun)(void);
+    bool (*empty)(void);
+    virtual_can_stats_t stats;
+} virtual_can_t;
+
+struct spi_device_t
+{
+    spi_host_device_t host;
+};
+
+static bool storeTwaiFrame(const virtual_can_frame_t *frame);
+static bool isTwaiEmpty(void);
+static bool storeMcp2515Frame(const virtual_can_frame_t *frame);
+static void overrunMcp2515(void);
+static bool isMcp2515Empty(void);
+
+static virtual_can_t virtual_can[VIRTUAL_CAN_BUS_COUNT] = {
+    [VIRTUAL_CAN_TWAI] = {.store = storeTwaiFrame, .empty = isTwaiEmpty},
+    [VIRTUAL_CAN_MCP2515] = {.store = storeMcp2515Frame, .overrun = overrunMcp2515, .empty = isMcp2515Empty},
+};
+static portMUX_TYPE virtual_can_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static bool twai_installed = false;
+static bool twai_running = false;
+static virtual_can_frame_t twai_rx_buffer[TWAI_RX_BUFFER_MAX];
+static uint32_t twai_rx_capacity = 0;
+static uint32_t twai_rx_head = 0;
+static uint32_t twai_rx_count = 0;
+
+static struct spi_device_t mcp2515_device = {.host = VSPI_HOST};
+static uint8_t mcp2515_registers[128];
+
+void virtualCanAttach(virtual_can_bus_t bus, virtual_can_source_t source, void *context)
+{
+    virtual_can_t *can = &virtual_can[bus];
+    portENTER_CRITICAL(&virtual_can_lock);
+    can->source = source;
+    can->context = context;
+    can->exhausted = false;
+    can->has_next = false;
+    portEXIT_CRITICAL(&virtual_can_lock);
+}
+
+void virtualCanGetStats(virtual_can_bus_t bus, virtual_can_stats_t *stats)
+{
+    virtual_can_t *can = &virtual_can[bus];
+    portENTER_CRITICAL(&virtual_can_lock);
+    *stats = can->stats;
+    stats->finished = can->exhausted && can->empty();
+    portEXIT_CRITICAL(&virtual_can_lock);
+}
+
+/// @brief Move the frames due at now from the source into the controller, called by the reader of the bus only.
+static void pollVirtualCan(virtual_can_t *can, int64_t now)
+{
+    while (true)
+    {
+        if (!can->has_next)
+        {
+            if (!can->source || can->exhausted)
+                return;
+            // Outside of the lock: sources may read files.
+            if (!can->source(can->context, &can->next))
+            {
+                can->exhausted = true;
+                return;
+            }
+            can->has_next = true;
+        }
+        if (can->next.due_us > now)
+            return;
+
+        portENTER_CRITICAL(&virtual_can_lock);
+        bool stored = can->store(&can->next);
+        bool keep = !stored && (can->next.due_us == 0 || can->next.due_us <= can->lossless_until_us);
+        if (!stored && !keep)
+        {
+            can->stats.overrun++;
+            if (can->overrun)
+                can->overrun();
+        }
+        portEXIT_CRITICAL(&virtual_can_lock);
+        if (keep)
+            return;
+        can->has_next = false;
+    }
+}
+
+// ------------------------------------------------ TWAI ------------------------------------------------ //
+
+static bool storeTwaiFrame(const virtual_can_frame_t *frame)
+{
+    if (twai_rx_count == twai_rx_capacity)
+        return false;
+    twai_rx_buffer[(twai_rx_head + twai_rx_count++) % twai_rx_capacity] = *frame;
+    return true;
+}
+
+static bool isTwaiEmpty(void)
+{
+    return twai_rx_count == 0;
+}
+
+esp_err_t twai_driver_install(const twai_general_config_t *g_config, const twai_timing_config_t *t_config,
+                              const twai_filter_config_t *f_config)
+{
+    if (twai_installed)
+        return ESP_ERR_INVALID_STATE;
+    if (!g_config || g_config->rx_queue_len == 0 || g_config->rx_queue_len > TWAI_RX_BUFFER_MAX)
+        return ESP_ERR_INVALID_ARG;
+    twai_rx_capacity = g_config->rx_queue_len;
+    twai_installed = true;
+    return ESP_OK;
+}
+
+esp_err_t twai_start(void)
+{
+    if (!twai_installed || twai_running)
+        return ESP_ERR_INVALID_STATE;
+    twai_running = true;
+    return ESP_OK;
+}
+
+/// As the driver: waits up to ticks_to_wait for a frame, a source may be attached meanwhile.
+esp_err_t twai_receive(twai_message_t *message, TickType_t ticks_to_wait)
+{
+    virtual_can_t *can = &virtual_can[VIRTUAL_CAN_TWAI];
+    const int64_t tick_us = portTICK_PERIOD_MS * 1000LL;
+    int64_t deadline = ticks_to_wait == portMAX_DELAY ? INT64_MAX : esp_timer_get_time() + ticks_to_wait * tick_us;
+
+    if (!twai_running)
+        return ESP_ERR_INVALID_STATE;
+    while (true)
+    {
+        int64_t now = esp_timer_get_time();
+        pollVirtualCan(can, now);
+        portENTER_CRITICAL(&virtual_can_lock);
+        bool received = twai_rx_count > 0;
+        if (received)
+        {
+            virtual_can_frame_t *frame = &twai_rx_buffer[twai_rx_head];
+            memset(message, 0, sizeof(*message));
+            message->identifier = frame->identifier;
+            message->extd = frame->extended;
+            message->rtr = frame->rtr;
+            message->data_length_code = frame->dlc;
+            memcpy(message->data, frame->data, sizeof(message->data));
+            twai_rx_head = (twai_rx_head + 1) % twai_rx_capacity;
+            twai_rx_count--;
+            can->stats.delivered++;
+        }
+        portEXIT_CRITICAL(&virtual_can_lock);
+        if (received)
+            return ESP_OK;
+        if (now >= deadline)
+            return ESP_ERR_TIMEOUT;
+
+        // Nothing before the next frame (or a tick when no source is attached). The ISR would wake the task right
+        // on time, a tick is coarser: the frames due while sleeping past the wake up time are not lost.
+        int64_t wake_us = can->has_next ? can->next.due_us : now + tick_us;
+        if (wake_us > deadline)
+            wake_us = deadline;
+        vTaskDelay((wake_us - now + tick_us - 1) / tick_us);
+        can->lossless_until_us = esp_timer_get_time();
+    }
+}
+
+esp_err_t twai_get_status_info(twai_status_info_t *status_info)
+{
+    if (!twai_installed)
+        return ESP_ERR_INVALID_STATE;
+    memset(status_info, 0, sizeof(*status_info));
+    portENTER_CRITICAL(&virtual_can_lock);
+    status_info->state = twai_running ? TWAI_STATE_RUNNING : TWAI_STATE_STOPPED;
+    status_info->msgs_to_rx = twai_rx_count;
+    status_info->rx_missed_count = virtual_can[VIRTUAL_CAN_TWAI].stats.overrun;
+    portEXIT_CRITICAL(&virtual_can_lock);
+    return ESP_OK;
+}
+
+// ----------------------------------------------- MCP2515 ----------------------------------------------- //
+
+static bool storeMcp2515Frame(const virtual_can_frame_t *frame)
+{
+    uint8_t *registers = mcp2515_registers;
+    uint8_t buffer, flag;
+
+    if (!(registers[MCP2515_CANINTF] & MCP2515_CANINTF_RX0IF))
+    {
+        buffer = MCP2515_RXB0CTRL;
+        flag = MCP2515_CANINTF_RX0IF;
+    }
+    else if ((registers[MCP2515_RXB0CTRL] & MCP2515_RXB0CTRL_BUKT) &&
+             !(registers[MCP2515_CANINTF] & MCP2515_CANINTF_RX1IF))
+    {
+        buffer = MCP2515_RXB1CTRL;
+        flag = MCP2515_CANINTF_RX1IF;
+    }
+    else
+    {
+        return false;
+    }
+
+    // RXBnCTRL, SIDH, SIDL, EID8, EID0, DLC, D0..D7.
+    uint32_t id = frame->identifier;
+    uint8_t *rxb = &registers[buffer];
+    if (frame->extended)
+    {
+        rxb[1] = id >> 21;
+        rxb[2] = ((id >> 18) & 0x07) << 5 | 0x08 | ((id >> 16) & 0x03);
+        rxb[3] = id >> 8;
+        rxb[4] = id;
+    }
+    else
+    {
+        rxb[1] = id >> 3;
+        rxb[2] = (id & 0x07) << 5;
+        rxb[3] = rxb[4] = 0;
+    }
+    rxb[0] = frame->rtr ? rxb[0] | MCP2515_RXBNCTRL_RXRTR : rxb[0] & ~MCP2515_RXBNCTRL_RXRTR;
+    rxb[5] = (frame->dlc & 0x0F) | (frame->rtr && frame->extended ? 0x40 : 0);
+    memcpy(&rxb[6], frame->data, 8);
+    registers[MCP2515_CANINTF] |= flag;
+    return true;
+}
+
+static void overrunMcp2515(void)
+{
+    bool rollover = mcp2515_registers[MCP2515_RXB0CTRL] & MCP2515_RXB0CTRL_BUKT;
+    mcp2515_registers[MCP2515_EFLG] |= rollover ? MCP2515_EFLG_RX1OVR : MCP2515_EFLG_RX0OVR;
+    mcp2515_registers[MCP2515_CANINTF] |= MCP2515_CANINTF_ERRIF;
+}
+
+static bool isMcp2515Empty(void)
+{
+    return !(mcp2515_registers[MCP2515_CANINTF] & (MCP2515_CANINTF_RX0IF | MCP2515_CANINTF_RX1IF));
+}
+
+static void resetMcp2515(void)
+{
+    memset(mcp2515_registers, 0, sizeof(mcp2515_registers));
+    mcp2515_registers[MCP2515_CANCTRL] = 0x87;
+    mcp2515_registers[MCP2515_CANSTAT] = MCP2515_REQOP_CONFIG;
+}
+
+static void writeMcp2515Register(uint8_t address, uint8_t value)
+{
+    uint8_t *registers = mcp2515_registers;
+    address &= 0x7F;
+    if (address == MCP2515_CANINTF)
+    {
+        // Clearing RXnIF hands the buffer back to the controller: the frame was read.
+        uint8_t read = registers[address] & ~value & (MCP2515_CANINTF_RX0IF | MCP2515_CANINTF_RX1IF);
+        virtual_can[VIRTUAL_CAN_MCP2515].stats.delivered += __builtin_popcount(read);
+    }
+    if ((address & 0x0F) == MCP2515_CANSTAT)
+        return; // Read only, in every bank.
+    registers[address] = value;
+    if (address == MCP2515_CANCTRL)
+        registers[MCP2515_CANSTAT] = (registers[MCP2515_CANSTAT] & ~MCP2515_REQOP_MASK) | (value & MCP2515_REQOP_MASK);
+}
+
+esp_err_t spi_bus_initialize(spi_host_device_t host_id, const spi_bus_config_t *bus_config, int dma_chan)
+{
+    return ESP_OK;
+}
+
+esp_err_t spi_bus_add_device(spi_host_device_t host_id, const spi_device_interface_config_t *dev_config,
+                             spi_device_handle_t *handle)
+{
+    mcp2515_device.host = host_id;
+    resetMcp2515();
+    *handle = &mcp2515_device;
+    return ESP_OK;
+}
+
+esp_err_t spi_device_transmit(spi_device_handle_t handle, spi_transaction_t *trans_desc)
+{
+    const uint8_t *tx = trans_desc->flags & SPI_TRANS_USE_TXDATA ? trans_desc->tx_data : trans_desc->tx_buffer;
+    uint8_t *rx = trans_desc->flags & SPI_TRANS_USE_RXDATA ? trans_desc->rx_data : trans_desc->rx_buffer;
+    size_t length = trans_desc->length / 8;
+    uint8_t opmode = mcp2515_registers[MCP2515_CANSTAT] & MCP2515_REQOP_MASK;
+
+    if (handle != &mcp2515_device || !tx || length == 0)
+        return ESP_ERR_INVALID_ARG;
+    if (rx)
+        memset(rx, 0, length);
+    // Frames are only received out of configuration and sleep modes.
+    if (opmode != MCP2515_REQOP_CONFIG && opmode != MCP2515_REQOP_SLEEP)
+        pollVirtualCan(&virtual_can[VIRTUAL_CAN_MCP2515], esp_timer_get_time());
+
+    portENTER_CRITICAL(&virtual_can_lock);
+    switch (tx[0])
+    {
+    case MCP2515_INSTRUCTION_RESET:
+        resetMcp2515();
+        break;
+    case MCP2515_INSTRUCTION_READ_STATUS:
+        if (rx && length > 1)
+            rx[1] = mcp2515_registers[MCP2515_CANINTF] & (MCP2515_CANINTF_RX0IF | MCP2515_CANINTF_RX1IF);
+        break;
+    case MCP2515_INSTRUCTION_READ:
+        for (size_t i = 2; rx && i < length; i++)
+            rx[i] = mcp2515_registers[(tx[1] + i - 2) & 0x7F];
+        break;
+    case MCP2515_INSTRUCTION_WRITE:
+        for (size_t i = 2; i < length; i++)
+            writeMcp2515Register(tx[1] + i - 2, tx[i]);
+        break;
+    case MCP2515_INSTRUCTION_BITMOD:
+        if (length >= 4)
+        {
+            uint8_t value = mcp2515_registers[tx[1] & 0x7F];
+            writeMcp2515Register(tx[1], (value & ~tx[2]) | (tx[3] & tx[2]));
+        }
+        break;
+    default:
+        break; // Transmission and the other instructions are not emulated.
+    }
+    portEXIT_CRITICAL(&virtual_can_lock);
+    return ESP_OK;
+}
@@ -0,0 +1,265 @@
+// SD card of the host simulation: a host directory, with the FatFs calls the logger uses (see ff.h).
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include "sdkconfig.h"
+#include "esp_vfs_fat.h"
+#include "sdmmc_cmd.h"
+
+#define CARD_PATH_SIZE FF_HOST_PATH_SIZE
+#define CARD_CLUSTER_SIZE (32 * 1024)
+#define CARD_MAX_CLEARED 1024 // Entries whose archive attribute can be cleared at the same time.
+
+static char card_root[CARD_PATH_SIZE];
+static FATFS card_fs = {.csize = CARD_CLUSTER_SIZE / 512, .ssize = 512};
+// Host paths of the entries whose archive attribute is cleared, FAT sets it on anything new.
+static char card_cleared[CARD_MAX_CLEARED][CARD_PATH_SIZE];
+static size_t card_cleared_count = 0;
+
+/// @brief Host path of a FAT path, each component matched without case.
+/// @return FR_OK if the entry exists, FR_NO_FILE if only the last component is missing (host_path then ends with it,
+/// upper case), FR_NO_PATH otherwise.
+static FRESULT resolveCardPath(const char *path, char *host_path)
+{
+    size_t length = snprintf(host_path, CARD_PATH_SIZE, "%s", card_root);
+    const char *component = path;
+
+    while (true)
+    {
+        component += strspn(component, "/");
+        size_t component_length = strcspn(component, "/");
+        if (!component_length)
+            return FR_OK;
+        if (length + component_length + 2 > CARD_PATH_SIZE)
+            return FR_INVALID_NAME;
+
+        bool found = false;
+        bool listed = false;
+        DIR *dir = opendir(host_path);
+        if (dir)
+        {
+            struct dirent *entry;
+            listed = true;
+            while (!found && (entry = readdir(dir)))
+            {
+                found = strlen(entry->d_name) == component_length &&
+                        strncasecmp(entry->d_name, component, component_length) == 0;
+                if (found)
+                    length += snprintf(host_path + length, CARD_PATH_SIZE - length, "/%s", entry->d_name);
+            }
+            closedir(dir);
+        }
+        if (!found)
+        {
+            host_path[length++] = '/';
+            for (size_t i = 0; i < component_length; i++)
+                host_path[length++] = toupper((unsigned char)component[i]);
+            host_path[length] = '\0';
+            component += component_length;
+            return listed && component[strspn(component, "/")] == '\0' ? FR_NO_FILE : FR_NO_PATH;
+        }
+        component += component_length;
+    }
+}
+
+static int findCleared(const char *host_path)
+{
+    for (size_t i = 0; i < card_cleared_count; i++)
+    {
+        if (strcmp(card_cleared[i], host_path) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static void setArchive(const char *host_path, bool archive)
+{
+    int index = findCleared(host_path);
+    if (archive && index >= 0)
+        memcpy(card_cleared[index], card_cleared[--card_cleared_count], CARD_PATH_SIZE);
+    else if (!archive && index < 0 && card_cleared_count < CARD_MAX_CLEARED)
+        snprintf(card_cleared[card_cleared_count++], CARD_PATH_SIZE, "%s", host_path);
+}
+
+static void fillFileInfo(const char *host_path, const char *name, const struct stat *st, FILINFO *fno)
+{
+    memset(fno, 0, sizeof(*fno));
+    snprintf(fno->fname, sizeof(fno->fname), "%s", name);
+    fno->fsize = S_ISDIR(st->st_mode) ? 0 : st->st_size;
+    fno->fattrib = (S_ISDIR(st->st_mode) ? AM_DIR : 0) | (findCleared(host_path) < 0 ? AM_ARC : 0);
+}
+
+FRESULT f_mkdir(const char *path)
+{
+    char host_path[CARD_PATH_SIZE];
+    FRESULT res = resolveCardPath(path, host_path);
+    if (res == FR_OK)
+        return FR_EXIST;
+    if (res != FR_NO_FILE)
+        return res;
+    return mkdir(host_path, 0755) == 0 ? FR_OK : FR_DENIED;
+}
+
+FRESULT f_unlink(const char *path)
+{
+    char host_path[CARD_PATH_SIZE];
+    struct stat st;
+    FRESULT res = resolveCardPath(path, host_path);
+    if (res != FR_OK)
+        return res;
+    if (stat(host_path, &st) != 0)
+        return FR_DISK_ERR;
+    if ((S_ISDIR(st.st_mode) ? rmdir(host_path) : unlink(host_path)) != 0)
+        return FR_DENIED;
+    setArchive(host_path, true);
+    return FR_OK;
+}
+
+FRESULT f_stat(const char *path, FILINFO *fno)
+{
+    char host_path[CARD_PATH_SIZE];
+    struct stat st;
+    FRESULT res = resolveCardPath(path, host_path);
+    if (res != FR_OK)
+        return res;
+    if (stat(host_path, &st) != 0)
+        return FR_DISK_ERR;
+    if (fno)
+        fillFileInfo(host_path, strrchr(host_path, '/') + 1, &st, fno);
+    return FR_OK;
+}
+
+FRESULT f_chmod(const char *path, BYTE attr, BYTE mask)
+{
+    char host_path[CARD_PATH_SIZE];
+    FRESULT res = resolveCardPath(path, host_path);
+    if (res != FR_OK)
+        return res;
+    if (mask & AM_ARC)
+        setArchive(host_path, attr & AM_ARC);
+    return FR_OK;
+}
+
+FRESULT f_opendir(FF_DIR *dp, const char *path)
+{
+    FRESULT res = resolveCardPath(path, dp->path);
+    if (res != FR_OK)
+        return res == FR_NO_FILE ? FR_NO_PATH : res;
+    dp->dir = opendir(dp->path);
+    return dp->dir ? FR_OK : FR_NO_PATH;
+}
+
+/// End of directory: fname[0] == '\0'.
+FRESULT f_readdir(FF_DIR *dp, FILINFO *fno)
+{
+    struct dirent *entry;
+    char host_path[CARD_PATH_SIZE];
+    struct stat st;
+
+    while ((entry = readdir(dp->dir)))
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        snprintf(host_path, sizeof(host_path), "%s/%s", dp->path, entry->d_name);
+        if (stat(host_path, &st) != 0)
+            continue;
+        fillFileInfo(host_path, entry->d_name, &st, fno);
+        return FR_OK;
+    }
+    fno->fname[0] = '\0';
+    return FR_OK;
+}
+
+FRESULT f_closedir(FF_DIR *dp)
+{
+    if (dp->dir)
+        closedir(dp->dir);
+    dp->dir = NULL;
+    return FR_OK;
+}
+
+/// @brief Bytes taken by a directory tree, in whole clusters as on the card.
+static uint64_t getUsedBytes(const char *host_path)
+{
+    char child[CARD_PATH_SIZE];
+    uint64_t used = 0;
+    struct dirent *entry;
+    struct stat st;
+    DIR *dir = opendir(host_path);
+
+    while (dir && (entry = readdir(dir)))
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        snprintf(child, sizeof(child), "%s/%s", host_path, entry->d_name);
+        if (stat(child, &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            used += CARD_CLUSTER_SIZE + getUsedBytes(child);
+        else
+            used += (st.st_size + CARD_CLUSTER_SIZE - 1) / CARD_CLUSTER_SIZE * CARD_CLUSTER_SIZE;
+    }
+    if (dir)
+        closedir(dir);
+    return used;
+}
+
+FRESULT f_getfree(const char *path, DWORD *nclst, FATFS **fatfs)
+{
+    uint64_t total_bytes, free_bytes;
+#if CONFIG_DATAFLY_HOST_CARD_MB
+    total_bytes = (uint64_t)CONFIG_DATAFLY_HOST_CARD_MB * 1024 * 1024;
+    uint64_t used_bytes = getUsedBytes(card_root);
+    free_bytes = used_bytes < total_bytes ? total_bytes - used_bytes : 0;
+#else
+    struct statvfs host_fs;
+    if (statvfs(card_root, &host_fs) != 0)
+        return FR_NOT_READY;
+    total_bytes = (uint64_t)host_fs.f_blocks * host_fs.f_frsize;
+    free_bytes = (uint64_t)host_fs.f_bavail * host_fs.f_frsize;
+#endif
+    card_fs.n_fatent = total_bytes / CARD_CLUSTER_SIZE + 2;
+    card_fs.free_clst = free_bytes / CARD_CLUSTER_SIZE;
+    *nclst = card_fs.free_clst;
+    *fatfs = &card_fs;
+    return FR_OK;
+}
+
+esp_err_t esp_vfs_fat_sdspi_mount(const char *base_path, const sdmmc_host_t *host_config_input,
+                                  const sdspi_device_config_t *slot_config,
+                                  const esp_vfs_fat_sdmmc_mount_config_t *mount_config, sdmmc_card_t **out_card)
+{
+    static sdmmc_card_t card;
+    char path[CARD_PATH_SIZE];
+
+    // Every level of the base path, e.g. build/sdcard.
+    snprintf(path, sizeof(path), "%s", base_path);
+    for (char *separator = strchr(path + 1, '/'); separator; separator = strchr(separator + 1, '/'))
+    {
+        *separator = '\0';
+        mkdir(path, 0755);
+        *separator = '/';
+    }
+    if (mkdir(path, 0755) != 0 && access(path, W_OK) != 0)
+        return ESP_FAIL;
+    snprintf(card_root, sizeof(card_root), "%s", base_path);
+
+    DWORD free_clusters;
+    FATFS *fs;
+    f_getfree("", &free_clusters, &fs);
+    card.capacity_bytes = (uint64_t)(fs->n_fatent - 2) * CARD_CLUSTER_SIZE;
+    if (out_card)
+        *out_card = &card;
+    return ESP_OK;
+}
+
+void sdmmc_card_print_info(FILE *stream, const sdmmc_card_t *card)
+{
+    fprintf(stream, "Name: host directory %s\nSize: %lluMB\n", card_root,
+            (unsigned long long)(card->capacity_bytes / (1024 * 1024)));
+}
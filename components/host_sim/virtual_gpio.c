@@ -0,0 +1,85 @@
+// GPIOs and timer of the host simulation.
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "host_sim.h"
+
+static uint8_t gpio_levels[GPIO_PIN_COUNT];
+static gpio_isr_t gpio_isr_handlers[GPIO_PIN_COUNT];
+static void *gpio_isr_args[GPIO_PIN_COUNT];
+
+/// @brief µs since the first call, boot for the logger.
+int64_t esp_timer_get_time(void)
+{
+    static int64_t boot_us = 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t now_us = now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+    if (!boot_us)
+        boot_us = now_us;
+    return now_us - boot_us;
+}
+
+static inline bool isValidGpio(gpio_num_t gpio_num)
+{
+    return gpio_num >= 0 && gpio_num < GPIO_PIN_COUNT;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
+{
+    return isValidGpio(gpio_num) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    if (!isValidGpio(gpio_num))
+        return ESP_ERR_INVALID_ARG;
+    gpio_levels[gpio_num] = level != 0;
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    return isValidGpio(gpio_num) ? gpio_levels[gpio_num] : 0;
+}
+
+esp_err_t gpio_pullup_en(gpio_num_t gpio_num)
+{
+    return gpio_set_level(gpio_num, 1);
+}
+
+esp_err_t gpio_pulldown_dis(gpio_num_t gpio_num)
+{
+    return isValidGpio(gpio_num) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type)
+{
+    return isValidGpio(gpio_num) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void *args)
+{
+    if (!isValidGpio(gpio_num))
+        return ESP_ERR_INVALID_ARG;
+    gpio_isr_handlers[gpio_num] = isr_handler;
+    gpio_isr_args[gpio_num] = args;
+    return ESP_OK;
+}
+
+void virtualGpioTrigger(int gpio_num)
+{
+    if (isValidGpio(gpio_num) && gpio_isr_handlers[gpio_num])
+        gpio_isr_handlers[gpio_num](gpio_isr_args[gpio_num]);
+}
+
+int virtualGpioGetLevel(int gpio_num)
+{
+    return gpio_get_level(gpio_num);
+}
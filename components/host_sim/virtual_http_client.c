@@ -0,0 +1,308 @@
+// HTTP client of the host simulation (see esp_http_client.h): one request at a time per client, over a blocking
+// socket of the host with timeout_ms as send and receive timeout.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "esp_http_client.h"
+
+#define HTTP_CLIENT_MAX_HEADERS 8
+#define HTTP_CLIENT_HOST_SIZE 64
+#define HTTP_CLIENT_PATH_SIZE 256
+#define HTTP_CLIENT_HEADER_SIZE 128
+#define HTTP_CLIENT_RESPONSE_SIZE 2048 // Status line and headers of a response.
+
+struct esp_http_client
+{
+    esp_http_client_config_t config;
+    char host[HTTP_CLIENT_HOST_SIZE];
+    char port[8];
+    char path[HTTP_CLIENT_PATH_SIZE];
+    esp_http_client_method_t method;
+    char header_keys[HTTP_CLIENT_MAX_HEADERS][HTTP_CLIENT_HEADER_SIZE];
+    char header_values[HTTP_CLIENT_MAX_HEADERS][HTTP_CLIENT_HEADER_SIZE];
+    int header_count;
+    const char *post_data;
+    int post_length;
+    int socket;
+    int status_code;
+};
+
+static const char *const http_method_names[HTTP_METHOD_MAX] = {"GET", "POST", "PUT", "PATCH", "DELETE", "HEAD"};
+
+static void postHttpEvent(esp_http_client_handle_t client, esp_http_client_event_id_t event_id, char *key,
+                          char *value, void *data, int data_len)
+{
+    esp_http_client_event_t event = {
+        .event_id = event_id,
+        .client = client,
+        .data = data,
+        .data_len = data_len,
+        .user_data = client->config.user_data,
+        .header_key = key,
+        .header_value = value,
+    };
+    if (client->config.event_handler)
+        client->config.event_handler(&event);
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client)
+{
+    if (client->socket >= 0)
+    {
+        close(client->socket);
+        client->socket = -1;
+        postHttpEvent(client, HTTP_EVENT_DISCONNECTED, NULL, NULL, NULL, 0);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char *url)
+{
+    if (strncmp(url, "http://", 7) != 0)
+        return ESP_ERR_HTTP_INVALID_TRANSPORT;
+    const char *authority = url + 7;
+    size_t authority_length = strcspn(authority, "/");
+    const char *colon = memchr(authority, ':', authority_length);
+    size_t host_length = colon ? (size_t)(colon - authority) : authority_length;
+    char host[HTTP_CLIENT_HOST_SIZE];
+    char port[sizeof(client->port)] = "80";
+
+    if (!host_length || host_length >= sizeof(host) ||
+        (colon && authority_length - host_length - 1 >= sizeof(port)))
+        return ESP_ERR_INVALID_ARG;
+    memcpy(host, authority, host_length);
+    host[host_length] = '\0';
+    if (colon)
+        snprintf(port, sizeof(port), "%.*s", (int)(authority_length - host_length - 1), colon + 1);
+    // Another server: the connection kept for the previous one is of no use.
+    if (strcmp(host, client->host) != 0 || strcmp(port, client->port) != 0)
+        esp_http_client_close(client);
+    memcpy(client->host, host, sizeof(host));
+    memcpy(client->port, port, sizeof(port));
+    snprintf(client->path, sizeof(client->path), "%s", authority[authority_length] ? authority + authority_length : "/");
+    return ESP_OK;
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+    esp_http_client_handle_t client = calloc(1, sizeof(*client));
+    if (!client)
+        return NULL;
+    client->config = *config;
+    client->method = config->method;
+    client->socket = -1;
+    if (config->url && esp_http_client_set_url(client, config->url) != ESP_OK)
+    {
+        free(client);
+        return NULL;
+    }
+    return client;
+}
+
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t client, esp_http_client_method_t method)
+{
+    if (method >= HTTP_METHOD_MAX)
+        return ESP_ERR_INVALID_ARG;
+    client->method = method;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value)
+{
+    int i = 0;
+    while (i < client->header_count && strcasecmp(client->header_keys[i], key) != 0)
+        i++;
+    if (i == HTTP_CLIENT_MAX_HEADERS || strlen(key) >= HTTP_CLIENT_HEADER_SIZE ||
+        strlen(value) >= HTTP_CLIENT_HEADER_SIZE)
+        return ESP_ERR_NO_MEM;
+    snprintf(client->header_keys[i], HTTP_CLIENT_HEADER_SIZE, "%s", key);
+    snprintf(client->header_values[i], HTTP_CLIENT_HEADER_SIZE, "%s", value);
+    if (i == client->header_count)
+        client->header_count++;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client, const char *data, int len)
+{
+    client->post_data = data;
+    client->post_length = len;
+    return ESP_OK;
+}
+
+static esp_err_t connectHttpClient(esp_http_client_handle_t client)
+{
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM}, *addresses;
+    struct timeval timeout = {.tv_sec = client->config.timeout_ms / 1000,
+                              .tv_usec = client->config.timeout_ms % 1000 * 1000};
+
+    if (getaddrinfo(client->host, client->port, &hints, &addresses) != 0)
+        return ESP_ERR_HTTP_CONNECT;
+    for (struct addrinfo *address = addresses; address && client->socket < 0; address = address->ai_next)
+    {
+        int fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd < 0)
+            continue;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if (connect(fd, address->ai_addr, address->ai_addrlen) == 0)
+            client->socket = fd;
+        else
+            close(fd);
+    }
+    freeaddrinfo(addresses);
+    if (client->socket < 0)
+        return ESP_ERR_HTTP_CONNECT;
+    postHttpEvent(client, HTTP_EVENT_ON_CONNECTED, NULL, NULL, NULL, 0);
+    return ESP_OK;
+}
+
+/// @brief Whether the server closed the connection kept from the previous request.
+static bool isHttpConnectionClosed(esp_http_client_handle_t client)
+{
+    char byte;
+    return recv(client->socket, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+}
+
+static bool sendHttpBytes(int fd, const char *bytes, size_t length)
+{
+    while (length)
+    {
+        ssize_t sent = send(fd, bytes, length, MSG_NOSIGNAL);
+        if (sent <= 0)
+            return false;
+        bytes += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+/// @brief Read the status line and the headers, passing each header to the event handler.
+/// @param content_length length of the body announced, -1 if none was (the body then ends with the connection).
+/// @param buffer HTTP_CLIENT_RESPONSE_SIZE bytes, receives the head and what came after it (buffered bytes in all,
+/// head_length of them the head).
+static esp_err_t readHttpResponseHead(esp_http_client_handle_t client, long *content_length, bool *keep_alive,
+                                      char *buffer, size_t *buffered, size_t *head_length)
+{
+    char *end = NULL;
+    *buffered = 0;
+    while (!end)
+    {
+        if (*buffered == HTTP_CLIENT_RESPONSE_SIZE - 1)
+            return ESP_ERR_HTTP_FETCH_HEADER;
+        ssize_t received = recv(client->socket, buffer + *buffered, HTTP_CLIENT_RESPONSE_SIZE - 1 - *buffered, 0);
+        if (received <= 0)
+            return ESP_ERR_HTTP_FETCH_HEADER;
+        *buffered += received;
+        buffer[*buffered] = '\0';
+        end = strstr(buffer, "\r\n\r\n");
+    }
+    *end = '\0';
+    *head_length = end + 4 - buffer;
+
+    int minor_version;
+    if (sscanf(buffer, "HTTP/1.%d %d", &minor_version, &client->status_code) != 2)
+        return ESP_ERR_HTTP_FETCH_HEADER;
+    *content_length = -1;
+    *keep_alive = client->config.keep_alive_enable && minor_version >= 1;
+    for (char *line = strstr(buffer, "\r\n"); line; )
+    {
+        line += 2;
+        char *next = strstr(line, "\r\n");
+        if (next)
+            *next = '\0';
+        char *colon = strchr(line, ':');
+        if (colon)
+        {
+            *colon = '\0';
+            char *value = colon + 1 + strspn(colon + 1, " \t");
+            if (strcasecmp(line, "Content-Length") == 0)
+                *content_length = strtol(value, NULL, 10);
+            else if (strcasecmp(line, "Connection") == 0 && strcasecmp(value, "close") == 0)
+                *keep_alive = false;
+            postHttpEvent(client, HTTP_EVENT_ON_HEADER, line, value, NULL, 0);
+        }
+        line = next;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client)
+{
+    char head[HTTP_CLIENT_PATH_SIZE + HTTP_CLIENT_HOST_SIZE + HTTP_CLIENT_MAX_HEADERS * 2 * HTTP_CLIENT_HEADER_SIZE +
+              128];
+    char response[HTTP_CLIENT_RESPONSE_SIZE];
+    size_t buffered, head_length;
+    long content_length;
+    bool keep_alive;
+    esp_err_t err;
+
+    client->status_code = -1;
+    if (client->socket >= 0 && isHttpConnectionClosed(client))
+        esp_http_client_close(client);
+    if (client->socket < 0 && (err = connectHttpClient(client)) != ESP_OK)
+        return err;
+
+    int length = snprintf(head, sizeof(head), "%s %s HTTP/1.1\r\nHost: %s:%s\r\nContent-Length: %d\r\n",
+                          http_method_names[client->method], client->path, client->host, client->port,
+                          client->post_data ? client->post_length : 0);
+    for (int i = 0; i < client->header_count; i++)
+        length += snprintf(head + length, sizeof(head) - length, "%s: %s\r\n", client->header_keys[i],
+                           client->header_values[i]);
+    length += snprintf(head + length, sizeof(head) - length, "Connection: %s\r\n\r\n",
+                       client->config.keep_alive_enable ? "keep-alive" : "close");
+    if (!sendHttpBytes(client->socket, head, length) ||
+        (client->post_data && !sendHttpBytes(client->socket, client->post_data, client->post_length)))
+    {
+        esp_http_client_close(client);
+        return ESP_ERR_HTTP_WRITE_DATA;
+    }
+    postHttpEvent(client, HTTP_EVENT_HEADERS_SENT, NULL, NULL, NULL, 0);
+
+    err = readHttpResponseHead(client, &content_length, &keep_alive, response, &buffered, &head_length);
+    if (err != ESP_OK)
+    {
+        esp_http_client_close(client);
+        return err;
+    }
+
+    // The body, whatever part of it came with the headers first.
+    long remaining = content_length < 0 ? -1 : content_length - (long)(buffered - head_length);
+    if (buffered > head_length)
+        postHttpEvent(client, HTTP_EVENT_ON_DATA, NULL, NULL, response + head_length, buffered - head_length);
+    while (remaining != 0 && client->method != HTTP_METHOD_HEAD)
+    {
+        size_t wanted = remaining < 0 || remaining > (long)sizeof(response) ? sizeof(response) : (size_t)remaining;
+        ssize_t received = recv(client->socket, response, wanted, 0);
+        if (received <= 0)
+        {
+            esp_http_client_close(client);
+            if (remaining > 0)
+                return ESP_FAIL;
+            break;
+        }
+        postHttpEvent(client, HTTP_EVENT_ON_DATA, NULL, NULL, response, received);
+        if (remaining > 0)
+            remaining -= received;
+    }
+    postHttpEvent(client, HTTP_EVENT_ON_FINISH, NULL, NULL, NULL, 0);
+    if (!keep_alive || content_length < 0)
+        esp_http_client_close(client);
+    return ESP_OK;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client->status_code;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    esp_http_client_close(client);
+    free(client);
+    return ESP_OK;
+}
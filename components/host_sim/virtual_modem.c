@@ -0,0 +1,171 @@
+// Virtual SIM7080G of the host simulation (see host_sim.h): the modem end of a virtual UART, answering the AT commands
+// the driver (sim7080g.h) sends, with the framing of the module: echo until ATE0, "\r\n<response>\r\n" lines, the
+// "> " prompt of AT+CASEND after which the payload is read, and a final OK or ERROR.
+// Commands it knows: AT, ATE0, ATE1, AT+CGSN, AT+CASTATE?, AT+CAOPEN=<cid>,0,"TCP",<host>,<port>, AT+CASEND=<cid>,
+// <length>. Anything else is answered with ERROR. The modem runs in the task writing to the UART.
+#include <stdio.h>
+#include <string.h>
+#include "host_sim.h"
+
+#define VIRTUAL_MODEM_LINE_SIZE 256
+#define VIRTUAL_MODEM_CONNECTIONS 13 // cid 0 to 12, as the module.
+
+static struct
+{
+    int uart_num;
+    bool echo;
+    bool muted;
+    bool connections[VIRTUAL_MODEM_CONNECTIONS];
+    char line[VIRTUAL_MODEM_LINE_SIZE];
+    size_t line_length;
+    size_t payload_remaining; // Bytes of the AT+CASEND payload still to come.
+    size_t payload_length;
+    uint8_t payload[VIRTUAL_MODEM_MAX_PAYLOAD];
+    char deferred_urc[VIRTUAL_MODEM_LINE_SIZE];
+    virtual_modem_stats_t stats;
+} virtual_modem;
+
+static void sendVirtualModem(const char *text)
+{
+    virtualUartReceive(virtual_modem.uart_num, text, strlen(text));
+}
+
+static void sendVirtualModemLine(const char *line)
+{
+    sendVirtualModem("\r\n");
+    sendVirtualModem(line);
+    sendVirtualModem("\r\n");
+}
+
+/// Final result of a command, after the URC deferred to it if any.
+static void sendVirtualModemResult(const char *result)
+{
+    if (virtual_modem.deferred_urc[0])
+    {
+        sendVirtualModemLine(virtual_modem.deferred_urc);
+        virtual_modem.deferred_urc[0] = '\0';
+    }
+    sendVirtualModemLine(result);
+}
+
+static void runVirtualModemCommand(const char *command)
+{
+    unsigned cid, length;
+    char response[VIRTUAL_MODEM_LINE_SIZE];
+
+    virtual_modem.stats.commands++;
+    if (strcmp(command, "AT") == 0)
+        sendVirtualModemResult("OK");
+    else if (strcmp(command, "ATE0") == 0 || strcmp(command, "ATE1") == 0)
+    {
+        virtual_modem.echo = command[3] == '1';
+        sendVirtualModemResult("OK");
+    }
+    else if (strcmp(command, "AT+CGSN") == 0)
+    {
+        sendVirtualModemLine(VIRTUAL_MODEM_IMEI);
+        sendVirtualModemResult("OK");
+    }
+    else if (strcmp(command, "AT+CASTATE?") == 0)
+    {
+        for (cid = 0; cid < VIRTUAL_MODEM_CONNECTIONS; cid++)
+        {
+            if (virtual_modem.connections[cid])
+            {
+                snprintf(response, sizeof(response), "+CASTATE: %u,1", cid);
+                sendVirtualModemLine(response);
+            }
+        }
+        sendVirtualModemResult("OK");
+    }
+    else if (sscanf(command, "AT+CAOPEN=%u,0,\"TCP\",", &cid) == 1 && cid < VIRTUAL_MODEM_CONNECTIONS)
+    {
+        virtual_modem.connections[cid] = true;
+        snprintf(response, sizeof(response), "+CAOPEN: %u,0", cid);
+        sendVirtualModemLine(response);
+        sendVirtualModemResult("OK");
+    }
+    else if (sscanf(command, "AT+CASEND=%u,%u", &cid, &length) == 2 && cid < VIRTUAL_MODEM_CONNECTIONS &&
+             virtual_modem.connections[cid] && length && length <= VIRTUAL_MODEM_MAX_PAYLOAD)
+    {
+        virtual_modem.payload_remaining = length;
+        virtual_modem.payload_length = 0;
+        sendVirtualModem("\r\n> ");
+    }
+    else
+        sendVirtualModemResult("ERROR");
+}
+
+/// Peer of the UART: the bytes the driver writes.
+static void receiveVirtualModem(void *context, const uint8_t *bytes, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        if (virtual_modem.muted)
+            continue;
+        if (virtual_modem.payload_remaining)
+        {
+            virtual_modem.payload[virtual_modem.payload_length++] = bytes[i];
+            if (--virtual_modem.payload_remaining == 0)
+            {
+                virtual_modem.stats.payloads++;
+                virtual_modem.stats.payload_bytes += virtual_modem.payload_length;
+                sendVirtualModemResult("OK");
+            }
+            continue;
+        }
+        if (bytes[i] == '\n')
+            continue;
+        if (bytes[i] != '\r')
+        {
+            if (virtual_modem.line_length < VIRTUAL_MODEM_LINE_SIZE - 1)
+                virtual_modem.line[virtual_modem.line_length++] = bytes[i];
+            continue;
+        }
+        virtual_modem.line[virtual_modem.line_length] = '\0';
+        if (virtual_modem.echo)
+        {
+            sendVirtualModem(virtual_modem.line);
+            sendVirtualModem("\r");
+        }
+        if (virtual_modem.line_length)
+            runVirtualModemCommand(virtual_modem.line);
+        virtual_modem.line_length = 0;
+    }
+}
+
+void virtualModemAttach(int uart_num)
+{
+    memset(&virtual_modem, 0, sizeof(virtual_modem));
+    virtual_modem.uart_num = uart_num;
+    virtual_modem.echo = true; // Until ATE0, as after power on.
+    virtualUartAttach(uart_num, receiveVirtualModem, NULL);
+}
+
+void virtualModemSend(const void *bytes, size_t length)
+{
+    virtualUartReceive(virtual_modem.uart_num, bytes, length);
+}
+
+void virtualModemDeferUrc(const char *line)
+{
+    snprintf(virtual_modem.deferred_urc, sizeof(virtual_modem.deferred_urc), "%s", line);
+}
+
+void virtualModemMute(bool muted)
+{
+    virtual_modem.muted = muted;
+}
+
+void virtualModemGetStats(virtual_modem_stats_t *stats)
+{
+    *stats = virtual_modem.stats;
+    stats->echo = virtual_modem.echo;
+}
+
+size_t virtualModemLastPayload(uint8_t *buffer, size_t size)
+{
+    size_t length = virtual_modem.payload_length < size ? virtual_modem.payload_length : size;
+    memcpy(buffer, virtual_modem.payload, length);
+    return length;
+}
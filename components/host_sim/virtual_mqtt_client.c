@@ -0,0 +1,293 @@
+// MQTT client of the host simulation (see mqtt_client.h): MQTT 3.1.1 over a socket of the host, run by a task of its
+// own that reads what the broker sends (CONNACK, PUBACK, PINGRESP) and keeps the connection alive.
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "mqtt_client.h"
+
+#define MQTT_CLIENT_RECONNECT_MS 10000 // esp-mqtt default.
+#define MQTT_CLIENT_KEEPALIVE_S 120    // esp-mqtt default.
+#define MQTT_CLIENT_POLL_MS 1000       // Receive timeout of the task, the keepalive is checked this often.
+#define MQTT_CLIENT_HOST_SIZE 64
+#define MQTT_CLIENT_FIELD_SIZE 256
+#define MQTT_CLIENT_PACKET_SIZE 2048
+
+#define MQTT_PACKET_CONNECT 0x10
+#define MQTT_PACKET_CONNACK 0x20
+#define MQTT_PACKET_PUBLISH 0x30
+#define MQTT_PACKET_PUBACK 0x40
+#define MQTT_PACKET_PINGREQ 0xC0
+#define MQTT_PACKET_PINGRESP 0xD0
+
+struct esp_mqtt_client
+{
+    char host[MQTT_CLIENT_HOST_SIZE];
+    char port[8];
+    char client_id[MQTT_CLIENT_FIELD_SIZE];
+    char will_topic[MQTT_CLIENT_FIELD_SIZE];
+    char will_message[MQTT_CLIENT_FIELD_SIZE];
+    int will_length;
+    int will_qos;
+    bool will_retain;
+    uint16_t keepalive_s;
+    esp_event_handler_t event_handler;
+    void *event_handler_arg;
+    int socket;
+    volatile bool connected;
+    uint16_t next_message_id;
+    int64_t last_sent_us;
+    SemaphoreHandle_t send_lock; // Packets are written by the publishing task and the task of the client.
+    SemaphoreHandle_t publish_lock;
+    uint8_t publish_packet[MQTT_CLIENT_PACKET_SIZE];
+};
+
+static void postMqttEvent(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event_id)
+{
+    esp_mqtt_event_t event = {.event_id = event_id, .client = client};
+    if (client->event_handler)
+        client->event_handler(client->event_handler_arg, "MQTT_EVENTS", event_id, &event);
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config)
+{
+    const char *uri = config->broker.address.uri;
+    if (!uri || strncmp(uri, "mqtt://", 7) != 0)
+        return NULL;
+    esp_mqtt_client_handle_t client = calloc(1, sizeof(*client));
+    if (!client)
+        return NULL;
+
+    const char *authority = uri + 7;
+    size_t authority_length = strcspn(authority, "/");
+    const char *colon = memchr(authority, ':', authority_length);
+    size_t host_length = colon ? (size_t)(colon - authority) : authority_length;
+    snprintf(client->host, sizeof(client->host), "%.*s", (int)host_length, authority);
+    snprintf(client->port, sizeof(client->port), "%.*s", colon ? (int)(authority_length - host_length - 1) : 4,
+             colon ? colon + 1 : "1883");
+    snprintf(client->client_id, sizeof(client->client_id), "%s",
+             config->credentials.client_id ? config->credentials.client_id : "");
+    if (config->session.last_will.topic)
+    {
+        snprintf(client->will_topic, sizeof(client->will_topic), "%s", config->session.last_will.topic);
+        client->will_length = config->session.last_will.msg_len ? config->session.last_will.msg_len
+                                                                 : (int)strlen(config->session.last_will.msg);
+        if (client->will_length > (int)sizeof(client->will_message))
+            client->will_length = sizeof(client->will_message);
+        memcpy(client->will_message, config->session.last_will.msg, client->will_length);
+        client->will_qos = config->session.last_will.qos;
+        client->will_retain = config->session.last_will.retain;
+    }
+    client->keepalive_s = config->session.keepalive ? config->session.keepalive : MQTT_CLIENT_KEEPALIVE_S;
+    client->socket = -1;
+    client->next_message_id = 1;
+    client->send_lock = xSemaphoreCreateMutex();
+    client->publish_lock = xSemaphoreCreateMutex();
+    return client;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+                                         esp_event_handler_t event_handler, void *event_handler_arg)
+{
+    client->event_handler = event_handler;
+    client->event_handler_arg = event_handler_arg;
+    return ESP_OK;
+}
+
+static size_t putMqttLength(uint8_t *packet, size_t length)
+{
+    size_t size = 0;
+    do
+    {
+        packet[size] = length % 128;
+        length /= 128;
+        if (length)
+            packet[size] |= 0x80;
+        size++;
+    } while (length);
+    return size;
+}
+
+static size_t putMqttString(uint8_t *packet, const char *string, size_t length)
+{
+    packet[0] = length >> 8;
+    packet[1] = length & 0xFF;
+    memcpy(packet + 2, string, length);
+    return 2 + length;
+}
+
+/// @brief Send a packet: fixed header byte, remaining length, then the variable header and payload (body).
+static bool sendMqttPacket(esp_mqtt_client_handle_t client, uint8_t type, const uint8_t *body, size_t body_length)
+{
+    uint8_t head[5] = {type};
+    size_t head_length = 1 + putMqttLength(head + 1, body_length);
+    bool sent = true;
+
+    xSemaphoreTake(client->send_lock, portMAX_DELAY);
+    for (size_t offset = 0; sent && offset < head_length + body_length;)
+    {
+        const uint8_t *bytes = offset < head_length ? head + offset : body + offset - head_length;
+        size_t length = offset < head_length ? head_length - offset : body_length - (offset - head_length);
+        ssize_t written = client->socket >= 0 ? send(client->socket, bytes, length, MSG_NOSIGNAL) : -1;
+        sent = written > 0;
+        offset += sent ? written : 0;
+    }
+    if (sent)
+        client->last_sent_us = esp_timer_get_time();
+    xSemaphoreGive(client->send_lock);
+    return sent;
+}
+
+/// @brief Read one packet the broker sent.
+/// @return its fixed header byte, 0 if none came within MQTT_CLIENT_POLL_MS, -1 if the connection is lost.
+static int receiveMqttPacket(esp_mqtt_client_handle_t client, uint8_t *body, size_t *body_length)
+{
+    uint8_t type;
+    ssize_t received = recv(client->socket, &type, 1, 0);
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return 0;
+    if (received <= 0)
+        return -1;
+
+    size_t length = 0;
+    uint8_t byte;
+    for (int shift = 0; shift < 28; shift += 7)
+    {
+        if (recv(client->socket, &byte, 1, MSG_WAITALL) != 1)
+            return -1;
+        length |= (size_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            break;
+    }
+    *body_length = length;
+    if (length > MQTT_CLIENT_PACKET_SIZE ||
+        (length && recv(client->socket, body, length, MSG_WAITALL) != (ssize_t)length))
+        return -1;
+    return type;
+}
+
+static bool connectMqttClient(esp_mqtt_client_handle_t client)
+{
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM}, *addresses;
+    struct timeval timeout = {.tv_sec = MQTT_CLIENT_POLL_MS / 1000, .tv_usec = MQTT_CLIENT_POLL_MS % 1000 * 1000};
+    int fd = -1;
+
+    if (getaddrinfo(client->host, client->port, &hints, &addresses) != 0)
+        return false;
+    for (struct addrinfo *address = addresses; address && fd < 0; address = address->ai_next)
+    {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0)
+        return false;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    client->socket = fd;
+
+    // CONNECT: protocol "MQTT" level 4, clean session, the last will if any, the keepalive and the client id.
+    uint8_t packet[16 + 3 * MQTT_CLIENT_FIELD_SIZE];
+    size_t length = putMqttString(packet, "MQTT", 4);
+    packet[length++] = 4;
+    packet[length++] = 0x02 | (client->will_topic[0] ? 0x04 | client->will_qos << 3 | client->will_retain << 5 : 0);
+    packet[length++] = client->keepalive_s >> 8;
+    packet[length++] = client->keepalive_s & 0xFF;
+    length += putMqttString(packet + length, client->client_id, strlen(client->client_id));
+    if (client->will_topic[0])
+    {
+        length += putMqttString(packet + length, client->will_topic, strlen(client->will_topic));
+        length += putMqttString(packet + length, client->will_message, client->will_length);
+    }
+
+    uint8_t answer[MQTT_CLIENT_PACKET_SIZE];
+    size_t answer_length;
+    if (sendMqttPacket(client, MQTT_PACKET_CONNECT, packet, length) &&
+        receiveMqttPacket(client, answer, &answer_length) == MQTT_PACKET_CONNACK && answer_length == 2 &&
+        answer[1] == 0)
+        return true;
+    close(fd);
+    client->socket = -1;
+    return false;
+}
+
+static void runMqttClient(void *pvParameter)
+{
+    esp_mqtt_client_handle_t client = pvParameter;
+    uint8_t packet[MQTT_CLIENT_PACKET_SIZE];
+    size_t length;
+
+    while (true)
+    {
+        if (!connectMqttClient(client))
+        {
+            vTaskDelay(pdMS_TO_TICKS(MQTT_CLIENT_RECONNECT_MS));
+            continue;
+        }
+        client->connected = true;
+        postMqttEvent(client, MQTT_EVENT_CONNECTED);
+
+        int type;
+        while ((type = receiveMqttPacket(client, packet, &length)) >= 0)
+        {
+            // PUBACK and PINGRESP need no action, the other packets are not expected by a client that never subscribes.
+            if (esp_timer_get_time() - client->last_sent_us >= client->keepalive_s * 1000000LL / 2 &&
+                !sendMqttPacket(client, MQTT_PACKET_PINGREQ, NULL, 0))
+                break;
+        }
+
+        client->connected = false;
+        xSemaphoreTake(client->send_lock, portMAX_DELAY);
+        close(client->socket);
+        client->socket = -1;
+        xSemaphoreGive(client->send_lock);
+        postMqttEvent(client, MQTT_EVENT_DISCONNECTED);
+        vTaskDelay(pdMS_TO_TICKS(MQTT_CLIENT_RECONNECT_MS));
+    }
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+    if (!client->send_lock || !client->publish_lock)
+        return ESP_ERR_NO_MEM;
+    return xTaskCreate(runMqttClient, "mqtt_client", 8192, client, 5, NULL) == pdPASS ? ESP_OK : ESP_FAIL;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos,
+                            int retain)
+{
+    uint8_t *packet = client->publish_packet;
+    size_t topic_length = strlen(topic);
+    if (!len && data)
+        len = strlen(data);
+    if (!client->connected || qos < 0 || qos > 1 || 4 + topic_length + len > sizeof(client->publish_packet))
+        return -1;
+
+    xSemaphoreTake(client->publish_lock, portMAX_DELAY);
+    int message_id = 0;
+    size_t length = putMqttString(packet, topic, topic_length);
+    if (qos)
+    {
+        message_id = client->next_message_id++;
+        if (!client->next_message_id)
+            client->next_message_id = 1;
+        packet[length++] = message_id >> 8;
+        packet[length++] = message_id & 0xFF;
+    }
+    memcpy(packet + length, data, len);
+    length += len;
+    bool sent = sendMqttPacket(client, MQTT_PACKET_PUBLISH | qos << 1 | (retain ? 1 : 0), packet, length);
+    xSemaphoreGive(client->publish_lock);
+    return sent ? message_id : -1;
+}
@@ -0,0 +1,157 @@
+// UARTs of the host simulation (see host_sim.h): the driver side of driver/uart.h, connected to a peer in the host.
+// - uart_write_bytes() hands the bytes to the peer attached to the port (virtualUartAttach()) at once, from the
+//   writing task, as if the line were infinitely fast.
+// - virtualUartReceive() is the peer sending: the bytes land in the RX buffer of the driver (rx_buffer_size bytes)
+//   and a UART_DATA event is posted. The bytes that do not fit are lost and a UART_BUFFER_FULL event is posted, as
+//   when the driver's ring buffer is full and the hardware FIFO overflows behind it.
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "driver/uart.h"
+#include "host_sim.h"
+
+typedef struct
+{
+    bool installed;
+    uint8_t *rx_buffer;
+    size_t rx_capacity;
+    size_t rx_head;
+    size_t rx_count;
+    QueueHandle_t event_queue;
+    virtual_uart_peer_t peer;
+    void *peer_context;
+} virtual_uart_t;
+
+static virtual_uart_t virtual_uarts[UART_NUM_MAX];
+static portMUX_TYPE virtual_uart_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static virtual_uart_t *getVirtualUart(uart_port_t uart_num)
+{
+    if (uart_num < 0 || uart_num >= UART_NUM_MAX || !virtual_uarts[uart_num].installed)
+        return NULL;
+    return &virtual_uarts[uart_num];
+}
+
+static void postVirtualUartEvent(virtual_uart_t *uart, uart_event_type_t type, size_t size)
+{
+    uart_event_t event = {.type = type, .size = size};
+    if (uart->event_queue)
+        xQueueSend(uart->event_queue, &event, 0); // A full event queue loses the event, as with the driver.
+}
+
+void virtualUartAttach(int uart_num, virtual_uart_peer_t peer, void *context)
+{
+    if (uart_num < 0 || uart_num >= UART_NUM_MAX)
+        return;
+    portENTER_CRITICAL(&virtual_uart_lock);
+    virtual_uarts[uart_num].peer = peer;
+    virtual_uarts[uart_num].peer_context = context;
+    portEXIT_CRITICAL(&virtual_uart_lock);
+}
+
+size_t virtualUartReceive(int uart_num, const void *bytes, size_t length)
+{
+    virtual_uart_t *uart = getVirtualUart(uart_num);
+    size_t stored = 0;
+
+    if (!uart || !length)
+        return 0;
+    portENTER_CRITICAL(&virtual_uart_lock);
+    while (stored < length && uart->rx_count < uart->rx_capacity)
+    {
+        uart->rx_buffer[(uart->rx_head + uart->rx_count++) % uart->rx_capacity] = ((const uint8_t *)bytes)[stored];
+        stored++;
+    }
+    portEXIT_CRITICAL(&virtual_uart_lock);
+    if (stored)
+        postVirtualUartEvent(uart, UART_DATA, stored);
+    if (stored < length)
+        postVirtualUartEvent(uart, UART_BUFFER_FULL, 0);
+    return stored;
+}
+
+esp_err_t uart_driver_install(uart_port_t uart_num, int rx_buffer_size, int tx_buffer_size, int queue_size,
+                              QueueHandle_t *uart_queue, int intr_alloc_flags)
+{
+    if (uart_num < 0 || uart_num >= UART_NUM_MAX || rx_buffer_size <= 0)
+        return ESP_ERR_INVALID_ARG;
+    virtual_uart_t *uart = &virtual_uarts[uart_num];
+    if (uart->installed)
+        return ESP_ERR_INVALID_STATE;
+    uart->rx_buffer = malloc(rx_buffer_size);
+    if (!uart->rx_buffer)
+        return ESP_ERR_NO_MEM;
+    uart->event_queue = NULL;
+    if (queue_size && uart_queue)
+    {
+        uart->event_queue = xQueueCreate(queue_size, sizeof(uart_event_t));
+        if (!uart->event_queue)
+        {
+            free(uart->rx_buffer);
+            return ESP_ERR_NO_MEM;
+        }
+        *uart_queue = uart->event_queue;
+    }
+    uart->rx_capacity = rx_buffer_size;
+    uart->rx_head = 0;
+    uart->rx_count = 0;
+    uart->installed = true;
+    return ESP_OK;
+}
+
+esp_err_t uart_param_config(uart_port_t uart_num, const uart_config_t *uart_config)
+{
+    return getVirtualUart(uart_num) && uart_config ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t uart_set_pin(uart_port_t uart_num, int tx_io_num, int rx_io_num, int rts_io_num, int cts_io_num)
+{
+    return getVirtualUart(uart_num) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+int uart_write_bytes(uart_port_t uart_num, const void *src, size_t size)
+{
+    virtual_uart_t *uart = getVirtualUart(uart_num);
+    if (!uart)
+        return -1;
+    portENTER_CRITICAL(&virtual_uart_lock);
+    virtual_uart_peer_t peer = uart->peer;
+    void *context = uart->peer_context;
+    portEXIT_CRITICAL(&virtual_uart_lock);
+    // Outside of the lock: the peer usually answers through virtualUartReceive().
+    if (peer && size)
+        peer(context, src, size);
+    return size;
+}
+
+/// Returns what the RX buffer holds, up to length bytes, without waiting: the bytes of the peer are there already.
+int uart_read_bytes(uart_port_t uart_num, void *buf, uint32_t length, TickType_t ticks_to_wait)
+{
+    virtual_uart_t *uart = getVirtualUart(uart_num);
+    uint32_t count = 0;
+
+    if (!uart)
+        return -1;
+    portENTER_CRITICAL(&virtual_uart_lock);
+    while (count < length && uart->rx_count)
+    {
+        ((uint8_t *)buf)[count++] = uart->rx_buffer[uart->rx_head];
+        uart->rx_head = (uart->rx_head + 1) % uart->rx_capacity;
+        uart->rx_count--;
+    }
+    portEXIT_CRITICAL(&virtual_uart_lock);
+    return count;
+}
+
+esp_err_t uart_flush_input(uart_port_t uart_num)
+{
+    virtual_uart_t *uart = getVirtualUart(uart_num);
+    if (!uart)
+        return ESP_ERR_INVALID_ARG;
+    portENTER_CRITICAL(&virtual_uart_lock);
+    uart->rx_head = 0;
+    uart->rx_count = 0;
+    portEXIT_CRITICAL(&virtual_uart_lock);
+    return ESP_OK;
+}
@@ -810,15 +810,22 @@ ERROR_t MCP2515_readMessage(const RXBn_t rxbn, const CAN_FRAME frame)
     return ERROR_OK;
 }
 
+// With rollover, a frame goes to RXB1 only while RXB0 is full. Once RXB0 was read with RXB1 full, the next frame
+// may land in RXB0 while RXB1 still holds an older one: RXB1 is then read first, so that frames come out in the
+// order they were received.
+static bool rxb1_older = false;
+
 ERROR_t MCP2515_readMessageAfterStatCheck(const CAN_FRAME frame)
 {
     ERROR_t rc;
     uint8_t stat = MCP2515_getStatus();
 
-    if ( stat & STAT_RX0IF ) {
-        rc = MCP2515_readMessage(RXB0, frame);
-    } else if ( stat & STAT_RX1IF ) {
+    if ( (stat & STAT_RX1IF) && (rxb1_older || !(stat & STAT_RX0IF)) ) {
         rc = MCP2515_readMessage(RXB1, frame);
+        rxb1_older = false;
+    } else if ( stat & STAT_RX0IF ) {
+        rc = MCP2515_readMessage(RXB0, frame);
+        rxb1_older = stat & STAT_RX1IF;
     } else {
         rc = ERROR_NOMSG;
     }
@@ -0,0 +1,208 @@
+// Vector ASC output. A log is what CANalyzer, CANoe, SavvyCAN or python-can load as is:
+//   date Mon Oct 19 10:12:33.000 am 2026
+//   base hex  timestamps absolute
+//   no internal events logged
+//   // version 9.0.0
+//   Begin Triggerblock Mon Oct 19 10:12:33.000 am 2026
+//   // time base: ...                                              (comment lines: time_base.h, frame_loss.h)
+//    0.001099 1        500             Rx   d 8 AB 74 9A 8B AC B3 E1 64
+//    0.001230 2        18DAF110x             Rx   d 3 02 10 03    (29-bit identifier)
+//    0.001300 1        7DF             Rx   r 8                     (remote frame, no data)
+//    0.001412 2  ErrorFrame
+//   End TriggerBlock                                                (when the writer closes the log)
+// Times are seconds since the date of the header (the origin of the file), identifiers hex. The logger only listens:
+// every frame is Rx. The date is the UTC time of the origin when the time base is disciplined; before, the date is
+// unknown and the header carries the Unix epoch (the time base comments give the mapping once known).
+// Frame lines are built in a caller's buffer with table lookups (two hex digits or two decimal digits per load) and
+// integer arithmetic only, no stdio. The writers then hand the line to stdio in one fwrite(), instead of a dozen
+// locked fprintf() calls going through the format parser. The host check asc_golden (host_checks.h) compares
+// formatAscFrameLine() with the same line written with fprintf (formatAscLineStdio()), kernel_benchmark.h times both.
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include "time_base.h"
+
+#define ASC_LINE_MAX 96 // Longest line: 21 digit time, 8 digit identifier, 3 digit DLC, 8 bytes.
+#define ASC_CHANNEL_TWAI 1
+#define ASC_CHANNEL_MCP2515 2
+
+#define ASC_HEX_ROW(high)                                                                                             \
+    high "0" high "1" high "2" high "3" high "4" high "5" high "6" high "7" high "8" high "9" high "A" high "B" high "C" \
+        high "D" high "E" high "F"
+#define ASC_DECIMAL_ROW(high) high "0" high "1" high "2" high "3" high "4" high "5" high "6" high "7" high "8" high "9"
+
+// Byte b is asc_hex_pairs[2 * b], asc_hex_pairs[2 * b + 1]; same for 0..99 in asc_decimal_pairs.
+static const char asc_hex_pairs[] = ASC_HEX_ROW("0") ASC_HEX_ROW("1") ASC_HEX_ROW("2") ASC_HEX_ROW("3")
+    ASC_HEX_ROW("4") ASC_HEX_ROW("5") ASC_HEX_ROW("6") ASC_HEX_ROW("7") ASC_HEX_ROW("8") ASC_HEX_ROW("9")
+        ASC_HEX_ROW("A") ASC_HEX_ROW("B") ASC_HEX_ROW("C") ASC_HEX_ROW("D") ASC_HEX_ROW("E") ASC_HEX_ROW("F");
+static const char asc_decimal_pairs[] = ASC_DECIMAL_ROW("0") ASC_DECIMAL_ROW("1") ASC_DECIMAL_ROW("2")
+    ASC_DECIMAL_ROW("3") ASC_DECIMAL_ROW("4") ASC_DECIMAL_ROW("5") ASC_DECIMAL_ROW("6") ASC_DECIMAL_ROW("7")
+        ASC_DECIMAL_ROW("8") ASC_DECIMAL_ROW("9");
+
+static inline char *ascCopy(char *out, const char *text, size_t length)
+{
+    memcpy(out, text, length);
+    return out + length;
+}
+
+/// @brief Write value in decimal, no leading zeros.
+static char *ascDecimal(char *out, uint64_t value)
+{
+    char digits[20];
+    char *end = digits + sizeof(digits), *start = end;
+    // 32-bit divisions once the value fits: 64-bit ones are library calls on the ESP32.
+    while (value > UINT32_MAX)
+    {
+        *--start = '0' + value % 10;
+        value /= 10;
+    }
+    uint32_t low = value;
+    while (low >= 100)
+    {
+        start -= 2;
+        memcpy(start, &asc_decimal_pairs[2 * (low % 100)], 2);
+        low /= 100;
+    }
+    if (low >= 10)
+    {
+        start -= 2;
+        memcpy(start, &asc_decimal_pairs[2 * low], 2);
+    }
+    else
+        *--start = '0' + low;
+    return ascCopy(out, start, end - start);
+}
+
+/// @brief Write value as 6 decimal digits (value < 1000000).
+static inline char *ascMicroseconds(char *out, uint32_t value)
+{
+    memcpy(out + 4, &asc_decimal_pairs[2 * (value % 100)], 2);
+    value /= 100;
+    memcpy(out + 2, &asc_decimal_pairs[2 * (value % 100)], 2);
+    memcpy(out, &asc_decimal_pairs[2 * (value / 100)], 2);
+    return out + 6;
+}
+
+/// @brief Write value in upper case hex, at least min_digits digits ("%0<min_digits>lX").
+static char *ascHex(char *out, uint32_t value, int min_digits)
+{
+    int digits = value ? (32 - __builtin_clz(value) + 3) / 4 : 1;
+    if (digits < min_digits)
+        digits = min_digits;
+    for (int i = digits - 1; i >= 0; i--, value >>= 4)
+        out[i] = asc_hex_pairs[2 * (value & 0xF) + 1];
+    return out + digits;
+}
+
+/// @brief Write the time of a line, " <s>.<µs>", exact (no rounding through a double).
+static inline char *ascTime(char *out, int64_t time_us)
+{
+    uint64_t magnitude = time_us < 0 ? -(uint64_t)time_us : (uint64_t)time_us;
+    uint64_t seconds = magnitude <= UINT32_MAX ? (uint32_t)magnitude / 1000000 : magnitude / 1000000;
+    *out++ = ' ';
+    if (time_us < 0)
+        *out++ = '-';
+    out = ascDecimal(out, seconds);
+    *out++ = '.';
+    return ascMicroseconds(out, magnitude - seconds * 1000000);
+}
+
+/// @brief Format a frame line.
+/// @param buffer at least ASC_LINE_MAX bytes.
+/// @param channel 1 to 9.
+/// @param extended 29-bit identifier, written with an x suffix.
+/// @param remote remote frame: no data bytes.
+/// @param dlc printed as is, at most 8 data bytes are written.
+/// @return length of the line (not terminated).
+static size_t formatAscFrameLine(char *buffer, int64_t time_us, uint8_t channel, uint32_t identifier, bool extended,
+                                 bool remote, uint8_t dlc, const uint8_t *data)
+{
+    char *out = ascTime(buffer, time_us);
+    *out++ = ' ';
+    *out++ = '0' + channel;
+    out = ascCopy(out, "        ", 8);
+    out = ascHex(out, identifier, 3);
+    if (extended)
+        *out++ = 'x';
+    out = ascCopy(out, "             Rx   ", 18);
+    *out++ = remote ? 'r' : 'd';
+    *out++ = ' ';
+    out = ascDecimal(out, dlc);
+    for (int i = 0; !remote && i < dlc && i < 8; i++)
+    {
+        *out++ = ' ';
+        out = ascCopy(out, &asc_hex_pairs[2 * data[i]], 2);
+    }
+    *out++ = '\n';
+    return out - buffer;
+}
+
+/// @brief Format an error frame line.
+/// @return length of the line (not terminated).
+static size_t formatAscErrorFrameLine(char *buffer, int64_t time_us, uint8_t channel)
+{
+    char *out = ascTime(buffer, time_us);
+    *out++ = ' ';
+    *out++ = '0' + channel;
+    out = ascCopy(out, "  ErrorFrame\n", 13);
+    return out - buffer;
+}
+
+/// @brief Format the date of a log, "Mon Oct 19 10:12:33.000 am 2026".
+static void formatAscDate(char *buffer, size_t size, int64_t utc_us)
+{
+    time_t seconds = utc_us / 1000000;
+    struct tm date;
+    gmtime_r(&seconds, &date);
+    size_t length = strftime(buffer, size, "%a %b %d %I:%M:%S", &date);
+    snprintf(buffer + length, size - length, ".%03d %s %d", (int)(utc_us / 1000 % 1000),
+             date.tm_hour < 12 ? "am" : "pm", date.tm_year + 1900);
+}
+
+/// @brief Write the header of a log, before any other line.
+/// @param origin_us local time the times of the file are relative to.
+void writeAscHeader(FILE *file, int64_t origin_us)
+{
+    char date[48];
+    int64_t utc_us = 0;
+    if (!timeBaseLocalToUtc(origin_us, &utc_us) || utc_us < 0)
+        utc_us = 0;
+    formatAscDate(date, sizeof(date), utc_us);
+    fprintf(file, "date %s\nbase hex  timestamps absolute\nno internal events logged\n// version 9.0.0\n"
+            "Begin Triggerblock %s\n", date, date);
+}
+
+/// @brief Write the end of a log, once nothing more is written to it.
+void writeAscFooter(FILE *file)
+{
+    fprintf(file, "End TriggerBlock\n");
+}
+
+#if defined(CONFIG_DATAFLY_BENCHMARK_ENABLED) || defined(CONFIG_DATAFLY_HOST_CHECKS)
+// Times the reference line is exact for: below 1e9 s, the seconds as a double are within a quarter of a µs of the
+// time, and " %f" rounds them to the right 6 decimals.
+#define ASC_STDIO_TIME_LIMIT_US 1000000000000000LL
+
+/// @brief Reference ASC line: the fprintf() calls of the writers before formatAscFrameLine(), the time in double
+/// seconds through " %f" (|time_us| < ASC_STDIO_TIME_LIMIT_US). The ASC output changed since in Rx for Tx, the x of
+/// 29-bit identifiers, and the data bytes: none on remote frames, at most 8.
+/// @param error an error frame line (formatAscErrorFrameLine()), the frame fields are ignored.
+static void formatAscLineStdio(FILE *stream, int64_t time_us, uint8_t channel, uint32_t identifier, bool extended,
+                               bool remote, bool error, uint8_t dlc, const uint8_t *data)
+{
+    fprintf(stream, " %f", (double)time_us * 1e-6);
+    if (error)
+    {
+        fprintf(stream, " %d  ErrorFrame\n", channel);
+        return;
+    }
+    fprintf(stream, " %d        %03lX%s             Rx   %c %d", channel, (unsigned long)identifier,
+            extended ? "x" : "", remote ? 'r' : 'd', dlc);
+    for (int i = 0; !remote && i < dlc && i < 8; i++)
+        fprintf(stream, " %02X", data[i]);
+    fprintf(stream, "\n");
+}
+#endif
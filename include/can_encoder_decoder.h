@@ -2,12 +2,18 @@
 #define CAN_ENCODE_DECODE_INL_H_
 
 #include <stdint.h> //uint typedefinitions, non-rtw!
+#include <stdbool.h>
+#include <string.h>
 #include <assert.h>
 #include <math.h>
 
 #define MASK64(nbits) ((0xffffffffffffffff) >> (64 - nbits))
 
-inline float toPhysicalValue(uint64_t target, float factor, float offset, bool is_signed)
+// Fractional bits of the integer-only physical values (Q47.16 in an int64_t), see canSignalDecodeFixed().
+#define CAN_FIXED_FRAC_BITS 16
+#define CAN_FIXED_ONE ((int64_t)1 << CAN_FIXED_FRAC_BITS)
+
+static inline float toPhysicalValue(uint64_t target, float factor, float offset, bool is_signed)
 {
     if (is_signed)
         return ((int64_t)target) * factor + offset;
@@ -15,12 +21,12 @@ inline float toPhysicalValue(uint64_t target, float factor, float offset, bool i
         return target * factor + offset;
 }
 
-inline uint64_t fromPhysicalValue(float physical_value, float factor, float offset)
+static inline uint64_t fromPhysicalValue(float physical_value, float factor, float offset)
 {
     return (int64_t)((physical_value - offset) / factor);
 }
 
-inline void clearBits(uint8_t *target_byte, uint8_t *bits_to_clear, const uint8_t startbit, const uint8_t length)
+static inline void clearBits(uint8_t *target_byte, uint8_t *bits_to_clear, const uint8_t startbit, const uint8_t length)
 {
     for (uint8_t i = startbit; i < length + startbit; ++i)
     {
@@ -29,8 +35,8 @@ inline void clearBits(uint8_t *target_byte, uint8_t *bits_to_clear, const uint8_
     }
 }
 
-inline void storeSignal(uint8_t *frame, uint64_t value, const uint8_t startbit, const uint8_t length,
-                        bool is_big_endian, bool is_signed)
+static inline void storeSignal(uint8_t *frame, uint64_t value, const uint8_t startbit, const uint8_t length,
+                               bool is_big_endian, bool is_signed)
 {
     uint8_t start_byte = startbit / 8;
     uint8_t startbit_in_byte = startbit % 8;
@@ -71,8 +77,8 @@ inline void storeSignal(uint8_t *frame, uint64_t value, const uint8_t startbit,
     }
 }
 
-inline uint64_t extractSignal(const uint8_t *frame, const uint8_t startbit, const uint8_t length, bool is_big_endian,
-                              bool is_signed)
+static inline uint64_t extractSignal(const uint8_t *frame, const uint8_t startbit, const uint8_t length,
+                                     bool is_big_endian, bool is_signed)
 {
     uint8_t start_byte = startbit / 8;
     uint8_t startbit_in_byte = startbit % 8;
@@ -90,7 +96,7 @@ inline uint64_t extractSignal(const uint8_t *frame, const uint8_t startbit, cons
 
         for (count = start_byte - 1; count >= end_byte; count--)
         {
-            target |= frame[count] << current_target_length;
+            target |= (uint64_t)frame[count] << current_target_length;
             current_target_length += 8;
         }
     }
@@ -100,7 +106,7 @@ inline uint64_t extractSignal(const uint8_t *frame, const uint8_t startbit, cons
 
         for (count = start_byte + 1; count <= end_byte; count++)
         {
-            target |= frame[count] << current_target_length;
+            target |= (uint64_t)frame[count] << current_target_length;
             current_target_length += 8;
         }
     }
@@ -111,7 +117,7 @@ inline uint64_t extractSignal(const uint8_t *frame, const uint8_t startbit, cons
     // perform sign extension
     if (is_signed)
     {
-        int64_t msb_sign_mask = 1 << (length - 1);
+        int64_t msb_sign_mask = (int64_t)1 << (length - 1);
         target = ((int64_t)target ^ msb_sign_mask) - msb_sign_mask;
     }
 
@@ -120,30 +126,237 @@ inline uint64_t extractSignal(const uint8_t *frame, const uint8_t startbit, cons
 
 // For Vector CAN DB files https://vector.com/vi_candb_en.html
 
-inline float decode(const uint8_t *frame, const uint16_t startbit, const uint16_t length, bool is_big_endian,
-                    bool is_signed, float factor, float offset)
+static inline float decode(const uint8_t *frame, const uint16_t startbit, const uint16_t length, bool is_big_endian,
+                           bool is_signed, float factor, float offset)
 {
     return toPhysicalValue(extractSignal(frame, startbit, length, is_big_endian, is_signed), factor, offset, is_signed);
 }
 
-inline void encode(uint8_t *frame, const float value, const uint16_t startbit, const uint16_t length,
-                   bool is_big_endian, bool is_signed, float factor, float offset)
+static inline void encode(uint8_t *frame, const float value, const uint16_t startbit, const uint16_t length,
+                          bool is_big_endian, bool is_signed, float factor, float offset)
 {
     storeSignal(frame, fromPhysicalValue(value, factor, offset), startbit, length, is_big_endian, is_signed);
 }
 
+// Precompiled signal kernels.
+// The layout of a signal never changes, so everything extractSignal works out on each call (start byte, direction,
+// byte count, mask, sign bit) is resolved once by canSignalCompile(). Extracting is then one 64-bit load, a shift,
+// a mask and a branchless sign extension.
+// Intel signals are contiguous in the payload loaded as a little endian word. Motorola signals are contiguous in the
+// payload loaded as a big endian word, startbit being the LSB of the signal (same convention as extractSignal).
+// The payload is always loaded as 8 bytes: both twai_message_t and struct can_frame keep a full 8 byte data array.
+
+typedef struct
+{
+    uint64_t mask;     // MASK64(length).
+    uint64_t sign_bit; // Bit to sign extend from, 0 for unsigned signals (the extension is then a no-op).
+    uint8_t shift;     // Position of the LSB of the signal inside the loaded word.
+    uint8_t length;
+    bool is_big_endian;
+    bool is_signed;
+    float factor;
+    float offset;
+    // Integer-only path: physical value in Q.16 = ((raw * fixed_multiplier) >> fixed_shift) + fixed_offset.
+    int64_t fixed_multiplier;
+    int64_t fixed_offset;
+    uint8_t fixed_shift;
+} can_signal_t;
+
+static inline uint64_t loadFrameLittleEndian(const uint8_t *frame)
+{
+    uint64_t word;
+    memcpy(&word, frame, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+static inline uint64_t loadFrameBigEndian(const uint8_t *frame)
+{
+    return __builtin_bswap64(loadFrameLittleEndian(frame));
+}
+
+/// @brief Work out the integer scaling of a signal: factor is turned into a 30-bit multiplier and a right shift,
+/// power of two factors (IQ signals, factor 1, 0.5...) into a plain shift. All floating point work happens here.
+static inline void canSignalCompileFixed(can_signal_t *signal)
+{
+    int exponent;
+    double mantissa = frexp(signal->factor, &exponent); // factor = mantissa * 2^exponent, 0.5 <= |mantissa| < 1
+    int64_t multiplier;
+    int shift;
+
+    if (fabs(mantissa) == 0.5)
+    {
+        multiplier = mantissa < 0 ? -1 : 1;
+        shift = 1 - exponent - CAN_FIXED_FRAC_BITS;
+    }
+    else
+    {
+        multiplier = llround(ldexp(mantissa, 30));
+        shift = 30 - exponent - CAN_FIXED_FRAC_BITS;
+    }
+
+    if (shift < 0) // factor large enough to need no rounding shift at all.
+    {
+        multiplier *= (int64_t)1 << -shift;
+        shift = 0;
+    }
+    else if (shift > 62) // factor below the Q.16 resolution, only the offset is left.
+    {
+        multiplier = 0;
+        shift = 0;
+    }
+
+    signal->fixed_multiplier = multiplier;
+    signal->fixed_shift = shift;
+    signal->fixed_offset = llround((double)signal->offset * CAN_FIXED_ONE);
+}
+
+/// @brief Build the extraction recipe of a signal, to be called once when the signal table is set up (not per frame).
+/// Takes the same layout arguments as decode().
+static inline can_signal_t canSignalCompile(const uint8_t startbit, const uint8_t length, bool is_big_endian,
+                                            bool is_signed, float factor, float offset)
+{
+    assert(length >= 1 && length <= 64);
+    can_signal_t signal = {
+        .mask = MASK64(length),
+        .sign_bit = is_signed ? (uint64_t)1 << (length - 1) : 0,
+        .shift = is_big_endian ? (7 - startbit / 8) * 8 + startbit % 8 : startbit,
+        .length = length,
+        .is_big_endian = is_big_endian,
+        .is_signed = is_signed,
+        .factor = factor,
+        .offset = offset,
+    };
+    assert(signal.shift + length <= 64);
+    canSignalCompileFixed(&signal);
+    return signal;
+}
+
+/// @brief Extract a signal from a word already loaded with loadFrameLittleEndian/loadFrameBigEndian (matching its
+/// endianness). Same result as extractSignal().
+static inline uint64_t canSignalExtractWord(const can_signal_t *signal, uint64_t word)
+{
+    uint64_t target = (word >> signal->shift) & signal->mask;
+    return (target ^ signal->sign_bit) - signal->sign_bit;
+}
+
+static inline uint64_t canSignalExtract(const can_signal_t *signal, const uint8_t *frame)
+{
+    uint64_t word = signal->is_big_endian ? loadFrameBigEndian(frame) : loadFrameLittleEndian(frame);
+    return canSignalExtractWord(signal, word);
+}
+
+/// @brief Same result as decode() called with the arguments the signal was compiled from.
+static inline float canSignalDecode(const can_signal_t *signal, const uint8_t *frame)
+{
+    return toPhysicalValue(canSignalExtract(signal, frame), signal->factor, signal->offset, signal->is_signed);
+}
+
+/// @brief Integer-only counterpart of toPhysicalValue(), for a raw value extracted with the signal's recipe.
+static inline int64_t canSignalScaleFixed(const can_signal_t *signal, uint64_t raw)
+{
+    int64_t value = (int64_t)raw * signal->fixed_multiplier;
+    if (signal->fixed_shift)
+        value = (value + ((int64_t)1 << (signal->fixed_shift - 1))) >> signal->fixed_shift;
+    return value + signal->fixed_offset;
+}
+
+/// @brief Decode a signal without touching the FPU. The result is the physical value in Q.16 (CAN_FIXED_ONE == 1.0),
+/// within one LSB of the signal (factor) of canSignalDecode().
+/// Signals up to 32 bits are supported, longer ones only with a power of two factor, and the physical value must fit
+/// the Q47.16 range (+/- 2^47).
+static inline int64_t canSignalDecodeFixed(const can_signal_t *signal, const uint8_t *frame)
+{
+    return canSignalScaleFixed(signal, canSignalExtract(signal, frame));
+}
+
+static inline float canFixedToFloat(int64_t value)
+{
+    return (float)value / CAN_FIXED_ONE;
+}
+
+// Batch decoding.
+// A message definition groups the compiled signals of one CAN identifier. The payload is loaded once in both byte
+// orders and every signal of the message is extracted from the register copy, instead of walking the frame per signal.
+
+typedef struct
+{
+    uint32_t id;
+    uint8_t signal_count;
+    const can_signal_t *signals;
+} can_message_def_t;
+
+/// @brief Extract the raw value of every signal of a message in one pass.
+/// @param raw_values caller array of message->signal_count entries, in the order of message->signals.
+static inline void canExtractFrame(const can_message_def_t *message, const uint8_t *frame, uint64_t *raw_values)
+{
+    const uint64_t little = loadFrameLittleEndian(frame);
+    const uint64_t big = __builtin_bswap64(little);
+
+    for (uint8_t i = 0; i < message->signal_count; i++)
+    {
+        const can_signal_t *signal = &message->signals[i];
+        raw_values[i] = canSignalExtractWord(signal, signal->is_big_endian ? big : little);
+    }
+}
+
+/// @brief Decode every signal of a message in one pass, same values as calling decode() on each of them.
+/// @param values caller array of message->signal_count entries, in the order of message->signals.
+static inline void canDecodeFrame(const can_message_def_t *message, const uint8_t *frame, float *values)
+{
+    const uint64_t little = loadFrameLittleEndian(frame);
+    const uint64_t big = __builtin_bswap64(little);
+
+    for (uint8_t i = 0; i < message->signal_count; i++)
+    {
+        const can_signal_t *signal = &message->signals[i];
+        uint64_t raw = canSignalExtractWord(signal, signal->is_big_endian ? big : little);
+        values[i] = toPhysicalValue(raw, signal->factor, signal->offset, signal->is_signed);
+    }
+}
+
+/// @brief Integer-only counterpart of canDecodeFrame(), values in Q.16.
+static inline void canDecodeFrameFixed(const can_message_def_t *message, const uint8_t *frame, int64_t *values)
+{
+    const uint64_t little = loadFrameLittleEndian(frame);
+    const uint64_t big = __builtin_bswap64(little);
+
+    for (uint8_t i = 0; i < message->signal_count; i++)
+    {
+        const can_signal_t *signal = &message->signals[i];
+        values[i] = canSignalScaleFixed(signal, canSignalExtractWord(signal, signal->is_big_endian ? big : little));
+    }
+}
+
 // Texas instruments IQ notation https://en.wikipedia.org/wiki/Q_(number_format)
 
-inline double extractIQ(const uint8_t *frame, uint8_t start, uint8_t length, uint8_t float_length, bool is_big_endian,
-                        bool is_signed)
+static inline double extractIQ(const uint8_t *frame, uint8_t start, uint8_t length, uint8_t float_length,
+                               bool is_big_endian, bool is_signed)
+{
+    return ldexp((int64_t)extractSignal(frame, start, length, is_big_endian, is_signed), -float_length);
+}
+
+/// @brief Build the recipe of an IQ signal in Q.float_length for extractIQFixed(), once when the signal table is set
+/// up. The factor 2^-float_length is a power of two, so canSignalCompileFixed() turns it into a plain shift.
+static inline can_signal_t canSignalCompileIQ(uint8_t start, uint8_t length, uint8_t float_length, bool is_big_endian,
+                                              bool is_signed)
+{
+    return canSignalCompile(start, length, is_big_endian, is_signed, ldexpf(1.0f, -float_length), 0.0f);
+}
+
+/// @brief Integer-only extractIQ(), the value is converted from Q.float_length to Q.16 by the shift of the recipe.
+/// @param signal compiled with canSignalCompileIQ().
+static inline int64_t extractIQFixed(const can_signal_t *signal, const uint8_t *frame)
 {
-    return (int64_t)extractSignal(frame, start, length, is_big_endian, is_signed) / pow(2, float_length);
+    return canSignalDecodeFixed(signal, frame);
 }
 
-inline void storeIQ(uint8_t *frame, double value, uint8_t start, uint8_t length, uint8_t float_length,
-                    bool is_big_endian, bool is_signed)
+static inline void storeIQ(uint8_t *frame, double value, uint8_t start, uint8_t length, uint8_t float_length,
+                           bool is_big_endian, bool is_signed)
 {
-    storeSignal(frame, value * pow(2, float_length), start, length, is_big_endian, is_signed);
+    storeSignal(frame, ldexp(value, float_length), start, length, is_big_endian, is_signed);
 }
 
 #endif
@@ -1,20 +1,70 @@
 // 
 #pragma once
 
+/// @brief Stamp the sequence of a received frame and queue it for the writer, never blocking the receiver for longer
+/// than ticks_to_wait: a frame finding the queue full is dropped and counted.
+void ingestFrameTwai(timed_twai_message_t* message, TickType_t ticks_to_wait)
+{
+    message->sequence = twai_rx_sequence++;
+    message->error_frame = false;
+    if (xQueueSend(file_data_queue, (void *) message, ticks_to_wait) != pdPASS)
+    {
+        countFrameLoss(FRAME_LOSS_TWAI_QUEUE_FULL, 1);
+        return;
+    }
+    noteFrameIngested(file_data_queue, &twai_frames_ingested, &file_data_queue_high_water);
+}
+
+#define ERROR_FRAMES_PER_POLL_MAX 10 // Error frames logged per poll at most: a bus off must not flood the log.
+
+/// @brief Queue an ErrorFrame entry for each bus error since the last poll, up to ERROR_FRAMES_PER_POLL_MAX. The
+/// controller only counts them: they are all stamped with the time of the poll. Not frames, never counted as lost.
+static void ingestErrorFramesTwai(uint32_t bus_errors, int64_t time_us)
+{
+    timed_twai_message_t error = {.rx_time_us = time_us, .error_frame = true};
+    for (uint32_t i = 0; i < bus_errors && i < ERROR_FRAMES_PER_POLL_MAX; i++)
+        if (xQueueSend(file_data_queue, (void *) &error, 0) != pdPASS)
+            break;
+}
+
+/// @brief Count the frames the TWAI driver and controller dropped since the last call, and log the bus errors.
+static void pollTwaiLosses()
+{
+    static uint32_t rx_missed = 0, rx_overrun = 0, bus_errors = 0;
+    twai_status_info_t status;
+    if (twai_get_status_info(&status) != ESP_OK)
+        return;
+    countFrameLoss(FRAME_LOSS_TWAI_RX_MISSED, status.rx_missed_count - rx_missed);
+    countFrameLoss(FRAME_LOSS_TWAI_RX_OVERRUN, status.rx_overrun_count - rx_overrun);
+    ingestErrorFramesTwai(status.bus_error_count - bus_errors, timeBaseNow());
+    rx_missed = status.rx_missed_count;
+    rx_overrun = status.rx_overrun_count;
+    bus_errors = status.bus_error_count;
+}
+
 void SendCANData(void *param)
 {
+    int64_t last_poll_us = 0;
     while(true)
     {
         //Wait for message to be received
-        twai_message_t message;
-        if (twai_receive(&message, pdMS_TO_TICKS(10000)) == ESP_OK) {
+        timed_twai_message_t message;
+        if (twai_receive(&message.frame, pdMS_TO_TICKS(10000)) == ESP_OK) {
+            // Stamped here, not when written: the time the frame waits in the queue must not show in the log.
+            message.rx_time_us = timeBaseNow();
             // ESP_LOGI("CAN_NODE_H", "Message received\n");
-            xQueueSend(file_data_queue, (void *) &message, portMAX_DELAY);
+            ingestFrameTwai(&message, ingest_queue_wait);
+            if (message.rx_time_us - last_poll_us >= FRAME_LOSS_POLL_US)
+            {
+                pollTwaiLosses();
+                last_poll_us = message.rx_time_us;
+            }
         } else {
+            pollTwaiLosses();
             ESP_LOGE("CAN_NODE_H", "Failed to receive message\n");
             break;
         }
         vTaskDelay(0);
     }
     vTaskDelete(NULL);
-}
\ No newline at end of file
+}
@@ -1,13 +1,27 @@
 #pragma once
 #include "mcp2515.h"
 #include "can_encoder_decoder.h"
-#include "cJSON.h"
+#include "vehicle_signals.h"
+#include "signal_store.h"
+#include "cluster_state.h"
+#include "signal_cache.h"
+#include "signal_aggregate.h"
 
 #define HSPI_MISO 27
 #define HSPI_MOSI 13
 #define HSPI_CLK 14
 #define HSPI_CS 15
 
+#if defined(CONFIG_DATAFLY_LOAD_TEST_ENABLED) && !defined(CONFIG_IDF_TARGET_LINUX)
+// The bench load test transmits through the MCP2515 from its own task: accesses to the SPI device are serialised.
+static SemaphoreHandle_t mcp2515_mutex = NULL;
+#define MCP2515_LOCK() xSemaphoreTake(mcp2515_mutex, portMAX_DELAY)
+#define MCP2515_UNLOCK() xSemaphoreGive(mcp2515_mutex)
+#else
+#define MCP2515_LOCK()
+#define MCP2515_UNLOCK()
+#endif
+
 
 bool HSPI_Init(void)
 {
@@ -64,77 +78,76 @@ void CAN_Init(void)
 	MCP2515_setBitrate(CAN_500KBPS, MCP_8MHZ);
 	// MCP2515_setNormalMode();
     MCP2515_setListenOnlyMode();
+#if defined(CONFIG_DATAFLY_LOAD_TEST_ENABLED) && !defined(CONFIG_IDF_TARGET_LINUX)
+    mcp2515_mutex = xSemaphoreCreateMutex();
+#endif
 	// xTaskCreatePinnedToCore(CAN_Module_RX_Task_Polling, "CAN_Module_RX_Task_Polling", 16384, NULL, 20, NULL, 1);
 }
 
+/// @brief Stamp the sequence of a received frame, hand it to the writer and decode its signals. A frame finding the
+/// queue full for ticks_to_wait is dropped (and counted), its signals are decoded all the same.
+/// @param signal_fixed_values latest values of the signals in Q.16, kept by the receiving task.
+void ingestFrameMCP2515(timed_can_frame_t* can_message, int64_t* signal_fixed_values, TickType_t ticks_to_wait)
+{
+    can_message->sequence = mcp2515_rx_sequence++;
+    if (xQueueSend(file_data_queue_mcp2515, (void *) can_message, ticks_to_wait) == pdPASS)
+        noteFrameIngested(file_data_queue_mcp2515, &mcp2515_frames_ingested, &file_data_queue_mcp2515_high_water);
+    else
+        countFrameLoss(FRAME_LOSS_MCP2515_QUEUE_FULL, 1);
+    // Every known frame is looked up once and decoded once, in Q.16, in one pass over its payload: the receiver never
+    // touches the FPU. signal_fixed_values always holds the latest values.
+    const can_message_def_t* message = findVehicleMessage(can_message->frame.can_id);
+    if (message)
+    {
+        int64_t now = can_message->rx_time_us;
+        decodeVehicleMessageFixed(message, can_message->frame.data, signal_fixed_values);
+        // The cluster state is updated in place, publishClusterState (core 1) serialises it when needed.
+        clusterStateUpdate(message, signal_fixed_values, now);
+        signalCacheUpdateMessage(message, signal_fixed_values, now);
+        signalStoreAppendMessage(message, signal_fixed_values, now);
+        signalAggregateUpdateMessage(message, signal_fixed_values, now);
+    }
+}
+
+/// @brief Count the receive buffer overruns flagged by the MCP2515 since the last call, and clear the flags. A message
+/// error flagged since is logged as one ErrorFrame: the controller does not count them.
+static void pollMcp2515Losses()
+{
+    uint8_t flags = MCP2515_getErrorFlags();
+    if (flags & (EFLG_RX0OVR | EFLG_RX1OVR))
+    {
+        countFrameLoss(FRAME_LOSS_MCP2515_RX_OVERRUN, !!(flags & EFLG_RX0OVR) + !!(flags & EFLG_RX1OVR));
+        // Not MCP2515_clearRXnOVR(): it clears every interrupt flag, the frames waiting in the buffers with them.
+        MCP2515_clearRXnOVRFlags();
+        MCP2515_clearERRIF();
+    }
+    if (MCP2515_getInterrupts() & CANINTF_MERRF)
+    {
+        timed_can_frame_t error = {.frame = {.can_id = CAN_ERR_FLAG}, .rx_time_us = timeBaseNow()};
+        xQueueSend(file_data_queue_mcp2515, (void *) &error, 0);
+        MCP2515_clearMERR();
+    }
+}
+
 void sendCanDataMCP2515(void* params)
 {
     // vTaskDelay(2000 / portTICK_PERIOD_MS);
-    struct can_frame can_message;
-    int dummy_channel_1 = 0;
-    int dummy_channel_2 = 0;
-    bool flag_channel_1 = false;
-    bool flag_channel_2 = false;
-    cJSON* cluster = cJSON_CreateObject();
+    timed_can_frame_t can_message;
+    int64_t signal_fixed_values[SIG_COUNT] = {0};
+    int64_t last_poll_us = 0;
+    int64_t last_sweep_us = 0;
+    vehicleSignalsInit();
     CAN_Init();
     // vTaskDelay(2000 / portTICK_PERIOD_MS);
     while(true)
     {
-        ERROR_t err_msg = MCP2515_readMessageAfterStatCheck(&can_message);
+        MCP2515_LOCK();
+        ERROR_t err_msg = MCP2515_readMessageAfterStatCheck(&can_message.frame);
+        MCP2515_UNLOCK();
         if (err_msg == ERROR_OK)
         {
-            xQueueSend(file_data_queue_mcp2515, (void *) &can_message, portMAX_DELAY);
-            if (can_message.can_id == 0x500 && ++dummy_channel_1 >= 500 && !flag_channel_1)
-            {
-                // ESP_LOGW("-", "-----------------------------------------------------");
-                // ESP_LOGI("CAN_NODE_MCP", "Displaying Cluster");
-                cJSON_AddNumberToObject(cluster, "Battery State Bars", decode(can_message.data, 7, 4, false, false, 1, 0));
-                cJSON_AddNumberToObject(cluster, "Vehicle Speed", decode(can_message.data, 11, 7, false, false, 1, 0));
-                cJSON_AddNumberToObject(cluster, "Odometer", decode(can_message.data, 25, 24, false, false, 0.1, 0));
-                cJSON_AddNumberToObject(cluster, "State of Charge", decode(can_message.data, 18, 7, false, false, 0.5, 0));
-                cJSON_AddNumberToObject(cluster, "Remaining Charge Time", decode(can_message.data, 49, 8, false, false, 2, 0));
-
-                // ESP_LOGI("CAN_NODE_MCP", "Ready LCD %f", decode(can_message.data, 0, 1, false, false, 1, 0));
-                // ESP_LOGI("CAN_NODE_MCP", "Autonomy Icon LCD %f", decode(can_message.data, 1, 2, false, false, 1, 0));
-                // ESP_LOGI("CAN_NODE_MCP", "Charge Icon LCD %f", decode(can_message.data, 3, 2, false, false, 1, 0));
-                // ESP_LOGI("CAN_NODE_MCP", "Drive Mode Selector LCD %f", decode(can_message.data, 5, 2, false, false, 1, 0));
-                // ESP_LOGI("CAN_NODE_MCP", "Batterry State bars %f", decode(can_message.data, 7, 4, false, false, 1, 0));
-                // ESP_LOGI("CAN_NODE_MCP", "Vehicle Speed %f ", decode(can_message.data, 11, 7, false, false, 1, 0));
-                // ESP_LOGI("CAN_NODE_MCP", "Battery State of Charge %f", decode(can_message.data, 18, 7, false, false, 0.5, 0));
-                // ESP_LOGI("CAN_NODE_MCP", "Odemeter %f", decode(can_message.data, 25, 24, false, false, 0.1, 0));
-                // ESP_LOGI("CAN_NODE_MCP", "Remaining Charge Time %f", decode(can_message.data, 49, 8, false, false, 2, 0));
-                // ESP_LOGW("-", "-----------------------------------------------------");
-                dummy_channel_1 = 0;
-                flag_channel_1 = true;
-            }
-            if (can_message.can_id == 0x510 && ++dummy_channel_2 >= 50 && !flag_channel_2)
-            {
-                // ESP_LOGW("CAN_NODE_MCP", "*****************");
-                cJSON_AddNumberToObject(cluster, "Brake System Problem", decode(can_message.data, 6, 2, false, false, 1, 0));
-                cJSON_AddNumberToObject(cluster, "Stop", decode(can_message.data, 10, 2, false, false, 1, 0));
-                cJSON_AddNumberToObject(cluster, "Battery Temperature", decode(can_message.data, 14, 2, false, false, 1, 0));
-                cJSON_AddNumberToObject(cluster, "Turtle Mode", decode(can_message.data, 18, 2, false, false, 1, 0));
-                cJSON_AddNumberToObject(cluster, "Remaining Autonomy", decode(can_message.data, 34, 8, false, false, 1, 0));
-
-                // ESP_LOGI("CAN_NODE_MCP", "Right Indicator %f", decode(can_message.data, 0, 2, false, false, 1, 0));
-                // ESP_LOGI("CAN_NODE_MCP", "Left Indicator %f", decode(can_message.data, 2, 2, false, false, 1, 0));
-                // ESP_LOGI("CAN_NODE_MCP", "Brake System Problem %f", decode(can_message.data, 6, 2, false, false, 1, 0));
-                // ESP_LOGI("CAN_NODE_MCP", "Stop %f", decode(can_message.data, 10, 2, false, false, 1, 0));
-                // ESP_LOGI("CAN_NODE_MCP", "Battery Temperature %f", decode(can_message.data, 14, 2, false, false, 1, 0));
-                // ESP_LOGI("CAN_NODE_MCP", "Turtle Mode %f", decode(can_message.data, 18, 2, false, false, 1, 0));
-                // ESP_LOGI("CAN_NODE_MCP", "Remaining Autonomy %f", decode(can_message.data, 34, 8, false, false, 1, 0));
-                // ESP_LOGW("CAN_NODE_MCP", "**************");
-                dummy_channel_2 = 0;
-                flag_channel_2 = true;
-            }
-            if (flag_channel_1 && flag_channel_2)
-            {
-                ESP_LOGI("CAN_NODE_MCP", "%s", cJSON_Print(cluster));
-                cJSON_Delete(cluster);
-                cluster = cJSON_CreateObject();
-                flag_channel_1 = false;
-                flag_channel_2 = false;
-            }
+            can_message.rx_time_us = timeBaseNow();
+            ingestFrameMCP2515(&can_message, signal_fixed_values, ingest_queue_wait);
         }
         else if (err_msg == ERROR_NOMSG) {
             // ESP_LOGW("CAN_NODE_MCP", "No messages received");
@@ -144,6 +157,20 @@ void sendCanDataMCP2515(void* params)
             ESP_LOGE("CAN_NODE_MCP", "Error code: %d", err_msg);
             // break;
         }
+        int64_t now = timeBaseNow();
+        if (now - last_poll_us >= FRAME_LOSS_POLL_US)
+        {
+            MCP2515_LOCK();
+            pollMcp2515Losses();
+            MCP2515_UNLOCK();
+            last_poll_us = now;
+        }
+        if (now - last_sweep_us >= AGGREGATE_SWEEP_US)
+        {
+            signalAggregateCloseWindows(now);
+            signalStoreSealIdleChunks(now);
+            last_sweep_us = now;
+        }
     }
     vTaskDelete(NULL);
 }
\ No newline at end of file
@@ -0,0 +1,131 @@
+// Cluster state: the values shown on the vehicle cluster, kept in a fixed-layout struct updated in place by the
+// decoding task (sendCanDataMCP2515), instead of building and printing a cJSON tree for every snapshot.
+// Serialisation is done on demand by a consumer task (publishClusterState) into a reusable buffer, so taking a
+// snapshot allocates nothing on the heap.
+// The struct is shared between cores, it is only accessed under cluster_state_lock for the time of a copy.
+// Values are kept in Q.16 as decoded (canSignalDecodeFixed()) and printed with jsonWriterFixed(): no float is
+// involved from the frame to the JSON text.
+#pragma once
+#include "vehicle_signals.h"
+#include "json_writer.h"
+
+#define CLUSTER_STATE_PERIOD_MS 5000
+#define CLUSTER_STATE_JSON_SIZE 512
+
+// Bits of cluster_state_t.updated.
+#define CLUSTER_DISPLAY_UPDATED (1 << 0)  // 0x500 received.
+#define CLUSTER_WARNINGS_UPDATED (1 << 1) // 0x510 received.
+#define CLUSTER_ALL_UPDATED (CLUSTER_DISPLAY_UPDATED | CLUSTER_WARNINGS_UPDATED)
+
+typedef struct
+{
+    int64_t time_us;   // Time of the last update.
+    uint32_t sequence; // Incremented on every update.
+    uint8_t updated;   // CLUSTER_*_UPDATED since the last snapshot.
+    // 0x500 Cluster display, Q.16.
+    int64_t battery_state_bars;
+    int64_t vehicle_speed;
+    int64_t odometer;
+    int64_t state_of_charge;
+    int64_t remaining_charge_time;
+    // 0x510 Cluster warnings, Q.16.
+    int64_t brake_system_problem;
+    int64_t stop;
+    int64_t battery_temperature;
+    int64_t turtle_mode;
+    int64_t remaining_autonomy;
+} cluster_state_t;
+
+static cluster_state_t cluster_state;
+static portMUX_TYPE cluster_state_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/// @brief Update the cluster state from a decoded message (values indexed by vehicle_signal_id_t, as filled by
+/// decodeVehicleMessageFixed()). Messages that are not part of the cluster are ignored.
+void clusterStateUpdate(const can_message_def_t *message, const int64_t values[SIG_COUNT], int64_t time_us)
+{
+    portENTER_CRITICAL(&cluster_state_lock);
+    if (message->id == 0x500)
+    {
+        cluster_state.battery_state_bars = values[SIG_BATTERY_STATE_BARS];
+        cluster_state.vehicle_speed = values[SIG_VEHICLE_SPEED];
+        cluster_state.odometer = values[SIG_ODOMETER];
+        cluster_state.state_of_charge = values[SIG_STATE_OF_CHARGE];
+        cluster_state.remaining_charge_time = values[SIG_REMAINING_CHARGE_TIME];
+        cluster_state.updated |= CLUSTER_DISPLAY_UPDATED;
+    }
+    else if (message->id == 0x510)
+    {
+        cluster_state.brake_system_problem = values[SIG_BRAKE_SYSTEM_PROBLEM];
+        cluster_state.stop = values[SIG_STOP];
+        cluster_state.battery_temperature = values[SIG_BATTERY_TEMPERATURE];
+        cluster_state.turtle_mode = values[SIG_TURTLE_MODE];
+        cluster_state.remaining_autonomy = values[SIG_REMAINING_AUTONOMY];
+        cluster_state.updated |= CLUSTER_WARNINGS_UPDATED;
+    }
+    cluster_state.time_us = time_us;
+    cluster_state.sequence++;
+    portEXIT_CRITICAL(&cluster_state_lock);
+}
+
+/// @brief Copy the cluster state, and clear its updated bits.
+/// @return the updated bits of the copy.
+uint8_t clusterStateSnapshot(cluster_state_t *snapshot)
+{
+    portENTER_CRITICAL(&cluster_state_lock);
+    *snapshot = cluster_state;
+    cluster_state.updated = 0;
+    portEXIT_CRITICAL(&cluster_state_lock);
+    return snapshot->updated;
+}
+
+/// @brief Serialise a snapshot as JSON, with the keys the cluster print always used.
+/// @return the JSON text in buffer, NULL if the buffer is too small.
+const char *clusterStateToJson(const cluster_state_t *state, char *buffer, size_t size)
+{
+    json_writer_t writer;
+    jsonWriterInit(&writer, buffer, size);
+    jsonWriterBeginObject(&writer);
+    jsonWriterKey(&writer, vehicle_signal_names[SIG_BATTERY_STATE_BARS]);
+    jsonWriterFixed(&writer, state->battery_state_bars, 1);
+    jsonWriterKey(&writer, vehicle_signal_names[SIG_VEHICLE_SPEED]);
+    jsonWriterFixed(&writer, state->vehicle_speed, 1);
+    jsonWriterKey(&writer, vehicle_signal_names[SIG_ODOMETER]);
+    jsonWriterFixed(&writer, state->odometer, 1);
+    jsonWriterKey(&writer, vehicle_signal_names[SIG_STATE_OF_CHARGE]);
+    jsonWriterFixed(&writer, state->state_of_charge, 1);
+    jsonWriterKey(&writer, vehicle_signal_names[SIG_REMAINING_CHARGE_TIME]);
+    jsonWriterFixed(&writer, state->remaining_charge_time, 1);
+    jsonWriterKey(&writer, vehicle_signal_names[SIG_BRAKE_SYSTEM_PROBLEM]);
+    jsonWriterFixed(&writer, state->brake_system_problem, 1);
+    jsonWriterKey(&writer, vehicle_signal_names[SIG_STOP]);
+    jsonWriterFixed(&writer, state->stop, 1);
+    jsonWriterKey(&writer, vehicle_signal_names[SIG_BATTERY_TEMPERATURE]);
+    jsonWriterFixed(&writer, state->battery_temperature, 1);
+    jsonWriterKey(&writer, vehicle_signal_names[SIG_TURTLE_MODE]);
+    jsonWriterFixed(&writer, state->turtle_mode, 1);
+    jsonWriterKey(&writer, vehicle_signal_names[SIG_REMAINING_AUTONOMY]);
+    jsonWriterFixed(&writer, state->remaining_autonomy, 1);
+    jsonWriterEndObject(&writer);
+    return jsonWriterFinish(&writer);
+}
+
+/// @brief Task: print the cluster state every CLUSTER_STATE_PERIOD_MS, once both cluster messages have been seen.
+/// Serialisation happens here (core 1), away from the decoding task, into a static buffer.
+void publishClusterState(void *pvParameter)
+{
+    static char json[CLUSTER_STATE_JSON_SIZE];
+    cluster_state_t snapshot;
+    uint8_t updated = 0;
+
+    while (true)
+    {
+        vTaskDelay(CLUSTER_STATE_PERIOD_MS / portTICK_PERIOD_MS);
+        updated |= clusterStateSnapshot(&snapshot);
+        if ((updated & CLUSTER_ALL_UPDATED) != CLUSTER_ALL_UPDATED)
+            continue;
+        if (clusterStateToJson(&snapshot, json, sizeof(json)))
+            ESP_LOGI("CLUSTER_STATE_H", "%s", json);
+        updated = 0;
+    }
+    vTaskDelete(NULL);
+}
@@ -14,16 +14,35 @@
 #pragma once
 #include "mcp2515.h"
 #include "freertos/semphr.h"
+#include <strings.h>
+#include <ctype.h>
+#include "time_base.h"
+#include "trigger_button.h"
+#include "frame_loss.h"
+#include "log_naming.h"
+#include "latency_stats.h"
+#include "asc_format.h"
+#include "mf4_writer.h"
 
 static const uint8_t led_file = 33;
 static esp_err_t err_file; 
-static int count_file = 5000;
 
 static SemaphoreHandle_t file_mutex = NULL; 
 FILE* log_f = NULL;
-bool send_err_messages = false;
+bool send_err_messages = false; // A capture is in progress, see errorCaptureOpen().
+static int64_t err_capture_start_us = 0; // esp_timer_get_time() of the trigger of the capture in progress.
+static portMUX_TYPE err_capture_lock = portMUX_INITIALIZER_UNLOCKED;
 
-double log_start_time = 0.0f;
+// Local time (timeBaseNow()) the times of the LOG_FS files are relative to. Latched by startLogClock() before the
+// writers are created, the same for the logs of both buses.
+int64_t log_start_us = 0;
+
+// Stop of the writers (stopLogWriters()): each one drains its queue, closes its file the way it does at the end of a
+// log (ASC footer, finalised MF4) and ends.
+#define LOG_WRITER_COUNT 3     // writeDataToFile(), writeDataToFileMCP(), writeDataToErrorFiles().
+#define LOG_WRITER_POLL_MS 100 // Longest wait of a writer for a frame before it looks at log_writers_stopping.
+static volatile bool log_writers_stopping = false;
+static uint32_t log_writers_stopped = 0; // Writers that ended, for whatever reason.
 
 // const char* "FILE_HANDLE_H" = "FILE_HANDLDE_H";
 
@@ -32,7 +51,40 @@ static QueueHandle_t file_data_queue = NULL;
 static QueueHandle_t file_data_queue_mcp2515 = NULL;
 QueueHandle_t file_name_queue = NULL;
 
+// Ingest statistics (load tests): frames queued for the writers by each receiver, and the highest fill of the data
+// queues seen by the receivers since the last reset. Each is written by its receiver task only.
+static volatile uint32_t twai_frames_ingested = 0;
+static volatile uint32_t mcp2515_frames_ingested = 0;
+static volatile UBaseType_t file_data_queue_high_water = 0;
+static volatile UBaseType_t file_data_queue_mcp2515_high_water = 0;
+
+/// @brief Count a frame a receiver just queued, and note the fill of its queue.
+static inline void noteFrameIngested(QueueHandle_t queue, volatile uint32_t *ingested, volatile UBaseType_t *high_water)
+{
+    UBaseType_t waiting = uxQueueMessagesWaiting(queue);
+    (*ingested)++;
+    if (waiting > *high_water)
+        *high_water = waiting;
+}
+
+
 
+/// @brief Ask the writers to close their files once their queues are empty.
+void stopLogWriters()
+{
+    log_writers_stopping = true;
+}
+
+/// @brief Whether every writer closed its file and ended.
+static inline bool logWritersStopped()
+{
+    return __atomic_load_n(&log_writers_stopped, __ATOMIC_RELAXED) == LOG_WRITER_COUNT;
+}
+
+static inline void noteLogWriterStopped()
+{
+    __atomic_add_fetch(&log_writers_stopped, 1, __ATOMIC_RELAXED);
+}
 
 // Regular function: creating the queue for handling errors.
 
@@ -56,8 +108,8 @@ void createFileErrQueue()
 void createFileDataQueues()
 {
     // file_data_queue = xQueueCreate(64, sizeof(char));
-    file_data_queue = xQueueCreate(1000, sizeof(twai_message_t));
-    file_data_queue_mcp2515 = xQueueCreate(1000, sizeof(struct can_frame));
+    file_data_queue = xQueueCreate(1000, sizeof(timed_twai_message_t));
+    file_data_queue_mcp2515 = xQueueCreate(1000, sizeof(timed_can_frame_t));
     if (!(file_data_queue && file_data_queue_mcp2515))
     {
         err_file = ESP_FAIL;
@@ -140,48 +192,212 @@ void createDirectory(const char* file_name_)
 }
 
 
-/// @brief Regular function: Returning the name of the file to be ceated. Yeaaaaah another 10 line function to create the obvious, long live C. 
-/// This function is to be modified later, as the name of the file would strongly depend on the date of creation.
-/// For now it just appends an increasing number to the file. 
+// Files handed out by getFileName() that are still being written. Other tasks (the uploader) must leave them alone
+// until the writer releases them.
+#define MAX_OPEN_LOG_FILES 8
+#define ERR_CAPTURE_WINDOW_US (60 * 1000000LL) // Frames of both buses are captured this long after a trigger.
+#define ERR_CAPTURE_IDLE_US 1000000LL // Quiet time after the end of a capture window before its file is closed.
+#define ERR_MERGE_HOLD_US 20000LL // Time a frame alone in the capture queues waits for an older one of the other bus.
+static const char* open_log_files[MAX_OPEN_LOG_FILES];
+// Names handed out by getFileName(), open_log_files[i] points to log_file_names[i] while in use.
+static char log_file_names[MAX_OPEN_LOG_FILES][LOG_NAME_SIZE];
+static portMUX_TYPE open_log_files_lock = portMUX_INITIALIZER_UNLOCKED;
+// Files released so far: the uploader looks for new segments of the classes it let wait only when this moves.
+static uint32_t log_files_closed = 0;
+
+void registerOpenLogFile(const char* file_name)
+{
+    portENTER_CRITICAL(&open_log_files_lock);
+    for (size_t i = 0; i < MAX_OPEN_LOG_FILES; i++)
+    {
+        if (!open_log_files[i])
+        {
+            open_log_files[i] = file_name;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&open_log_files_lock);
+}
+
+void releaseOpenLogFile(const char* file_name)
+{
+    if (!file_name)
+        return; // getFileName() gave none.
+    portENTER_CRITICAL(&open_log_files_lock);
+    for (size_t i = 0; i < MAX_OPEN_LOG_FILES; i++)
+    {
+        if (open_log_files[i] == file_name)
+            open_log_files[i] = NULL;
+    }
+    log_files_closed++;
+    portEXIT_CRITICAL(&open_log_files_lock);
+}
+
+/// @brief Number of files released so far, moves every time a log file or segment is closed for good.
+static inline uint32_t logFilesClosed()
+{
+    return __atomic_load_n(&log_files_closed, __ATOMIC_RELAXED);
+}
+
+/// @brief Whether a file is still being written by one of the writing tasks.
+/// @param file_name full path (MOUNT_POINT included), compared without case as FAT does.
+bool isLogFileOpen(const char* file_name)
+{
+    bool is_open = false;
+    portENTER_CRITICAL(&open_log_files_lock);
+    for (size_t i = 0; i < MAX_OPEN_LOG_FILES && !is_open; i++)
+        is_open = open_log_files[i] && strcasecmp(open_log_files[i], file_name) == 0;
+    portEXIT_CRITICAL(&open_log_files_lock);
+    return is_open;
+}
+
+/// @brief Regular function: Returning the name of the file to be ceated, see log_naming.h for the layout.
 /// @param is_data, true -> create file inside LOG_FS: false -> create file inside ERR_FS.
-/// @return file name in dynamic memory.
+/// The file is registered as open (see isLogFileOpen()) until the writer calls releaseOpenLogFile(), which also frees
+/// the name.
+/// @return file name in static memory, NULL if MAX_OPEN_LOG_FILES files are already open.
 const char* getFileName(bool is_data)
 {
-    char int_str[32];
-        
-    char* file_name = malloc(64);
-    char* constant_name = is_data ? MOUNT_POINT"/LOG_FS/log_" : MOUNT_POINT"/ERR_FS/log_";
-    strcpy(file_name, constant_name);
-
-    sprintf(int_str, "%d", count_file++);
-    strcat(file_name, int_str);
-    strcat(file_name, ".asc");
-    return file_name;
+    char file_name[LOG_NAME_SIZE];
+    const char* slot = NULL;
+
+    buildLogFileName(is_data, file_name);
+    portENTER_CRITICAL(&open_log_files_lock);
+    for (size_t i = 0; i < MAX_OPEN_LOG_FILES && !slot; i++)
+    {
+        if (!open_log_files[i])
+        {
+            memcpy(log_file_names[i], file_name, sizeof(file_name));
+            slot = open_log_files[i] = log_file_names[i];
+        }
+    }
+    portEXIT_CRITICAL(&open_log_files_lock);
+    if (!slot)
+        ESP_LOGE("FILE_HANDLE_H", "Too many open log files for %s", file_name);
+    return slot;
 }
 
-/// @brief send error messages to error data queues for a specific duration (2 minutes)
-/// @param message TWAI (CAN) message to send
-/// @param send_err_messages a bool variable showing whether error messages should be sent or not.
-/// @param start_time starting time of sending error messages. 
-void sendErrorMessagesDuration(twai_message_t* message, bool* send_err_messages, int64_t* start_time)
+/// @brief Index following the highest segment <prefix>_<n>.* of a directory, so that segments of a previous run are
+/// kept.
+/// @param directory FAT path relative to the card root.
+unsigned long nextLogSegmentIndex(const char* directory, char prefix)
+{
+    FF_DIR dir;
+    FILINFO info;
+    unsigned long next_index = 0, index;
+
+    if (f_opendir(&dir, directory) != FR_OK)
+        return 0;
+    while (f_readdir(&dir, &info) == FR_OK && info.fname[0])
+    {
+        if (toupper((unsigned char)info.fname[0]) == toupper((unsigned char)prefix) && info.fname[1] == '_' &&
+            sscanf(info.fname + 2, "%lu", &index) == 1 && index >= next_index)
+            next_index = index + 1;
+    }
+    f_closedir(&dir);
+    return next_index;
+}
+
+/// @brief Close the current segment of a directory (if any) and open the next one, <prefix>_<index>.<extension>,
+/// registered as open (isLogFileOpen()) until it is closed.
+/// @param file_name buffer of LOG_NAME_SIZE bytes holding the name of the current segment, receives the new one.
+/// @return the new segment, NULL if it cannot be opened.
+FILE* openLogSegment(FILE* segment_f, const char* directory, char prefix, const char* extension, char* file_name,
+                     unsigned long* index)
+{
+    if (segment_f)
+    {
+        fclose(segment_f);
+        releaseOpenLogFile(file_name);
+    }
+    snprintf(file_name, LOG_NAME_SIZE, MOUNT_POINT"/%s/%c_%lu.%s", directory, prefix, (*index)++, extension);
+    registerOpenLogFile(file_name);
+    segment_f = fopen(file_name, "a");
+    if (!segment_f)
+    {
+        ESP_LOGE("FILE_HANDLE_H", "Failed to open %s", file_name);
+        releaseOpenLogFile(file_name);
+    }
+    return segment_f;
+}
+
+/// @brief Write the log line of a TWAI frame or error frame (channel 1).
+static void writeTwaiLine(FILE* file, const timed_twai_message_t* message, int64_t time_us)
+{
+    char line[ASC_LINE_MAX];
+    size_t length = message->error_frame
+                        ? formatAscErrorFrameLine(line, time_us, ASC_CHANNEL_TWAI)
+                        : formatAscFrameLine(line, time_us, ASC_CHANNEL_TWAI, message->frame.identifier,
+                                             message->frame.extd, message->frame.rtr,
+                                             message->frame.data_length_code, message->frame.data);
+    fwrite(line, 1, length, file);
+}
+
+/// @brief Write the log line of an MCP2515 frame or error frame (channel 2).
+static void writeMcp2515Line(FILE* file, const timed_can_frame_t* message, int64_t time_us)
+{
+    char line[ASC_LINE_MAX];
+    canid_t can_id = message->frame.can_id;
+    bool extended = can_id & CAN_EFF_FLAG;
+    size_t length = (can_id & CAN_ERR_FLAG)
+                        ? formatAscErrorFrameLine(line, time_us, ASC_CHANNEL_MCP2515)
+                        : formatAscFrameLine(line, time_us, ASC_CHANNEL_MCP2515,
+                                             can_id & (extended ? CAN_EFF_MASK : CAN_SFF_MASK), extended,
+                                             can_id & CAN_RTR_FLAG, message->frame.can_dlc, message->frame.data);
+    fwrite(line, 1, length, file);
+}
+
+/// @brief Latch the start of the LOG_FS logs: called once before the writers of both buses are created.
+void startLogClock()
 {
-    // int64_t start_time = esp_timer_get_time();
-    int64_t end_time = esp_timer_get_time();
-    int64_t time_difference = end_time - *start_time;
-    int64_t duration = 1 * 60 * 1e6;
-    if(time_difference < duration)
-        xQueueSend(trigger_err_data_queue, (void*) message, 0);
-    else
-        *send_err_messages = false;
+    log_start_us = timeBaseNow();
 }
 
-/// @brief Alternative version for messages sent from MCP2515 Controller. send error messages to error data queues for a specific duration (2 minutes)
+/// @brief Start a capture if the trigger button was pressed since the last look. Both writers look, so that a capture
+/// starts with a frame of either bus.
+static void takeErrorCaptureTrigger()
+{
+    int listen_message;
+    if (xQueueReceive(trigger_listen_queue, (void*) &listen_message, 0) == pdTRUE)
+    {
+        portENTER_CRITICAL(&err_capture_lock);
+        err_capture_start_us = esp_timer_get_time();
+        send_err_messages = true;
+        portEXIT_CRITICAL(&err_capture_lock);
+    }
+}
+
+/// @brief Whether the capture window is open. The capture ends ERR_CAPTURE_WINDOW_US after its trigger, for whichever
+/// of the writers and writeDataToErrorFiles() looks first: a silent bus does not keep it open.
+static bool errorCaptureOpen()
+{
+    portENTER_CRITICAL(&err_capture_lock);
+    if (send_err_messages && esp_timer_get_time() - err_capture_start_us >= ERR_CAPTURE_WINDOW_US)
+        send_err_messages = false;
+    bool open = send_err_messages;
+    portEXIT_CRITICAL(&err_capture_lock);
+    return open;
+}
+
+/// @brief send error messages to error data queues while the capture window is open (1 minute)
 /// @param message TWAI (CAN) message to send
-/// @param send_err_messages a bool variable showing whether error messages should be sent or not.
-/// @param start_time starting time of sending error messages. 
-void sendErrorMessagesDurationMCP(struct can_frame* message)
+void sendErrorMessagesDuration(timed_twai_message_t* message)
 {
-        xQueueSend(trigger_err_data_queue_mcp2515, (void*) message, portMAX_DELAY);
+    if (!errorCaptureOpen())
+        return;
+    if (xQueueSend(trigger_err_data_queue, (void*) message, 0) != pdPASS)
+        countFrameLoss(FRAME_LOSS_TWAI_ERR_QUEUE_FULL, 1);
+}
+
+/// @brief Alternative version for messages sent from MCP2515 Controller. send error messages to error data queues while the capture window is open (1 minute)
+/// @param message MCP2515 (CAN) message to send
+void sendErrorMessagesDurationMCP(timed_can_frame_t* message)
+{
+    if (!errorCaptureOpen())
+        return;
+    // Not waiting: the writer of the MCP2515 log must not stall behind the error file.
+    if (xQueueSend(trigger_err_data_queue_mcp2515, (void*) message, 0) != pdPASS)
+        countFrameLoss(FRAME_LOSS_MCP2515_ERR_QUEUE_FULL, 1);
 }
 
 /// @brief Task: Create a file in sd-card, and write buffers that comes into the queue.
@@ -205,61 +421,114 @@ void sendErrorMessagesDurationMCP(struct can_frame* message)
 void writeDataToFileMCP(void* pvParameter)
 {
     vTaskDelay(100);
-    char* file_name = getFileName(true);
+    const char* file_name = getFileName(true);
     FILE* log_ff = NULL;
     int number_of_lines = 0;
+    int64_t batch_rx_us = 0; // Reception of the first line since the file was last reopened.
+    TickType_t idle_ticks = 0;
+#ifdef CONFIG_DATAFLY_LOG_FORMAT_MF4
+    mf4_log_t mf4_log = {0};
+#else
+    uint32_t time_base_version = 0;
+    frame_loss_cursor_t loss_cursor = {0};
+#endif
     // if (xQueueReceive(file_name_queue, &file_name, portMAX_DELAY))
     // {
     //     // Process the received string
     //     printf("Received string: %s\n", file_name);
     // }
     // bool send_err_messages = false;
-    if(!log_ff)
+    if(!log_ff && file_name)
     {
         log_ff = fopen(file_name, "w");
     }
     if (!log_ff)
     {
-        ESP_LOGE("FILE_HANDLE_H", "Failed to open file %s for writing", file_name);
+        // No name (too many open files, see getFileName()) or no file: the frames are counted as write failures.
+        ESP_LOGE("FILE_HANDLE_H", "Failed to open file %s for writing", file_name ? file_name : "(no name)");
     } else {
         ESP_LOGI("FILE_HANDLE_H", "Received File %s created succesfully", file_name);
+#ifdef CONFIG_DATAFLY_LOG_FORMAT_MF4
+        writeMf4Header(log_ff, file_name, &mf4_log, log_start_us, ASC_CHANNEL_MCP2515);
+#else
+        writeAscHeader(log_ff, log_start_us);
+        time_base_version = writeTimeBaseComment(log_ff, log_start_us);
+#endif
     }
     while (true)
     {
-        struct can_frame mcp_message;
-        int64_t start_err_msg_time;
+        timed_can_frame_t mcp_message;
         // ------------- TWAI Controller message reception ------------- //
 
         // --------------- MCP2515 Controller message reception ------------- //
         // Just a duplication of the previous function with some cheap cheat :).
         // I think it's a better idea to make the second CAN message handler in a separate task.
         // But I don't think it would improve speed :(. (IDK it may be at the level of fprintf).
-        if (xQueueReceive(file_data_queue_mcp2515, &mcp_message, 10000) != pdPASS)
+        if (log_writers_stopping && uxQueueMessagesWaiting(file_data_queue_mcp2515) == 0)
+            break;
+        if (xQueueReceive(file_data_queue_mcp2515, &mcp_message, pdMS_TO_TICKS(LOG_WRITER_POLL_MS)) != pdPASS)
         {
+            idle_ticks += pdMS_TO_TICKS(LOG_WRITER_POLL_MS);
+            if (idle_ticks < 10000)
+                continue;
             ESP_LOGE("FILE_HANDLE_H", "Error receiving data from the MCP queue");
             vTaskDelay(100);
             break;
-        } else if (log_ff){
+        }
+        idle_ticks = 0;
+        if (log_ff){
+            int64_t dequeued_us = LATENCY_NOW();
+            LATENCY_RECORD(LATENCY_MCP2515, LATENCY_QUEUE, dequeued_us - mcp_message.rx_time_us);
+            if (number_of_lines == 0)
+                batch_rx_us = mcp_message.rx_time_us;
             xSemaphoreTake(file_mutex, portMAX_DELAY);
-            fprintf(log_ff, " %f 2        %03lX             Tx   d %d", (double) (esp_timer_get_time()*1e-6) - log_start_time, 
-            mcp_message.can_id, mcp_message.can_dlc);
-            for (int i = 0; i < mcp_message.can_dlc; i++) 
-                fprintf(log_ff, " %02X", mcp_message.data[i]);
-            fprintf(log_ff, "\n");
+#ifdef CONFIG_DATAFLY_LOG_FORMAT_MF4
+            writeMf4Mcp2515Record(log_ff, &mf4_log, &mcp_message, mcp_message.rx_time_us - log_start_us);
+#else
+            if (timeBaseVersion() != time_base_version)
+                time_base_version = writeTimeBaseComment(log_ff, log_start_us);
+            if (!(mcp_message.frame.can_id & CAN_ERR_FLAG))
+                checkFrameLoss(log_ff, &loss_cursor, mcp_message.sequence, mcp_message.rx_time_us);
+            writeMcp2515Line(log_ff, &mcp_message, mcp_message.rx_time_us - log_start_us);
+#endif
+            checkFrameWritten(log_ff, FRAME_LOSS_MCP2515_WRITE_FAILED);
             xSemaphoreGive(file_mutex);
+            LATENCY_RECORD(LATENCY_MCP2515, LATENCY_ENCODE, LATENCY_NOW() - dequeued_us);
+            takeErrorCaptureTrigger();
             if(send_err_messages)
                 sendErrorMessagesDurationMCP(&mcp_message);
 
             if(number_of_lines++ == 1000) //A condition to save the file. If not closed, all modification would lost.
             {
+                int64_t flush_us = LATENCY_NOW();
+#ifdef CONFIG_DATAFLY_LOG_FORMAT_MF4
+                log_ff = checkpointMf4Log(log_ff, file_name, &mf4_log);
+#else
                 fclose(log_ff);
-                ESP_LOGI("FILE_HANDLE_H", "MCP Log file Closed");
                 log_ff = fopen(file_name, "a");
+#endif
+                ESP_LOGI("FILE_HANDLE_H", "MCP Log file Closed");
                 number_of_lines = 0;
+                int64_t flushed_us = LATENCY_NOW();
+                LATENCY_RECORD(LATENCY_MCP2515, LATENCY_FLUSH, flushed_us - flush_us);
+                LATENCY_RECORD(LATENCY_MCP2515, LATENCY_END_TO_END, flushed_us - batch_rx_us);
             }   
+        } else {
+            countFrameLoss(FRAME_LOSS_MCP2515_WRITE_FAILED, 1); // No file to write to.
         }
         taskYIELD();
     }
+#ifdef CONFIG_DATAFLY_LOG_FORMAT_MF4
+    finalizeMf4Log(log_ff, file_name, &mf4_log);
+#else
+    if (log_ff)
+    {
+        writeAscFooter(log_ff);
+        fclose(log_ff);
+    }
+#endif
+    releaseOpenLogFile(file_name);
+    noteLogWriterStopped();
     vTaskDelete(NULL);
 }
 
@@ -270,55 +539,85 @@ void writeDataToFile(void* pvParameter)
     // vTaskDelay(100);
     const char* file_name = getFileName(true);
     int number_of_lines = 0;
+    int64_t batch_rx_us = 0; // Reception of the first line since the file was last reopened.
+#ifdef CONFIG_DATAFLY_LOG_FORMAT_MF4
+    mf4_log_t mf4_log = {0};
+#else
+    uint32_t time_base_version = 0;
+    frame_loss_cursor_t loss_cursor = {0};
+#endif
     // bool send_err_messages = false;
     file_mutex = xSemaphoreCreateMutex();
-    if(!log_f)
+    if(!log_f && file_name)
     {
         log_f = fopen(file_name, "w");
     }
     if (!log_f)
     {
-        ESP_LOGE("FILE_HANDLE_H", "Failed to open file %s for writing", file_name);
+        // No name (too many open files, see getFileName()) or no file: the frames are counted as write failures.
+        ESP_LOGE("FILE_HANDLE_H", "Failed to open file %s for writing", file_name ? file_name : "(no name)");
     } else {
         ESP_LOGI("FILE_HANDLE_H", "File %s created succesfully", file_name);
         xQueueSend(file_name_queue, &file_name, portMAX_DELAY);
     }
-    log_start_time = (double) esp_timer_get_time()*1e-6;
+    if (log_f)
+    {
+#ifdef CONFIG_DATAFLY_LOG_FORMAT_MF4
+        writeMf4Header(log_f, file_name, &mf4_log, log_start_us, ASC_CHANNEL_TWAI);
+#else
+        writeAscHeader(log_f, log_start_us);
+        time_base_version = writeTimeBaseComment(log_f, log_start_us);
+#endif
+    }
     while (true)
     {
-        twai_message_t message;
-        int listen_message;
-        int64_t start_err_msg_time;
-        if (xQueueReceive(file_data_queue, &message, portMAX_DELAY) != pdPASS)
+        timed_twai_message_t message;
+        if (log_writers_stopping && uxQueueMessagesWaiting(file_data_queue) == 0)
+            break;
+        if (xQueueReceive(file_data_queue, &message, pdMS_TO_TICKS(LOG_WRITER_POLL_MS)) != pdPASS)
         {
             // xQueueSend(file_err_queue, (void*) &err_file, portMAX_DELAY);
-            ESP_LOGE("FILE_HANDLE_H", "Error receiving data from the queue");
-            break;
+            continue; // Nothing for a while: look for a stop.
+        } else if (!log_f) {
+            countFrameLoss(FRAME_LOSS_TWAI_WRITE_FAILED, 1); // No file to write to.
         } else {
-            char data_or_request = message.rtr ? 'r' : 'd';
+            int64_t dequeued_us = LATENCY_NOW();
+            LATENCY_RECORD(LATENCY_TWAI, LATENCY_QUEUE, dequeued_us - message.rx_time_us);
+            if (number_of_lines == 0)
+                batch_rx_us = message.rx_time_us;
             xSemaphoreTake(file_mutex, portMAX_DELAY);
-            fprintf(log_f, " %f 1        %03lX             Tx   %c %d", (double) esp_timer_get_time()*1e-6 - log_start_time, 
-            message.identifier, data_or_request, message.data_length_code);
-            for (int i = 0; i < message.data_length_code; i++) 
-                fprintf(log_f, " %02X", message.data[i]);
-            fprintf(log_f, "\n");
+#ifdef CONFIG_DATAFLY_LOG_FORMAT_MF4
+            writeMf4TwaiRecord(log_f, &mf4_log, &message, message.rx_time_us - log_start_us);
+#else
+            if (timeBaseVersion() != time_base_version)
+                time_base_version = writeTimeBaseComment(log_f, log_start_us);
+            if (!message.error_frame)
+                checkFrameLoss(log_f, &loss_cursor, message.sequence, message.rx_time_us);
+            writeTwaiLine(log_f, &message, message.rx_time_us - log_start_us);
+#endif
+            checkFrameWritten(log_f, FRAME_LOSS_TWAI_WRITE_FAILED);
             xSemaphoreGive(file_mutex);  
+            LATENCY_RECORD(LATENCY_TWAI, LATENCY_ENCODE, LATENCY_NOW() - dequeued_us);
 
             if(number_of_lines++ == 1000) //A condition to save the file. If not closed, all modification would lost.
             {
+                int64_t flush_us = LATENCY_NOW();
+#ifdef CONFIG_DATAFLY_LOG_FORMAT_MF4
+                log_f = checkpointMf4Log(log_f, file_name, &mf4_log);
+#else
                 fclose(log_f);
-                ESP_LOGI("FILE_HANDLE_H", "Log file Closed");
                 log_f = fopen(file_name, "a");
+#endif
+                ESP_LOGI("FILE_HANDLE_H", "Log file Closed");
                 number_of_lines = 0;
+                int64_t flushed_us = LATENCY_NOW();
+                LATENCY_RECORD(LATENCY_TWAI, LATENCY_FLUSH, flushed_us - flush_us);
+                LATENCY_RECORD(LATENCY_TWAI, LATENCY_END_TO_END, flushed_us - batch_rx_us);
             }          
             // --------------- Check for errors -----------------//
-            if(xQueueReceive(trigger_listen_queue, (void*) &listen_message, 0) == pdTRUE)
-            {
-                send_err_messages = true;
-                start_err_msg_time = esp_timer_get_time();
-            }
+            takeErrorCaptureTrigger();
             if(send_err_messages)
-                sendErrorMessagesDuration(&message, &send_err_messages, &start_err_msg_time);   
+                sendErrorMessagesDuration(&message);
         }
 
         //  if (xQueueReceive(file_data_queue_mcp2515, &mcp_message, 1000) != pdPASS)
@@ -336,50 +635,141 @@ void writeDataToFile(void* pvParameter)
         // }
         vTaskDelay(0);
     }
-    fclose(log_f);
+#ifdef CONFIG_DATAFLY_LOG_FORMAT_MF4
+    finalizeMf4Log(log_f, file_name, &mf4_log);
+#else
+    if (log_f)
+    {
+        writeAscFooter(log_f);
+        fclose(log_f);
+    }
+#endif
+    releaseOpenLogFile(file_name);
+    noteLogWriterStopped();
     vTaskDelete(NULL);
 }
 
-void writeDataToErrorFiles(void* pvParameter)
+/// @brief Open the file of a new ERR_FS capture, registered as open until closeErrorCapture().
+/// @param file_name receives the name, NULL if no file could be opened.
+static FILE* openErrorCapture(const char** file_name, uint32_t* time_base_version)
 {
-    int number_of_lines = 0;
-    const char* file_name = getFileName(false);
-    twai_message_t message;
-    struct can_frame mcp_message;
-    FILE *err_f = fopen(file_name, "w");
-    if(!err_f)
+    *file_name = getFileName(false);
+    if (!*file_name)
+        return NULL;
+    FILE* err_f = fopen(*file_name, "w");
+    if (!err_f)
     {
-        ESP_LOGE("FILE_HANDLE_H", "Error creating %s error file", file_name);
-        vTaskDelete(NULL);
+        ESP_LOGE("FILE_HANDLE_H", "Error creating %s error file", *file_name);
+        releaseOpenLogFile(*file_name);
+        *file_name = NULL;
+        return NULL;
     }
+    ESP_LOGI("FILE_HANDLE_H", "Error file %s created", *file_name);
+    // Error files keep times since boot.
+    writeAscHeader(err_f, 0);
+    *time_base_version = writeTimeBaseComment(err_f, 0);
+    return err_f;
+}
+
+/// @brief Close the file of an ERR_FS capture for good: it can be uploaded from now on.
+static void closeErrorCapture(FILE* err_f, const char* file_name)
+{
+    writeAscFooter(err_f);
+    fclose(err_f);
+    releaseOpenLogFile(file_name);
+    ESP_LOGI("FILE_HANDLE_H", "Error file %s closed", file_name);
+}
+
+/// @brief Task: write every capture (the frames of both buses from a trigger to the end of its window, see
+/// errorCaptureOpen()) to a file of its own under ERR_FS, the two buses merged in reception order. The file
+/// is created with the first frame of the capture and closed ERR_CAPTURE_IDLE_US after the window ended and the queues
+/// ran dry, so that it can be uploaded.
+void writeDataToErrorFiles(void* pvParameter)
+{
+    int number_of_lines = 0;
+    const char* file_name = NULL;
+    FILE *err_f = NULL;
+    bool open_failed = false; // Not retried before the next capture.
+    int64_t last_frame_us = 0;
+    uint32_t time_base_version = 0;
+    timed_twai_message_t message;
+    timed_can_frame_t mcp_message;
+    // Captures are windows of the buses: sequences are not contiguous, only the counters are recorded.
+    frame_loss_cursor_t loss_cursor = {0};
     while (true)
     {
-        if(xQueueReceive(trigger_err_data_queue, &message, 0) == pdPASS)
+        // Both buses in time order: of the two frames at the head of the queues, the older one is written, the other
+        // one stays queued for the next round. A frame alone waits ERR_MERGE_HOLD_US for the receiver of the other
+        // bus, which may not have queued an older frame yet.
+        bool has_message = xQueuePeek(trigger_err_data_queue, &message, 0) == pdPASS;
+        bool has_mcp_message = xQueuePeek(trigger_err_data_queue_mcp2515, &mcp_message, 0) == pdPASS;
+        if (has_message && has_mcp_message)
+        {
+            has_message = message.rx_time_us <= mcp_message.rx_time_us;
+            has_mcp_message = !has_message;
+        }
+        else if ((has_message || has_mcp_message) && !log_writers_stopping &&
+                 timeBaseNow() - (has_message ? message.rx_time_us : mcp_message.rx_time_us) < ERR_MERGE_HOLD_US)
+        {
+            has_message = has_mcp_message = false;
+        }
+        if (has_message)
+            xQueueReceive(trigger_err_data_queue, &message, 0);
+        if (has_mcp_message)
+            xQueueReceive(trigger_err_data_queue_mcp2515, &mcp_message, 0);
+        int64_t now = esp_timer_get_time();
+        if (log_writers_stopping && !has_message && !has_mcp_message)
+            break;
+        if (has_message || has_mcp_message)
+        {
+            last_frame_us = now;
+            if (!err_f && !open_failed)
+            {
+                err_f = openErrorCapture(&file_name, &time_base_version);
+                open_failed = !err_f;
+                number_of_lines = 0;
+            }
+            if (!err_f)
+                countFrameLoss(FRAME_LOSS_ERR_WRITE_FAILED, has_message + has_mcp_message);
+        }
+        else if (!errorCaptureOpen() && now - last_frame_us >= ERR_CAPTURE_IDLE_US)
         {
-            char data_or_request = message.rtr ? 'r' : 'd';
-            fprintf(err_f, " %f 1        %03lX             Tx   %c %d", (double) esp_timer_get_time()*1e-6, 
-            message.identifier, data_or_request, message.data_length_code);
-            for (int i = 0; i < message.data_length_code; i++) 
-                fprintf(err_f, " %02X", message.data[i]);
-            fprintf(err_f, "\n");
+            if (err_f)
+            {
+                closeErrorCapture(err_f, file_name);
+                err_f = NULL;
+            }
+            open_failed = false;
+        }
+
+        if ((has_message || has_mcp_message) && err_f)
+        {
+            int64_t rx_time_us = has_message ? message.rx_time_us : mcp_message.rx_time_us;
+            if (timeBaseVersion() != time_base_version)
+                time_base_version = writeTimeBaseComment(err_f, 0);
+            checkFrameLossTotals(err_f, &loss_cursor, rx_time_us);
+            if (has_message)
+                writeTwaiLine(err_f, &message, rx_time_us);
+            else
+                writeMcp2515Line(err_f, &mcp_message, rx_time_us);
+            checkFrameWritten(err_f, FRAME_LOSS_ERR_WRITE_FAILED);
             if(number_of_lines++ == 1000) //A condition to save the file. If not closed, all modification would lost.
             {
                 fclose(err_f);
                 ESP_LOGI("FILE_HANDLE_H", "Error file Closed");
                 err_f = fopen(file_name, "a");
                 number_of_lines = 0;
+                if (!err_f)
+                {
+                    releaseOpenLogFile(file_name);
+                    open_failed = true;
+                }
             }
-        } 
-        if (xQueueReceive(trigger_err_data_queue_mcp2515, &mcp_message, 0) == pdPASS)
-        {
-            fprintf(err_f, " %f 2        %03lX             Tx   d %d", (double) esp_timer_get_time()*1e-6, 
-            mcp_message.can_id, mcp_message.can_dlc);
-            for (int i = 0; i < mcp_message.can_dlc; i++) 
-                fprintf(err_f, " %02X", mcp_message.data[i]);
-            fprintf(err_f, "\n");
         }
         taskYIELD();
     }
-    fclose(err_f);
+    if (err_f)
+        closeErrorCapture(err_f, file_name);
+    noteLogWriterStopped();
     vTaskDelete(NULL);
 }
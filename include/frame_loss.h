@@ -0,0 +1,142 @@
+// Frame loss accounting: every place a received frame can be dropped has its counter (stages are disjoint, a frame is
+// counted once), and frames carry a per bus sequence number stamped at reception.
+// - hardware: TWAI driver queue (rx_missed_count) and controller FIFO (rx_overrun_count), polled from the driver;
+//   MCP2515 RX0OVR/RX1OVR, polled and cleared by the receiver (the chip has no counter: at least one frame per flag).
+// - data queues: the receivers never block, a frame finding the queue full is dropped and counted, so that a stalled
+//   writer no longer turns into silent hardware overruns. Same for the trigger queues of the error files.
+// - writes: lines the file system refused.
+// - sorted MF4 logs (CONFIG_DATAFLY_MF4_SORTED): remote and error frames, which their data group cannot hold.
+// The writers compare the sequence of each frame with the one they expect, and write a comment line where frames are
+// missing, and when counters moved (at most once a second), so that each log records where and how many frames were
+// lost:
+//   // frames lost: 12 before this line (sequences 4051 to 4062), totals: twai_rx_missed=0 ... err_write_failed=0
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+
+#define FRAME_LOSS_POLL_US 100000     // Period of the hardware counters polls.
+#define FRAME_LOSS_COMMENT_US 1000000 // Shortest time between two comments of a log when only counters moved.
+
+typedef enum
+{
+    FRAME_LOSS_TWAI_RX_MISSED,
+    FRAME_LOSS_TWAI_RX_OVERRUN,
+    FRAME_LOSS_MCP2515_RX_OVERRUN,
+    FRAME_LOSS_TWAI_QUEUE_FULL,
+    FRAME_LOSS_MCP2515_QUEUE_FULL,
+    FRAME_LOSS_TWAI_ERR_QUEUE_FULL,
+    FRAME_LOSS_MCP2515_ERR_QUEUE_FULL,
+    FRAME_LOSS_TWAI_WRITE_FAILED,
+    FRAME_LOSS_MCP2515_WRITE_FAILED,
+    FRAME_LOSS_ERR_WRITE_FAILED,
+    FRAME_LOSS_MF4_NOT_LOGGED,
+    FRAME_LOSS_STAGE_COUNT
+} frame_loss_stage_t;
+
+static const char *const frame_loss_stage_names[FRAME_LOSS_STAGE_COUNT] = {
+    "twai_rx_missed",
+    "twai_rx_overrun",
+    "mcp2515_rx_overrun",
+    "twai_queue_full",
+    "mcp2515_queue_full",
+    "twai_err_queue_full",
+    "mcp2515_err_queue_full",
+    "twai_write_failed",
+    "mcp2515_write_failed",
+    "err_write_failed",
+    "mf4_not_logged",
+};
+
+static uint32_t frame_losses[FRAME_LOSS_STAGE_COUNT];
+static uint32_t frame_loss_version = 0; // Incremented every time frames are counted as lost.
+
+// Time the receivers wait for room in the data queues. 0 on the buses: a blocked receiver only moves the loss into the
+// controller. Host throughput runs, where the logger sets the pace, wait (host_simulation.h).
+static TickType_t ingest_queue_wait = 0;
+
+// Sequence numbers of the frames received on each bus, stamped by the task ingesting them.
+static uint32_t twai_rx_sequence = 0;
+static uint32_t mcp2515_rx_sequence = 0;
+
+static inline void countFrameLoss(frame_loss_stage_t stage, uint32_t frames)
+{
+    if (!frames)
+        return;
+    __atomic_add_fetch(&frame_losses[stage], frames, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&frame_loss_version, 1, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t frameLossVersion()
+{
+    return __atomic_load_n(&frame_loss_version, __ATOMIC_RELAXED);
+}
+
+void getFrameLosses(uint32_t losses[FRAME_LOSS_STAGE_COUNT])
+{
+    for (int i = 0; i < FRAME_LOSS_STAGE_COUNT; i++)
+        losses[i] = __atomic_load_n(&frame_losses[i], __ATOMIC_RELAXED);
+}
+
+/// @brief Write the loss counters as a log comment line.
+/// @param missing frames missing right before the next line (sequence gap seen by the writer), 0 if none.
+/// @param first_missing sequence of the first of them.
+/// @return version of the counters written.
+uint32_t writeFrameLossComment(FILE *file, uint32_t missing, uint32_t first_missing)
+{
+    uint32_t version = frameLossVersion();
+    uint32_t losses[FRAME_LOSS_STAGE_COUNT];
+    getFrameLosses(losses);
+
+    fprintf(file, "// frames lost:");
+    if (missing)
+        fprintf(file, " %lu before this line (sequences %lu to %lu),", (unsigned long)missing,
+                (unsigned long)first_missing, (unsigned long)(first_missing + missing - 1));
+    fprintf(file, " totals:");
+    for (int i = 0; i < FRAME_LOSS_STAGE_COUNT; i++)
+        fprintf(file, " %s=%lu", frame_loss_stage_names[i], (unsigned long)losses[i]);
+    fprintf(file, "\n");
+    return version;
+}
+
+// What a writer last recorded.
+typedef struct
+{
+    uint32_t next_sequence; // Sequence of the next frame expected.
+    uint32_t version;       // Version of the counters last written.
+    int64_t written_us;     // Frame time of the last comment.
+} frame_loss_cursor_t;
+
+/// @brief Write the loss comment if the counters moved, at most every FRAME_LOSS_COMMENT_US of frame time.
+static inline void checkFrameLossTotals(FILE *file, frame_loss_cursor_t *cursor, int64_t time_us)
+{
+    if (frameLossVersion() != cursor->version && time_us - cursor->written_us >= FRAME_LOSS_COMMENT_US)
+    {
+        cursor->version = writeFrameLossComment(file, 0, 0);
+        cursor->written_us = time_us;
+    }
+}
+
+/// @brief Check the sequence of a frame about to be written: frames missing are recorded right away, in the line
+/// above it; otherwise the counters are recorded if they moved (checkFrameLossTotals).
+static inline void checkFrameLoss(FILE *file, frame_loss_cursor_t *cursor, uint32_t sequence, int64_t time_us)
+{
+    uint32_t missing = sequence - cursor->next_sequence;
+    if (missing)
+    {
+        cursor->version = writeFrameLossComment(file, missing, cursor->next_sequence);
+        cursor->written_us = time_us;
+    }
+    else
+        checkFrameLossTotals(file, cursor, time_us);
+    cursor->next_sequence = sequence + 1;
+}
+
+/// @brief Count a line that could not be written (the error flag of the file is cleared).
+static inline void checkFrameWritten(FILE *file, frame_loss_stage_t stage)
+{
+    if (ferror(file))
+    {
+        countFrameLoss(stage, 1);
+        clearerr(file);
+    }
+}
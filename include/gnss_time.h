@@ -0,0 +1,101 @@
+// GNSS time source of the time base (time_base.h), through the GNSS receiver of the SIM7080G (sim7080g.h).
+// AT+CGNSINF reports the UTC time of the last fix, which changes once per second. Every GNSS_TIME_PERIOD_MS the time
+// is polled in a burst, GNSS_TIME_POLL_MS apart: when the reported time changes between two polls, the fix came out
+// between them and the midpoint of their local times is paired with the new UTC time.
+// Such a pair is accurate to about half the poll period plus the output latency of the receiver (constant, so it does
+// not affect the drift). Microsecond pairs need a PPS output wired to a GPIO interrupt, which timeBaseDiscipline()
+// takes as well.
+#pragma once
+#include "sim7080g.h"
+#include "time_base.h"
+
+#define GNSS_TIME_PERIOD_MS 60000
+#define GNSS_TIME_POLL_MS 50
+#define GNSS_TIME_MAX_POLLS 40 // Enough for the reported second to change at least once.
+
+typedef struct
+{
+    TaskHandle_t task;
+    bool valid;
+    int64_t utc_us;
+    int64_t local_us; // When the response was parsed.
+} gnss_time_poll_t;
+
+/// @brief Days since 1970-01-01 of a date of the proleptic Gregorian calendar.
+static int64_t daysFromCivil(int year, unsigned month, unsigned day)
+{
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    unsigned year_of_era = year - era * 400;
+    unsigned day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    unsigned day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+/// @brief Parse the UTC time of a "+CGNSINF: <run>,<fix>,<yyyyMMddhhmmss.sss>,..." line.
+/// @return false if the receiver has no fix.
+bool parseGnssUtc(const char *line, int64_t *utc_us)
+{
+    int run, fix;
+    unsigned year, month, day, hour, minute, second, millisecond;
+    if (sscanf(line, "+CGNSINF: %d,%d,%4u%2u%2u%2u%2u%2u.%3u", &run, &fix, &year, &month, &day, &hour, &minute,
+               &second, &millisecond) != 9 || !fix)
+        return false;
+    if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60)
+        return false;
+    *utc_us = ((daysFromCivil(year, month, day) * 24 + hour) * 60 + minute) * 60 * 1000000LL +
+              second * 1000000LL + millisecond * 1000LL;
+    return true;
+}
+
+static void onGnssLine(const char *line, void *context)
+{
+    gnss_time_poll_t *poll = context;
+    poll->local_us = timeBaseNow();
+    poll->valid = parseGnssUtc(line, &poll->utc_us);
+}
+
+static void onGnssDone(modem_result_t result, const char *final_line, void *context)
+{
+    gnss_time_poll_t *poll = context;
+    xTaskNotifyGive(poll->task);
+}
+
+/// @brief Task: discipline the time base with the GNSS time every GNSS_TIME_PERIOD_MS. Needs runModem().
+void disciplineTimeFromGnss(void *pvParameter)
+{
+    gnss_time_poll_t poll = {.task = xTaskGetCurrentTaskHandle()};
+
+    modemSendCommand("AT+CGNSPWR=1", 0, NULL, NULL, NULL);
+    while (true)
+    {
+        bool has_previous = false;
+        int64_t previous_utc_us = 0, previous_local_us = 0;
+
+        for (int i = 0; i < GNSS_TIME_MAX_POLLS; i++)
+        {
+            poll.valid = false;
+            if (!modemSendCommand("AT+CGNSINF", 1000, onGnssLine, onGnssDone, &poll))
+                break;
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(2000));
+            if (!poll.valid)
+            {
+                has_previous = false;
+            }
+            else if (has_previous && poll.utc_us != previous_utc_us)
+            {
+                timeBaseDiscipline(previous_local_us + (poll.local_us - previous_local_us) / 2, poll.utc_us);
+                break;
+            }
+            else
+            {
+                has_previous = true;
+                previous_utc_us = poll.utc_us;
+                previous_local_us = poll.local_us;
+            }
+            vTaskDelay(pdMS_TO_TICKS(GNSS_TIME_POLL_MS));
+        }
+        vTaskDelay(GNSS_TIME_PERIOD_MS / portTICK_PERIOD_MS);
+    }
+    vTaskDelete(NULL);
+}
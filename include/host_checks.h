@@ -0,0 +1,1399 @@
+// Host checks (CONFIG_DATAFLY_HOST_CHECKS, linux target): the kernels of the logger checked against their reference
+// implementations. runHostChecks() is called at the start of app_main instead of the simulation, runs every check of
+// host_checks, then exits the process with status 1 if one of them failed, so that running the ELF is the test:
+//   idf.py -B build_host -D SDKCONFIG=build_host/sdkconfig menuconfig   (Host simulation > Run the host checks)
+//   idf.py -B build_host -D SDKCONFIG=build_host/sdkconfig build && ./build_host/Data-Fly.elf
+// pytest_host_checks.py does the same with sdkconfig.ci.host_checks.
+// A check logs every case that differs (up to HOST_CHECK_MAX_REPORTS) and returns the number of cases that differ:
+// - signal_kernels: canSignalExtract() and canSignalDecode() against extractSignal() and decode(), for every layout
+//   that fits in 8 bytes (every start bit and length, Intel and Motorola, signed and unsigned) over a set of payloads
+//   (zeros, ones, alternating bits, walking bits, random).
+// - fixed_decode: canSignalDecodeFixed() against canSignalDecode(), within one LSB of the signal (its factor) plus
+//   the rounding of the float path, for the signals of vehicle_signals and for lengths up to 32 bits with exact and
+//   inexact factors, signed and unsigned, and offsets; extractIQFixed() against extractIQ(), Intel and Motorola,
+//   within one Q.16 LSB.
+// - vehicle_lookup: findVehicleMessage() against a scan of vehicle_messages, for every 11-bit identifier and the
+//   29-bit identifiers next to the known ones.
+// - json_fixed: jsonWriterFixed() against the exact 128-bit scaling of the Q.16 value, for every number of decimals,
+//   over the extremes of an int64_t, the values next to the powers of two and random values.
+// - segment_order: compareSegmentNames() over every pair of a list of paths in sequence order (undated and dated
+//   cycles, parts, file indexes, flat segments), both ways round.
+// - asc_golden: formatAscFrameLine() and formatAscErrorFrameLine() (asc_format.h) against the same line written with
+//   the fprintf() calls of the writers before them (formatAscLineStdio()), byte for byte, on random frames and on
+//   edge cases (times around the second and 32-bit boundaries and up to 1e9 s, negative times, 11 and 29-bit
+//   identifiers, every DLC field from 0 to 15, remote and error frames); longer times against the seconds and
+//   microseconds printed apart.
+// - trace_parse: the ASC and candump parsers of trace_replay.h on the lines of formatAscFrameLine() and on candump -l
+//   lines of random frames (11 and 29-bit identifiers, remote frames, every DLC), which must give the frame back;
+//   on the "base dec" and "timestamps relative" headers; and on error frames and malformed lines, which must be
+//   skipped.
+// - modem: the AT engine of sim7080g.h against the virtual SIM7080G of host_sim (virtual_modem.c), driven round by
+//   round (serviceModem()): echo turned off, plain and +NAME responses, a URC while idle and one in the middle of a
+//   command, the prompt and payload of AT+CASEND, ERROR, a timeout, and an RX overflow the engine recovers from.
+// - signal_store: samples appended to the columns of signal_store.h, sealed, packed into a segment the way
+//   writeSignalStore() does and read back with signalStoreQuery(), over the whole segment and a time range: the delta
+//   and zigzag varint encoding must give back every sample stored (large jumps, small steps, keepalives of a signal
+//   that does not move), the idle sweep must seal a chunk once it is SIGNAL_STORE_CHUNK_AGE_US old and not before,
+//   and the segment must hold a time base record at its start and one after the time base changed.
+// - upload: uploadSegment() (uploader.h) on a card of its own, over a transport standing in for the server and the
+//   network: the raw log resumes at the offset the server acknowledges, a connection dropped in the middle of a chunk
+//   resumes from the state file, a capture closed between two chunks goes first, a chunk damaged in transit is
+//   rejected by its CRC and sent again. The server must end up with both files, byte for byte, and the card with
+//   nothing pending and no state file.
+// - mf4: logs of mf4_writer.h read back: a finalised log of data, remote and error frames must have the ID of a
+//   finalised file, HD -> DG -> CG chain -> CN (time, structure, members) links that lead to the right blocks, the
+//   cycle counters of the frames written, and a DT block whose length covers the records, which come back in order;
+//   a log cut in the middle of a record without being finalised must be recovered by recoverMf4Log() with the whole
+//   records only; and a record the file has no room for (a memory stream) must be taken back and counted as not
+//   written, the records before it left intact.
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef CONFIG_DATAFLY_HOST_CHECKS
+#include "host_sim.h"
+#include "sim7080g.h"
+
+#define HOST_CHECK_SEED 0x2545F491
+#define HOST_CHECK_RANDOM_PAYLOADS 64
+#define HOST_CHECK_MAX_REPORTS 10
+#define HOST_CHECK_ASC_RANDOM_FRAMES 256
+#define HOST_CHECK_TRACE_RANDOM_FRAMES 256
+#define HOST_CHECK_MF4_FRAMES 300
+#define HOST_CHECK_MF4_CHECKPOINT 200 // Frames of the recovered log written before its last checkpoint.
+
+typedef struct
+{
+    const char *name;
+    uint32_t (*run)(); // Returns the cases that differ.
+} host_check_t;
+
+static uint32_t host_check_reports; // Cases logged by the current check.
+
+static inline uint32_t nextHostCheckRandom(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/// @brief Whether a case may still be logged: the first HOST_CHECK_MAX_REPORTS failures of a check are.
+static bool reportHostCheckFailure()
+{
+    return host_check_reports++ < HOST_CHECK_MAX_REPORTS;
+}
+
+#define HOST_CHECK_PAYLOAD_COUNT (4 + 64 + HOST_CHECK_RANDOM_PAYLOADS)
+
+/// @brief Payloads the kernels are checked over.
+static void initHostCheckPayloads(uint8_t payloads[HOST_CHECK_PAYLOAD_COUNT][8])
+{
+    static const uint8_t patterns[4] = {0x00, 0xFF, 0x55, 0xAA};
+    uint32_t state = HOST_CHECK_SEED;
+    int count = 0;
+    for (int i = 0; i < 4; i++)
+        memset(payloads[count++], patterns[i], 8);
+    for (int bit = 0; bit < 64; bit++, count++)
+    {
+        memset(payloads[count], 0, 8);
+        payloads[count][bit / 8] = 1 << bit % 8;
+    }
+    for (int i = 0; i < HOST_CHECK_RANDOM_PAYLOADS; i++, count++)
+    {
+        uint32_t low = nextHostCheckRandom(&state), high = nextHostCheckRandom(&state);
+        memcpy(payloads[count], &low, 4);
+        memcpy(payloads[count] + 4, &high, 4);
+    }
+}
+
+/// @brief Whether a layout fits in the 8 bytes of a frame: extractSignal() reads out of the frame otherwise.
+static bool isHostCheckLayoutValid(uint8_t startbit, uint8_t length, bool is_big_endian)
+{
+    if (is_big_endian)
+        return length <= 8 + (startbit / 8) * 8 - startbit % 8;
+    return startbit + length <= 64;
+}
+
+static uint32_t checkSignalKernels()
+{
+    static uint8_t payloads[HOST_CHECK_PAYLOAD_COUNT][8];
+    static const float factors[] = {1, 0.1, 0.5, -0.25};
+    uint32_t failures = 0, cases = 0;
+
+    initHostCheckPayloads(payloads);
+    for (int layout = 0; layout < 64 * 64 * 4; layout++)
+    {
+        uint8_t startbit = layout % 64, length = 1 + layout / 64 % 64;
+        bool is_big_endian = layout / 4096 & 1, is_signed = layout / 8192 & 1;
+        if (!isHostCheckLayoutValid(startbit, length, is_big_endian))
+            continue;
+        float factor = factors[layout % 4], offset = layout % 3 ? 0 : -40;
+        can_signal_t signal = canSignalCompile(startbit, length, is_big_endian, is_signed, factor, offset);
+
+        for (int i = 0; i < HOST_CHECK_PAYLOAD_COUNT; i++, cases++)
+        {
+            uint64_t expected = extractSignal(payloads[i], startbit, length, is_big_endian, is_signed);
+            uint64_t raw = canSignalExtract(&signal, payloads[i]);
+            float expected_value = decode(payloads[i], startbit, length, is_big_endian, is_signed, factor, offset);
+            float value = canSignalDecode(&signal, payloads[i]);
+            if (raw == expected && memcmp(&value, &expected_value, sizeof(value)) == 0)
+                continue;
+            failures++;
+            if (reportHostCheckFailure())
+                ESP_LOGE("HOST_CHECKS_H", "signal_kernels: start %u length %u %s %s payload %d: raw %016llX "
+                         "expected %016llX, value %g expected %g", startbit, length,
+                         is_big_endian ? "Motorola" : "Intel", is_signed ? "signed" : "unsigned", i,
+                         (unsigned long long)raw, (unsigned long long)expected, value, expected_value);
+        }
+    }
+    ESP_LOGI("HOST_CHECKS_H", "signal_kernels: %lu cases", (unsigned long)cases);
+    return failures;
+}
+
+/// @brief Compare the fixed and float decoding of a signal over the payloads.
+static uint32_t checkFixedSignal(const can_signal_t *signal, uint8_t payloads[HOST_CHECK_PAYLOAD_COUNT][8],
+                                 uint32_t *cases)
+{
+    uint32_t failures = 0;
+    for (int i = 0; i < HOST_CHECK_PAYLOAD_COUNT; i++, (*cases)++)
+    {
+        float expected = canSignalDecode(signal, payloads[i]);
+        int64_t value = canSignalDecodeFixed(signal, payloads[i]);
+        // The float path rounds three times: the raw value to a float, the product and the sum.
+        double tolerance = fabs(signal->factor) + (2 * fabs(expected) + fabs(signal->offset)) * FLT_EPSILON;
+        if (fabs((double)value / CAN_FIXED_ONE - expected) <= tolerance)
+            continue;
+        failures++;
+        if (reportHostCheckFailure())
+            ESP_LOGE("HOST_CHECKS_H", "fixed_decode: length %u %s factor %g offset %g payload %d: %.6f expected %.6f",
+                     signal->length, signal->is_signed ? "signed" : "unsigned", signal->factor, signal->offset, i,
+                     (double)value / CAN_FIXED_ONE, expected);
+    }
+    return failures;
+}
+
+static uint32_t checkFixedDecode()
+{
+    static uint8_t payloads[HOST_CHECK_PAYLOAD_COUNT][8];
+    static const uint8_t lengths[] = {1, 2, 7, 8, 12, 16, 24, 31, 32};
+    static const float factors[] = {1, 2, 100, 0.5, 0.0625, 0.1, 0.05, 0.01, 0.001, 1.0f / 3, -0.25, -0.1};
+    static const float offsets[] = {0, -40, 273.15f, -0.5f};
+    uint32_t failures = 0, cases = 0;
+
+    initHostCheckPayloads(payloads);
+    vehicleSignalsInit();
+    for (int i = 0; i < SIG_COUNT; i++)
+        failures += checkFixedSignal(&vehicle_signals[i], payloads, &cases);
+    for (int l = 0; l < sizeof(lengths); l++)
+    {
+        for (int f = 0; f < sizeof(factors) / sizeof(factors[0]); f++)
+        {
+            for (int o = 0; o < sizeof(offsets) / sizeof(offsets[0]); o++)
+            {
+                for (int is_signed = 0; is_signed < 2; is_signed++)
+                {
+                    can_signal_t signal = canSignalCompile(64 - lengths[l], lengths[l], false, is_signed, factors[f],
+                                                           offsets[o]);
+                    failures += checkFixedSignal(&signal, payloads, &cases);
+                }
+            }
+        }
+    }
+    for (int is_big_endian = 0; is_big_endian < 2; is_big_endian++)
+    {
+        // Start bit of the LSB in the last byte for Motorola, in the first one for Intel.
+        uint8_t start = is_big_endian ? 56 : 0;
+        for (uint8_t length = 8; length <= 32; length += 8)
+        {
+            for (uint8_t float_length = 0; float_length <= length; float_length++)
+            {
+                can_signal_t signal = canSignalCompileIQ(start, length, float_length, is_big_endian, true);
+                for (int i = 0; i < HOST_CHECK_PAYLOAD_COUNT; i++, cases++)
+                {
+                    double expected = extractIQ(payloads[i], start, length, float_length, is_big_endian, true);
+                    int64_t value = extractIQFixed(&signal, payloads[i]);
+                    if (fabs((double)value / CAN_FIXED_ONE - expected) <= 1.0 / CAN_FIXED_ONE)
+                        continue;
+                    failures++;
+                    if (reportHostCheckFailure())
+                        ESP_LOGE("HOST_CHECKS_H", "fixed_decode: IQ %s length %u Q.%u payload %d: %.8f expected %.8f",
+                                 is_big_endian ? "motorola" : "intel", length, float_length, i,
+                                 (double)value / CAN_FIXED_ONE, expected);
+                }
+            }
+        }
+    }
+    ESP_LOGI("HOST_CHECKS_H", "fixed_decode: %lu cases", (unsigned long)cases);
+    return failures;
+}
+
+static uint32_t checkVehicleLookup()
+{
+    uint32_t failures = 0;
+    vehicleSignalsInit();
+    for (uint32_t i = 0; i < 0x800 + 3 * VEHICLE_MESSAGE_COUNT; i++)
+    {
+        uint32_t can_id = i < 0x800 ? i : (vehicle_messages[(i - 0x800) / 3].id | CAN_EFF_FLAG) + (i - 0x800) % 3 - 1;
+        const can_message_def_t *expected = NULL;
+        for (size_t m = 0; m < VEHICLE_MESSAGE_COUNT; m++)
+        {
+            if (vehicle_messages[m].id == can_id)
+                expected = &vehicle_messages[m];
+        }
+        const can_message_def_t *message = findVehicleMessage(can_id);
+        if (message == expected)
+            continue;
+        failures++;
+        if (reportHostCheckFailure())
+            ESP_LOGE("HOST_CHECKS_H", "vehicle_lookup: %08lX found %p expected %p", (unsigned long)can_id,
+                     (const void *)message, (const void *)expected);
+    }
+    return failures;
+}
+
+/// @brief Reference of jsonWriterFixed(): the value scaled in 128 bits, printed with the trailing zeros removed.
+static void formatHostCheckFixed(char *text, size_t size, int64_t value, uint8_t decimals)
+{
+    unsigned __int128 power = 1;
+    for (uint8_t i = 0; i < decimals; i++)
+        power *= 10;
+    unsigned __int128 magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+    unsigned __int128 scaled = (magnitude * power + (1 << 15)) >> 16;
+    uint64_t integer_part = scaled / power, fraction = scaled % power;
+    int length = snprintf(text, size, "%s%llu", value < 0 && scaled ? "-" : "", (unsigned long long)integer_part);
+    if (fraction)
+    {
+        length += snprintf(text + length, size - length, ".%0*llu", decimals, (unsigned long long)fraction);
+        while (text[length - 1] == '0')
+            text[--length] = '\0';
+    }
+}
+
+static uint32_t checkJsonFixed()
+{
+    uint32_t failures = 0, cases = 0, state = HOST_CHECK_SEED;
+    int64_t values[3 * 63 + 5 + HOST_CHECK_RANDOM_PAYLOADS];
+    int count = 0;
+
+    values[count++] = 0;
+    values[count++] = 1;
+    values[count++] = -1;
+    values[count++] = INT64_MAX;
+    values[count++] = INT64_MIN;
+    for (int bit = 0; bit < 63; bit++)
+    {
+        values[count++] = ((int64_t)1 << bit) - 1;
+        values[count++] = (int64_t)1 << bit;
+        values[count++] = -((int64_t)1 << bit) - 1;
+    }
+    for (int i = 0; i < HOST_CHECK_RANDOM_PAYLOADS; i++)
+        values[count++] = (int64_t)((uint64_t)nextHostCheckRandom(&state) << 32 | nextHostCheckRandom(&state));
+
+    for (int i = 0; i < count; i++)
+    {
+        for (uint8_t decimals = 0; decimals <= JSON_WRITER_MAX_DECIMALS; decimals++, cases++)
+        {
+            char buffer[32], expected[32];
+            json_writer_t writer;
+            jsonWriterInit(&writer, buffer, sizeof(buffer));
+            jsonWriterFixed(&writer, values[i], decimals);
+            formatHostCheckFixed(expected, sizeof(expected), values[i], decimals);
+            const char *text = jsonWriterFinish(&writer);
+            if (text && strcmp(text, expected) == 0)
+                continue;
+            failures++;
+            if (reportHostCheckFailure())
+                ESP_LOGE("HOST_CHECKS_H", "json_fixed: %lld with %u decimals: %s expected %s", (long long)values[i],
+                         decimals, text ? text : "(overflow)", expected);
+        }
+    }
+    ESP_LOGI("HOST_CHECKS_H", "json_fixed: %lu cases", (unsigned long)cases);
+    return failures;
+}
+
+static uint32_t checkSegmentOrder()
+{
+    // In sequence order.
+    static const char *const names[] = {
+        "LOG_FS/UNDATED/00/00007/000.asc",
+        "LOG_FS/UNDATED/00/00007/127.asc",
+        "LOG_FS/UNDATED/00/00007_1/000.asc",
+        "LOG_FS/UNDATED/00/00041/000.asc",
+        "LOG_FS/UNDATED/01/01000/000.asc",
+        "LOG_FS/UNDATED/99/99999/000.asc",
+        "LOG_FS/2025/12/31/00040/000.asc",
+        "LOG_FS/2026/01/02/00040/000.asc",
+        "LOG_FS/2026/10/17/00041/000.asc",
+        "LOG_FS/2026/10/17/00041/001.asc",
+        "LOG_FS/2026/10/17/00041/010.asc",
+        "LOG_FS/2026/10/17/00041_1/000.asc",
+        "LOG_FS/2026/10/17/00041_2/000.asc",
+        "LOG_FS/2026/10/17/00041_10/000.asc",
+        "LOG_FS/2026/10/17/00050/000.asc",
+        "LOG_FS/2026/10/18/00050/000.asc",
+        "SUM_FS/s_0.bin",
+        "SUM_FS/s_9.bin",
+        "SUM_FS/s_99.bin",
+        "SUM_FS/s_100.bin",
+    };
+    const size_t count = sizeof(names) / sizeof(names[0]);
+    uint32_t failures = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        for (size_t j = 0; j < count; j++)
+        {
+            int expected = i < j ? -1 : i > j ? 1 : 0;
+            int result = compareSegmentNames(names[i], names[j]);
+            if (result == expected)
+                continue;
+            failures++;
+            if (reportHostCheckFailure())
+                ESP_LOGE("HOST_CHECKS_H", "segment_order: %s vs %s: %d expected %d", names[i], names[j], result,
+                         expected);
+        }
+    }
+    return failures;
+}
+
+#define HOST_CHECK_MODEM_WAIT_US 2000000LL
+
+typedef struct
+{
+    bool done;
+    modem_result_t result;
+    char final_line[MODEM_LINE_SIZE];
+    uint32_t lines;
+    char last_line[MODEM_LINE_SIZE];
+} host_check_modem_command_t;
+
+static uint32_t host_check_modem_urcs;
+
+static void onHostCheckModemLine(const char *line, void *context)
+{
+    host_check_modem_command_t *command = context;
+    command->lines++;
+    snprintf(command->last_line, sizeof(command->last_line), "%s", line);
+}
+
+static void onHostCheckModemDone(modem_result_t result, const char *final_line, void *context)
+{
+    host_check_modem_command_t *command = context;
+    command->done = true;
+    command->result = result;
+    snprintf(command->final_line, sizeof(command->final_line), "%s", final_line);
+}
+
+static void onHostCheckModemUrc(const char *line, void *context)
+{
+    host_check_modem_urcs++;
+}
+
+/// @brief Run the modem engine until the command is over (or HOST_CHECK_MODEM_WAIT_US).
+static void runHostCheckModem(host_check_modem_command_t *command)
+{
+    int64_t deadline = esp_timer_get_time() + HOST_CHECK_MODEM_WAIT_US;
+    while (!command->done && esp_timer_get_time() < deadline)
+        serviceModem(pdMS_TO_TICKS(1));
+}
+
+/// @brief Count and log a failed case of the modem check.
+static uint32_t checkHostModemCase(const char *name, bool passed, const host_check_modem_command_t *command)
+{
+    if (passed)
+        return 0;
+    if (reportHostCheckFailure())
+        ESP_LOGE("HOST_CHECKS_H", "modem: %s: done %d result %d final \"%s\", %lu lines, last \"%s\"", name,
+                 command->done, command->result, command->final_line, (unsigned long)command->lines,
+                 command->last_line);
+    return 1;
+}
+
+static uint32_t checkModem()
+{
+    static uint8_t payload[MODEM_CASEND_MAX_LENGTH], received[VIRTUAL_MODEM_MAX_PAYLOAD];
+    static char burst[MODEM_RX_BUFFER_SIZE + 512];
+    host_check_modem_command_t command;
+    virtual_modem_stats_t stats;
+    uint32_t failures = 0, state = HOST_CHECK_SEED, urcs;
+
+    virtualModemAttach(MODEM_UART);
+    modemRegisterUrc("+CADATAIND", onHostCheckModemUrc, NULL);
+    if (!initModem())
+        return 1;
+
+    // initModem() queued ATE0, which the modem echoes before it takes effect.
+    command = (host_check_modem_command_t){0};
+    modemSendCommand("AT", 0, onHostCheckModemLine, onHostCheckModemDone, &command);
+    runHostCheckModem(&command);
+    virtualModemGetStats(&stats);
+    failures += checkHostModemCase("echo off", command.done && command.result == MODEM_RESULT_OK && !stats.echo &&
+                                   command.lines == 0, &command);
+
+    command = (host_check_modem_command_t){0};
+    modemSendCommand("AT+CGSN", 0, onHostCheckModemLine, onHostCheckModemDone, &command);
+    runHostCheckModem(&command);
+    failures += checkHostModemCase("plain response", command.result == MODEM_RESULT_OK && command.lines == 1 &&
+                                   strcmp(command.last_line, VIRTUAL_MODEM_IMEI) == 0, &command);
+
+    command = (host_check_modem_command_t){0};
+    modemOpenTcp(0, "example.com", 80, onHostCheckModemLine, onHostCheckModemDone, &command);
+    runHostCheckModem(&command);
+    failures += checkHostModemCase("open", command.result == MODEM_RESULT_OK && command.lines == 1 &&
+                                   strcmp(command.last_line, "+CAOPEN: 0,0") == 0, &command);
+
+    // The URC comes between the response and the final result: it goes to its handler, not to the command.
+    urcs = host_check_modem_urcs;
+    virtualModemDeferUrc("+CADATAIND: 0");
+    command = (host_check_modem_command_t){0};
+    modemSendCommand("AT+CASTATE?", 0, onHostCheckModemLine, onHostCheckModemDone, &command);
+    runHostCheckModem(&command);
+    failures += checkHostModemCase("urc in a command", command.result == MODEM_RESULT_OK && command.lines == 1 &&
+                                   strcmp(command.last_line, "+CASTATE: 0,1") == 0 &&
+                                   host_check_modem_urcs == urcs + 1, &command);
+
+    for (size_t i = 0; i < sizeof(payload); i++)
+        payload[i] = nextHostCheckRandom(&state);
+    payload[0] = '>'; // Payload bytes are not parsed.
+    payload[1] = '\n';
+    command = (host_check_modem_command_t){0};
+    modemSendTcp(0, payload, sizeof(payload), onHostCheckModemDone, &command);
+    runHostCheckModem(&command);
+    failures += checkHostModemCase("prompt and payload", command.result == MODEM_RESULT_OK &&
+                                   virtualModemLastPayload(received, sizeof(received)) == sizeof(payload) &&
+                                   memcmp(received, payload, sizeof(payload)) == 0, &command);
+
+    command = (host_check_modem_command_t){0};
+    modemSendCommand("AT+CFUN=9", 0, onHostCheckModemLine, onHostCheckModemDone, &command);
+    runHostCheckModem(&command);
+    failures += checkHostModemCase("error", command.result == MODEM_RESULT_ERROR &&
+                                   strcmp(command.final_line, "ERROR") == 0, &command);
+
+    urcs = host_check_modem_urcs;
+    virtualModemSend("\r\n+CADATAIND: 0\r\n", 17);
+    command = (host_check_modem_command_t){0};
+    for (int round = 0; round < 10; round++)
+        serviceModem(pdMS_TO_TICKS(1));
+    failures += checkHostModemCase("urc while idle", host_check_modem_urcs == urcs + 1, &command);
+
+    virtualModemMute(true);
+    command = (host_check_modem_command_t){0};
+    modemSendCommand("AT", 50, onHostCheckModemLine, onHostCheckModemDone, &command);
+    runHostCheckModem(&command);
+    virtualModemMute(false);
+    failures += checkHostModemCase("timeout", command.result == MODEM_RESULT_TIMEOUT && command.final_line[0] == '\0',
+                                   &command);
+
+    // More than the RX buffer holds, with no line end: the bytes that fit are read, the rest is lost, and the partial
+    // line must not be glued to the next response.
+    uint32_t overflows = modem_rx_overflows;
+    memset(burst, 'A', sizeof(burst));
+    virtualModemSend(burst, sizeof(burst));
+    for (int round = 0; round < 10; round++)
+        serviceModem(pdMS_TO_TICKS(1));
+    command = (host_check_modem_command_t){0};
+    modemSendCommand("AT+CGSN", 0, onHostCheckModemLine, onHostCheckModemDone, &command);
+    runHostCheckModem(&command);
+    failures += checkHostModemCase("overflow", modem_rx_overflows == overflows + 1 &&
+                                   command.result == MODEM_RESULT_OK && command.lines == 1 &&
+                                   strcmp(command.last_line, VIRTUAL_MODEM_IMEI) == 0, &command);
+    return failures;
+}
+
+/// @brief Compare one line of both ASC formatters.
+static bool checkAscLine(int64_t time_us, uint8_t channel, uint32_t identifier, bool extended, bool remote,
+                         bool error, uint8_t dlc, const uint8_t *data)
+{
+    char line[ASC_LINE_MAX];
+    char expected[2 * ASC_LINE_MAX];
+    size_t length = error ? formatAscErrorFrameLine(line, time_us, channel)
+                          : formatAscFrameLine(line, time_us, channel, identifier, extended, remote, dlc, data);
+    FILE *stream = fmemopen(expected, sizeof(expected), "w");
+    if (!stream)
+        return false;
+    formatAscLineStdio(stream, time_us, channel, identifier, extended, remote, error, dlc, data);
+    size_t expected_length = ftell(stream);
+    fclose(stream);
+    if (length == expected_length && memcmp(line, expected, length) == 0)
+        return true;
+    if (reportHostCheckFailure())
+        ESP_LOGE("HOST_CHECKS_H", "asc_golden:\n  got      '%.*s'\n  expected '%.*s'", (int)length, line,
+                 (int)expected_length, expected);
+    return false;
+}
+
+/// @brief The time of formatAscFrameLine() beyond ASC_STDIO_TIME_LIMIT_US, against the seconds and µs printed apart.
+static bool checkAscLongTime(int64_t time_us)
+{
+    char line[ASC_LINE_MAX];
+    char expected[ASC_LINE_MAX];
+    uint64_t magnitude = time_us < 0 ? -(uint64_t)time_us : (uint64_t)time_us;
+    size_t length = formatAscErrorFrameLine(line, time_us, 1);
+    int expected_length = snprintf(expected, sizeof(expected), " %s%" PRIu64 ".%06" PRIu64 " 1  ErrorFrame\n",
+                                   time_us < 0 ? "-" : "", magnitude / 1000000, magnitude % 1000000);
+    if (length == expected_length && memcmp(line, expected, length) == 0)
+        return true;
+    if (reportHostCheckFailure())
+        ESP_LOGE("HOST_CHECKS_H", "asc_golden:\n  got      '%.*s'\n  expected '%s'", (int)length, line, expected);
+    return false;
+}
+
+static uint32_t checkAscGolden()
+{
+    static const int64_t times_us[] = {0, 1, 999999, 1000000, 1000001, 59999999, 4294967295LL, 4294967296LL,
+                                       4295000000LL, 86400000000LL, 123456789012345LL,
+                                       ASC_STDIO_TIME_LIMIT_US - 1, -1, -999999, -1000000, -4294967297LL,
+                                       1 - ASC_STDIO_TIME_LIMIT_US};
+    static const int64_t long_times_us[] = {ASC_STDIO_TIME_LIMIT_US, 4294967296LL * 1000000, INT64_MAX,
+                                            -ASC_STDIO_TIME_LIMIT_US, INT64_MIN};
+    static const uint32_t identifiers[] = {0, 0x7, 0x7FF, 0x800, 0xFFF, 0x1000, 0x1FFFFFFF, 0xFFFFFFFF};
+    static const uint8_t edge_data[8] = {0x00, 0x0F, 0x10, 0x7F, 0x80, 0xA5, 0xF0, 0xFF};
+    uint32_t state = HOST_CHECK_SEED;
+    uint32_t failures = 0;
+
+    for (int t = 0; t < sizeof(times_us) / sizeof(times_us[0]); t++)
+    {
+        failures += !checkAscLine(times_us[t], 2, 0, false, false, true, 0, edge_data);
+        for (int id = 0; id < sizeof(identifiers) / sizeof(identifiers[0]); id++)
+            for (uint8_t dlc = 0; dlc <= 15; dlc++) // 9 to 15: the DLC field of a classic frame, 8 bytes.
+                failures += !checkAscLine(times_us[t], 1 + dlc % 2, identifiers[id], identifiers[id] > 0x7FF,
+                                          dlc == 3 || dlc == 12, false, dlc, edge_data);
+    }
+    for (int t = 0; t < sizeof(long_times_us) / sizeof(long_times_us[0]); t++)
+        failures += !checkAscLongTime(long_times_us[t]);
+
+    // Frames as the buses deliver them: times of a day of logging, identifiers of both widths, every DLC.
+    for (int i = 0; i < HOST_CHECK_ASC_RANDOM_FRAMES; i++)
+    {
+        uint8_t data[8];
+        uint32_t low = nextHostCheckRandom(&state), high = nextHostCheckRandom(&state);
+        uint32_t x = nextHostCheckRandom(&state);
+        bool extended = x & 1;
+        int64_t time_us = (((uint64_t)nextHostCheckRandom(&state) << 32) | nextHostCheckRandom(&state)) %
+                          86400000000LL;
+        memcpy(data, &low, 4);
+        memcpy(data + 4, &high, 4);
+        failures += !checkAscLine(time_us, 1 + (x >> 1 & 1), extended ? x >> 3 & 0x1FFFFFFF : x >> 3 & 0x7FF,
+                                  extended, (x & 0x3F0) == 0x3F0, (x >> 12) % 17 == 16, (x >> 12) % 17 % 16, data);
+    }
+    return failures;
+}
+
+/// @brief Parse one trace line and compare it with the frame it was made of (NULL: the line must be skipped).
+static bool checkTraceLine(trace_replay_t *replay, const char *line, const trace_frame_t *expected)
+{
+    trace_frame_t frame;
+    memset(&frame, 0, sizeof(frame));
+    bool parsed = line[0] == '(' ? parseCandumpFrame(line, &frame) : parseAscFrame(replay, line, &frame);
+    if (expected ? parsed && memcmp(&frame, expected, sizeof(frame)) == 0 : !parsed)
+        return true;
+    if (reportHostCheckFailure())
+    {
+        if (!expected)
+            ESP_LOGE("HOST_CHECKS_H", "trace_parse: '%s' parsed, expected skipped", line);
+        else if (!parsed)
+            ESP_LOGE("HOST_CHECKS_H", "trace_parse: '%s' skipped", line);
+        else
+            ESP_LOGE("HOST_CHECKS_H", "trace_parse: '%s': %lld %d %lX%s%s dlc %d, expected %lld %d %lX%s%s dlc %d",
+                     line, (long long)frame.time_us, frame.channel, (unsigned long)frame.identifier,
+                     frame.extended ? "x" : "", frame.rtr ? " r" : "", frame.dlc, (long long)expected->time_us,
+                     expected->channel, (unsigned long)expected->identifier, expected->extended ? "x" : "",
+                     expected->rtr ? " r" : "", expected->dlc);
+    }
+    return false;
+}
+
+static uint32_t checkTraceParse()
+{
+    static const char *const malformed[] = {
+        "",
+        "// time base: origin_local_us=0 unsynced",
+        "Begin Triggerblock Thu Jan 01 12:00:00.000 am 1970",
+        " 1.000000 1        12G             Rx   d 1 00",
+        " 1.000000 1        123             Rx   d 2 00",
+        " 1.000000 1        123             Rx   d 1 0",
+        " 1.000000 1        123             Rx   d 1 000",
+        " 1.000000 1        123             Rx   x 1 00",
+        " 1.000000 1        123             Rx   d",
+        " 1.000000 CANFD 1 Rx 123 1 0 8 8 00 00 00 00 00 00 00 00",
+        " 1.000000 Statistic: D 0 R 0 XD 0 XR 0 E 0 O 0 B 0.00%",
+        "(1.000000) can0 123##100",
+        "(1.000000) can0 123#0",
+        "(1.000000) can0 123#001122334455667788",
+        "(1.000000) can0 12Z#00",
+        "(1.000000) can0 123#0G",
+        "(1.000000 can0 123#00",
+        "(1.000000) can0",
+        "(x) can0 123#00",
+    };
+    uint32_t state = HOST_CHECK_SEED;
+    uint32_t failures = 0;
+    trace_replay_t replay;
+    char line[ASC_LINE_MAX + 1];
+    size_t length;
+
+    memset(&replay, 0, sizeof(replay));
+    for (int i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++)
+        failures += !checkTraceLine(&replay, malformed[i], NULL);
+    length = formatAscErrorFrameLine(line, 1000000, ASC_CHANNEL_MCP2515);
+    line[length] = '\0';
+    failures += !checkTraceLine(&replay, line, NULL);
+
+    // Lines of the logger, and the same frames as candump -l writes them.
+    for (int i = 0; i < HOST_CHECK_TRACE_RANDOM_FRAMES; i++)
+    {
+        trace_frame_t frame = {0};
+        uint32_t low = nextHostCheckRandom(&state), high = nextHostCheckRandom(&state);
+        uint32_t x = nextHostCheckRandom(&state);
+        frame.time_us = (((uint64_t)nextHostCheckRandom(&state) << 32) | nextHostCheckRandom(&state)) %
+                        86400000000LL;
+        frame.channel = 1 + (x & 1);
+        frame.extended = x >> 1 & 1;
+        frame.identifier = frame.extended ? x >> 3 & 0x1FFFFFFF : x >> 3 & 0x7FF;
+        frame.rtr = (x & 0x3C) == 0x3C;
+        frame.dlc = (x >> 12) % 9;
+        if (!frame.rtr)
+        {
+            memcpy(frame.data, &low, 4);
+            memcpy(frame.data + 4, &high, 4);
+            memset(frame.data + frame.dlc, 0, sizeof(frame.data) - frame.dlc);
+        }
+        length = formatAscFrameLine(line, frame.time_us, frame.channel, frame.identifier, frame.extended, frame.rtr,
+                                    frame.dlc, frame.data);
+        line[length] = '\0';
+        failures += !checkTraceLine(&replay, line, &frame);
+
+        char candump[TRACE_LINE_SIZE];
+        int used = snprintf(candump, sizeof(candump), "(%lld.%06lld) can%d %0*lX#",
+                            (long long)(frame.time_us / 1000000), (long long)(frame.time_us % 1000000),
+                            frame.channel - 1, frame.extended ? 8 : 3, (unsigned long)frame.identifier);
+        if (frame.rtr)
+            snprintf(candump + used, sizeof(candump) - used, "R%d", frame.dlc);
+        for (int b = 0; !frame.rtr && b < frame.dlc; b++)
+            used += snprintf(candump + used, sizeof(candump) - used, "%02X", frame.data[b]);
+        failures += !checkTraceLine(&replay, candump, &frame);
+    }
+
+    // Headers of other tools: decimal identifiers, each time the delay from the previous frame.
+    failures += !checkTraceLine(&replay, "base dec  timestamps relative", NULL);
+    failures += !checkTraceLine(&replay, " 0.500000 1  2047  Rx   d 1 5A",
+                                &(trace_frame_t){.time_us = 500000, .channel = 1, .identifier = 2047, .dlc = 1,
+                                                 .data = {0x5A}});
+    failures += !checkTraceLine(&replay, " 0.250000 2  536870911x  Rx   r 2",
+                                &(trace_frame_t){.time_us = 750000, .channel = 2, .identifier = 0x1FFFFFFF,
+                                                 .extended = true, .rtr = true, .dlc = 2});
+    failures += !checkTraceLine(&replay, "base hex  timestamps absolute", NULL);
+    failures += !checkTraceLine(&replay, " 2.000000 1  7FF  Rx   d 0",
+                                &(trace_frame_t){.time_us = 2000000, .channel = 1, .identifier = 0x7FF});
+    return failures;
+}
+
+#define HOST_CHECK_STORE_SIGNALS 3
+#define HOST_CHECK_STORE_SAMPLES 4096
+
+typedef struct
+{
+    int64_t time_us;
+    int64_t value;
+} host_check_sample_t;
+
+typedef struct
+{
+    const host_check_sample_t *expected; // Samples the query must report, in order.
+    uint32_t expected_count;
+    uint32_t count;
+    uint32_t failures;
+    vehicle_signal_id_t signal_id;
+} host_check_store_query_t;
+
+static void onHostCheckStoreSample(int64_t time_us, int64_t value, void *context)
+{
+    host_check_store_query_t *query = context;
+    uint32_t i = query->count++;
+    if (i < query->expected_count && query->expected[i].time_us == time_us && query->expected[i].value == value)
+        return;
+    query->failures++;
+    if (reportHostCheckFailure())
+        ESP_LOGE("HOST_CHECKS_H", "signal_store: signal %d sample %lu: %lld %lld expected %lld %lld",
+                 query->signal_id, (unsigned long)i, (long long)time_us, (long long)value,
+                 i < query->expected_count ? (long long)query->expected[i].time_us : 0LL,
+                 i < query->expected_count ? (long long)query->expected[i].value : 0LL);
+}
+
+/// @brief Move the sealed chunks to the block as writeSignalStore() does, flushing it to the segment when full.
+/// @return chunks moved.
+static uint32_t drainHostCheckStore(FILE *store_f, uint8_t *block, size_t *block_size, uint32_t *time_base_version)
+{
+    static signal_chunk_t chunk;
+    uint32_t chunks = 0;
+    while (xQueueReceive(signal_chunk_queue, &chunk, 0) == pdPASS)
+    {
+        if (*block_size + sizeof(chunk) + sizeof(chunk.header) + sizeof(signal_store_time_base_t) >
+            SIGNAL_STORE_BLOCK_SIZE)
+            flushSignalStoreBlock(store_f, block, block_size);
+        if (timeBaseVersion() != *time_base_version)
+            *time_base_version = appendSignalStoreTimeBase(block, block_size);
+        appendSignalStoreChunk(block, block_size, &chunk);
+        chunks++;
+    }
+    return chunks;
+}
+
+/// @brief Query one signal of the segment over [from_us, to_us] and compare with the samples stored in that range.
+static uint32_t checkHostStoreQuery(const char *file_name, vehicle_signal_id_t signal_id,
+                                    const host_check_sample_t *stored, uint32_t stored_count, int64_t from_us,
+                                    int64_t to_us)
+{
+    uint32_t first = 0;
+    while (first < stored_count && stored[first].time_us < from_us)
+        first++;
+    uint32_t last = first;
+    while (last < stored_count && stored[last].time_us <= to_us)
+        last++;
+    host_check_store_query_t query = {
+        .expected = &stored[first], .expected_count = last - first, .signal_id = signal_id};
+    int samples = signalStoreQuery(file_name, signal_id, from_us, to_us, onHostCheckStoreSample, &query);
+    if (samples == query.expected_count && query.count == query.expected_count)
+        return query.failures;
+    if (reportHostCheckFailure())
+        ESP_LOGE("HOST_CHECKS_H", "signal_store: signal %d [%lld, %lld]: %d samples, %lu expected", signal_id,
+                 (long long)from_us, (long long)to_us, samples, (unsigned long)query.expected_count);
+    return query.failures + 1;
+}
+
+static uint32_t checkSignalStore()
+{
+    static host_check_sample_t stored[HOST_CHECK_STORE_SIGNALS][HOST_CHECK_STORE_SAMPLES];
+    static uint8_t block[SIGNAL_STORE_BLOCK_SIZE];
+    uint32_t stored_count[HOST_CHECK_STORE_SIGNALS] = {0};
+    int64_t values[HOST_CHECK_STORE_SIGNALS] = {0};
+    uint32_t failures = 0, state = HOST_CHECK_SEED;
+    size_t block_size = 0;
+    char file_name[] = "/tmp/datafly_store_XXXXXX";
+
+    int fd = mkstemp(file_name);
+    FILE *store_f = fd < 0 ? NULL : fdopen(fd, "w");
+    if (!store_f)
+    {
+        ESP_LOGE("HOST_CHECKS_H", "signal_store: cannot create %s", file_name);
+        return 1;
+    }
+    if (!signal_chunk_queue)
+        createSignalStoreQueue();
+
+    // Signal 0 jumps anywhere in +/- 2^61 (10 byte varints) or takes small steps, signal 1 is a slow counter, both
+    // change on every sample so that each of them is stored. Signal 2 never moves: only the samples at least
+    // SIGNAL_STORE_KEEPALIVE_US after the last one stored are. Time steps go from 0 to beyond SIGNAL_STORE_CHUNK_AGE_US.
+    // The time base changes halfway, the segment must carry a second time base record.
+    uint32_t time_base_version = appendSignalStoreTimeBase(block, &block_size);
+    int64_t time_us = 1000;
+    for (int i = 0; i < HOST_CHECK_STORE_SAMPLES; i++)
+    {
+        uint32_t x = nextHostCheckRandom(&state);
+        switch (x & 7)
+        {
+        case 0:
+            break;
+        case 1:
+            time_us += SIGNAL_STORE_CHUNK_AGE_US + (x >> 3) % 1000000;
+            break;
+        default:
+            time_us += (x >> 3) % 3000000;
+        }
+        if (i == HOST_CHECK_STORE_SAMPLES / 2)
+            timeBaseDiscipline(time_us, 1767225600000000LL); // 2026-01-01.
+
+        int64_t value = values[0];
+        if (nextHostCheckRandom(&state) & 1)
+            while (value == values[0])
+                value = (int64_t)(((uint64_t)nextHostCheckRandom(&state) << 32) | nextHostCheckRandom(&state)) >> 2;
+        else
+        {
+            int64_t step = (int64_t)(nextHostCheckRandom(&state) % 255) - 127;
+            value += step ? step : 1;
+        }
+        values[0] = value;
+        values[1] += 1 + (x >> 24) % 4;
+
+        for (int signal_id = 0; signal_id < HOST_CHECK_STORE_SIGNALS; signal_id++)
+        {
+            host_check_sample_t *last = stored_count[signal_id] ? &stored[signal_id][stored_count[signal_id] - 1]
+                                                                : NULL;
+            if (signal_id != 2 || !last || time_us - last->time_us >= SIGNAL_STORE_KEEPALIVE_US)
+                stored[signal_id][stored_count[signal_id]++] = (host_check_sample_t){time_us, values[signal_id]};
+            signalStoreAppend(signal_id, time_us, values[signal_id]);
+        }
+        drainHostCheckStore(store_f, block, &block_size, &time_base_version);
+    }
+
+    // The sweep seals a chunk once it is SIGNAL_STORE_CHUNK_AGE_US old, not before.
+    int64_t first_us = INT64_MAX;
+    for (int signal_id = 0; signal_id < HOST_CHECK_STORE_SIGNALS; signal_id++)
+        if (signal_columns[signal_id].chunk.header.first_time_us < first_us)
+            first_us = signal_columns[signal_id].chunk.header.first_time_us;
+    signalStoreSealIdleChunks(first_us + SIGNAL_STORE_CHUNK_AGE_US - 1);
+    uint32_t early = drainHostCheckStore(store_f, block, &block_size, &time_base_version);
+    signalStoreSealIdleChunks(INT64_MAX);
+    uint32_t sealed = drainHostCheckStore(store_f, block, &block_size, &time_base_version);
+    flushSignalStoreBlock(store_f, block, &block_size);
+    fclose(store_f);
+    if (early || sealed != HOST_CHECK_STORE_SIGNALS || signal_chunks_dropped)
+    {
+        failures++;
+        if (reportHostCheckFailure())
+            ESP_LOGE("HOST_CHECKS_H", "signal_store: sweep sealed %lu chunks early and %lu at the end, %lu dropped",
+                     (unsigned long)early, (unsigned long)sealed, (unsigned long)signal_chunks_dropped);
+    }
+
+    for (int signal_id = 0; signal_id < HOST_CHECK_STORE_SIGNALS; signal_id++)
+    {
+        uint32_t count = stored_count[signal_id];
+        failures += checkHostStoreQuery(file_name, signal_id, stored[signal_id], count, INT64_MIN, INT64_MAX);
+        failures += checkHostStoreQuery(file_name, signal_id, stored[signal_id], count,
+                                        stored[signal_id][count / 3].time_us, stored[signal_id][count / 2].time_us);
+    }
+
+    // Time base records: the model at the start of the segment (not synced), then the disciplined one.
+    uint32_t time_bases = 0, synced = 0;
+    signal_chunk_header_t header;
+    signal_store_time_base_t record;
+    store_f = fopen(file_name, "r");
+    while (store_f && fread(&header, sizeof(header), 1, store_f) == 1)
+    {
+        if (header.signal_id != SIGNAL_STORE_TIME_BASE_ID)
+        {
+            fseek(store_f, header.payload_size, SEEK_CUR);
+            continue;
+        }
+        if (header.payload_size != sizeof(record) || fread(&record, sizeof(record), 1, store_f) != 1)
+            break;
+        bool expected_synced = time_bases++ > 0;
+        if (record.synced != expected_synced || (record.synced && record.ref_utc_us != 1767225600000000LL))
+            break;
+        synced += record.synced;
+    }
+    if (store_f)
+        fclose(store_f);
+    if (time_bases != 2 || synced != 1)
+    {
+        failures++;
+        if (reportHostCheckFailure())
+            ESP_LOGE("HOST_CHECKS_H", "signal_store: %lu time base records, %lu synced, expected 2 and 1",
+                     (unsigned long)time_bases, (unsigned long)synced);
+    }
+    unlink(file_name);
+    ESP_LOGI("HOST_CHECKS_H", "signal_store: %lu, %lu and %lu samples stored", (unsigned long)stored_count[0],
+             (unsigned long)stored_count[1], (unsigned long)stored_count[2]);
+    return failures;
+}
+
+#define HOST_CHECK_UPLOAD_RAW_SIZE (4 * UPLOAD_CHUNK_SIZE + 1234)
+#define HOST_CHECK_UPLOAD_RAW_HELD 10000 // Bytes the server holds before the first request.
+#define HOST_CHECK_UPLOAD_CAPTURE_SIZE 3000
+#define HOST_CHECK_UPLOAD_DROP_AT 3    // Request (from 1) whose connection drops after half the chunk,
+#define HOST_CHECK_UPLOAD_PREEMPT_AT 4 // after which the capture is closed,
+#define HOST_CHECK_UPLOAD_CORRUPT_AT 6 // and whose chunk is damaged in transit.
+#define HOST_CHECK_UPLOAD_MAX_REQUESTS 16
+
+typedef struct
+{
+    const char *name;
+    uint32_t size;
+    uint32_t held; // Contiguous bytes the server holds.
+    uint8_t data[HOST_CHECK_UPLOAD_RAW_SIZE];
+} host_check_upload_segment_t;
+
+typedef struct
+{
+    int segment;
+    uint32_t offset;
+} host_check_upload_request_t;
+
+// The raw log, then the capture closed while it is on its way.
+static host_check_upload_segment_t host_check_upload_segments[2] = {
+    {.name = "LOG_FS/CHECK/RAW.ASC", .size = HOST_CHECK_UPLOAD_RAW_SIZE},
+    {.name = "ERR_FS/CHECK/CAPTURE.ASC", .size = HOST_CHECK_UPLOAD_CAPTURE_SIZE},
+};
+static host_check_upload_request_t host_check_upload_requests[HOST_CHECK_UPLOAD_MAX_REQUESTS];
+static uint32_t host_check_upload_request_count;
+static uint32_t host_check_upload_random;
+
+/// @brief Write a segment of random bytes on the card, the way a writer does: its directories are created with it
+/// (a directory found empty, and not active, is marked uploaded), it is registered open, then released.
+static bool writeHostCheckUploadFile(const host_check_upload_segment_t *segment)
+{
+    static char path[LOG_NAME_SIZE];
+    snprintf(path, sizeof(path), "%s", segment->name);
+    for (char *separator = strchr(path, '/'); separator; separator = strchr(separator + 1, '/'))
+    {
+        *separator = '\0';
+        f_mkdir(path);
+        *separator = '/';
+    }
+    snprintf(path, sizeof(path), MOUNT_POINT"/%s", segment->name);
+    registerOpenLogFile(path);
+    FILE *segment_f = fopen(path, "w");
+    bool written = segment_f != NULL;
+    for (uint32_t i = 0; written && i < segment->size; i++)
+        written = fputc(nextHostCheckRandom(&host_check_upload_random) & 0xFF, segment_f) != EOF;
+    if (segment_f && fclose(segment_f) != 0)
+        written = false;
+    releaseOpenLogFile(path);
+    return written;
+}
+
+/// @brief upload_transport_t of the check: a server keeping the bytes of each segment, with the faults of the network
+/// injected on given requests.
+static esp_err_t sendChunkHostCheck(const char *name, uint32_t offset, const uint8_t *data, size_t length, uint32_t crc,
+                                    uint32_t size, uint32_t *acked_offset)
+{
+    static uint8_t received[UPLOAD_CHUNK_SIZE];
+    host_check_upload_segment_t *segment = NULL;
+    int segment_index = -1;
+    for (int i = 0; i < 2 && !segment; i++)
+    {
+        if (strcmp(name, host_check_upload_segments[i].name) == 0)
+            segment = &host_check_upload_segments[segment_index = i];
+    }
+    uint32_t request = ++host_check_upload_request_count;
+    if (request <= HOST_CHECK_UPLOAD_MAX_REQUESTS)
+        host_check_upload_requests[request - 1] = (host_check_upload_request_t){segment_index, offset};
+    if (!segment || size != segment->size || offset > segment->held || length > size - offset)
+    {
+        *acked_offset = segment ? segment->held : 0; // 416.
+        return ESP_OK;
+    }
+
+    memcpy(received, data, length);
+    if (request == HOST_CHECK_UPLOAD_DROP_AT)
+        length /= 2;
+    if (request == HOST_CHECK_UPLOAD_CORRUPT_AT)
+        received[length / 2] ^= 0x10;
+    if (request == HOST_CHECK_UPLOAD_DROP_AT || esp_rom_crc32_le(0, received, length) == crc)
+    {
+        memcpy(segment->data + offset, received, length);
+        if (offset + length > segment->held)
+            segment->held = offset + length;
+    }
+    if (request == HOST_CHECK_UPLOAD_DROP_AT)
+        return ESP_FAIL; // No answer.
+    *acked_offset = segment->held;
+    if (request == HOST_CHECK_UPLOAD_PREEMPT_AT && !writeHostCheckUploadFile(&host_check_upload_segments[1]))
+        ESP_LOGE("HOST_CHECKS_H", "upload: cannot write %s", host_check_upload_segments[1].name);
+    return ESP_OK;
+}
+
+/// @brief Pick the next segment as uploadLogSegments() does: the oldest of the first class that has one.
+static int nextHostCheckUploadClass(upload_state_t *state)
+{
+    upload_scan_closed = logFilesClosed();
+    for (int class_id = 0; class_id < UPLOAD_CLASS_COUNT; class_id++)
+    {
+        if (scanUploadClass(class_id, state))
+            return class_id;
+    }
+    return -1;
+}
+
+static uint32_t checkUpload()
+{
+    static const upload_transport_t transport = {.send_chunk = sendChunkHostCheck};
+    static uint8_t chunk[UPLOAD_CHUNK_SIZE];
+    // uploadSegment() calls and what they must give: the raw log resumes where the server is, stops on the dropped
+    // connection, resumes from its state file, is set aside for the capture, backs off on the CRC reject and ends.
+    static const struct
+    {
+        upload_class_id_t class_id;
+        esp_err_t err;
+    } calls[] = {
+        {UPLOAD_CLASS_RAW, ESP_FAIL},
+        {UPLOAD_CLASS_RAW, ESP_ERR_NOT_FINISHED},
+        {UPLOAD_CLASS_CAPTURE, ESP_OK},
+        {UPLOAD_CLASS_RAW, ESP_ERR_INVALID_RESPONSE},
+        {UPLOAD_CLASS_RAW, ESP_OK},
+    };
+    static const host_check_upload_request_t expected[] = {
+        {0, 0},
+        {0, HOST_CHECK_UPLOAD_RAW_HELD},
+        {0, HOST_CHECK_UPLOAD_RAW_HELD + UPLOAD_CHUNK_SIZE},
+        {0, HOST_CHECK_UPLOAD_RAW_HELD + UPLOAD_CHUNK_SIZE},
+        {1, 0},
+        {0, HOST_CHECK_UPLOAD_RAW_HELD + 2 * UPLOAD_CHUNK_SIZE},
+        {0, HOST_CHECK_UPLOAD_RAW_HELD + 2 * UPLOAD_CHUNK_SIZE},
+    };
+    static const char *directories[] = {"LOG_FS", "LOG_FS/CHECK", "ERR_FS", "ERR_FS/CHECK"};
+    static uint8_t file_data[HOST_CHECK_UPLOAD_RAW_SIZE];
+    char work_directory[] = "/tmp/datafly_upload_XXXXXX";
+    char previous_directory[256];
+    upload_state_t state;
+    uint32_t failures = 0;
+
+    // A card of its own (the mount point is relative to the working directory), nothing else may be pending on it.
+    if (!getcwd(previous_directory, sizeof(previous_directory)) || !mkdtemp(work_directory) ||
+        chdir(work_directory) != 0 || esp_vfs_fat_sdspi_mount(MOUNT_POINT, NULL, NULL, NULL, NULL) != ESP_OK)
+    {
+        ESP_LOGE("HOST_CHECKS_H", "upload: cannot mount a card in %s", work_directory);
+        return 1;
+    }
+    if (nextHostCheckUploadClass(&state) >= 0)
+    {
+        ESP_LOGE("HOST_CHECKS_H", "upload: %s is pending on the card already", state.name);
+        chdir(previous_directory);
+        return 1;
+    }
+    host_check_upload_random = HOST_CHECK_SEED;
+    host_check_upload_request_count = 0;
+    for (int i = 0; i < 2; i++)
+        host_check_upload_segments[i].held = 0;
+    host_check_upload_segment_t *raw = &host_check_upload_segments[0];
+    FILE *raw_f = writeHostCheckUploadFile(raw) ? fopen(MOUNT_POINT"/LOG_FS/CHECK/RAW.ASC", "r") : NULL;
+    if (!raw_f || fread(raw->data, 1, HOST_CHECK_UPLOAD_RAW_HELD, raw_f) != HOST_CHECK_UPLOAD_RAW_HELD)
+        failures++;
+    raw->held = HOST_CHECK_UPLOAD_RAW_HELD;
+    if (raw_f)
+        fclose(raw_f);
+
+    for (int i = 0; i < sizeof(calls) / sizeof(calls[0]) && !failures; i++)
+    {
+        int class_id = nextHostCheckUploadClass(&state);
+        esp_err_t err = class_id == calls[i].class_id ? uploadSegment(&transport, class_id, &state, chunk) : ESP_OK;
+        if (class_id != calls[i].class_id || err != calls[i].err)
+        {
+            failures++;
+            if (reportHostCheckFailure())
+                ESP_LOGE("HOST_CHECKS_H", "upload: call %d: class %d gave %s, expected class %d and %s", i, class_id,
+                         esp_err_to_name(err), calls[i].class_id, esp_err_to_name(calls[i].err));
+        }
+    }
+
+    uint32_t request_count = sizeof(expected) / sizeof(expected[0]);
+    for (uint32_t i = 0; i < request_count || i < host_check_upload_request_count; i++)
+    {
+        host_check_upload_request_t none = {-1, 0};
+        const host_check_upload_request_t *sent =
+            i < host_check_upload_request_count ? &host_check_upload_requests[i] : &none;
+        const host_check_upload_request_t *wanted = i < request_count ? &expected[i] : &none;
+        if (sent->segment == wanted->segment && sent->offset == wanted->offset && sent != &none)
+            continue;
+        failures++;
+        if (reportHostCheckFailure())
+            ESP_LOGE("HOST_CHECKS_H", "upload: request %lu: segment %d at %lu, expected segment %d at %lu",
+                     (unsigned long)i + 1, sent->segment, (unsigned long)sent->offset, wanted->segment,
+                     (unsigned long)wanted->offset);
+    }
+
+    // The server holds both files, byte for byte, and the card nothing pending nor any upload in flight.
+    if (nextHostCheckUploadClass(&state) >= 0)
+    {
+        failures++;
+        if (reportHostCheckFailure())
+            ESP_LOGE("HOST_CHECKS_H", "upload: %s still pending", state.name);
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        host_check_upload_segment_t *segment = &host_check_upload_segments[i];
+        char path[LOG_NAME_SIZE];
+        snprintf(path, sizeof(path), MOUNT_POINT"/%s", segment->name);
+        FILE *segment_f = fopen(path, "r");
+        size_t read = segment_f ? fread(file_data, 1, segment->size, segment_f) : 0;
+        if (segment_f)
+            fclose(segment_f);
+        if (read != segment->size || segment->held != segment->size || memcmp(file_data, segment->data, read) != 0)
+        {
+            failures++;
+            if (reportHostCheckFailure())
+                ESP_LOGE("HOST_CHECKS_H", "upload: the server holds %lu bytes of %s, not the %lu of the file",
+                         (unsigned long)segment->held, segment->name, (unsigned long)segment->size);
+        }
+        remove(path);
+    }
+    for (int class_id = 0; class_id < UPLOAD_CLASS_COUNT; class_id++)
+    {
+        if (access(upload_classes[class_id].state_file, F_OK) == 0)
+        {
+            failures++;
+            if (reportHostCheckFailure())
+                ESP_LOGE("HOST_CHECKS_H", "upload: %s left behind", upload_classes[class_id].state_file);
+        }
+    }
+
+    for (int i = sizeof(directories) / sizeof(directories[0]) - 1; i >= 0; i--)
+    {
+        char path[LOG_NAME_SIZE];
+        snprintf(path, sizeof(path), MOUNT_POINT"/%s", directories[i]);
+        rmdir(path);
+    }
+    rmdir(MOUNT_POINT);
+    chdir(previous_directory);
+    rmdir(work_directory);
+    ESP_LOGI("HOST_CHECKS_H", "upload: %lu requests", (unsigned long)host_check_upload_request_count);
+    return failures;
+}
+
+static uint32_t checkHostMf4Case(const char *name, bool passed)
+{
+    if (passed)
+        return 0;
+    if (reportHostCheckFailure())
+        ESP_LOGE("HOST_CHECKS_H", "mf4: %s", name);
+    return 1;
+}
+
+/// @brief Group of frame i of the logs of the mf4 check: data, remote and error frames in turn.
+static inline mf4_group_index_t hostCheckMf4Group(uint32_t i)
+{
+    return i % MF4_GROUP_COUNT;
+}
+
+/// @brief Write frames first..first + count - 1 of the mf4 check to a log, through the writer of its channel.
+/// @param counts the records of each group written so far.
+static void writeHostCheckMf4Frames(FILE *file, mf4_log_t *log, uint32_t first, uint32_t count,
+                                    uint64_t counts[MF4_GROUP_COUNT])
+{
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        mf4_group_index_t group = hostCheckMf4Group(i);
+        uint32_t identifier = i % 2 ? 0x18DA0000 | i : i & 0x7FF;
+        if (log->channel == ASC_CHANNEL_TWAI)
+        {
+            timed_twai_message_t message = {.error_frame = group == MF4_ERROR_FRAME};
+            message.frame.identifier = identifier;
+            message.frame.extd = i % 2;
+            message.frame.rtr = group == MF4_REMOTE_FRAME;
+            message.frame.data_length_code = i % 9;
+            memset(message.frame.data, i, sizeof(message.frame.data));
+            writeMf4TwaiRecord(file, log, &message, i * 1000LL);
+        }
+        else
+        {
+            timed_can_frame_t message = {0};
+            message.frame.can_id = group == MF4_ERROR_FRAME ? CAN_ERR_FLAG
+                                   : identifier | (i % 2 ? CAN_EFF_FLAG : 0) |
+                                         (group == MF4_REMOTE_FRAME ? CAN_RTR_FLAG : 0);
+            message.frame.can_dlc = i % 9;
+            memset(message.frame.data, i, sizeof(message.frame.data));
+            writeMf4Mcp2515Record(file, log, &message, i * 1000LL);
+        }
+        if (group < MF4_GROUPS_WRITTEN)
+            counts[group]++;
+    }
+}
+
+/// @brief Read a finalised log back from its blocks.
+/// @param counts records of each group the log must hold: the first ones of the frames of the check.
+/// @param exact_size the file ends with the data block (false: bytes of a record cut short may follow).
+static uint32_t checkHostMf4File(const char *path, uint8_t channel, const uint64_t counts[MF4_GROUP_COUNT],
+                                 bool exact_size)
+{
+    uint32_t failures = 0;
+    uint8_t id[MF4_ID_SIZE];
+    uint64_t links[8], dt_header[3];
+    mf4_dg_data_t dg;
+    mf4_cg_data_t cg;
+    mf4_cn_data_t cn;
+    char text[32];
+    uint64_t data_bytes = 0;
+    FILE *file = fopen(path, "rb");
+
+    if (!file)
+        return checkHostMf4Case("log not found", false);
+    failures += checkHostMf4Case("ID block", fread(id, 1, sizeof(id), file) == sizeof(id) &&
+                                 memcmp(id, "MDF     4.11    ", 16) == 0 && id[28] == 411 % 256 &&
+                                 id[29] == 411 / 256 && id[60] == 0 && id[61] == 0);
+    failures += checkHostMf4Case("HD -> DG", readMf4Block(file, MF4_ID_SIZE, "##HD", links, 2, NULL, 0) &&
+                                 readMf4Block(file, links[1], "##FH", NULL, 0, NULL, 0) &&
+                                 readMf4Block(file, links[0], "##DG", links, 4, &dg, sizeof(dg)) && links[0] == 0 &&
+                                 dg.record_id_size == MF4_RECORD_ID_SIZE);
+    uint64_t dt = links[2];
+    uint64_t next = links[1];
+    for (int g = 0; g < MF4_GROUPS_WRITTEN; g++)
+    {
+        const mf4_group_t *group = &mf4_groups[g];
+        bool cg_read = readMf4Block(file, next, "##CG", links, 6, &cg, sizeof(cg));
+        next = links[0];
+        failures += checkHostMf4Case(group->name, cg_read && cg.data_bytes == group->record_bytes &&
+                                     cg.record_id == (MF4_RECORD_ID_SIZE ? g + 1 : 0) &&
+                                     readMf4Block(file, links[2], "##TX", NULL, 0, text, strlen(group->name) + 1) &&
+                                     strcmp(text, group->name) == 0);
+        failures += checkHostMf4Case("cycle count", cg_read && cg.cycle_count == counts[g]);
+        data_bytes += counts[g] * (MF4_RECORD_ID_SIZE + group->record_bytes);
+
+        // Timestamp (master) -> structure channel -> its members.
+        bool cn_read = cg_read && readMf4Block(file, links[1], "##CN", links, 8, &cn, sizeof(cn)) &&
+                       cn.type == MF4_CHANNEL_MASTER &&
+                       readMf4Block(file, links[0], "##CN", links, 8, &cn, sizeof(cn)) &&
+                       cn.byte_offset == 8 && cn.flags == MF4_CN_BUS_EVENT;
+        int members = 0;
+        uint64_t member = cn_read ? links[1] : 0;
+        for (; member && members < MF4_MEMBER_COUNT; member = links[0])
+        {
+            if (!readMf4Block(file, member, "##CN", links, 8, &cn, sizeof(cn)) ||
+                cn.byte_offset != mf4_members[members].byte_offset)
+                break;
+            members++;
+        }
+        failures += checkHostMf4Case("channels", cn_read && !member && members == group->member_count);
+    }
+    failures += checkHostMf4Case("CG chain end", next == 0);
+
+    fseek(file, 0, SEEK_END);
+    uint64_t size = ftell(file);
+    failures += checkHostMf4Case("DT block", fseek(file, dt, SEEK_SET) == 0 &&
+                                 fread(dt_header, 1, sizeof(dt_header), file) == sizeof(dt_header) &&
+                                 memcmp(dt_header, "##DT", 4) == 0 && dt_header[1] == MF4_HEADER_SIZE + data_bytes &&
+                                 (exact_size ? size == dt + dt_header[1] : size >= dt + dt_header[1]));
+
+    // The records, in the order of the frames.
+    uint32_t frame = 0;
+    for (uint64_t offset = 0; offset < data_bytes && !ferror(file);)
+    {
+        mf4_can_record_t record = {0};
+        while (hostCheckMf4Group(frame) >= MF4_GROUPS_WRITTEN)
+            frame++;
+        mf4_group_index_t g = hostCheckMf4Group(frame);
+        size_t record_size = MF4_RECORD_ID_SIZE + mf4_groups[g].record_bytes;
+        bool record_read = fread((uint8_t *)&record + 1 - MF4_RECORD_ID_SIZE, 1, record_size, file) == record_size;
+        failures += checkHostMf4Case("record", record_read && record.timestamp_us == frame * 1000LL &&
+                                     record.bus_channel == channel &&
+                                     record.record_id == (MF4_RECORD_ID_SIZE ? g + 1 : 0));
+        offset += record_size;
+        frame++;
+    }
+    fclose(file);
+    return failures;
+}
+
+static uint32_t checkMf4()
+{
+    char directory[] = "/tmp/datafly_mf4_XXXXXX";
+    char path[64];
+    uint64_t counts[MF4_GROUP_COUNT] = {0};
+    uint32_t failures = 0;
+    mf4_log_t log;
+
+    if (!mkdtemp(directory))
+        return checkHostMf4Case("no temporary directory", false);
+
+    // A log written and finalised, with a checkpoint on the way.
+    snprintf(path, sizeof(path), "%s/whole.mf4", directory);
+    FILE *file = fopen(path, "w");
+    failures += checkHostMf4Case("header", file && writeMf4Header(file, NULL, &log, 0, ASC_CHANNEL_TWAI));
+    if (file)
+    {
+        writeHostCheckMf4Frames(file, &log, 0, HOST_CHECK_MF4_CHECKPOINT, counts);
+        file = checkpointMf4Log(file, path, &log);
+        if (file)
+            writeHostCheckMf4Frames(file, &log, HOST_CHECK_MF4_CHECKPOINT,
+                                    HOST_CHECK_MF4_FRAMES - HOST_CHECK_MF4_CHECKPOINT, counts);
+        finalizeMf4Log(file, path, &log);
+        failures += checkHostMf4File(path, ASC_CHANNEL_TWAI, counts, true);
+    }
+    unlink(path);
+
+    // A log left unfinalised after its last checkpoint, its last record cut short.
+    snprintf(path, sizeof(path), "%s/cut.mf4", directory);
+    memset(counts, 0, sizeof(counts));
+    file = fopen(path, "w");
+    failures += checkHostMf4Case("header", file && writeMf4Header(file, NULL, &log, 0, ASC_CHANNEL_MCP2515));
+    if (file)
+    {
+        writeHostCheckMf4Frames(file, &log, 0, HOST_CHECK_MF4_CHECKPOINT, counts);
+        file = checkpointMf4Log(file, path, &log);
+        uint32_t last = HOST_CHECK_MF4_FRAMES - 1;
+        while (hostCheckMf4Group(last) >= MF4_GROUPS_WRITTEN)
+            last--;
+        if (file)
+        {
+            writeHostCheckMf4Frames(file, &log, HOST_CHECK_MF4_CHECKPOINT, last + 1 - HOST_CHECK_MF4_CHECKPOINT,
+                                    counts);
+            fclose(file);
+        }
+        counts[hostCheckMf4Group(last)]--;
+        struct stat info;
+        failures += checkHostMf4Case("cut", stat(path, &info) == 0 && truncate(path, info.st_size - 3) == 0);
+        failures += checkHostMf4Case("recovered", recoverMf4Log(path));
+        failures += checkHostMf4File(path, ASC_CHANNEL_MCP2515, counts, false);
+        failures += checkHostMf4Case("recovered twice", !recoverMf4Log(path));
+    }
+    unlink(path);
+    rmdir(directory);
+
+    // A file with room for the header and two data frames and a half: the third one is taken back.
+    static uint8_t memory[8192];
+    mf4_layout_t layout;
+    size_t record_size = MF4_RECORD_ID_SIZE + mf4_groups[MF4_DATA_FRAME].record_bytes;
+    layoutMf4Log(&layout, &log, 0, ASC_CHANNEL_TWAI);
+    size_t memory_size = log.dt + MF4_HEADER_SIZE + 5 * record_size / 2;
+    uint32_t losses_before[FRAME_LOSS_STAGE_COUNT], losses[FRAME_LOSS_STAGE_COUNT];
+    file = memory_size <= sizeof(memory) ? fmemopen(memory, memory_size, "w+") : NULL;
+    failures += checkHostMf4Case("memory stream", file && setvbuf(file, NULL, _IONBF, 0) == 0 &&
+                                 writeMf4Header(file, NULL, &log, 0, ASC_CHANNEL_TWAI));
+    if (file)
+    {
+        getFrameLosses(losses_before);
+        for (uint32_t i = 0; i < 4; i++)
+        {
+            timed_twai_message_t message = {.frame = {.identifier = 0x100 + i, .data_length_code = 8}};
+            memset(message.frame.data, 0xA0 + i, sizeof(message.frame.data));
+            writeMf4TwaiRecord(file, &log, &message, i);
+            checkFrameWritten(file, FRAME_LOSS_TWAI_WRITE_FAILED);
+        }
+        getFrameLosses(losses);
+        long position = ftell(file);
+        fclose(file);
+        mf4_can_record_t second;
+        memcpy((uint8_t *)&second + 1 - MF4_RECORD_ID_SIZE, memory + log.dt + MF4_HEADER_SIZE + record_size,
+               record_size);
+        failures += checkHostMf4Case("short write",
+                                     log.data_bytes == 2 * record_size && log.groups[MF4_DATA_FRAME].cycle_count == 2 &&
+                                     position == log.dt + MF4_HEADER_SIZE + log.data_bytes &&
+                                     losses[FRAME_LOSS_TWAI_WRITE_FAILED] ==
+                                         losses_before[FRAME_LOSS_TWAI_WRITE_FAILED] + 2 &&
+                                     second.timestamp_us == 1 && second.id_ide == 0x101 && second.data[7] == 0xA1);
+    }
+    return failures;
+}
+
+static const host_check_t host_checks[] = {
+    {"signal_kernels", checkSignalKernels},
+    {"fixed_decode", checkFixedDecode},
+    {"vehicle_lookup", checkVehicleLookup},
+    {"json_fixed", checkJsonFixed},
+    {"segment_order", checkSegmentOrder},
+    {"asc_golden", checkAscGolden},
+    {"trace_parse", checkTraceParse},
+    {"modem", checkModem},
+    {"signal_store", checkSignalStore},
+    {"upload", checkUpload},
+    {"mf4", checkMf4},
+};
+#define HOST_CHECK_COUNT (sizeof(host_checks) / sizeof(host_checks[0]))
+
+/// @brief Run every host check, then exit the process: status 0 if all of them passed, 1 otherwise.
+void runHostChecks()
+{
+    uint32_t failed = 0;
+    for (int i = 0; i < HOST_CHECK_COUNT; i++)
+    {
+        host_check_reports = 0;
+        uint32_t failures = host_checks[i].run();
+        if (failures)
+            ESP_LOGE("HOST_CHECKS_H", "%s: FAILED, %lu cases differ", host_checks[i].name, (unsigned long)failures);
+        else
+            ESP_LOGI("HOST_CHECKS_H", "%s: passed", host_checks[i].name);
+        failed += failures != 0;
+    }
+    if (failed)
+        printf("host checks: %lu failed\n", (unsigned long)failed);
+    else
+        printf("host checks: all passed\n");
+    fflush(stdout);
+    exit(failed ? 1 : 0);
+}
+
+#endif // CONFIG_DATAFLY_HOST_CHECKS
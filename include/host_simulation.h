@@ -0,0 +1,150 @@
+// Host simulation run (linux target, the hardware is components/host_sim): both virtual buses get
+// CONFIG_DATAFLY_HOST_FRAMES frames, the trigger button is pressed once CONFIG_DATAFLY_HOST_TRIGGER_AT_FRAME frames
+// went through the TWAI bus, and once the queues are drained the writers close their files (stopLogWriters()), the
+// throughput is printed and the process exits. The log files are left, complete, in CONFIG_DATAFLY_HOST_CARD_DIR.
+// With CONFIG_DATAFLY_HOST_REPLAY_FILE, the buses replay a trace instead (trace_replay.h).
+// With CONFIG_DATAFLY_UPLOAD_ENABLED, the run ends once the uploader sent every log to CONFIG_DATAFLY_UPLOAD_URL
+// (tools/upload_server.py), and fails if that takes more than HOST_SIMULATION_UPLOAD_TIMEOUT_MS.
+// Generated frames are deterministic: three in four carry one of vehicle_messages (decoded by sendCanDataMCP2515), the others
+// an identifier the logger does not know, payloads come from a fixed-seed xorshift. Two runs write the same lines,
+// times aside.
+// Build and run:
+//   idf.py -B build_host -D SDKCONFIG=build_host/sdkconfig --preview set-target linux
+//   idf.py -B build_host -D SDKCONFIG=build_host/sdkconfig build
+//   ./build_host/Data-Fly.elf
+// pytest_host_sim.py runs it with sdkconfig.ci.host_sim and checks the exit status, the throughput line and the frames
+// of the logs, and with sdkconfig.ci.host_replay, where the logs must give back the frames of the trace replayed.
+#pragma once
+#include <stdlib.h>
+#include "host_sim.h"
+
+#define HOST_SIMULATION_POLL_MS 100
+#define HOST_SIMULATION_UPLOAD_TIMEOUT_MS 120000
+#define HOST_SIMULATION_SEED 0x2545F491
+
+typedef struct
+{
+    uint32_t remaining;
+    uint32_t state;     // xorshift32.
+    int64_t period_us;  // 0: as fast as the logger reads.
+    int64_t next_due_us;
+} host_frame_source_t;
+
+static inline uint32_t nextHostRandom(host_frame_source_t *source)
+{
+    uint32_t x = source->state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return source->state = x;
+}
+
+/// @brief virtual_can_source_t of the simulation run.
+static bool nextHostFrame(void *context, virtual_can_frame_t *frame)
+{
+    host_frame_source_t *source = context;
+    if (!source->remaining)
+        return false;
+    source->remaining--;
+
+    uint32_t x = nextHostRandom(source);
+    memset(frame, 0, sizeof(*frame));
+    if (x & 3)
+        frame->identifier = vehicle_messages[(x >> 2) % VEHICLE_MESSAGE_COUNT].id;
+    else
+        frame->identifier = 0x100 + ((x >> 2) & 0x3FF);
+    frame->dlc = 8;
+    uint32_t low = nextHostRandom(source), high = nextHostRandom(source);
+    memcpy(frame->data, &low, 4);
+    memcpy(frame->data + 4, &high, 4);
+    if (source->period_us)
+        frame->due_us = source->next_due_us += source->period_us;
+    return true;
+}
+
+/// @brief Whether every frame received has been handed to the writers.
+static bool isHostPipelineDrained()
+{
+    return uxQueueMessagesWaiting(file_data_queue) == 0 && uxQueueMessagesWaiting(file_data_queue_mcp2515) == 0 &&
+           uxQueueMessagesWaiting(trigger_err_data_queue) == 0 &&
+           uxQueueMessagesWaiting(trigger_err_data_queue_mcp2515) == 0;
+}
+
+/// @brief Task: run the simulation, then exit the process.
+void runHostSimulation(void *pvParameter)
+{
+    static host_frame_source_t sources[VIRTUAL_CAN_BUS_COUNT];
+    static trace_replay_t replays[VIRTUAL_CAN_BUS_COUNT];
+    virtual_can_stats_t stats[VIRTUAL_CAN_BUS_COUNT];
+    bool triggered = CONFIG_DATAFLY_HOST_TRIGGER_AT_FRAME == 0;
+    int64_t start_us = esp_timer_get_time();
+
+    // Frames due as soon as there is room: nothing may be lost, the receivers wait for the writers.
+    if (CONFIG_DATAFLY_HOST_REPLAY_FILE[0] ? CONFIG_DATAFLY_REPLAY_SPEED_PERCENT == 0
+                                           : CONFIG_DATAFLY_HOST_FRAME_PERIOD_US == 0)
+        ingest_queue_wait = portMAX_DELAY;
+
+    for (int bus = 0; bus < VIRTUAL_CAN_BUS_COUNT; bus++)
+    {
+        if (CONFIG_DATAFLY_HOST_REPLAY_FILE[0])
+        {
+            if (traceReplayOpen(&replays[bus], CONFIG_DATAFLY_HOST_REPLAY_FILE, bus + 1,
+                                CONFIG_DATAFLY_REPLAY_SPEED_PERCENT, start_us))
+                virtualCanAttach(bus, nextReplayFrame, &replays[bus]);
+            else
+                exit(1);
+            continue;
+        }
+        sources[bus] = (host_frame_source_t){.remaining = CONFIG_DATAFLY_HOST_FRAMES,
+                                             .state = HOST_SIMULATION_SEED + bus,
+                                             .period_us = CONFIG_DATAFLY_HOST_FRAME_PERIOD_US,
+                                             .next_due_us = start_us};
+        virtualCanAttach(bus, nextHostFrame, &sources[bus]);
+    }
+
+    while (true)
+    {
+        vTaskDelay(pdMS_TO_TICKS(HOST_SIMULATION_POLL_MS));
+        for (int bus = 0; bus < VIRTUAL_CAN_BUS_COUNT; bus++)
+            virtualCanGetStats(bus, &stats[bus]);
+        // triggerActive() ignores presses in the first debounce delay after boot.
+        if (!triggered && stats[VIRTUAL_CAN_TWAI].delivered >= CONFIG_DATAFLY_HOST_TRIGGER_AT_FRAME &&
+            xTaskGetTickCount() > pdMS_TO_TICKS(DEBOUNCE_DELAY_MS))
+        {
+            virtualGpioTrigger(INPUT_PIN);
+            triggered = true;
+        }
+        if (stats[VIRTUAL_CAN_TWAI].finished && stats[VIRTUAL_CAN_MCP2515].finished && isHostPipelineDrained())
+            break;
+    }
+    double elapsed_s = (esp_timer_get_time() - start_us) * 1e-6;
+    // The logs get their footer, or are finalised (MF4), before the process ends.
+    stopLogWriters();
+    while (!logWritersStopped())
+        vTaskDelay(pdMS_TO_TICKS(HOST_SIMULATION_POLL_MS));
+    uint64_t total = 0;
+    for (int bus = 0; bus < VIRTUAL_CAN_BUS_COUNT; bus++)
+    {
+        printf("bus %d: %llu frames delivered, %llu lost\n", bus, (unsigned long long)stats[bus].delivered,
+               (unsigned long long)stats[bus].overrun);
+        total += stats[bus].delivered;
+    }
+    printf("%llu frames in %.3f s, %.0f frames/s\n", (unsigned long long)total, elapsed_s, total / elapsed_s);
+    fflush(stdout);
+#ifdef CONFIG_DATAFLY_UPLOAD_ENABLED
+    int64_t upload_start_us = esp_timer_get_time();
+    while (!isUploadDone())
+    {
+        if (esp_timer_get_time() - upload_start_us >= HOST_SIMULATION_UPLOAD_TIMEOUT_MS * 1000LL)
+        {
+            printf("uploads: timed out\n");
+            fflush(stdout);
+            exit(1);
+        }
+        vTaskDelay(pdMS_TO_TICKS(HOST_SIMULATION_POLL_MS));
+    }
+    printf("uploads: done\n");
+    fflush(stdout);
+#endif
+    exit(0);
+}
@@ -0,0 +1,299 @@
+// JSON output without heap churn, for telemetry messages.
+// Two tools live here:
+// - json_arena_t: a bump allocator to install as cJSON hooks (cJSON_InitHooks). Every node and print buffer of a
+//   message is carved out of one static buffer and the whole message is released at once with jsonArenaReset(),
+//   cJSON_Delete() becomes a no-op. Hooks are global to cJSON, so only install an arena while a single task uses cJSON.
+// - json_writer_t: a streaming writer that prints straight into a caller's fixed buffer, no tree is built at all.
+//   Numbers are formatted with integer arithmetic (no stdio, no dtoa allocations). Preferred for anything periodic.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "cJSON.h"
+
+// ------------------------------ Arena allocator for cJSON ------------------------------ //
+
+#define JSON_ARENA_ALIGNMENT 8
+
+typedef struct
+{
+    uint8_t *buffer;
+    size_t size;
+    size_t used;
+    size_t high_water; // Highest use since the arena was created, to size the buffer.
+    uint32_t allocations;
+    uint32_t failures; // Allocations refused because the arena was full (cJSON then reports a NULL item).
+} json_arena_t;
+
+static json_arena_t *json_arena_active = NULL;
+
+void jsonArenaInit(json_arena_t *arena, uint8_t *buffer, size_t size)
+{
+    memset(arena, 0, sizeof(*arena));
+    arena->buffer = buffer;
+    arena->size = size;
+}
+
+static void *jsonArenaMalloc(size_t size)
+{
+    json_arena_t *arena = json_arena_active;
+    size_t start = (arena->used + JSON_ARENA_ALIGNMENT - 1) & ~(size_t)(JSON_ARENA_ALIGNMENT - 1);
+    if (start + size > arena->size)
+    {
+        arena->failures++;
+        return NULL;
+    }
+    arena->used = start + size;
+    if (arena->used > arena->high_water)
+        arena->high_water = arena->used;
+    arena->allocations++;
+    return &arena->buffer[start];
+}
+
+static void jsonArenaFree(void *pointer)
+{
+    // Released all at once by jsonArenaReset().
+    (void)pointer;
+}
+
+/// @brief Route every cJSON allocation to the arena until jsonArenaUninstall().
+void jsonArenaInstall(json_arena_t *arena)
+{
+    cJSON_Hooks hooks = {
+        .malloc_fn = jsonArenaMalloc,
+        .free_fn = jsonArenaFree,
+    };
+    json_arena_active = arena;
+    cJSON_InitHooks(&hooks);
+}
+
+void jsonArenaUninstall()
+{
+    cJSON_InitHooks(NULL);
+    json_arena_active = NULL;
+}
+
+/// @brief Release everything allocated for the previous message. Any cJSON item or printed string of that message
+/// is invalid afterwards.
+void jsonArenaReset(json_arena_t *arena)
+{
+    arena->used = 0;
+    arena->allocations = 0;
+}
+
+// ------------------------------ Streaming writer ------------------------------ //
+
+// Decimals kept by jsonWriterFixed(), bounded so that the integer part of any Q.16 value (below 2^47) times
+// 10^decimals fits in a uint64_t.
+#define JSON_WRITER_MAX_DECIMALS 4
+
+typedef struct
+{
+    char *buffer;
+    size_t size;
+    size_t length;
+    bool need_comma;
+    bool after_key;
+    bool overflow; // Set once something did not fit, the output is then unusable.
+} json_writer_t;
+
+void jsonWriterInit(json_writer_t *writer, char *buffer, size_t size)
+{
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->length = 0;
+    writer->need_comma = false;
+    writer->after_key = false;
+    writer->overflow = size == 0;
+}
+
+static inline void jsonWriterRaw(json_writer_t *writer, const char *text, size_t length)
+{
+    // One byte is always kept for the terminating 0.
+    if (writer->overflow || writer->length + length >= writer->size)
+    {
+        writer->overflow = true;
+        return;
+    }
+    memcpy(&writer->buffer[writer->length], text, length);
+    writer->length += length;
+}
+
+static inline void jsonWriterChar(json_writer_t *writer, char c)
+{
+    jsonWriterRaw(writer, &c, 1);
+}
+
+// Comma between members/elements, nothing between a key and its value.
+static inline void jsonWriterSeparator(json_writer_t *writer)
+{
+    if (writer->after_key)
+        writer->after_key = false;
+    else if (writer->need_comma)
+        jsonWriterChar(writer, ',');
+}
+
+static void jsonWriterQuoted(json_writer_t *writer, const char *text)
+{
+    static const char hex_digits[] = "0123456789abcdef";
+    jsonWriterChar(writer, '"');
+    for (const char *c = text; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            char escaped[2] = {'\\', *c};
+            jsonWriterRaw(writer, escaped, 2);
+        }
+        else if ((uint8_t)*c < 0x20)
+        {
+            char escaped[6] = {'\\', 'u', '0', '0', hex_digits[(uint8_t)*c >> 4], hex_digits[*c & 0xF]};
+            jsonWriterRaw(writer, escaped, 6);
+        }
+        else
+        {
+            jsonWriterChar(writer, *c);
+        }
+    }
+    jsonWriterChar(writer, '"');
+}
+
+static void jsonWriterDigits(json_writer_t *writer, uint64_t value, uint8_t min_digits)
+{
+    char digits[20];
+    uint8_t count = 0;
+    do
+    {
+        digits[sizeof(digits) - 1 - count++] = '0' + value % 10;
+        value /= 10;
+    } while (value || count < min_digits);
+    jsonWriterRaw(writer, &digits[sizeof(digits) - count], count);
+}
+
+void jsonWriterBeginObject(json_writer_t *writer)
+{
+    jsonWriterSeparator(writer);
+    jsonWriterChar(writer, '{');
+    writer->need_comma = false;
+}
+
+void jsonWriterEndObject(json_writer_t *writer)
+{
+    jsonWriterChar(writer, '}');
+    writer->need_comma = true;
+}
+
+void jsonWriterBeginArray(json_writer_t *writer)
+{
+    jsonWriterSeparator(writer);
+    jsonWriterChar(writer, '[');
+    writer->need_comma = false;
+}
+
+void jsonWriterEndArray(json_writer_t *writer)
+{
+    jsonWriterChar(writer, ']');
+    writer->need_comma = true;
+}
+
+void jsonWriterKey(json_writer_t *writer, const char *key)
+{
+    jsonWriterSeparator(writer);
+    jsonWriterQuoted(writer, key);
+    jsonWriterChar(writer, ':');
+    writer->after_key = true;
+}
+
+void jsonWriterString(json_writer_t *writer, const char *value)
+{
+    jsonWriterSeparator(writer);
+    jsonWriterQuoted(writer, value);
+    writer->need_comma = true;
+}
+
+void jsonWriterBool(json_writer_t *writer, bool value)
+{
+    jsonWriterSeparator(writer);
+    if (value)
+        jsonWriterRaw(writer, "true", 4);
+    else
+        jsonWriterRaw(writer, "false", 5);
+    writer->need_comma = true;
+}
+
+void jsonWriterInt(json_writer_t *writer, int64_t value)
+{
+    jsonWriterSeparator(writer);
+    if (value < 0)
+        jsonWriterChar(writer, '-');
+    jsonWriterDigits(writer, value < 0 ? -(uint64_t)value : (uint64_t)value, 1);
+    writer->need_comma = true;
+}
+
+// Writes integer_part.fraction, fraction having `decimals` digits with the trailing zeros removed.
+static void jsonWriterScaled(json_writer_t *writer, bool negative, uint64_t scaled, uint64_t power, uint8_t decimals)
+{
+    uint64_t integer_part = scaled / power;
+    uint64_t fraction = scaled % power;
+    while (decimals && fraction && fraction % 10 == 0)
+    {
+        fraction /= 10;
+        decimals--;
+    }
+
+    jsonWriterSeparator(writer);
+    if (negative && scaled)
+        jsonWriterChar(writer, '-');
+    jsonWriterDigits(writer, integer_part, 1);
+    if (fraction)
+    {
+        jsonWriterChar(writer, '.');
+        jsonWriterDigits(writer, fraction, decimals);
+    }
+    writer->need_comma = true;
+}
+
+/// @brief Write a Q.16 value (see canSignalDecodeFixed()) rounded to `decimals` digits, integer arithmetic only.
+void jsonWriterFixed(json_writer_t *writer, int64_t value, uint8_t decimals)
+{
+    if (decimals > JSON_WRITER_MAX_DECIMALS)
+        decimals = JSON_WRITER_MAX_DECIMALS;
+    uint64_t power = 1;
+    for (uint8_t i = 0; i < decimals; i++)
+        power *= 10;
+
+    // The integer and fraction parts are scaled apart: the whole magnitude times power overflows above 2^64 / 10^4.
+    uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+    uint64_t scaled = (magnitude >> 16) * power + (((magnitude & 0xFFFF) * power + ((uint64_t)1 << 15)) >> 16);
+    jsonWriterScaled(writer, value < 0, scaled, power, decimals);
+}
+
+/// @brief Write a float rounded to `decimals` digits (up to 9). Not a number and infinities are written as null,
+/// which JSON has no other way to express.
+void jsonWriterFloat(json_writer_t *writer, float value, uint8_t decimals)
+{
+    if (decimals > 9)
+        decimals = 9;
+    uint64_t power = 1;
+    for (uint8_t i = 0; i < decimals; i++)
+        power *= 10;
+
+    double magnitude = value < 0 ? -(double)value : (double)value;
+    if (!(magnitude * power < 1.8e19)) // Also true for NaN.
+    {
+        jsonWriterSeparator(writer);
+        jsonWriterRaw(writer, "null", 4);
+        writer->need_comma = true;
+        return;
+    }
+    jsonWriterScaled(writer, value < 0, (uint64_t)(magnitude * power + 0.5), power, decimals);
+}
+
+/// @brief Terminate the output.
+/// @return the JSON text, or NULL if the buffer was too small.
+const char *jsonWriterFinish(json_writer_t *writer)
+{
+    if (writer->overflow)
+        return NULL;
+    writer->buffer[writer->length] = '\0';
+    return writer->buffer;
+}
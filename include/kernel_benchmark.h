@@ -0,0 +1,473 @@
+// Kernel microbenchmarks (CONFIG_DATAFLY_BENCHMARK_ENABLED): time the per-frame kernels of the logger so that an
+// optimisation of them is judged on numbers.
+// runKernelBenchmarks() is called at the start of app_main, before anything else runs. On a unit it times with the
+// CPU cycle counter of its core, then boot goes on; on the host build (linux target) with the monotonic clock, then
+// the process exits, which makes the host build with this option the benchmark program:
+//   idf.py -B build_host -D SDKCONFIG=build_host/sdkconfig menuconfig   (DataFLY Configuration > Run the kernel...)
+//   idf.py -B build_host -D SDKCONFIG=build_host/sdkconfig build && ./build_host/Data-Fly.elf
+// Every kernel runs over the same fixed mix of BENCHMARK_FRAME_MIX frames (three in four of vehicle_messages, the
+// others unknown identifiers, short frames and remote requests, deterministic payloads): one warm-up pass, then
+// BENCHMARK_REPEATS timed passes of CONFIG_DATAFLY_BENCHMARK_OPERATIONS operations, the fastest is reported, as
+// ns/op (and cycles/op on a unit) and bytes/s of the data each operation consumes or produces:
+// - extract_signal, store_signal, decode: the generic kernels of can_encoder_decoder.h, one signal per operation,
+//   over benchmark_layouts (Intel and Motorola, signed and unsigned, 1 to 32 bits). Bytes: the 8 bytes of the frame.
+// - extract_compiled, decode_compiled: canSignalExtract() and canSignalDecode() on the same layouts, compiled.
+// - decode_frame, decode_frame_fixed: decodeVehicleFrame(Fixed)(), one frame per operation (identifier lookup
+//   included).
+// - asc_twai_line, asc_mcp2515_line: the log line formatters of file_handle.h into a memory stream. Bytes: the
+//   text written.
+// - mf4_twai_record: the MF4 records of the frames (mf4_writer.h) into a memory stream. Bytes: the records written.
+// - asc_format, asc_stdio: formatAscFrameLine() (asc_format.h) into a buffer, and the same line with fprintf()
+//   (formatAscLineStdio()), into a memory stream.
+// - json_writer, cjson_print: the cluster state as JSON, with json_writer.h and with a cJSON tree (arena hooks,
+//   printed into a preallocated buffer). Bytes: the text written.
+// asc_format and asc_stdio time two formatters that must write the same lines: the host check asc_golden
+// (host_checks.h) compares them.
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "cJSON.h"
+#include "json_writer.h"
+#include "cluster_state.h"
+
+#ifdef CONFIG_DATAFLY_BENCHMARK_ENABLED
+
+#define BENCHMARK_FRAME_MIX 256 // Power of two.
+#define BENCHMARK_REPEATS 5
+#define BENCHMARK_SEED 0x2545F491
+#define BENCHMARK_STREAM_SIZE 4096
+#define BENCHMARK_JSON_SIZE 512
+#define BENCHMARK_ARENA_SIZE 4096
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+typedef uint64_t benchmark_ticks_t;
+#define BENCHMARK_TICKS_PER_US 1000 // ns.
+
+static inline benchmark_ticks_t benchmarkTicks()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+#else
+#include "esp_cpu.h"
+typedef uint32_t benchmark_ticks_t; // Cycles, wraps every 2^32 / CPU frequency (17 s at 240 MHz).
+#define BENCHMARK_TICKS_PER_US CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+
+static inline benchmark_ticks_t benchmarkTicks()
+{
+    return esp_cpu_get_cycle_count();
+}
+#endif
+
+typedef struct
+{
+    uint8_t startbit;
+    uint8_t length;
+    bool is_big_endian;
+    bool is_signed;
+    float factor;
+    float offset;
+} benchmark_signal_layout_t;
+
+static const benchmark_signal_layout_t benchmark_layouts[] = {
+    {0, 1, false, false, 1, 0},       // Flag.
+    {11, 7, false, false, 1, 0},      // Vehicle speed.
+    {25, 24, false, false, 0.1, 0},   // Odometer.
+    {34, 8, false, false, 1, 0},      // Remaining autonomy.
+    {40, 16, false, true, 0.05, 0},   // Intel signed word.
+    {32, 32, false, false, 1, 0},     // Intel 32 bits.
+    {56, 16, true, false, 0.01, 0},   // Motorola word.
+    {44, 12, true, true, 0.1, -40},   // Motorola signed, across bytes.
+};
+#define BENCHMARK_LAYOUT_COUNT (sizeof(benchmark_layouts) / sizeof(benchmark_layouts[0]))
+
+typedef struct
+{
+    const char *name;
+    uint64_t (*run)(uint32_t operations); // Returns the bytes consumed or produced.
+} kernel_benchmark_t;
+
+static timed_twai_message_t benchmark_twai_frames[BENCHMARK_FRAME_MIX];
+static timed_can_frame_t benchmark_mcp2515_frames[BENCHMARK_FRAME_MIX];
+static can_signal_t benchmark_signals[BENCHMARK_LAYOUT_COUNT];
+static volatile uint64_t benchmark_sink; // Results go here so that the compiler keeps the kernels.
+
+static inline uint32_t nextBenchmarkRandom(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/// @brief Build the frame mix (same frames on both buses) and compile the layouts.
+static void initBenchmarkFrames()
+{
+    uint32_t state = BENCHMARK_SEED;
+    vehicleSignalsInit();
+    for (int i = 0; i < BENCHMARK_LAYOUT_COUNT; i++)
+    {
+        const benchmark_signal_layout_t *layout = &benchmark_layouts[i];
+        benchmark_signals[i] = canSignalCompile(layout->startbit, layout->length, layout->is_big_endian,
+                                                layout->is_signed, layout->factor, layout->offset);
+    }
+    for (int i = 0; i < BENCHMARK_FRAME_MIX; i++)
+    {
+        uint32_t x = nextBenchmarkRandom(&state);
+        timed_twai_message_t *twai = &benchmark_twai_frames[i];
+        timed_can_frame_t *mcp2515 = &benchmark_mcp2515_frames[i];
+        memset(twai, 0, sizeof(*twai));
+        memset(mcp2515, 0, sizeof(*mcp2515));
+
+        twai->frame.identifier = x & 3 ? vehicle_messages[(x >> 2) % VEHICLE_MESSAGE_COUNT].id : 0x100 + ((x >> 2) & 0x3FF);
+        twai->frame.data_length_code = (x >> 12) % 8 == 0 ? (x >> 16) % 9 : 8;
+        twai->frame.rtr = (x >> 20) % 32 == 0;
+        uint32_t low = nextBenchmarkRandom(&state), high = nextBenchmarkRandom(&state);
+        memcpy(twai->frame.data, &low, 4);
+        memcpy(twai->frame.data + 4, &high, 4);
+        twai->rx_time_us = (int64_t)i * 1237 + (x >> 24) * 1000000LL;
+        twai->sequence = i;
+
+        mcp2515->frame.can_id = twai->frame.identifier;
+        mcp2515->frame.can_dlc = twai->frame.data_length_code;
+        memcpy(mcp2515->frame.data, twai->frame.data, 8);
+        mcp2515->rx_time_us = twai->rx_time_us;
+        mcp2515->sequence = i;
+    }
+}
+
+static uint64_t benchmarkExtractSignal(uint32_t operations)
+{
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < operations; i++)
+    {
+        const benchmark_signal_layout_t *layout = &benchmark_layouts[i % BENCHMARK_LAYOUT_COUNT];
+        sum += extractSignal(benchmark_twai_frames[i % BENCHMARK_FRAME_MIX].frame.data, layout->startbit,
+                             layout->length, layout->is_big_endian, layout->is_signed);
+    }
+    benchmark_sink = sum;
+    return (uint64_t)operations * 8;
+}
+
+static uint64_t benchmarkStoreSignal(uint32_t operations)
+{
+    uint8_t frame[8] = {0};
+    for (uint32_t i = 0; i < operations; i++)
+    {
+        const benchmark_signal_layout_t *layout = &benchmark_layouts[i % BENCHMARK_LAYOUT_COUNT];
+        storeSignal(frame, i * 0x9E3779B9u, layout->startbit, layout->length, layout->is_big_endian,
+                    layout->is_signed);
+    }
+    benchmark_sink = loadFrameLittleEndian(frame);
+    return (uint64_t)operations * 8;
+}
+
+static uint64_t benchmarkDecode(uint32_t operations)
+{
+    float sum = 0;
+    for (uint32_t i = 0; i < operations; i++)
+    {
+        const benchmark_signal_layout_t *layout = &benchmark_layouts[i % BENCHMARK_LAYOUT_COUNT];
+        sum += decode(benchmark_twai_frames[i % BENCHMARK_FRAME_MIX].frame.data, layout->startbit, layout->length,
+                      layout->is_big_endian, layout->is_signed, layout->factor, layout->offset);
+    }
+    benchmark_sink = (uint64_t)(int64_t)sum;
+    return (uint64_t)operations * 8;
+}
+
+static uint64_t benchmarkExtractCompiled(uint32_t operations)
+{
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < operations; i++)
+        sum += canSignalExtract(&benchmark_signals[i % BENCHMARK_LAYOUT_COUNT],
+                                benchmark_twai_frames[i % BENCHMARK_FRAME_MIX].frame.data);
+    benchmark_sink = sum;
+    return (uint64_t)operations * 8;
+}
+
+static uint64_t benchmarkDecodeCompiled(uint32_t operations)
+{
+    float sum = 0;
+    for (uint32_t i = 0; i < operations; i++)
+        sum += canSignalDecode(&benchmark_signals[i % BENCHMARK_LAYOUT_COUNT],
+                               benchmark_twai_frames[i % BENCHMARK_FRAME_MIX].frame.data);
+    benchmark_sink = (uint64_t)(int64_t)sum;
+    return (uint64_t)operations * 8;
+}
+
+static uint64_t benchmarkDecodeFrame(uint32_t operations)
+{
+    static float values[SIG_COUNT];
+    uint32_t decoded = 0;
+    for (uint32_t i = 0; i < operations; i++)
+    {
+        const twai_message_t *frame = &benchmark_twai_frames[i % BENCHMARK_FRAME_MIX].frame;
+        decoded += decodeVehicleFrame(frame->identifier, frame->data, values) != NULL;
+    }
+    benchmark_sink = decoded + (uint64_t)(int64_t)values[SIG_ODOMETER];
+    return (uint64_t)operations * 8;
+}
+
+static uint64_t benchmarkDecodeFrameFixed(uint32_t operations)
+{
+    static int64_t values[SIG_COUNT];
+    uint32_t decoded = 0;
+    for (uint32_t i = 0; i < operations; i++)
+    {
+        const twai_message_t *frame = &benchmark_twai_frames[i % BENCHMARK_FRAME_MIX].frame;
+        decoded += decodeVehicleFrameFixed(frame->identifier, frame->data, values) != NULL;
+    }
+    benchmark_sink = decoded + values[SIG_ODOMETER];
+    return (uint64_t)operations * 8;
+}
+
+// The formatters write into a memory stream, rewound before it fills up: only formatting and stdio buffering are
+// timed, not the card.
+static char benchmark_stream_buffer[BENCHMARK_STREAM_SIZE];
+
+static uint64_t benchmarkAscLines(uint32_t operations, bool twai)
+{
+    FILE *stream = fmemopen(benchmark_stream_buffer, sizeof(benchmark_stream_buffer), "w");
+    if (!stream)
+        return 0;
+    uint64_t bytes = 0;
+    long position = 0;
+    for (uint32_t i = 0; i < operations; i++)
+    {
+        if (twai)
+            writeTwaiLine(stream, &benchmark_twai_frames[i % BENCHMARK_FRAME_MIX],
+                          benchmark_twai_frames[i % BENCHMARK_FRAME_MIX].rx_time_us);
+        else
+            writeMcp2515Line(stream, &benchmark_mcp2515_frames[i % BENCHMARK_FRAME_MIX],
+                             benchmark_mcp2515_frames[i % BENCHMARK_FRAME_MIX].rx_time_us);
+        if (i % 16 == 15)
+        {
+            position = ftell(stream);
+            if (position > BENCHMARK_STREAM_SIZE / 2)
+            {
+                bytes += position;
+                rewind(stream);
+            }
+        }
+    }
+    bytes += ftell(stream);
+    fclose(stream);
+    return bytes;
+}
+
+static uint64_t benchmarkAscFormat(uint32_t operations)
+{
+    static char lines[BENCHMARK_STREAM_SIZE];
+    uint64_t bytes = 0;
+    size_t position = 0;
+    for (uint32_t i = 0; i < operations; i++)
+    {
+        const timed_twai_message_t *twai = &benchmark_twai_frames[i % BENCHMARK_FRAME_MIX];
+        position += formatAscFrameLine(&lines[position], twai->rx_time_us, 1, twai->frame.identifier,
+                                       twai->frame.extd, twai->frame.rtr, twai->frame.data_length_code,
+                                       twai->frame.data);
+        if (position > BENCHMARK_STREAM_SIZE - ASC_LINE_MAX)
+        {
+            bytes += position;
+            position = 0;
+        }
+    }
+    benchmark_sink = lines[0];
+    return bytes + position;
+}
+
+static uint64_t benchmarkAscStdio(uint32_t operations)
+{
+    FILE *stream = fmemopen(benchmark_stream_buffer, sizeof(benchmark_stream_buffer), "w");
+    if (!stream)
+        return 0;
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < operations; i++)
+    {
+        const timed_twai_message_t *twai = &benchmark_twai_frames[i % BENCHMARK_FRAME_MIX];
+        formatAscLineStdio(stream, twai->rx_time_us, 1, twai->frame.identifier, twai->frame.extd, twai->frame.rtr,
+                           false, twai->frame.data_length_code, twai->frame.data);
+        if (i % 16 == 15)
+        {
+            long position = ftell(stream);
+            if (position > BENCHMARK_STREAM_SIZE / 2)
+            {
+                bytes += position;
+                rewind(stream);
+            }
+        }
+    }
+    bytes += ftell(stream);
+    fclose(stream);
+    return bytes;
+}
+
+static uint64_t benchmarkMf4TwaiRecord(uint32_t operations)
+{
+    mf4_layout_t layout;
+    mf4_log_t log;
+    FILE *stream = fmemopen(benchmark_stream_buffer, sizeof(benchmark_stream_buffer), "w");
+    if (!stream)
+        return 0;
+    layoutMf4Log(&layout, &log, 0, ASC_CHANNEL_TWAI);
+    for (uint32_t i = 0; i < operations; i++)
+    {
+        writeMf4TwaiRecord(stream, &log, &benchmark_twai_frames[i % BENCHMARK_FRAME_MIX],
+                           benchmark_twai_frames[i % BENCHMARK_FRAME_MIX].rx_time_us);
+        if (i % 16 == 15 && ftell(stream) > BENCHMARK_STREAM_SIZE / 2)
+            rewind(stream);
+    }
+    fclose(stream);
+    return log.data_bytes;
+}
+
+static uint64_t benchmarkAscTwaiLine(uint32_t operations)
+{
+    return benchmarkAscLines(operations, true);
+}
+
+static uint64_t benchmarkAscMcp2515Line(uint32_t operations)
+{
+    return benchmarkAscLines(operations, false);
+}
+
+/// @brief Cluster state of a frame of the mix.
+static void getBenchmarkClusterState(uint32_t i, cluster_state_t *state)
+{
+    static int64_t values[SIG_COUNT];
+    const twai_message_t *frame = &benchmark_twai_frames[i % BENCHMARK_FRAME_MIX].frame;
+    decodeVehicleMessageFixed(&vehicle_messages[i % VEHICLE_MESSAGE_COUNT], frame->data, values);
+    memset(state, 0, sizeof(*state));
+    state->battery_state_bars = values[SIG_BATTERY_STATE_BARS];
+    state->vehicle_speed = values[SIG_VEHICLE_SPEED];
+    state->odometer = values[SIG_ODOMETER];
+    state->state_of_charge = values[SIG_STATE_OF_CHARGE];
+    state->remaining_charge_time = values[SIG_REMAINING_CHARGE_TIME];
+    state->brake_system_problem = values[SIG_BRAKE_SYSTEM_PROBLEM];
+    state->stop = values[SIG_STOP];
+    state->battery_temperature = values[SIG_BATTERY_TEMPERATURE];
+    state->turtle_mode = values[SIG_TURTLE_MODE];
+    state->remaining_autonomy = values[SIG_REMAINING_AUTONOMY];
+}
+
+static cluster_state_t benchmark_cluster_states[BENCHMARK_FRAME_MIX];
+
+static uint64_t benchmarkJsonWriter(uint32_t operations)
+{
+    static char json[BENCHMARK_JSON_SIZE];
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < operations; i++)
+    {
+        const char *text = clusterStateToJson(&benchmark_cluster_states[i % BENCHMARK_FRAME_MIX], json, sizeof(json));
+        bytes += text ? strlen(text) : 0;
+    }
+    return bytes;
+}
+
+static uint64_t benchmarkCjsonPrint(uint32_t operations)
+{
+    static uint8_t arena_buffer[BENCHMARK_ARENA_SIZE];
+    static char json[BENCHMARK_JSON_SIZE];
+    json_arena_t arena;
+    uint64_t bytes = 0;
+
+    jsonArenaInit(&arena, arena_buffer, sizeof(arena_buffer));
+    jsonArenaInstall(&arena);
+    for (uint32_t i = 0; i < operations; i++)
+    {
+        const cluster_state_t *state = &benchmark_cluster_states[i % BENCHMARK_FRAME_MIX];
+        cJSON *root = cJSON_CreateObject();
+        cJSON_AddNumberToObject(root, vehicle_signal_names[SIG_BATTERY_STATE_BARS],
+                                canFixedToFloat(state->battery_state_bars));
+        cJSON_AddNumberToObject(root, vehicle_signal_names[SIG_VEHICLE_SPEED], canFixedToFloat(state->vehicle_speed));
+        cJSON_AddNumberToObject(root, vehicle_signal_names[SIG_ODOMETER], canFixedToFloat(state->odometer));
+        cJSON_AddNumberToObject(root, vehicle_signal_names[SIG_STATE_OF_CHARGE],
+                                canFixedToFloat(state->state_of_charge));
+        cJSON_AddNumberToObject(root, vehicle_signal_names[SIG_REMAINING_CHARGE_TIME],
+                                canFixedToFloat(state->remaining_charge_time));
+        cJSON_AddNumberToObject(root, vehicle_signal_names[SIG_BRAKE_SYSTEM_PROBLEM],
+                                canFixedToFloat(state->brake_system_problem));
+        cJSON_AddNumberToObject(root, vehicle_signal_names[SIG_STOP], canFixedToFloat(state->stop));
+        cJSON_AddNumberToObject(root, vehicle_signal_names[SIG_BATTERY_TEMPERATURE],
+                                canFixedToFloat(state->battery_temperature));
+        cJSON_AddNumberToObject(root, vehicle_signal_names[SIG_TURTLE_MODE], canFixedToFloat(state->turtle_mode));
+        cJSON_AddNumberToObject(root, vehicle_signal_names[SIG_REMAINING_AUTONOMY],
+                                canFixedToFloat(state->remaining_autonomy));
+        if (cJSON_PrintPreallocated(root, json, sizeof(json), false))
+            bytes += strlen(json);
+        cJSON_Delete(root);
+        jsonArenaReset(&arena);
+    }
+    jsonArenaUninstall();
+    return bytes;
+}
+
+static const kernel_benchmark_t kernel_benchmarks[] = {
+    {"extract_signal", benchmarkExtractSignal},
+    {"store_signal", benchmarkStoreSignal},
+    {"decode", benchmarkDecode},
+    {"extract_compiled", benchmarkExtractCompiled},
+    {"decode_compiled", benchmarkDecodeCompiled},
+    {"decode_frame", benchmarkDecodeFrame},
+    {"decode_frame_fixed", benchmarkDecodeFrameFixed},
+    {"asc_twai_line", benchmarkAscTwaiLine},
+    {"asc_mcp2515_line", benchmarkAscMcp2515Line},
+    {"mf4_twai_record", benchmarkMf4TwaiRecord},
+    {"asc_format", benchmarkAscFormat},
+    {"asc_stdio", benchmarkAscStdio},
+    {"json_writer", benchmarkJsonWriter},
+    {"cjson_print", benchmarkCjsonPrint},
+};
+#define KERNEL_BENCHMARK_COUNT (sizeof(kernel_benchmarks) / sizeof(kernel_benchmarks[0]))
+
+/// @brief Time one kernel: warm-up pass, then the fastest of BENCHMARK_REPEATS passes.
+static void runKernelBenchmark(const kernel_benchmark_t *benchmark)
+{
+    uint32_t operations = CONFIG_DATAFLY_BENCHMARK_OPERATIONS;
+    benchmark_ticks_t best = 0;
+    uint64_t bytes = benchmark->run(operations);
+    for (int repeat = 0; repeat < BENCHMARK_REPEATS; repeat++)
+    {
+        benchmark_ticks_t start = benchmarkTicks();
+        benchmark->run(operations);
+        benchmark_ticks_t elapsed = benchmarkTicks() - start;
+        if (repeat == 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    double ns_per_op = best * 1000.0 / BENCHMARK_TICKS_PER_US / operations;
+    double bytes_per_s = best ? bytes * (BENCHMARK_TICKS_PER_US * 1e6) / best : 0;
+#ifdef CONFIG_IDF_TARGET_LINUX
+    ESP_LOGI("KERNEL_BENCHMARK_H", "%-18s %10.1f ns/op %12.0f bytes/s", benchmark->name, ns_per_op, bytes_per_s);
+#else
+    ESP_LOGI("KERNEL_BENCHMARK_H", "%-18s %10.1f ns/op %8.1f cycles/op %12.0f bytes/s", benchmark->name, ns_per_op,
+             (double)best / operations, bytes_per_s);
+#endif
+}
+
+/// @brief Run every kernel benchmark. On the host build, the process then exits.
+void runKernelBenchmarks()
+{
+    initBenchmarkFrames();
+    for (int i = 0; i < BENCHMARK_FRAME_MIX; i++)
+        getBenchmarkClusterState(i, &benchmark_cluster_states[i]);
+
+    ESP_LOGI("KERNEL_BENCHMARK_H", "%d operations per pass, fastest of %d passes, mix of %d frames",
+             CONFIG_DATAFLY_BENCHMARK_OPERATIONS, BENCHMARK_REPEATS, BENCHMARK_FRAME_MIX);
+    for (int i = 0; i < KERNEL_BENCHMARK_COUNT; i++)
+    {
+        runKernelBenchmark(&kernel_benchmarks[i]);
+#ifndef CONFIG_IDF_TARGET_LINUX
+        vTaskDelay(1); // Let the idle task feed the watchdog.
+#endif
+    }
+#ifdef CONFIG_IDF_TARGET_LINUX
+    fflush(stdout);
+    exit(0);
+#endif
+}
+
+#endif // CONFIG_DATAFLY_BENCHMARK_ENABLED
@@ -0,0 +1,141 @@
+// Pipeline latency histograms (CONFIG_DATAFLY_LATENCY_STATS): how long a frame takes from the receiver to the card.
+// Stages, per bus:
+// - queue: reception (rx_time_us) to dequeue by the writer.
+// - encode: dequeue to the line formatted into the stdio buffer of the file (including the writes a full buffer
+//   triggers).
+// - flush: time the writer spends closing and reopening the file, which pushes the buffered lines to the card.
+// - end_to_end: reception of the oldest frame of a batch to the end of the flush that wrote it to the card.
+// Histograms are log-scale (bucket b counts latencies in [2^(b-1), 2^b) µs, bucket 0 the 0 µs ones, the last one
+// everything above), in fixed memory, each written by a single writer task. Counts are since boot: reportLatencyStats()
+// prints them to the console and appends them to STAT_FS/<ignition cycle>.TXT every
+// CONFIG_DATAFLY_LATENCY_REPORT_PERIOD_S.
+// Disabled, the LATENCY_* macros compile to nothing.
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include "esp_log.h"
+#include "sd_card.h"
+#include "log_naming.h"
+#include "time_base.h"
+
+#ifdef CONFIG_DATAFLY_LATENCY_STATS
+
+#define LATENCY_BUCKETS 28 // Up to 2^26 µs (67 s), the last bucket takes everything above.
+#define LATENCY_STATS_DIRECTORY "STAT_FS"
+
+typedef enum
+{
+    LATENCY_QUEUE,
+    LATENCY_ENCODE,
+    LATENCY_FLUSH,
+    LATENCY_END_TO_END,
+    LATENCY_STAGE_COUNT
+} latency_stage_t;
+
+typedef enum
+{
+    LATENCY_TWAI,
+    LATENCY_MCP2515,
+    LATENCY_BUS_COUNT
+} latency_bus_t;
+
+typedef struct
+{
+    uint32_t buckets[LATENCY_BUCKETS];
+    uint32_t count;
+    uint32_t max_us;
+} latency_histogram_t;
+
+static const char *const latency_stage_names[LATENCY_STAGE_COUNT] = {"queue", "encode", "flush", "end_to_end"};
+static const char *const latency_bus_names[LATENCY_BUS_COUNT] = {"twai", "mcp2515"};
+static latency_histogram_t latency_histograms[LATENCY_BUS_COUNT][LATENCY_STAGE_COUNT];
+
+static inline void latencyRecord(latency_bus_t bus, latency_stage_t stage, int64_t latency_us)
+{
+    latency_histogram_t *histogram = &latency_histograms[bus][stage];
+    uint32_t latency = latency_us < 0 ? 0 : latency_us > UINT32_MAX ? UINT32_MAX : latency_us;
+    int bucket = latency ? 32 - __builtin_clz(latency) : 0;
+    histogram->buckets[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1]++;
+    histogram->count++;
+    if (latency > histogram->max_us)
+        histogram->max_us = latency;
+}
+
+#define LATENCY_NOW() timeBaseNow()
+#define LATENCY_RECORD(bus, stage, latency_us) latencyRecord(bus, stage, latency_us)
+
+/// @brief Upper bound of the latency under which a share of the samples falls.
+static uint32_t getLatencyPercentile(const latency_histogram_t *histogram, uint32_t per_mille)
+{
+    uint64_t rank = ((uint64_t)histogram->count * per_mille + 999) / 1000;
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < LATENCY_BUCKETS - 1; bucket++)
+    {
+        seen += histogram->buckets[bucket];
+        if (seen >= rank)
+        {
+            uint32_t bound = bucket ? 1UL << bucket : 0;
+            return bound < histogram->max_us ? bound : histogram->max_us;
+        }
+    }
+    return histogram->max_us;
+}
+
+static void writeLatencyStats(FILE *file, int64_t now_us)
+{
+    for (int bus = 0; bus < LATENCY_BUS_COUNT; bus++)
+    {
+        for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+        {
+            const latency_histogram_t *histogram = &latency_histograms[bus][stage];
+            fprintf(file, "%lld %s %s count=%lu max_us=%lu buckets=", (long long)(now_us / 1000000),
+                    latency_bus_names[bus], latency_stage_names[stage], (unsigned long)histogram->count,
+                    (unsigned long)histogram->max_us);
+            for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+                fprintf(file, bucket ? ",%lu" : "%lu", (unsigned long)histogram->buckets[bucket]);
+            fprintf(file, "\n");
+        }
+    }
+}
+
+/// @brief Task: report the histograms every CONFIG_DATAFLY_LATENCY_REPORT_PERIOD_S.
+void reportLatencyStats(void *pvParameter)
+{
+    char file_name[LOG_NAME_SIZE + sizeof(MOUNT_POINT)];
+    snprintf(file_name, sizeof(file_name), MOUNT_POINT "/" LATENCY_STATS_DIRECTORY "/%05lu.TXT",
+             (unsigned long)(ignition_cycle % 100000));
+
+    while (true)
+    {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_DATAFLY_LATENCY_REPORT_PERIOD_S * 1000));
+        int64_t now_us = timeBaseNow();
+        for (int bus = 0; bus < LATENCY_BUS_COUNT; bus++)
+        {
+            for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+            {
+                const latency_histogram_t *histogram = &latency_histograms[bus][stage];
+                if (!histogram->count)
+                    continue;
+                ESP_LOGI("LATENCY_STATS_H", "%s %s: %lu samples, p50 <= %lu us, p99 <= %lu us, max %lu us",
+                         latency_bus_names[bus], latency_stage_names[stage], (unsigned long)histogram->count,
+                         (unsigned long)getLatencyPercentile(histogram, 500),
+                         (unsigned long)getLatencyPercentile(histogram, 990), (unsigned long)histogram->max_us);
+            }
+        }
+        FILE *stats_f = fopen(file_name, "a");
+        if (!stats_f)
+        {
+            ESP_LOGE("LATENCY_STATS_H", "Failed to open %s", file_name);
+            continue;
+        }
+        writeLatencyStats(stats_f, now_us);
+        fclose(stats_f);
+    }
+}
+
+#else
+
+#define LATENCY_NOW() 0
+#define LATENCY_RECORD(bus, stage, latency_us) ((void)(latency_us))
+
+#endif
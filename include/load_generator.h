@@ -0,0 +1,369 @@
+// Synthetic CAN load generator: worst-case traffic to size the queues and find where frames start to be lost.
+// A profile sets the bitrate, the average bus load, the identifiers (share of 29-bit ones, share of frames the logger
+// decodes), the DLC range, bursts (frames back to back at 100 % load, then idle so that the average is the load) and
+// error frames (bus time taken by the error and the retransmission, nothing received).
+// Frame lengths are worst-case stuffed: 135 bits for 8 standard bytes, 160 for 8 extended bytes (interframe space
+// included), so 100 % at 500 kbit/s is ~3100 extended frames/s.
+// runLoadTest() sweeps CONFIG_DATAFLY_LOAD_LEVELS, CONFIG_DATAFLY_LOAD_FRAMES_PER_LEVEL frames each, and reports per
+// level the frames generated, ingested and lost and the high-water marks of the data queues:
+// - host build: the generator is the source of both virtual buses, losses are the frames the controllers dropped,
+//   plus those a receiver could not queue or a writer could not write (frame_loss.h).
+// - bench unit: the MCP2515 transmits the frames, in loopback mode (nothing on the bus) or normal mode (another node
+//   must acknowledge, the TWAI controller receives them too on a shared bus). Losses are frames transmitted but never
+//   ingested, or ingested but not written. The MCP2515 runs at 500 kbit/s, keep the bitrate at 500000. Error frames
+//   cannot be transmitted, they only take bus time.
+#pragma once
+#include <stdlib.h>
+#ifndef CONFIG_IDF_TARGET_LINUX
+#include "esp_rom_sys.h"
+#endif
+
+#define LOAD_ERROR_FRAME_BITS 23 // Error flags (up to 12), delimiter (8), interframe space (3).
+#define LOAD_MAX_LEVELS 16
+
+typedef struct
+{
+    uint32_t bitrate;         // bit/s.
+    uint8_t load_percent;     // Average bus load, 1..100.
+    uint8_t extended_percent; // Share of 29-bit identifiers.
+    uint8_t known_percent;    // Share of frames carrying one of vehicle_messages (decoded by the logger).
+    uint8_t dlc_min;          // DLC drawn uniformly in [dlc_min, dlc_max].
+    uint8_t dlc_max;
+    uint16_t burst_frames;    // Frames back to back, then idle. 1: evenly spread.
+    uint16_t error_per_mille; // Error frames per 1000 frames.
+} load_profile_t;
+
+typedef struct
+{
+    load_profile_t profile;
+    uint32_t state; // xorshift32.
+    uint32_t remaining;
+    uint16_t in_burst;   // Frames of the current burst so far.
+    int64_t start_us;    // Local time the bus time starts at.
+    int64_t bus_time_ns; // End of the last frame on the bus, from start_us.
+    uint32_t generated;
+    uint32_t error_frames;
+} load_generator_t;
+
+typedef struct
+{
+    uint8_t load_percent;
+    uint32_t generated;
+    uint32_t error_frames;
+    uint32_t ingested[2]; // TWAI, MCP2515.
+    uint32_t lost[2];
+    UBaseType_t queue_high_water[2];
+    uint32_t duration_ms;
+} load_level_report_t;
+
+/// @brief Worst-case length of a classic CAN frame on the bus (bit stuffing included), in bits.
+static inline uint32_t canFrameBits(bool extended, uint8_t dlc)
+{
+    // Bits exposed to stuffing: SOF to CRC, 34 (standard) or 54 (extended) + payload. Then CRC delimiter, ACK, EOF
+    // and interframe space, 13 bits.
+    uint32_t stuffed = (extended ? 54 : 34) + 8 * dlc;
+    return stuffed + (stuffed - 1) / 4 + 13;
+}
+
+static inline uint32_t nextLoadRandom(load_generator_t *generator)
+{
+    uint32_t x = generator->state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return generator->state = x;
+}
+
+void loadGeneratorInit(load_generator_t *generator, const load_profile_t *profile, uint32_t frames, uint32_t seed,
+                       int64_t start_us)
+{
+    memset(generator, 0, sizeof(*generator));
+    generator->profile = *profile;
+    generator->state = seed ? seed : 1;
+    generator->remaining = frames;
+    generator->start_us = start_us;
+}
+
+/// @brief Time the bus is idle after a frame of the given length, so that the average load is the profile's.
+static int64_t loadIdleNs(const load_generator_t *generator, int64_t frame_ns)
+{
+    const load_profile_t *profile = &generator->profile;
+    int64_t idle_ns = frame_ns * (100 - profile->load_percent) / profile->load_percent;
+    // In bursts, the idle time of the whole burst comes after its last frame.
+    if (profile->burst_frames > 1)
+        return generator->in_burst == profile->burst_frames ? idle_ns * profile->burst_frames : 0;
+    return idle_ns;
+}
+
+/// @brief Next frame, error frames are accounted for as bus time.
+/// @param due_us local time the frame is complete on the bus.
+/// @return false once the frames of the generator are exhausted.
+bool loadGeneratorNext(load_generator_t *generator, uint32_t *identifier, bool *extended, uint8_t *dlc,
+                       uint8_t data[8], int64_t *due_us)
+{
+    const load_profile_t *profile = &generator->profile;
+    if (!generator->remaining)
+        return false;
+    generator->remaining--;
+    generator->generated++;
+
+    uint32_t x = nextLoadRandom(generator);
+    if (x % 100 < profile->known_percent)
+    {
+        const can_message_def_t *message = &vehicle_messages[(x >> 8) % VEHICLE_MESSAGE_COUNT];
+        *identifier = message->id;
+        *extended = message->id > CAN_SFF_MASK;
+    }
+    else
+    {
+        *extended = (x >> 8) % 100 < profile->extended_percent;
+        x = nextLoadRandom(generator);
+        *identifier = *extended ? x & CAN_EFF_MASK : x & CAN_SFF_MASK;
+    }
+    *dlc = profile->dlc_min + nextLoadRandom(generator) % (profile->dlc_max - profile->dlc_min + 1);
+    uint32_t low = nextLoadRandom(generator), high = nextLoadRandom(generator);
+    memcpy(data, &low, 4);
+    memcpy(data + 4, &high, 4);
+
+    int64_t frame_ns = canFrameBits(*extended, *dlc) * 1000000000LL / profile->bitrate;
+    if (nextLoadRandom(generator) % 1000 < profile->error_per_mille)
+    {
+        // Worst case: the error hits the last bit, the frame is sent twice.
+        generator->error_frames++;
+        generator->bus_time_ns += frame_ns + LOAD_ERROR_FRAME_BITS * 1000000000LL / profile->bitrate;
+    }
+    generator->bus_time_ns += frame_ns;
+    if (++generator->in_burst > profile->burst_frames)
+        generator->in_burst = 1;
+    *due_us = generator->start_us + generator->bus_time_ns / 1000;
+    generator->bus_time_ns += loadIdleNs(generator, frame_ns);
+    return true;
+}
+
+/// @brief Profile of the sweep from the configuration, at one load level.
+static void getConfiguredLoadProfile(load_profile_t *profile, uint8_t load_percent)
+{
+    profile->bitrate = CONFIG_DATAFLY_LOAD_BITRATE;
+    profile->load_percent = load_percent;
+    profile->extended_percent = CONFIG_DATAFLY_LOAD_EXTENDED_PERCENT;
+    profile->known_percent = CONFIG_DATAFLY_LOAD_KNOWN_PERCENT;
+    profile->dlc_min = CONFIG_DATAFLY_LOAD_DLC_MIN;
+    profile->dlc_max = CONFIG_DATAFLY_LOAD_DLC_MAX < CONFIG_DATAFLY_LOAD_DLC_MIN ? CONFIG_DATAFLY_LOAD_DLC_MIN
+                                                                                : CONFIG_DATAFLY_LOAD_DLC_MAX;
+    profile->burst_frames = CONFIG_DATAFLY_LOAD_BURST_FRAMES ? CONFIG_DATAFLY_LOAD_BURST_FRAMES : 1;
+    profile->error_per_mille = CONFIG_DATAFLY_LOAD_ERROR_PER_MILLE;
+}
+
+/// @brief Load levels of CONFIG_DATAFLY_LOAD_LEVELS ("25,50,100"), out of range levels are dropped.
+/// @return number of levels.
+static int getConfiguredLoadLevels(uint8_t levels[LOAD_MAX_LEVELS])
+{
+    const char *cursor = CONFIG_DATAFLY_LOAD_LEVELS;
+    int count = 0;
+    while (*cursor && count < LOAD_MAX_LEVELS)
+    {
+        char *end;
+        long level = strtol(cursor, &end, 10);
+        if (end == cursor)
+        {
+            cursor++;
+            continue;
+        }
+        if (level >= 1 && level <= 100)
+            levels[count++] = level;
+        cursor = end;
+    }
+    return count;
+}
+
+static void logLoadLevelReport(const load_level_report_t *report)
+{
+    ESP_LOGI("LOAD_GENERATOR_H",
+             "load %3d%%: %lu frames (%lu error frames) in %lu ms | TWAI %lu ingested %lu lost, queue high-water %u"
+             " | MCP2515 %lu ingested %lu lost, queue high-water %u",
+             report->load_percent, (unsigned long)report->generated, (unsigned long)report->error_frames,
+             (unsigned long)report->duration_ms, (unsigned long)report->ingested[0], (unsigned long)report->lost[0],
+             (unsigned)report->queue_high_water[0], (unsigned long)report->ingested[1], (unsigned long)report->lost[1],
+             (unsigned)report->queue_high_water[1]);
+}
+
+static void resetQueueHighWater()
+{
+    file_data_queue_high_water = 0;
+    file_data_queue_mcp2515_high_water = 0;
+}
+
+/// @brief Frames of a bus (0: TWAI, 1: MCP2515) lost after the controller since the counters were in before.
+/// @param queue_full count the frames the receiver could not queue as well.
+static uint32_t getLoadPipelineLosses(const uint32_t before[FRAME_LOSS_STAGE_COUNT],
+                                      const uint32_t after[FRAME_LOSS_STAGE_COUNT], int bus, bool queue_full)
+{
+    frame_loss_stage_t queue_stage = bus ? FRAME_LOSS_MCP2515_QUEUE_FULL : FRAME_LOSS_TWAI_QUEUE_FULL;
+    frame_loss_stage_t write_stage = bus ? FRAME_LOSS_MCP2515_WRITE_FAILED : FRAME_LOSS_TWAI_WRITE_FAILED;
+    uint32_t losses = after[write_stage] - before[write_stage];
+    if (queue_full)
+        losses += after[queue_stage] - before[queue_stage];
+    return losses;
+}
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+
+/// @brief virtual_can_source_t of the load test (context: load_generator_t).
+static bool nextLoadFrame(void *context, virtual_can_frame_t *frame)
+{
+    memset(frame, 0, sizeof(*frame));
+    if (!loadGeneratorNext(context, &frame->identifier, &frame->extended, &frame->dlc, frame->data, &frame->due_us))
+        return false;
+    if (!frame->due_us)
+        frame->due_us = 1;
+    return true;
+}
+
+/// @brief Run one level on both virtual buses, until every frame went through or was lost.
+static void runLoadLevel(uint8_t load_percent, load_level_report_t *report)
+{
+    static load_generator_t generators[VIRTUAL_CAN_BUS_COUNT];
+    virtual_can_stats_t before[VIRTUAL_CAN_BUS_COUNT], after[VIRTUAL_CAN_BUS_COUNT];
+    uint32_t losses_before[FRAME_LOSS_STAGE_COUNT], losses_after[FRAME_LOSS_STAGE_COUNT];
+    load_profile_t profile;
+
+    getConfiguredLoadProfile(&profile, load_percent);
+    resetQueueHighWater();
+    getFrameLosses(losses_before);
+    int64_t start_us = esp_timer_get_time();
+    for (int bus = 0; bus < VIRTUAL_CAN_BUS_COUNT; bus++)
+    {
+        virtualCanGetStats(bus, &before[bus]);
+        loadGeneratorInit(&generators[bus], &profile, CONFIG_DATAFLY_LOAD_FRAMES_PER_LEVEL, load_percent + bus,
+                          start_us);
+        virtualCanAttach(bus, nextLoadFrame, &generators[bus]);
+    }
+    while (true)
+    {
+        vTaskDelay(pdMS_TO_TICKS(10));
+        for (int bus = 0; bus < VIRTUAL_CAN_BUS_COUNT; bus++)
+            virtualCanGetStats(bus, &after[bus]);
+        if (after[VIRTUAL_CAN_TWAI].finished && after[VIRTUAL_CAN_MCP2515].finished &&
+            uxQueueMessagesWaiting(file_data_queue) == 0 && uxQueueMessagesWaiting(file_data_queue_mcp2515) == 0)
+            break;
+    }
+    getFrameLosses(losses_after);
+
+    report->load_percent = load_percent;
+    report->generated = generators[VIRTUAL_CAN_TWAI].generated;
+    report->error_frames = generators[VIRTUAL_CAN_TWAI].error_frames;
+    for (int bus = 0; bus < VIRTUAL_CAN_BUS_COUNT; bus++)
+    {
+        // Delivered frames are those the receiver took from the controller, queued or not.
+        uint32_t dropped = getLoadPipelineLosses(losses_before, losses_after, bus, true);
+        report->ingested[bus] = after[bus].delivered - before[bus].delivered - dropped;
+        report->lost[bus] = after[bus].overrun - before[bus].overrun + dropped;
+    }
+    report->queue_high_water[0] = file_data_queue_high_water;
+    report->queue_high_water[1] = file_data_queue_mcp2515_high_water;
+    report->duration_ms = (esp_timer_get_time() - start_us) / 1000;
+}
+
+#else
+
+/// @brief Run one level through the MCP2515, frames are transmitted when due (as soon as a transmit buffer is free).
+static void runLoadLevel(uint8_t load_percent, load_level_report_t *report)
+{
+    load_generator_t generator;
+    load_profile_t profile;
+    struct can_frame frame;
+    uint32_t identifier;
+    bool extended;
+    int64_t due_us;
+    uint32_t twai_before = twai_frames_ingested, mcp2515_before = mcp2515_frames_ingested;
+    uint32_t losses_before[FRAME_LOSS_STAGE_COUNT], losses_after[FRAME_LOSS_STAGE_COUNT];
+
+    getConfiguredLoadProfile(&profile, load_percent);
+    resetQueueHighWater();
+    getFrameLosses(losses_before);
+    int64_t start_us = esp_timer_get_time();
+    loadGeneratorInit(&generator, &profile, CONFIG_DATAFLY_LOAD_FRAMES_PER_LEVEL, load_percent, start_us);
+    uint32_t sent = 0;
+    while (loadGeneratorNext(&generator, &identifier, &extended, &frame.can_dlc, frame.data, &due_us))
+    {
+        frame.can_id = extended ? identifier | CAN_EFF_FLAG : identifier;
+        int64_t wait_us = due_us - esp_timer_get_time();
+        if (wait_us >= portTICK_PERIOD_MS * 1000)
+            vTaskDelay(wait_us / (portTICK_PERIOD_MS * 1000));
+        while (true)
+        {
+            MCP2515_LOCK();
+            ERROR_t err = MCP2515_sendMessageAfterCtrlCheck(&frame);
+            MCP2515_UNLOCK();
+            if (err == ERROR_OK)
+                break;
+            esp_rom_delay_us(50); // The three transmit buffers are full: the bus is saturated.
+        }
+        sent++;
+    }
+    // Let the last frames reach the writers.
+    vTaskDelay(pdMS_TO_TICKS(500));
+    getFrameLosses(losses_after);
+
+    report->load_percent = load_percent;
+    report->generated = sent;
+    report->error_frames = generator.error_frames;
+    // Frames that could not be queued are not counted as ingested already, the write failures come out of them.
+    report->ingested[0] = twai_frames_ingested - twai_before -
+                          getLoadPipelineLosses(losses_before, losses_after, 0, false);
+    report->ingested[1] = mcp2515_frames_ingested - mcp2515_before -
+                          getLoadPipelineLosses(losses_before, losses_after, 1, false);
+    report->lost[0] = CONFIG_DATAFLY_LOAD_LOOPBACK || report->ingested[0] >= sent ? 0 : sent - report->ingested[0];
+    report->lost[1] = report->ingested[1] >= sent ? 0 : sent - report->ingested[1];
+    report->queue_high_water[0] = file_data_queue_high_water;
+    report->queue_high_water[1] = file_data_queue_mcp2515_high_water;
+    report->duration_ms = (esp_timer_get_time() - start_us) / 1000;
+}
+
+#endif
+
+/// @brief Task: sweep the load levels and report each. On host, the process exits with the number of lossy levels.
+void runLoadTest(void *pvParameter)
+{
+    uint8_t levels[LOAD_MAX_LEVELS];
+    load_level_report_t report;
+    int lossy_levels = 0;
+    int count = getConfiguredLoadLevels(levels);
+
+    // The writers must have opened their files.
+    vTaskDelay(pdMS_TO_TICKS(1000));
+#ifndef CONFIG_IDF_TARGET_LINUX
+    while (!mcp2515_mutex)
+        vTaskDelay(pdMS_TO_TICKS(100));
+    MCP2515_LOCK();
+    ERROR_t err = CONFIG_DATAFLY_LOAD_LOOPBACK ? MCP2515_setLoopbackMode() : MCP2515_setNormalMode();
+    MCP2515_UNLOCK();
+    if (err != ERROR_OK)
+    {
+        ESP_LOGE("LOAD_GENERATOR_H", "Failed to switch the MCP2515 to %s mode",
+                 CONFIG_DATAFLY_LOAD_LOOPBACK ? "loopback" : "normal");
+        vTaskDelete(NULL);
+    }
+#endif
+    for (int i = 0; i < count; i++)
+    {
+        memset(&report, 0, sizeof(report));
+        runLoadLevel(levels[i], &report);
+        logLoadLevelReport(&report);
+        if (report.lost[0] || report.lost[1])
+            lossy_levels++;
+    }
+    ESP_LOGI("LOAD_GENERATOR_H", "Load test done: %d of %d levels lost frames", lossy_levels, count);
+#ifdef CONFIG_IDF_TARGET_LINUX
+    stopLogWriters();
+    while (!logWritersStopped())
+        vTaskDelay(pdMS_TO_TICKS(100));
+    fflush(stdout);
+    exit(lossy_levels);
+#else
+    MCP2515_LOCK();
+    MCP2515_setListenOnlyMode();
+    MCP2515_UNLOCK();
+    vTaskDelete(NULL);
+#endif
+}
@@ -0,0 +1,180 @@
+// Log naming and layout: LOG_FS/2026/10/17/00042/000.asc (same under ERR_FS, .mf4 under LOG_FS with MF4 logs).
+// - one directory per UTC day (from the time base), UNDATED until the time base is disciplined. Undated cycles are
+//   grouped by thousand (LOG_FS/UNDATED/42/42042/000.asc) so that UNDATED stays small on a logger that never gets a
+//   time fix.
+// - one directory per ignition cycle under its day, the cycle being a boot counter kept in NVS.
+// - at most LOG_FILES_PER_DIRECTORY files per cycle directory (128 8.3 entries fill one 4 KiB cluster), the following
+//   ones go to 00042_1, 00042_2... up to 00042_99 (LOG_MAX_PART, the longest 8.3 name), which takes all the files that
+//   follow.
+// FAT looks directories up linearly, so bounding every directory keeps fopen() and f_mkdir() at a constant cost
+// however many files the card holds. Names are built in caller buffers, nothing is allocated.
+// Long file names are disabled (CONFIG_FATFS_LFN_NONE), every component is 8.3.
+// Every directory of the path gets its archive attribute (AM_ARC) back when a file is created in it: the uploader
+// clears it on the directories it has fully uploaded, to skip them.
+#pragma once
+#include <time.h>
+#include <strings.h>
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "freertos/semphr.h"
+#include "sd_card.h"
+#include "time_base.h"
+
+#define LOG_FILES_PER_DIRECTORY 128
+#define LOG_MAX_PART 99 // cycle_<part> must stay 8.3: five digits of the cycle, '_' and two of the part.
+#define LOG_NAME_SIZE 64
+#define LOG_UNDATED_DIRECTORY "UNDATED"
+#define LOG_UNDATED_CYCLES_PER_DIRECTORY 1000
+#ifdef CONFIG_DATAFLY_LOG_FORMAT_MF4
+#define LOG_FILE_EXTENSION "mf4" // LOG_FS only, ERR_FS captures are always ASC.
+#else
+#define LOG_FILE_EXTENSION "asc"
+#endif
+
+typedef struct
+{
+    const char *root;              // FAT path relative to the card root.
+    char cycle[LOG_NAME_SIZE];     // root/date/cycle the current shard belongs to.
+    char directory[LOG_NAME_SIZE]; // Current shard: cycle, or cycle_<part>.
+    uint16_t part;
+    uint16_t file_count; // Files created in the current shard.
+} log_shard_t;
+
+static log_shard_t log_shards[] = {{.root = "LOG_FS"}, {.root = "ERR_FS"}};
+static uint32_t ignition_cycle = 0;
+static SemaphoreHandle_t log_naming_mutex = NULL;
+
+/// @brief Increment the ignition cycle counter kept in NVS, once per boot.
+static void loadIgnitionCycle()
+{
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open("datafly", NVS_READWRITE, &nvs);
+    if (err == ESP_OK)
+    {
+        err = nvs_get_u32(nvs, "cycle", &ignition_cycle);
+        if (err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND)
+        {
+            ignition_cycle = (ignition_cycle + 1) % 100000; // Five digits in the directory name.
+            err = nvs_set_u32(nvs, "cycle", ignition_cycle);
+        }
+        if (err == ESP_OK)
+            err = nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK)
+        ESP_LOGE("LOG_NAMING_H", "Failed to update the ignition cycle (%s)", esp_err_to_name(err));
+    else
+        ESP_LOGI("LOG_NAMING_H", "Ignition cycle %lu", (unsigned long)ignition_cycle);
+}
+
+/// @brief To be called once, after nvs_flash_init() and before any log file is created.
+void initLogNaming()
+{
+    loadIgnitionCycle();
+    log_naming_mutex = xSemaphoreCreateMutex();
+}
+
+/// @brief Create every missing directory of a FAT path and set their archive attribute.
+static void createLogDirectory(const char *directory, bool create)
+{
+    char path[LOG_NAME_SIZE];
+    const char *separator = directory;
+
+    do
+    {
+        separator = strchr(separator + 1, '/');
+        size_t length = separator ? (size_t)(separator - directory) : strlen(directory);
+        memcpy(path, directory, length);
+        path[length] = '\0';
+        if (create)
+        {
+            FRESULT res = f_mkdir(path);
+            if (res != FR_OK && res != FR_EXIST)
+                ESP_LOGE("LOG_NAMING_H", "Failed to create %s (%d)", path, res);
+        }
+        f_chmod(path, AM_ARC, AM_ARC);
+    } while (separator);
+}
+
+/// @brief Build the name of the next log file of a root and create its directories.
+/// @param is_data true -> LOG_FS, false -> ERR_FS.
+/// @param file_name buffer of LOG_NAME_SIZE bytes, receives the full path (MOUNT_POINT included).
+void buildLogFileName(bool is_data, char *file_name)
+{
+    log_shard_t *shard = &log_shards[is_data ? 0 : 1];
+    char cycle[LOG_NAME_SIZE];
+    char relative_name[LOG_NAME_SIZE]; // f_stat() takes FAT paths, fopen() VFS ones.
+    int64_t utc_us;
+
+    if (timeBaseLocalToUtc(timeBaseNow(), &utc_us))
+    {
+        struct tm date;
+        time_t seconds = utc_us / 1000000;
+        gmtime_r(&seconds, &date);
+        snprintf(cycle, sizeof(cycle), "%s/%04d/%02d/%02d/%05lu", shard->root, date.tm_year + 1900, date.tm_mon + 1,
+                 date.tm_mday, (unsigned long)ignition_cycle);
+    }
+    else
+    {
+        snprintf(cycle, sizeof(cycle), "%s/"LOG_UNDATED_DIRECTORY"/%02lu/%05lu", shard->root,
+                 (unsigned long)ignition_cycle / LOG_UNDATED_CYCLES_PER_DIRECTORY, (unsigned long)ignition_cycle);
+    }
+
+    if (log_naming_mutex)
+        xSemaphoreTake(log_naming_mutex, portMAX_DELAY);
+    bool new_directory = strcmp(cycle, shard->cycle) != 0;
+    if (new_directory)
+    {
+        memcpy(shard->cycle, cycle, sizeof(cycle));
+        shard->part = 0;
+        shard->file_count = 0;
+    }
+    while (true)
+    {
+        if (shard->file_count >= LOG_FILES_PER_DIRECTORY && shard->part < LOG_MAX_PART)
+        {
+            shard->part++;
+            shard->file_count = 0;
+            new_directory = true;
+        }
+        if (new_directory)
+        {
+            if (shard->part)
+                snprintf(shard->directory, sizeof(shard->directory), "%s_%u", shard->cycle, shard->part);
+            else
+                memcpy(shard->directory, shard->cycle, sizeof(shard->directory));
+        }
+        createLogDirectory(shard->directory, new_directory);
+        new_directory = false;
+
+        // A name already taken (the counter of NVS could not be updated) is skipped, never overwritten.
+        FILINFO info;
+        snprintf(relative_name, sizeof(relative_name), "%s/%03u.%s", shard->directory, shard->file_count++,
+                 is_data ? LOG_FILE_EXTENSION : "asc");
+        if (f_stat(relative_name, &info) != FR_OK)
+            break;
+    }
+    if (log_naming_mutex)
+        xSemaphoreGive(log_naming_mutex);
+    snprintf(file_name, LOG_NAME_SIZE, MOUNT_POINT"/%s", relative_name);
+}
+
+/// @brief Whether log files may still be created in a directory or below it (the current shards and their parents).
+/// @param directory FAT path relative to the card root.
+bool isLogDirectoryActive(const char *directory)
+{
+    size_t length = strlen(directory);
+    bool active = false;
+
+    if (log_naming_mutex)
+        xSemaphoreTake(log_naming_mutex, portMAX_DELAY);
+    for (size_t i = 0; i < sizeof(log_shards) / sizeof(log_shards[0]) && !active; i++)
+    {
+        const char *shard_directory = log_shards[i].directory;
+        active = strncasecmp(shard_directory, directory, length) == 0 &&
+                 (shard_directory[length] == '\0' || shard_directory[length] == '/');
+    }
+    if (log_naming_mutex)
+        xSemaphoreGive(log_naming_mutex);
+    return active;
+}
@@ -0,0 +1,702 @@
+// ASAM MDF 4.11 (MF4) log writer (CONFIG_DATAFLY_LOG_FORMAT_MF4): the LOG_FS files are written as binary MF4 instead
+// of Vector ASC text, following the ASAM MDF bus logging conventions, so that asammdf, CANape or the back end read
+// them as CAN logs with no conversion. ERR_FS captures stay ASC.
+// Blocks, written once when the file is created (writeMf4Header()), the records then stream at the end of the file:
+//   ID | HD -> FH (history), DG -> CG CAN_DataFrame -> CG CAN_RemoteFrame -> CG CAN_ErrorFrame, DT (the records)
+// Every CG (bus event, acquisition source: a CAN bus SI) has two channels: Timestamp, the master (µs since the origin
+// of the file, int64 converted to s), and a structure channel named after the group, whose members are
+//   <group>.BusChannel (1 TWAI, 2 MCP2515, the ASC channels), .ID, .IDE, .DLC, .Dir (0: Rx), .DataLength, .DataBytes
+// (the remote frames have no DataBytes, the error frames only a BusChannel).
+// The data group is unsorted: records of the three groups interleave as they come, each behind a record ID byte,
+// which is what a streaming writer produces; readers sort it when loading. With CONFIG_DATAFLY_MF4_SORTED it holds
+// CAN_DataFrame only, without record IDs: sorted, one byte less per frame, remote and error frames are not logged.
+// They are counted (FRAME_LOSS_MF4_NOT_LOGGED), and the DG comment of the log gives how many of each were left out:
+//   <e name="CAN_RemoteFrame not logged" type="unsignedInt">0000000012</e>
+// fixed width counters, updated in place with the cycle counters.
+// Finalisation: while written, the file is unfinalised (ID "UnFinMF ": cycle counters and length of the data block
+// to be updated). At every flush of its writer (checkpointMf4Log()) the counters and the length are updated in place,
+// closing (finalizeMf4Log()) marks it finalised. The name of a file being written is kept in NVS: a file left
+// unfinalised by a power cut is recovered at the next boot (recoverMf4Logs()), the records written after its last
+// checkpoint are counted, a record cut short is left out of the data block.
+// The start time of a file (HD) is the UTC time of its origin, written as soon as the time base is disciplined (0,
+// 1970, before). The time base and frame loss comments of the ASC logs have no MF4 counterpart: losses are still
+// counted (frame_loss.h) and published with the statistics.
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "nvs.h"
+#include "time_base.h"
+#include "log_naming.h"
+#include "asc_format.h"
+#include "frame_loss.h"
+
+#define MF4_ID_SIZE 64
+#define MF4_HEADER_SIZE 24            // Block header: id, reserved, length, link count.
+#define MF4_UNFINALIZED_FLAGS 0x0005  // Cycle counters of the CG blocks and length of the last DT block to update.
+#define MF4_GROUP_COUNT 3
+#define MF4_MEMBER_COUNT 7
+#define MF4_NVS_KEY_SIZE 16
+#define MF4_COUNTER_DIGITS 10 // Counters of the DG comment: any uint32_t.
+#define MF4_COMMENT_SIZE 384
+
+#ifdef CONFIG_DATAFLY_MF4_SORTED
+#define MF4_RECORD_ID_SIZE 0
+#define MF4_GROUPS_WRITTEN 1
+#else
+#define MF4_RECORD_ID_SIZE 1
+#define MF4_GROUPS_WRITTEN MF4_GROUP_COUNT
+#endif
+
+// Values of the block fields.
+#define MF4_TIME_CLASS_LOCAL 0
+#define MF4_TIME_CLASS_SYNCED 16 // External absolute synchronised time (GNSS).
+#define MF4_SOURCE_BUS 2
+#define MF4_BUS_CAN 2
+#define MF4_CONVERSION_LINEAR 1
+#define MF4_CHANNEL_DATA 0
+#define MF4_CHANNEL_MASTER 2
+#define MF4_SYNC_TIME 1
+#define MF4_UINT_LE 0
+#define MF4_INT_LE 2
+#define MF4_BYTE_ARRAY 10
+#define MF4_CG_BUS_EVENT 0x0002
+#define MF4_CN_BUS_EVENT 0x0400
+
+// Data of the blocks (after the header and the links), little endian like the chip.
+typedef struct __attribute__((packed))
+{
+    uint64_t start_time_ns;
+    int16_t tz_offset_min;
+    int16_t dst_offset_min;
+    uint8_t time_flags;
+    uint8_t time_class;
+    uint8_t flags;
+    uint8_t reserved;
+    double start_angle_rad;
+    double start_distance_m;
+} mf4_hd_data_t;
+
+typedef struct __attribute__((packed))
+{
+    uint64_t time_ns;
+    int16_t tz_offset_min;
+    int16_t dst_offset_min;
+    uint8_t time_flags;
+    uint8_t reserved[3];
+} mf4_fh_data_t;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t record_id_size;
+    uint8_t reserved[7];
+} mf4_dg_data_t;
+
+typedef struct __attribute__((packed))
+{
+    uint64_t record_id;
+    uint64_t cycle_count;
+    uint16_t flags;
+    uint16_t path_separator;
+    uint8_t reserved[4];
+    uint32_t data_bytes;
+    uint32_t inval_bytes;
+} mf4_cg_data_t;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t type;
+    uint8_t bus_type;
+    uint8_t flags;
+    uint8_t reserved[5];
+} mf4_si_data_t;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t type;
+    uint8_t sync_type;
+    uint8_t data_type;
+    uint8_t bit_offset;
+    uint32_t byte_offset;
+    uint32_t bit_count;
+    uint32_t flags;
+    uint32_t inval_bit_pos;
+    uint8_t precision;
+    uint8_t reserved;
+    uint16_t attachment_count;
+    double val_range_min;
+    double val_range_max;
+    double limit_min;
+    double limit_max;
+    double limit_ext_min;
+    double limit_ext_max;
+} mf4_cn_data_t;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t type;
+    uint8_t precision;
+    uint16_t flags;
+    uint16_t ref_count;
+    uint16_t val_count;
+    double phy_range_min;
+    double phy_range_max;
+    double values[2]; // Linear: offset, factor.
+} mf4_cc_data_t;
+
+// Offsets of the fields updated in place, from the start of their block.
+#define MF4_BLOCK_LENGTH_OFFSET 8
+#define MF4_HD_DATA_OFFSET (MF4_HEADER_SIZE + 6 * 8)
+#define MF4_CG_CYCLE_COUNT_OFFSET (MF4_HEADER_SIZE + 6 * 8 + offsetof(mf4_cg_data_t, cycle_count))
+
+// A record. The record ID is not written in a sorted data group, the remote and error frames stop after data_length.
+typedef struct __attribute__((packed))
+{
+    uint8_t record_id;
+    int64_t timestamp_us;
+    uint8_t bus_channel;
+    uint32_t id_ide;  // ID bits 0 to 28, IDE bit 31.
+    uint8_t dlc_dir;  // DLC bits 0 to 3, Dir bit 7 (always 0: Rx).
+    uint8_t data_length;
+    uint8_t reserved;
+    uint8_t data[8];
+} mf4_can_record_t;
+
+typedef enum
+{
+    MF4_DATA_FRAME,
+    MF4_REMOTE_FRAME,
+    MF4_ERROR_FRAME,
+} mf4_group_index_t;
+
+typedef struct
+{
+    const char *name;     // Acquisition name of the group and name of its structure channel.
+    uint8_t record_bytes; // Record ID excluded.
+    uint8_t member_count; // The first ones of mf4_members.
+} mf4_group_t;
+
+static const mf4_group_t mf4_groups[MF4_GROUP_COUNT] = {
+    {"CAN_DataFrame", 24, 7},
+    {"CAN_RemoteFrame", 16, 6},
+    {"CAN_ErrorFrame", 16, 1},
+};
+
+typedef struct
+{
+    const char *name;
+    uint8_t data_type;
+    uint8_t byte_offset; // Record ID excluded, as cn_byte_offset.
+    uint8_t bit_offset;
+    uint8_t bit_count;
+} mf4_member_t;
+
+static const mf4_member_t mf4_members[MF4_MEMBER_COUNT] = {
+    {"BusChannel", MF4_UINT_LE, 8, 0, 8},
+    {"ID", MF4_UINT_LE, 9, 0, 29},
+    {"IDE", MF4_UINT_LE, 12, 7, 1},
+    {"DLC", MF4_UINT_LE, 13, 0, 4},
+    {"Dir", MF4_UINT_LE, 13, 7, 1},
+    {"DataLength", MF4_UINT_LE, 14, 0, 8},
+    {"DataBytes", MF4_BYTE_ARRAY, 16, 0, 64},
+};
+
+// A log being written, or being recovered.
+typedef struct
+{
+    int64_t origin_us;    // Local time the timestamps are relative to.
+    bool has_origin;      // false when recovered: the origin was a time of another boot.
+    bool start_time_set;  // The HD block has the UTC start time.
+    uint8_t channel;
+    uint8_t record_id_size;
+    uint8_t group_count;
+    uint32_t hd, dt;      // Block offsets.
+    uint64_t data_bytes;  // Whole records in the data block.
+    struct
+    {
+        uint32_t cg;
+        uint32_t record_bytes;
+        uint64_t record_id;
+        uint64_t cycle_count;
+        uint32_t not_logged;       // Groups beyond group_count: frames left out.
+        uint32_t not_logged_field; // Offset of the counter in the DG comment, 0: none (recovered log).
+    } groups[MF4_GROUP_COUNT];
+} mf4_log_t;
+
+// Offsets of the blocks, found by a first pass over the blocks that writes nothing (mf4_builder_t.file NULL): the
+// second pass writes them with their links.
+typedef struct
+{
+    uint32_t hd, fh, fh_comment, dg, dg_comment, si, si_name, conversion, unit, time_name, dt;
+    uint32_t not_logged_fields[MF4_GROUP_COUNT];
+    struct
+    {
+        uint32_t cg, name, time, structure;
+        uint32_t members[MF4_MEMBER_COUNT], member_names[MF4_MEMBER_COUNT];
+    } groups[MF4_GROUP_COUNT];
+} mf4_layout_t;
+
+typedef struct
+{
+    FILE *file;        // NULL: layout pass.
+    uint32_t position; // Offset of the next block.
+} mf4_builder_t;
+
+/// @brief Write a block (8 byte aligned, zero padded).
+/// @return offset of the block.
+static uint32_t mf4Block(mf4_builder_t *builder, const char *id, const uint64_t *links, uint32_t link_count,
+                         const void *data, uint32_t data_size)
+{
+    static const uint8_t padding[8] = {0};
+    uint32_t offset = builder->position;
+    uint32_t padded_size = (data_size + 7) & ~7u;
+    uint64_t header[3] = {0, MF4_HEADER_SIZE + 8 * link_count + padded_size, link_count};
+
+    memcpy(header, id, 4);
+    if (builder->file)
+    {
+        fwrite(header, 1, sizeof(header), builder->file);
+        if (link_count)
+            fwrite(links, 8, link_count, builder->file);
+        if (data_size)
+            fwrite(data, 1, data_size, builder->file);
+        fwrite(padding, 1, padded_size - data_size, builder->file);
+    }
+    builder->position += header[1];
+    return offset;
+}
+
+/// @brief Write a TX or MD block.
+static inline uint32_t mf4Text(mf4_builder_t *builder, const char *id, const char *text)
+{
+    return mf4Block(builder, id, NULL, 0, text, strlen(text) + 1);
+}
+
+/// @brief DG comment of a log whose data group leaves groups out (sorted): their frames not logged, all 0.
+/// @param positions receives the offset of the counter of each group left out in the text.
+static void formatMf4NotLoggedComment(char *text, size_t size, uint32_t positions[MF4_GROUP_COUNT])
+{
+    size_t length = snprintf(text, size, "<DGcomment><TX>Sorted data group: remote and error frames are counted, not "
+                             "logged</TX><common_properties>");
+    for (int g = MF4_GROUPS_WRITTEN; g < MF4_GROUP_COUNT; g++)
+    {
+        length += snprintf(text + length, size - length, "<e name=\"%s not logged\" type=\"unsignedInt\">",
+                           mf4_groups[g].name);
+        positions[g] = length;
+        length += snprintf(text + length, size - length, "%0*u</e>", MF4_COUNTER_DIGITS, 0);
+    }
+    snprintf(text + length, size - length, "</common_properties></DGcomment>");
+}
+
+/// @brief Write the ID block, unfinalised or finalised.
+static void writeMf4Id(FILE *file, bool finalized)
+{
+    uint8_t id[MF4_ID_SIZE] = {0};
+    uint16_t version = 411, unfinalized_flags = finalized ? 0 : MF4_UNFINALIZED_FLAGS;
+
+    memcpy(id, finalized ? "MDF     " : "UnFinMF ", 8);
+    memcpy(id + 8, "4.11    ", 8);
+    memcpy(id + 16, "DataFLY ", 8);
+    memcpy(id + 28, &version, sizeof(version));
+    memcpy(id + 60, &unfinalized_flags, sizeof(unfinalized_flags));
+    fwrite(id, 1, sizeof(id), file);
+}
+
+/// @brief Write the blocks from HD to the header of the DT block, or only lay them out.
+static void emitMf4Blocks(mf4_builder_t *builder, mf4_layout_t *layout, uint64_t start_time_ns, uint8_t time_class,
+                          uint8_t channel)
+{
+    char name[40];
+
+    mf4_hd_data_t hd = {.start_time_ns = start_time_ns, .time_class = time_class};
+    layout->hd = mf4Block(builder, "##HD", (uint64_t[]){layout->dg, layout->fh, 0, 0, 0, 0}, 6, &hd, sizeof(hd));
+    mf4_fh_data_t fh = {.time_ns = start_time_ns};
+    layout->fh = mf4Block(builder, "##FH", (uint64_t[]){0, layout->fh_comment}, 2, &fh, sizeof(fh));
+    layout->fh_comment = mf4Text(builder, "##MD", "<FHcomment><TX>CAN bus log</TX><tool_id>DataFLY</tool_id>"
+                                 "<tool_vendor>DataFLY</tool_vendor><tool_version>1</tool_version></FHcomment>");
+    mf4_dg_data_t dg = {.record_id_size = MF4_RECORD_ID_SIZE};
+    layout->dg = mf4Block(builder, "##DG", (uint64_t[]){0, layout->groups[0].cg, layout->dt, layout->dg_comment}, 4,
+                          &dg, sizeof(dg));
+    if (MF4_GROUPS_WRITTEN < MF4_GROUP_COUNT)
+    {
+        char comment[MF4_COMMENT_SIZE];
+        uint32_t positions[MF4_GROUP_COUNT];
+        formatMf4NotLoggedComment(comment, sizeof(comment), positions);
+        layout->dg_comment = mf4Text(builder, "##MD", comment);
+        for (int g = MF4_GROUPS_WRITTEN; g < MF4_GROUP_COUNT; g++)
+            layout->not_logged_fields[g] = layout->dg_comment + MF4_HEADER_SIZE + positions[g];
+    }
+    mf4_si_data_t si = {.type = MF4_SOURCE_BUS, .bus_type = MF4_BUS_CAN};
+    layout->si = mf4Block(builder, "##SI", (uint64_t[]){layout->si_name, 0, 0}, 3, &si, sizeof(si));
+    snprintf(name, sizeof(name), "CAN%u", channel);
+    layout->si_name = mf4Text(builder, "##TX", name);
+    mf4_cc_data_t cc = {.type = MF4_CONVERSION_LINEAR, .val_count = 2, .values = {0, 1e-6}};
+    layout->conversion = mf4Block(builder, "##CC", (uint64_t[]){0, 0, 0, 0}, 4, &cc, sizeof(cc));
+    layout->unit = mf4Text(builder, "##TX", "s");
+    layout->time_name = mf4Text(builder, "##TX", "Timestamp");
+
+    for (int g = 0; g < MF4_GROUPS_WRITTEN; g++)
+    {
+        const mf4_group_t *group = &mf4_groups[g];
+        __typeof__(layout->groups[0]) *blocks = &layout->groups[g];
+        uint64_t next_cg = g + 1 < MF4_GROUPS_WRITTEN ? layout->groups[g + 1].cg : 0;
+
+        mf4_cg_data_t cg = {.record_id = MF4_RECORD_ID_SIZE ? g + 1 : 0, .flags = MF4_CG_BUS_EVENT,
+                            .path_separator = '.', .data_bytes = group->record_bytes};
+        blocks->cg = mf4Block(builder, "##CG", (uint64_t[]){next_cg, blocks->time, blocks->name, layout->si, 0, 0}, 6,
+                              &cg, sizeof(cg));
+        blocks->name = mf4Text(builder, "##TX", group->name);
+        mf4_cn_data_t time = {.type = MF4_CHANNEL_MASTER, .sync_type = MF4_SYNC_TIME, .data_type = MF4_INT_LE,
+                              .bit_count = 64};
+        blocks->time = mf4Block(builder, "##CN", (uint64_t[]){blocks->structure, 0, layout->time_name, 0,
+                                layout->conversion, 0, layout->unit, 0}, 8, &time, sizeof(time));
+        mf4_cn_data_t structure = {.type = MF4_CHANNEL_DATA, .data_type = MF4_BYTE_ARRAY, .byte_offset = 8,
+                                   .bit_count = (group->record_bytes - 8) * 8, .flags = MF4_CN_BUS_EVENT};
+        blocks->structure = mf4Block(builder, "##CN", (uint64_t[]){0, blocks->members[0], blocks->name, 0, 0, 0, 0, 0},
+                                     8, &structure, sizeof(structure));
+        for (int m = 0; m < group->member_count; m++)
+        {
+            const mf4_member_t *member = &mf4_members[m];
+            uint64_t next_member = m + 1 < group->member_count ? blocks->members[m + 1] : 0;
+            mf4_cn_data_t cn = {.type = MF4_CHANNEL_DATA, .data_type = member->data_type,
+                                .bit_offset = member->bit_offset, .byte_offset = member->byte_offset,
+                                .bit_count = member->bit_count, .flags = MF4_CN_BUS_EVENT};
+            blocks->members[m] = mf4Block(builder, "##CN", (uint64_t[]){next_member, 0, blocks->member_names[m], 0, 0,
+                                          0, 0, 0}, 8, &cn, sizeof(cn));
+            snprintf(name, sizeof(name), "%s.%s", group->name, member->name);
+            blocks->member_names[m] = mf4Text(builder, "##TX", name);
+        }
+    }
+    // Length of the header only: the data block is the last one, its length is updated as records are written.
+    layout->dt = mf4Block(builder, "##DT", NULL, 0, NULL, 0);
+}
+
+/// @brief Lay out the blocks of a new log and describe it in log, nothing is written.
+/// @return start time of the log (UTC ns, 0 if the time base is not disciplined).
+static uint64_t layoutMf4Log(mf4_layout_t *layout, mf4_log_t *log, int64_t origin_us, uint8_t channel)
+{
+    mf4_builder_t builder = {.file = NULL, .position = MF4_ID_SIZE};
+    int64_t utc_us = 0;
+    bool synced = timeBaseLocalToUtc(origin_us, &utc_us) && utc_us >= 0;
+
+    memset(layout, 0, sizeof(*layout));
+    emitMf4Blocks(&builder, layout, 0, 0, channel);
+    memset(log, 0, sizeof(*log));
+    log->origin_us = origin_us;
+    log->has_origin = true;
+    log->start_time_set = synced;
+    log->channel = channel;
+    log->record_id_size = MF4_RECORD_ID_SIZE;
+    log->group_count = MF4_GROUPS_WRITTEN;
+    log->hd = layout->hd;
+    log->dt = layout->dt;
+    for (int g = 0; g < MF4_GROUPS_WRITTEN; g++)
+    {
+        log->groups[g].cg = layout->groups[g].cg;
+        log->groups[g].record_bytes = mf4_groups[g].record_bytes;
+        log->groups[g].record_id = MF4_RECORD_ID_SIZE ? g + 1 : 0;
+    }
+    for (int g = MF4_GROUPS_WRITTEN; g < MF4_GROUP_COUNT; g++)
+        log->groups[g].not_logged_field = layout->not_logged_fields[g];
+    return synced ? utc_us * 1000 : 0;
+}
+
+/// @brief Keep (file_name) or forget (NULL) the name of the log of a channel being written, for recoverMf4Logs().
+static void noteMf4LogOpen(uint8_t channel, const char *file_name)
+{
+    nvs_handle_t nvs;
+    char key[MF4_NVS_KEY_SIZE];
+    esp_err_t err = nvs_open("datafly", NVS_READWRITE, &nvs);
+
+    snprintf(key, sizeof(key), "mf4_%u", channel);
+    if (err == ESP_OK)
+    {
+        err = file_name ? nvs_set_str(nvs, key, file_name) : nvs_erase_key(nvs, key);
+        if (err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND)
+            err = nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK)
+        ESP_LOGW("MF4_WRITER_H", "Failed to update %s in NVS (%s)", key, esp_err_to_name(err));
+}
+
+/// @brief Write the blocks of a new log, before any record. The file is left unfinalised.
+/// @param file_name kept for recoverMf4Logs() until finalizeMf4Log(), NULL if the file is not to be recovered.
+/// @param origin_us local time the timestamps are relative to.
+/// @param channel bus channel of the records (ASC_CHANNEL_TWAI, ASC_CHANNEL_MCP2515).
+bool writeMf4Header(FILE *file, const char *file_name, mf4_log_t *log, int64_t origin_us, uint8_t channel)
+{
+    mf4_layout_t layout;
+    uint64_t start_time_ns = layoutMf4Log(&layout, log, origin_us, channel);
+    mf4_builder_t builder = {.file = file, .position = MF4_ID_SIZE};
+
+    writeMf4Id(file, false);
+    emitMf4Blocks(&builder, &layout, start_time_ns,
+                  log->start_time_set ? MF4_TIME_CLASS_SYNCED : MF4_TIME_CLASS_LOCAL, channel);
+    if (file_name)
+        noteMf4LogOpen(channel, file_name);
+    return !ferror(file);
+}
+
+/// @brief Append a record of a group, counted once fully handed to stdio. The frames of groups not in the data group
+/// are counted as not logged. A record cut short is taken back: the file is positioned after the last whole record
+/// again, so that the next one does not land out of step, and the frame is counted as not written (the error flag of
+/// the file is cleared: checkFrameWritten() does not count it twice).
+static void writeMf4Record(FILE *file, mf4_log_t *log, mf4_group_index_t group, mf4_can_record_t *record)
+{
+    if (group >= log->group_count)
+    {
+        log->groups[group].not_logged++;
+        countFrameLoss(FRAME_LOSS_MF4_NOT_LOGGED, 1);
+        return;
+    }
+    size_t size = log->record_id_size + log->groups[group].record_bytes;
+    record->record_id = log->groups[group].record_id;
+    if (fwrite((const uint8_t *)record + 1 - log->record_id_size, 1, size, file) == size)
+    {
+        log->groups[group].cycle_count++;
+        log->data_bytes += size;
+        return;
+    }
+    frame_loss_stage_t stage = log->channel == ASC_CHANNEL_TWAI ? FRAME_LOSS_TWAI_WRITE_FAILED
+                                                                 : FRAME_LOSS_MCP2515_WRITE_FAILED;
+    countFrameLoss(stage, 1);
+    fseek(file, log->dt + MF4_HEADER_SIZE + log->data_bytes, SEEK_SET);
+    clearerr(file);
+}
+
+static inline void fillMf4CanRecord(mf4_can_record_t *record, uint32_t identifier, bool extended, uint8_t dlc,
+                                    const uint8_t *data)
+{
+    record->id_ide = identifier | (uint32_t)extended << 31;
+    record->dlc_dir = dlc & 0x0F;
+    record->data_length = dlc < 8 ? dlc : 8;
+    if (data)
+        memcpy(record->data, data, record->data_length);
+}
+
+/// @brief Append the record of a TWAI frame or error frame.
+/// @param time_us time since the origin of the log.
+void writeMf4TwaiRecord(FILE *file, mf4_log_t *log, const timed_twai_message_t *message, int64_t time_us)
+{
+    const twai_message_t *frame = &message->frame;
+    mf4_can_record_t record = {.timestamp_us = time_us, .bus_channel = log->channel};
+    mf4_group_index_t group = message->error_frame ? MF4_ERROR_FRAME
+                              : frame->rtr         ? MF4_REMOTE_FRAME
+                                                   : MF4_DATA_FRAME;
+    if (group != MF4_ERROR_FRAME)
+        fillMf4CanRecord(&record, frame->identifier, frame->extd, frame->data_length_code,
+                         group == MF4_DATA_FRAME ? frame->data : NULL);
+    writeMf4Record(file, log, group, &record);
+}
+
+/// @brief Append the record of an MCP2515 frame or error frame (CAN_ERR_FLAG).
+/// @param time_us time since the origin of the log.
+void writeMf4Mcp2515Record(FILE *file, mf4_log_t *log, const timed_can_frame_t *message, int64_t time_us)
+{
+    canid_t can_id = message->frame.can_id;
+    bool extended = can_id & CAN_EFF_FLAG;
+    mf4_can_record_t record = {.timestamp_us = time_us, .bus_channel = log->channel};
+    mf4_group_index_t group = (can_id & CAN_ERR_FLAG) ? MF4_ERROR_FRAME
+                              : (can_id & CAN_RTR_FLAG) ? MF4_REMOTE_FRAME
+                                                        : MF4_DATA_FRAME;
+    if (group != MF4_ERROR_FRAME)
+        fillMf4CanRecord(&record, can_id & (extended ? CAN_EFF_MASK : CAN_SFF_MASK), extended, message->frame.can_dlc,
+                         group == MF4_DATA_FRAME ? message->frame.data : NULL);
+    writeMf4Record(file, log, group, &record);
+}
+
+static inline void writeMf4Field(FILE *file, uint32_t offset, const void *value, size_t size)
+{
+    fseek(file, offset, SEEK_SET);
+    fwrite(value, 1, size, file);
+}
+
+/// @brief Update the cycle counters, the frames not logged, the length of the data block and the start time (once
+/// known) of a log in place.
+/// @param file opened "r+".
+/// @param finalize mark the log finalised as well.
+static bool patchMf4Log(FILE *file, mf4_log_t *log, bool finalize)
+{
+    uint64_t dt_length = MF4_HEADER_SIZE + log->data_bytes;
+    int64_t utc_us;
+
+    for (int g = 0; g < log->group_count; g++)
+        writeMf4Field(file, log->groups[g].cg + MF4_CG_CYCLE_COUNT_OFFSET, &log->groups[g].cycle_count,
+                      sizeof(uint64_t));
+    for (int g = log->group_count; g < MF4_GROUP_COUNT; g++)
+    {
+        char digits[MF4_COUNTER_DIGITS + 1];
+        if (!log->groups[g].not_logged_field)
+            continue;
+        snprintf(digits, sizeof(digits), "%0*lu", MF4_COUNTER_DIGITS, (unsigned long)log->groups[g].not_logged);
+        writeMf4Field(file, log->groups[g].not_logged_field, digits, MF4_COUNTER_DIGITS);
+    }
+    writeMf4Field(file, log->dt + MF4_BLOCK_LENGTH_OFFSET, &dt_length, sizeof(dt_length));
+    if (log->has_origin && !log->start_time_set && timeBaseLocalToUtc(log->origin_us, &utc_us) && utc_us >= 0)
+    {
+        uint64_t start_time_ns = utc_us * 1000;
+        uint8_t time_class = MF4_TIME_CLASS_SYNCED;
+        writeMf4Field(file, log->hd + MF4_HD_DATA_OFFSET + offsetof(mf4_hd_data_t, start_time_ns), &start_time_ns,
+                      sizeof(start_time_ns));
+        writeMf4Field(file, log->hd + MF4_HD_DATA_OFFSET + offsetof(mf4_hd_data_t, time_class), &time_class,
+                      sizeof(time_class));
+        log->start_time_set = true;
+    }
+    if (finalize)
+    {
+        fseek(file, 0, SEEK_SET);
+        writeMf4Id(file, true);
+    }
+    fflush(file);
+    return !ferror(file);
+}
+
+/// @brief Flush a log to the card and update its counters, in place of the writer's fclose()/fopen("a").
+/// @return the log reopened, positioned after its last record; NULL if it could not be reopened.
+FILE *checkpointMf4Log(FILE *file, const char *file_name, mf4_log_t *log)
+{
+    fclose(file);
+    file = fopen(file_name, "r+");
+    if (!file)
+        return NULL;
+    patchMf4Log(file, log, false);
+    fseek(file, log->dt + MF4_HEADER_SIZE + log->data_bytes, SEEK_SET);
+    return file;
+}
+
+/// @brief Close a log and finalise it.
+/// @param file the log, NULL if the writer lost it.
+void finalizeMf4Log(FILE *file, const char *file_name, mf4_log_t *log)
+{
+    if (file)
+        fclose(file);
+    if (!log->group_count)
+        return; // No header was ever written.
+    file = fopen(file_name, "r+");
+    if (!file || !patchMf4Log(file, log, true))
+        ESP_LOGE("MF4_WRITER_H", "Failed to finalise %s", file_name);
+    if (file)
+        fclose(file);
+    noteMf4LogOpen(log->channel, NULL);
+}
+
+/// @brief Read a block: its first link_count links and data_size bytes of its data.
+static bool readMf4Block(FILE *file, uint32_t offset, const char *id, uint64_t *links, uint32_t link_count, void *data,
+                         size_t data_size)
+{
+    uint64_t header[3];
+    if (!offset || fseek(file, offset, SEEK_SET) || fread(header, 1, sizeof(header), file) != sizeof(header) ||
+        memcmp(header, id, 4) || header[2] < link_count)
+        return false;
+    if (link_count && fread(links, 8, link_count, file) != link_count)
+        return false;
+    return !data_size || (!fseek(file, offset + MF4_HEADER_SIZE + 8 * header[2], SEEK_SET) &&
+                          fread(data, 1, data_size, file) == data_size);
+}
+
+/// @brief Describe an existing log from its blocks, counters and data length as last updated.
+static bool readMf4Log(FILE *file, mf4_log_t *log)
+{
+    uint64_t links[6], dt_header[3];
+    mf4_dg_data_t dg;
+    mf4_cg_data_t cg;
+
+    memset(log, 0, sizeof(*log));
+    log->hd = MF4_ID_SIZE;
+    if (!readMf4Block(file, log->hd, "##HD", links, 1, NULL, 0) ||
+        !readMf4Block(file, links[0], "##DG", links, 3, &dg, sizeof(dg)) || dg.record_id_size > 1)
+        return false;
+    log->record_id_size = dg.record_id_size;
+    log->dt = links[2];
+    for (uint64_t next = links[1]; next && log->group_count < MF4_GROUP_COUNT; next = links[0])
+    {
+        if (!readMf4Block(file, next, "##CG", links, 1, &cg, sizeof(cg)) ||
+            cg.data_bytes + cg.inval_bytes > sizeof(mf4_can_record_t))
+            return false;
+        log->groups[log->group_count].cg = next;
+        log->groups[log->group_count].record_id = cg.record_id;
+        log->groups[log->group_count].record_bytes = cg.data_bytes + cg.inval_bytes;
+        log->groups[log->group_count].cycle_count = cg.cycle_count;
+        log->group_count++;
+    }
+    if (!log->group_count || fseek(file, log->dt, SEEK_SET) ||
+        fread(dt_header, 1, sizeof(dt_header), file) != sizeof(dt_header) || memcmp(dt_header, "##DT", 4) ||
+        dt_header[1] < MF4_HEADER_SIZE)
+        return false;
+    log->data_bytes = dt_header[1] - MF4_HEADER_SIZE;
+    return true;
+}
+
+/// @brief Count the records written after the data length of a log, up to the end of the file or to a record cut
+/// short.
+static void countMf4Records(FILE *file, mf4_log_t *log)
+{
+    uint8_t record[sizeof(mf4_can_record_t)];
+
+    fseek(file, log->dt + MF4_HEADER_SIZE + log->data_bytes, SEEK_SET);
+    while (true)
+    {
+        int g = 0;
+        if (log->record_id_size)
+        {
+            if (fread(record, 1, 1, file) != 1)
+                break;
+            while (g < log->group_count && log->groups[g].record_id != record[0])
+                g++;
+            if (g == log->group_count)
+                break; // Not a record.
+        }
+        size_t size = log->groups[g].record_bytes;
+        if (fread(record, 1, size, file) != size)
+            break;
+        log->groups[g].cycle_count++;
+        log->data_bytes += log->record_id_size + size;
+    }
+}
+
+/// @brief Finalise a log left unfinalised.
+/// @return true if the log was unfinalised and is now finalised.
+bool recoverMf4Log(const char *file_name)
+{
+    FILE *file = fopen(file_name, "r+");
+    char id[8];
+    mf4_log_t log;
+    bool recovered = false;
+
+    if (!file)
+        return false;
+    if (fread(id, 1, sizeof(id), file) == sizeof(id) && memcmp(id, "UnFinMF ", sizeof(id)) == 0 &&
+        readMf4Log(file, &log))
+    {
+        countMf4Records(file, &log);
+        recovered = patchMf4Log(file, &log, true);
+        if (recovered)
+            ESP_LOGI("MF4_WRITER_H", "Recovered %s: %llu bytes of records", file_name,
+                     (unsigned long long)log.data_bytes);
+    }
+    fclose(file);
+    return recovered;
+}
+
+/// @brief Finalise the logs a power cut left unfinalised, whose names are kept in NVS. To be called after the card is
+/// mounted and NVS initialised, before the writers start.
+void recoverMf4Logs()
+{
+    nvs_handle_t nvs;
+    if (nvs_open("datafly", NVS_READWRITE, &nvs) != ESP_OK)
+        return;
+    for (uint8_t channel = ASC_CHANNEL_TWAI; channel <= ASC_CHANNEL_MCP2515; channel++)
+    {
+        char key[MF4_NVS_KEY_SIZE], file_name[LOG_NAME_SIZE];
+        size_t length = sizeof(file_name);
+        snprintf(key, sizeof(key), "mf4_%u", channel);
+        if (nvs_get_str(nvs, key, file_name, &length) != ESP_OK)
+            continue;
+        recoverMf4Log(file_name);
+        nvs_erase_key(nvs, key);
+    }
+    nvs_commit(nvs);
+    nvs_close(nvs);
+}
@@ -0,0 +1,278 @@
+// MQTT publisher (core 1): heartbeat and live telemetry of the logger, over esp-mqtt.
+// Telemetry is batched: one message per TELEMETRY_PERIOD_MS holding the signals of the latest-value cache
+// (signal_cache.h) that changed since the last message, and every signal once every TELEMETRY_FULL_EVERY messages.
+// A message never exceeds TELEMETRY_MAX_BYTES, signals that do not fit wait for the next message.
+// Fewer, larger messages keep the radio asleep longer, and unchanged values cost no bytes.
+
+// Topics are datafly/<CONFIG_DATAFLY_DEVICE_ID>/<suffix>, each with its own QoS (mqtt_topics):
+// - heartbeat: QoS 1, retained, {"status":"online",...} with uptime, heap, telemetry backlog, card space and upload
+//   queues.
+//   The broker publishes {"status":"offline"} there (last will) if the logger disappears. A heartbeat is published
+//   on every connection, so that the retained offline status does not outlive the reconnection.
+// - telemetry: QoS 0, {"t":<uptime s>,"s":{"<vehicle_signal_id_t>":<value>,...}}.
+// - stats (CONFIG_DATAFLY_RUNTIME_STATS): QoS 0, retained, the latest runtime_stats.h report, with the heartbeat.
+// While the broker is unreachable telemetry messages are kept in a ring of TELEMETRY_BACKLOG_LENGTH messages (the
+// oldest are overwritten) and sent oldest first once connected again. A stale heartbeat is never queued.
+// Can be checked against any broker, e.g. mosquitto on a host: mosquitto_sub -v -t 'datafly/#'. On the linux target
+// the host simulation publishes through components/host_sim, pytest_host_mqtt.py checks it against mosquitto.
+#pragma once
+#include "mqtt_client.h"
+#include "esp_system.h"
+#include "signal_cache.h"
+#include "json_writer.h"
+#include "uploader.h"
+#include "space_manager.h"
+#include "runtime_stats.h"
+
+#define TELEMETRY_PERIOD_MS 10000
+#define TELEMETRY_FULL_EVERY 30
+#define TELEMETRY_MAX_BYTES 512
+#define TELEMETRY_BACKLOG_LENGTH 16
+#define TELEMETRY_STALE_US (30 * 1000000LL) // Signals older than this are not published.
+#define TELEMETRY_DECIMALS 2
+#define HEARTBEAT_PERIOD_MS 60000
+#define MQTT_TOPIC_SIZE 64
+
+typedef enum
+{
+    MQTT_TOPIC_HEARTBEAT,
+    MQTT_TOPIC_TELEMETRY,
+#ifdef CONFIG_DATAFLY_RUNTIME_STATS
+    MQTT_TOPIC_STATS,
+#endif
+    MQTT_TOPIC_COUNT
+} mqtt_topic_id_t;
+
+typedef struct
+{
+    const char *suffix;
+    int qos;
+    bool retain;
+} mqtt_topic_t;
+
+static const mqtt_topic_t mqtt_topics[MQTT_TOPIC_COUNT] = {
+    [MQTT_TOPIC_HEARTBEAT] = {"heartbeat", 1, true},
+    [MQTT_TOPIC_TELEMETRY] = {"telemetry", 0, false},
+#ifdef CONFIG_DATAFLY_RUNTIME_STATS
+    [MQTT_TOPIC_STATS] = {"stats", 0, true},
+#endif
+};
+
+typedef struct
+{
+    uint16_t length;
+    char payload[TELEMETRY_MAX_BYTES];
+} telemetry_message_t;
+
+typedef struct
+{
+    int64_t value;
+    bool valid; // false until the signal is first published, whatever its value.
+} telemetry_published_t;
+
+static esp_mqtt_client_handle_t mqtt_client = NULL;
+static volatile bool mqtt_connected = false;
+static char mqtt_topic_names[MQTT_TOPIC_COUNT][MQTT_TOPIC_SIZE];
+
+// Offline backlog, only touched by the publisher task.
+static telemetry_message_t telemetry_backlog[TELEMETRY_BACKLOG_LENGTH];
+static uint8_t telemetry_backlog_head = 0; // Oldest message.
+static uint8_t telemetry_backlog_count = 0;
+static uint32_t telemetry_backlog_dropped = 0;
+
+static void publishHeartbeat();
+
+static void mqttEventHandler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    if (event_id == MQTT_EVENT_CONNECTED)
+    {
+        mqtt_connected = true;
+        ESP_LOGI("MQTT_PUBLISHER_H", "Connected to the broker");
+        // Replaces the retained offline will at once, rather than up to HEARTBEAT_PERIOD_MS later.
+        publishHeartbeat();
+    }
+    else if (event_id == MQTT_EVENT_DISCONNECTED)
+    {
+        mqtt_connected = false;
+        ESP_LOGW("MQTT_PUBLISHER_H", "Disconnected from the broker");
+    }
+}
+
+static bool mqttPublish(mqtt_topic_id_t topic, const char *payload, int length)
+{
+    if (!mqtt_connected)
+        return false;
+    return esp_mqtt_client_publish(mqtt_client, mqtt_topic_names[topic], payload, length, mqtt_topics[topic].qos,
+                                   mqtt_topics[topic].retain) >= 0;
+}
+
+static void pushTelemetryBacklog(const char *payload, size_t length)
+{
+    if (telemetry_backlog_count == TELEMETRY_BACKLOG_LENGTH)
+    {
+        telemetry_backlog_head = (telemetry_backlog_head + 1) % TELEMETRY_BACKLOG_LENGTH;
+        telemetry_backlog_count--;
+        telemetry_backlog_dropped++;
+    }
+    telemetry_message_t *message =
+        &telemetry_backlog[(telemetry_backlog_head + telemetry_backlog_count) % TELEMETRY_BACKLOG_LENGTH];
+    memcpy(message->payload, payload, length);
+    message->length = length;
+    telemetry_backlog_count++;
+}
+
+static void flushTelemetryBacklog()
+{
+    while (telemetry_backlog_count)
+    {
+        const telemetry_message_t *message = &telemetry_backlog[telemetry_backlog_head];
+        if (!mqttPublish(MQTT_TOPIC_TELEMETRY, message->payload, message->length))
+            return;
+        telemetry_backlog_head = (telemetry_backlog_head + 1) % TELEMETRY_BACKLOG_LENGTH;
+        telemetry_backlog_count--;
+    }
+}
+
+/// @brief Build a telemetry message from the signal cache.
+/// @param published last value published per signal, updated with what went into the message.
+/// @param full publish every fresh signal, not only the ones that changed.
+/// @return the message length, 0 if there is nothing to send.
+size_t buildTelemetryMessage(char *buffer, telemetry_published_t published[SIG_COUNT], bool full)
+{
+    json_writer_t writer;
+    bool any_signal = false;
+
+    // Two bytes are kept back for closing the objects whatever fits.
+    jsonWriterInit(&writer, buffer, TELEMETRY_MAX_BYTES - 2);
+    jsonWriterBeginObject(&writer);
+    jsonWriterKey(&writer, "t");
+    jsonWriterInt(&writer, esp_timer_get_time() / 1000000);
+    jsonWriterKey(&writer, "s");
+    jsonWriterBeginObject(&writer);
+    for (int signal_id = 0; signal_id < SIG_COUNT; signal_id++)
+    {
+        int64_t value;
+        if (signalCacheRead(signal_id, TELEMETRY_STALE_US, &value, NULL) != SIGNAL_FRESH)
+            continue;
+        if (!full && published[signal_id].valid && value == published[signal_id].value)
+            continue;
+
+        char key[8];
+        json_writer_t before = writer;
+        snprintf(key, sizeof(key), "%d", signal_id);
+        jsonWriterKey(&writer, key);
+        jsonWriterFixed(&writer, value, TELEMETRY_DECIMALS);
+        if (writer.overflow)
+        {
+            writer = before; // Over the byte budget, left for the next message.
+            break;
+        }
+        published[signal_id] = (telemetry_published_t){value, true};
+        any_signal = true;
+    }
+    writer.size = TELEMETRY_MAX_BYTES;
+    jsonWriterEndObject(&writer);
+    jsonWriterEndObject(&writer);
+    return any_signal && jsonWriterFinish(&writer) ? writer.length : 0;
+}
+
+static void publishHeartbeat()
+{
+    char buffer[768]; // Room for the metrics of every upload class.
+    json_writer_t writer;
+
+    jsonWriterInit(&writer, buffer, sizeof(buffer));
+    jsonWriterBeginObject(&writer);
+    jsonWriterKey(&writer, "status");
+    jsonWriterString(&writer, "online");
+    jsonWriterKey(&writer, "uptime");
+    jsonWriterInt(&writer, esp_timer_get_time() / 1000000);
+    jsonWriterKey(&writer, "heap");
+    jsonWriterInt(&writer, esp_get_free_heap_size());
+    jsonWriterKey(&writer, "backlog");
+    jsonWriterInt(&writer, telemetry_backlog_count);
+    jsonWriterKey(&writer, "dropped");
+    jsonWriterInt(&writer, telemetry_backlog_dropped);
+    jsonWriterKey(&writer, "card");
+    jsonWriterCardSpace(&writer);
+#ifdef CONFIG_DATAFLY_UPLOAD_ENABLED
+    jsonWriterKey(&writer, "upload");
+    jsonWriterUploadMetrics(&writer);
+#endif
+    jsonWriterEndObject(&writer);
+    if (jsonWriterFinish(&writer))
+        mqttPublish(MQTT_TOPIC_HEARTBEAT, buffer, writer.length);
+}
+
+#ifdef CONFIG_DATAFLY_RUNTIME_STATS
+
+static void publishRuntimeStats()
+{
+    static char buffer[RUNTIME_STATS_JSON_SIZE];
+    size_t length = copyRuntimeStatsJson(buffer, sizeof(buffer));
+    if (length)
+        mqttPublish(MQTT_TOPIC_STATS, buffer, length);
+}
+
+#endif
+
+#ifdef CONFIG_DATAFLY_MQTT_BROKER_URI
+
+/// @brief Create the MQTT client, with the heartbeat topic as last will.
+bool initMqttPublisher()
+{
+    for (int topic = 0; topic < MQTT_TOPIC_COUNT; topic++)
+        snprintf(mqtt_topic_names[topic], MQTT_TOPIC_SIZE, "datafly/%s/%s", CONFIG_DATAFLY_DEVICE_ID,
+                 mqtt_topics[topic].suffix);
+
+    esp_mqtt_client_config_t config = {
+        .broker.address.uri = CONFIG_DATAFLY_MQTT_BROKER_URI,
+        .credentials.client_id = CONFIG_DATAFLY_DEVICE_ID,
+        .session.keepalive = 2 * HEARTBEAT_PERIOD_MS / 1000,
+        .session.last_will.topic = mqtt_topic_names[MQTT_TOPIC_HEARTBEAT],
+        .session.last_will.msg = "{\"status\":\"offline\"}",
+        .session.last_will.qos = mqtt_topics[MQTT_TOPIC_HEARTBEAT].qos,
+        .session.last_will.retain = mqtt_topics[MQTT_TOPIC_HEARTBEAT].retain,
+    };
+    mqtt_client = esp_mqtt_client_init(&config);
+    if (!mqtt_client)
+    {
+        ESP_LOGE("MQTT_PUBLISHER_H", "Failed to create the MQTT client");
+        return false;
+    }
+    esp_mqtt_client_register_event(mqtt_client, ESP_EVENT_ANY_ID, mqttEventHandler, NULL);
+    return esp_mqtt_client_start(mqtt_client) == ESP_OK;
+}
+
+/// @brief Task: publish the telemetry every TELEMETRY_PERIOD_MS and the heartbeat every HEARTBEAT_PERIOD_MS.
+void publishTelemetry(void *pvParameter)
+{
+    static char buffer[TELEMETRY_MAX_BYTES];
+    static telemetry_published_t published[SIG_COUNT];
+    uint32_t message_count = 0;
+    TickType_t last_heartbeat = 0;
+
+    if (!initMqttPublisher())
+        vTaskDelete(NULL);
+    while (true)
+    {
+        vTaskDelay(TELEMETRY_PERIOD_MS / portTICK_PERIOD_MS);
+
+        if (mqtt_connected && xTaskGetTickCount() - last_heartbeat >= pdMS_TO_TICKS(HEARTBEAT_PERIOD_MS))
+        {
+            publishHeartbeat();
+#ifdef CONFIG_DATAFLY_RUNTIME_STATS
+            publishRuntimeStats();
+#endif
+            last_heartbeat = xTaskGetTickCount();
+        }
+        flushTelemetryBacklog();
+
+        size_t length = buildTelemetryMessage(buffer, published, message_count++ % TELEMETRY_FULL_EVERY == 0);
+        if (length && (telemetry_backlog_count || !mqttPublish(MQTT_TOPIC_TELEMETRY, buffer, length)))
+            pushTelemetryBacklog(buffer, length);
+    }
+    vTaskDelete(NULL);
+}
+
+#endif // CONFIG_DATAFLY_MQTT_BROKER_URI
@@ -0,0 +1,271 @@
+// Runtime statistics (CONFIG_DATAFLY_RUNTIME_STATS, core 1): CPU time and stack use of every task, fill of the queues
+// between the tasks and heap minimums, to size the stacks and see the real load of each core.
+// Every CONFIG_DATAFLY_RUNTIME_STATS_PERIOD_S, sampleRuntimeStats() reads the FreeRTOS run-time counters
+// (uxTaskGetSystemState(), esp_timer based, in µs) and the CPU share of each task is its counter difference over the
+// period. The load of a core is what its idle task did not get. Counters are 32 bits: they wrap after 71 minutes,
+// which the differences absorb as long as the period is shorter.
+// The report is printed to the console (one line for the cores and heap, one per queue and per task) and kept as JSON
+// for the dashboard, published on the stats topic (mqtt_publisher.h):
+//   {"t":<uptime s>,"cores":[<load %>,...],"heap":{"free":..,"min_free":..,"largest":..},
+//    "queues":[{"name":..,"waiting":..,"size":..,"high_water":..},...],
+//    "tasks":[{"name":..,"core":<-1: any>,"prio":..,"cpu":<% of a core>,"stack_free":<bytes>},...]}
+#pragma once
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "freertos/semphr.h"
+#include "json_writer.h"
+
+#ifdef CONFIG_DATAFLY_RUNTIME_STATS
+
+#define RUNTIME_STATS_MAX_TASKS 32
+#define RUNTIME_STATS_JSON_SIZE 2560
+#define RUNTIME_STATS_CORES 2
+
+typedef struct
+{
+    const char *name;
+    QueueHandle_t *queue;
+    volatile UBaseType_t *high_water; // NULL when the queue has no high-water mark.
+} runtime_queue_t;
+
+static const runtime_queue_t runtime_queues[] = {
+    {"twai_data", &file_data_queue, &file_data_queue_high_water},
+    {"mcp2515_data", &file_data_queue_mcp2515, &file_data_queue_mcp2515_high_water},
+    {"twai_err", &trigger_err_data_queue, NULL},
+    {"mcp2515_err", &trigger_err_data_queue_mcp2515, NULL},
+    {"signal_chunk", &signal_chunk_queue, NULL},
+    {"summary", &summary_queue, NULL},
+};
+#define RUNTIME_QUEUE_COUNT (sizeof(runtime_queues) / sizeof(runtime_queues[0]))
+
+typedef struct
+{
+    char name[configMAX_TASK_NAME_LEN];
+    int8_t core; // -1: not pinned.
+    uint8_t priority;
+    uint16_t cpu_permille; // Of one core, over the period.
+    uint32_t stack_free;   // Bytes never used since the task started.
+} runtime_task_stats_t;
+
+typedef struct
+{
+    int64_t time_us;
+    uint16_t core_load_permille[RUNTIME_STATS_CORES];
+    uint32_t heap_free;
+    uint32_t heap_min_free;
+    uint32_t heap_largest;
+    UBaseType_t queue_waiting[RUNTIME_QUEUE_COUNT];
+    UBaseType_t queue_size[RUNTIME_QUEUE_COUNT];
+    UBaseType_t task_count;
+    runtime_task_stats_t tasks[RUNTIME_STATS_MAX_TASKS];
+} runtime_stats_t;
+
+// Two samples of the task states: the current one and the previous one, the counters are compared between them.
+static TaskStatus_t runtime_samples[2][RUNTIME_STATS_MAX_TASKS];
+static UBaseType_t runtime_sample_count[2];
+static uint32_t runtime_sample_total[2];
+static uint8_t runtime_sample_current = 0;
+
+// Latest report as JSON, copied out by copyRuntimeStatsJson(). A copy is up to RUNTIME_STATS_JSON_SIZE bytes: it is
+// done under a mutex, not with the interrupts of the core masked.
+static char runtime_stats_json[RUNTIME_STATS_JSON_SIZE];
+static size_t runtime_stats_json_length = 0;
+static SemaphoreHandle_t runtime_stats_mutex = NULL; // Created by reportRuntimeStats().
+
+static uint32_t getPreviousRunTime(const TaskStatus_t *task, uint8_t previous)
+{
+    for (UBaseType_t i = 0; i < runtime_sample_count[previous]; i++)
+        if (runtime_samples[previous][i].xTaskNumber == task->xTaskNumber)
+            return runtime_samples[previous][i].ulRunTimeCounter;
+    return task->ulRunTimeCounter; // Task created during the period: not counted yet.
+}
+
+/// @brief Sample the tasks, queues and heap, CPU shares since the previous call.
+void sampleRuntimeStats(runtime_stats_t *stats)
+{
+    uint8_t current = runtime_sample_current ^= 1;
+    uint8_t previous = current ^ 1;
+    runtime_sample_count[current] =
+        uxTaskGetSystemState(runtime_samples[current], RUNTIME_STATS_MAX_TASKS, &runtime_sample_total[current]);
+    uint32_t elapsed = runtime_sample_total[current] - runtime_sample_total[previous];
+
+    memset(stats, 0, sizeof(*stats));
+    stats->time_us = esp_timer_get_time();
+    for (int core = 0; core < RUNTIME_STATS_CORES; core++)
+        stats->core_load_permille[core] = 1000;
+    stats->task_count = runtime_sample_count[current];
+    for (UBaseType_t i = 0; i < stats->task_count; i++)
+    {
+        const TaskStatus_t *task = &runtime_samples[current][i];
+        runtime_task_stats_t *task_stats = &stats->tasks[i];
+        BaseType_t affinity = xTaskGetAffinity(task->xHandle);
+        uint32_t run_time = task->ulRunTimeCounter - getPreviousRunTime(task, previous);
+
+        snprintf(task_stats->name, sizeof(task_stats->name), "%s", task->pcTaskName);
+        task_stats->core = affinity < RUNTIME_STATS_CORES ? affinity : -1;
+        task_stats->priority = task->uxCurrentPriority;
+        task_stats->cpu_permille = elapsed ? (uint64_t)run_time * 1000 / elapsed : 0;
+        task_stats->stack_free = task->usStackHighWaterMark; // StackType_t is a byte on ESP-IDF.
+        for (int core = 0; core < RUNTIME_STATS_CORES; core++)
+            if (task->xHandle == xTaskGetIdleTaskHandleForCPU(core))
+                stats->core_load_permille[core] =
+                    task_stats->cpu_permille < 1000 ? 1000 - task_stats->cpu_permille : 0;
+    }
+
+    stats->heap_free = esp_get_free_heap_size();
+    stats->heap_min_free = esp_get_minimum_free_heap_size();
+    stats->heap_largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    for (int i = 0; i < RUNTIME_QUEUE_COUNT; i++)
+    {
+        QueueHandle_t queue = *runtime_queues[i].queue;
+        if (!queue)
+            continue;
+        stats->queue_waiting[i] = uxQueueMessagesWaiting(queue);
+        stats->queue_size[i] = stats->queue_waiting[i] + uxQueueSpacesAvailable(queue);
+    }
+}
+
+static void jsonWriterPermille(json_writer_t *writer, uint16_t permille)
+{
+    jsonWriterFixed(writer, ((int64_t)permille << 16) / 10, 1);
+}
+
+/// @brief Serialise a report.
+/// @return the JSON text in buffer, NULL if the buffer is too small.
+const char *runtimeStatsToJson(const runtime_stats_t *stats, char *buffer, size_t size)
+{
+    json_writer_t writer;
+    jsonWriterInit(&writer, buffer, size);
+    jsonWriterBeginObject(&writer);
+    jsonWriterKey(&writer, "t");
+    jsonWriterInt(&writer, stats->time_us / 1000000);
+    jsonWriterKey(&writer, "cores");
+    jsonWriterBeginArray(&writer);
+    for (int core = 0; core < RUNTIME_STATS_CORES; core++)
+        jsonWriterPermille(&writer, stats->core_load_permille[core]);
+    jsonWriterEndArray(&writer);
+
+    jsonWriterKey(&writer, "heap");
+    jsonWriterBeginObject(&writer);
+    jsonWriterKey(&writer, "free");
+    jsonWriterInt(&writer, stats->heap_free);
+    jsonWriterKey(&writer, "min_free");
+    jsonWriterInt(&writer, stats->heap_min_free);
+    jsonWriterKey(&writer, "largest");
+    jsonWriterInt(&writer, stats->heap_largest);
+    jsonWriterEndObject(&writer);
+
+    jsonWriterKey(&writer, "queues");
+    jsonWriterBeginArray(&writer);
+    for (int i = 0; i < RUNTIME_QUEUE_COUNT; i++)
+    {
+        jsonWriterBeginObject(&writer);
+        jsonWriterKey(&writer, "name");
+        jsonWriterString(&writer, runtime_queues[i].name);
+        jsonWriterKey(&writer, "waiting");
+        jsonWriterInt(&writer, stats->queue_waiting[i]);
+        jsonWriterKey(&writer, "size");
+        jsonWriterInt(&writer, stats->queue_size[i]);
+        if (runtime_queues[i].high_water)
+        {
+            jsonWriterKey(&writer, "high_water");
+            jsonWriterInt(&writer, *runtime_queues[i].high_water);
+        }
+        jsonWriterEndObject(&writer);
+    }
+    jsonWriterEndArray(&writer);
+
+    jsonWriterKey(&writer, "tasks");
+    jsonWriterBeginArray(&writer);
+    for (UBaseType_t i = 0; i < stats->task_count; i++)
+    {
+        const runtime_task_stats_t *task = &stats->tasks[i];
+        jsonWriterBeginObject(&writer);
+        jsonWriterKey(&writer, "name");
+        jsonWriterString(&writer, task->name);
+        jsonWriterKey(&writer, "core");
+        jsonWriterInt(&writer, task->core);
+        jsonWriterKey(&writer, "prio");
+        jsonWriterInt(&writer, task->priority);
+        jsonWriterKey(&writer, "cpu");
+        jsonWriterPermille(&writer, task->cpu_permille);
+        jsonWriterKey(&writer, "stack_free");
+        jsonWriterInt(&writer, task->stack_free);
+        jsonWriterEndObject(&writer);
+    }
+    jsonWriterEndArray(&writer);
+    jsonWriterEndObject(&writer);
+    return jsonWriterFinish(&writer);
+}
+
+/// @brief Copy the latest JSON report.
+/// @return its length, 0 if there is none yet or the buffer is too small.
+size_t copyRuntimeStatsJson(char *buffer, size_t size)
+{
+    size_t length = 0;
+    if (!runtime_stats_mutex)
+        return 0;
+    xSemaphoreTake(runtime_stats_mutex, portMAX_DELAY);
+    if (runtime_stats_json_length < size)
+    {
+        length = runtime_stats_json_length;
+        memcpy(buffer, runtime_stats_json, length);
+        buffer[length] = '\0';
+    }
+    xSemaphoreGive(runtime_stats_mutex);
+    return length;
+}
+
+static void logRuntimeStats(const runtime_stats_t *stats)
+{
+    ESP_LOGI("RUNTIME_STATS_H", "cpu %u.%u%% %u.%u%%, heap free %lu min %lu largest %lu",
+             stats->core_load_permille[0] / 10, stats->core_load_permille[0] % 10, stats->core_load_permille[1] / 10,
+             stats->core_load_permille[1] % 10, (unsigned long)stats->heap_free, (unsigned long)stats->heap_min_free,
+             (unsigned long)stats->heap_largest);
+    for (int i = 0; i < RUNTIME_QUEUE_COUNT; i++)
+        ESP_LOGI("RUNTIME_STATS_H", "queue %-13s %4u/%-4u high %ld", runtime_queues[i].name,
+                 (unsigned)stats->queue_waiting[i], (unsigned)stats->queue_size[i],
+                 runtime_queues[i].high_water ? (long)*runtime_queues[i].high_water : -1L);
+    for (UBaseType_t i = 0; i < stats->task_count; i++)
+    {
+        const runtime_task_stats_t *task = &stats->tasks[i];
+        ESP_LOGI("RUNTIME_STATS_H", "task %-16s core %2d prio %2u cpu %3u.%u%% stack free %5lu", task->name,
+                 task->core, task->priority, task->cpu_permille / 10, task->cpu_permille % 10,
+                 (unsigned long)task->stack_free);
+    }
+}
+
+/// @brief Task: sample and report the runtime statistics every CONFIG_DATAFLY_RUNTIME_STATS_PERIOD_S.
+void reportRuntimeStats(void *pvParameter)
+{
+    static runtime_stats_t stats;
+    static char json[RUNTIME_STATS_JSON_SIZE];
+
+    runtime_stats_mutex = xSemaphoreCreateMutex();
+    if (!runtime_stats_mutex)
+    {
+        ESP_LOGE("RUNTIME_STATS_H", "Failed to create the runtime stats mutex");
+        vTaskDelete(NULL);
+    }
+    sampleRuntimeStats(&stats); // Reference for the first period.
+    while (true)
+    {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_DATAFLY_RUNTIME_STATS_PERIOD_S * 1000));
+        sampleRuntimeStats(&stats);
+        if (!stats.task_count) // uxTaskGetSystemState() returns nothing when the tasks do not fit.
+            ESP_LOGW("RUNTIME_STATS_H", "More than %d tasks, none reported", RUNTIME_STATS_MAX_TASKS);
+        logRuntimeStats(&stats);
+        if (!runtimeStatsToJson(&stats, json, sizeof(json)))
+        {
+            ESP_LOGE("RUNTIME_STATS_H", "Report larger than %d bytes", RUNTIME_STATS_JSON_SIZE);
+            continue;
+        }
+        xSemaphoreTake(runtime_stats_mutex, portMAX_DELAY);
+        runtime_stats_json_length = strlen(json);
+        memcpy(runtime_stats_json, json, runtime_stats_json_length);
+        xSemaphoreGive(runtime_stats_mutex);
+    }
+    vTaskDelete(NULL);
+}
+
+#endif // CONFIG_DATAFLY_RUNTIME_STATS
@@ -18,7 +18,11 @@
 #include "esp_vfs_fat.h"
 #include "sdmmc_cmd.h"
 
+#ifdef CONFIG_IDF_TARGET_LINUX
+#define MOUNT_POINT CONFIG_DATAFLY_HOST_CARD_DIR // Host directory standing in for the card (host_sim).
+#else
 #define MOUNT_POINT "/sdcard"
+#endif
 
 // Pin assignments can be set in menuconfig, see "SD SPI Example Configuration" menu.
 // You can also change the pin assignments here by changing the following 4 lines.
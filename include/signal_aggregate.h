@@ -0,0 +1,253 @@
+// On-device aggregates: per signal min/max/mean/last over fixed windows at several resolutions (1 s and 1 min), built
+// incrementally by the decoding task, in fixed memory (one open window per signal and resolution).
+// Dashboards and cellular uploads use these summaries instead of the raw 100 Hz values.
+
+// A window closes on the first sample received after its end, or at the latest AGGREGATE_SWEEP_US after its end when
+// the decoding task sweeps the windows (signalAggregateCloseWindows()), so that the last window of a signal that went
+// silent is emitted too. The decoding task stays the only one touching the windows. A closed window is emitted as a
+// signal_summary_t record through summary_queue to writeSignalSummaries (core 1), which appends the records in blocks
+// to segments of SUM_FS (s_<n>.bin, a new one every SUMMARY_SEGMENT_US) so that closed segments can be uploaded like
+// the logs. Each block is synced to the card once written.
+// Windows start on multiples of their length in local time (µs since boot, time_base.h). Every segment starts with a
+// summary_time_base_t record of the time base model, and has one more every time the model changes, so that every
+// window converts to UTC with the last model above it.
+// To keep the output compact, a 1 s window of a signal that did not move (min == max == last of the previous window)
+// is not emitted, the minute record covers it. Minute windows are always emitted.
+// Aggregation is done on the Q.16 values (integer only), records carry floats.
+#pragma once
+#include <unistd.h>
+#include "vehicle_signals.h"
+#include "time_base.h"
+#include "freertos/queue.h"
+
+#define SUMMARY_DIRECTORY "SUM_FS"
+#define SUMMARY_SEGMENT_US (15 * 60 * 1000000LL)
+#define SUMMARY_QUEUE_LENGTH 64
+#define SUMMARY_BLOCK_SIZE 2048
+#define SUMMARY_FLUSH_TICKS pdMS_TO_TICKS(60000)
+#define AGGREGATE_SWEEP_US 100000LL
+#define SUMMARY_TIME_BASE_ID 0xFFFF // signal_id of the summary_time_base_t records.
+
+typedef enum
+{
+    AGGREGATE_1S,
+    AGGREGATE_1MIN,
+    AGGREGATE_RESOLUTION_COUNT
+} aggregate_resolution_t;
+
+static const int64_t aggregate_window_us[AGGREGATE_RESOLUTION_COUNT] = {
+    [AGGREGATE_1S] = 1000000LL,
+    [AGGREGATE_1MIN] = 60 * 1000000LL,
+};
+
+// Record written to the card, 29 bytes.
+typedef struct __attribute__((packed))
+{
+    int64_t window_start_us;
+    uint16_t signal_id; // vehicle_signal_id_t.
+    uint8_t resolution; // aggregate_resolution_t.
+    uint16_t count;     // Samples in the window.
+    float min;
+    float max;
+    float mean;
+    float last;
+} signal_summary_t;
+
+// Time base model (time_base_model_t) in force for the records that follow, the size of a signal_summary_t.
+typedef struct __attribute__((packed))
+{
+    int64_t ref_local_us;
+    uint16_t signal_id; // SUMMARY_TIME_BASE_ID.
+    uint8_t synced;     // 0 until a time source disciplined the clock: the other fields are then meaningless.
+    uint16_t reserved;
+    int64_t ref_utc_us;
+    int32_t drift_ppb;
+    uint32_t version;
+} summary_time_base_t;
+
+typedef struct
+{
+    int64_t start_us;
+    int64_t min;
+    int64_t max;
+    int64_t sum;
+    int64_t last;
+    int64_t previous_last; // Last value of the previous window, to detect idle windows.
+    uint32_t count;
+    bool has_previous;
+} aggregate_window_t;
+
+static aggregate_window_t aggregate_windows[SIG_COUNT][AGGREGATE_RESOLUTION_COUNT];
+static QueueHandle_t summary_queue = NULL;
+static uint32_t summaries_dropped = 0;
+
+void createSummaryQueue()
+{
+    summary_queue = xQueueCreate(SUMMARY_QUEUE_LENGTH, sizeof(signal_summary_t));
+    if (!summary_queue)
+    {
+        ESP_LOGE("SIGNAL_AGGREGATE_H", "Error Creating Summary Queue");
+    } else {
+        ESP_LOGI("SIGNAL_AGGREGATE_H", "Summary Queue created succesfully");
+    }
+}
+
+static void emitSummary(vehicle_signal_id_t signal_id, aggregate_resolution_t resolution,
+                        const aggregate_window_t *window)
+{
+    if (resolution == AGGREGATE_1S && window->has_previous && window->min == window->max &&
+        window->last == window->previous_last)
+        return;
+
+    signal_summary_t summary = {
+        .window_start_us = window->start_us,
+        .signal_id = signal_id,
+        .resolution = resolution,
+        .count = window->count > UINT16_MAX ? UINT16_MAX : window->count,
+        .min = canFixedToFloat(window->min),
+        .max = canFixedToFloat(window->max),
+        .mean = canFixedToFloat(window->sum / (int64_t)window->count),
+        .last = canFixedToFloat(window->last),
+    };
+    if (xQueueSend(summary_queue, &summary, 0) != pdPASS)
+        summaries_dropped++;
+}
+
+static void closeAggregateWindow(vehicle_signal_id_t signal_id, aggregate_resolution_t resolution,
+                                 aggregate_window_t *window)
+{
+    emitSummary(signal_id, resolution, window);
+    window->previous_last = window->last;
+    window->has_previous = true;
+    window->count = 0;
+}
+
+/// @brief Add a sample to every window of a signal, emitting the windows it closes.
+/// @param value physical value in Q.16.
+void signalAggregateUpdate(vehicle_signal_id_t signal_id, int64_t value, int64_t time_us)
+{
+    for (uint8_t resolution = 0; resolution < AGGREGATE_RESOLUTION_COUNT; resolution++)
+    {
+        aggregate_window_t *window = &aggregate_windows[signal_id][resolution];
+        int64_t start_us = time_us - time_us % aggregate_window_us[resolution];
+
+        if (window->count && window->start_us != start_us)
+            closeAggregateWindow(signal_id, resolution, window);
+        if (window->count == 0)
+        {
+            window->start_us = start_us;
+            window->min = value;
+            window->max = value;
+            window->sum = 0;
+        }
+        if (value < window->min)
+            window->min = value;
+        if (value > window->max)
+            window->max = value;
+        window->sum += value;
+        window->last = value;
+        window->count++;
+    }
+}
+
+/// @brief Aggregate all signals of a decoded message (values indexed by vehicle_signal_id_t, as filled by
+/// decodeVehicleFrameFixed()).
+void signalAggregateUpdateMessage(const can_message_def_t *message, const int64_t values[SIG_COUNT], int64_t time_us)
+{
+    size_t first = message->signals - vehicle_signals;
+    for (size_t i = first; i < first + message->signal_count; i++)
+        signalAggregateUpdate(i, values[i], time_us);
+}
+
+/// @brief Emit the windows that ended by now_us. Called by the decoding task every AGGREGATE_SWEEP_US, whether
+/// frames come or not.
+void signalAggregateCloseWindows(int64_t now_us)
+{
+    for (int signal_id = 0; signal_id < SIG_COUNT; signal_id++)
+    {
+        for (uint8_t resolution = 0; resolution < AGGREGATE_RESOLUTION_COUNT; resolution++)
+        {
+            aggregate_window_t *window = &aggregate_windows[signal_id][resolution];
+            if (window->count && now_us - window->start_us >= aggregate_window_us[resolution])
+                closeAggregateWindow(signal_id, resolution, window);
+        }
+    }
+}
+
+static void flushSummaryBlock(FILE *summary_f, const uint8_t *block, size_t *block_size)
+{
+    if (!*block_size)
+        return;
+    if (file_mutex)
+        xSemaphoreTake(file_mutex, portMAX_DELAY);
+    if (fwrite(block, 1, *block_size, summary_f) != *block_size || fflush(summary_f) || fsync(fileno(summary_f)))
+        ESP_LOGE("SIGNAL_AGGREGATE_H", "Failed to write %u bytes of summaries", (unsigned)*block_size);
+    if (file_mutex)
+        xSemaphoreGive(file_mutex);
+    *block_size = 0;
+}
+
+/// @brief Append the time base model to the block, which has room for it.
+/// @return version of the model appended.
+static uint32_t appendSummaryTimeBase(uint8_t *block, size_t *block_size)
+{
+    time_base_model_t model;
+    timeBaseGetModel(&model);
+    summary_time_base_t record = {
+        .ref_local_us = model.ref_local_us,
+        .signal_id = SUMMARY_TIME_BASE_ID,
+        .synced = model.synced,
+        .ref_utc_us = model.ref_utc_us,
+        .drift_ppb = model.drift_ppb,
+        .version = model.version,
+    };
+    memcpy(&block[*block_size], &record, sizeof(record));
+    *block_size += sizeof(record);
+    return model.version;
+}
+
+/// @brief Task: append summary records to the current segment, a block at a time (or every SUMMARY_FLUSH_TICKS), and
+/// start a new segment every SUMMARY_SEGMENT_US once the current one holds summaries.
+void writeSignalSummaries(void *pvParameter)
+{
+    static uint8_t block[SUMMARY_BLOCK_SIZE];
+    static char file_name[LOG_NAME_SIZE];
+    size_t block_size = 0;
+    bool segment_used = false;
+    unsigned long index = nextLogSegmentIndex(SUMMARY_DIRECTORY, 's');
+    int64_t segment_start_us = esp_timer_get_time();
+    signal_summary_t summary;
+
+    FILE *summary_f = openLogSegment(NULL, SUMMARY_DIRECTORY, 's', "bin", file_name, &index);
+    if (!summary_f)
+        vTaskDelete(NULL);
+    uint32_t time_base_version = appendSummaryTimeBase(block, &block_size);
+    while (true)
+    {
+        if (xQueueReceive(summary_queue, &summary, SUMMARY_FLUSH_TICKS) != pdPASS)
+            flushSummaryBlock(summary_f, block, &block_size);
+        else
+        {
+            // Room for the summary and a time base record.
+            if (block_size + 2 * sizeof(summary) > SUMMARY_BLOCK_SIZE)
+                flushSummaryBlock(summary_f, block, &block_size);
+            if (timeBaseVersion() != time_base_version)
+                time_base_version = appendSummaryTimeBase(block, &block_size);
+            memcpy(&block[block_size], &summary, sizeof(summary));
+            block_size += sizeof(summary);
+            segment_used = true;
+        }
+
+        if (segment_used && esp_timer_get_time() - segment_start_us >= SUMMARY_SEGMENT_US)
+        {
+            flushSummaryBlock(summary_f, block, &block_size);
+            summary_f = openLogSegment(summary_f, SUMMARY_DIRECTORY, 's', "bin", file_name, &index);
+            if (!summary_f)
+                break;
+            time_base_version = appendSummaryTimeBase(block, &block_size);
+            segment_used = false;
+            segment_start_us = esp_timer_get_time();
+        }
+    }
+    vTaskDelete(NULL);
+}
@@ -0,0 +1,96 @@
+// Latest-value cache: the last decoded value of every signal of vehicle_signals.h with its time, for any task that
+// needs "current vehicle speed" (heartbeat, display, triggers...) without sniffing the raw queues.
+
+// Each entry is protected by a sequence lock (seqlock): the writer makes the sequence odd, updates the entry and makes
+// it even again, readers copy the entry and retry if the sequence was odd or changed meanwhile.
+// The writer never waits for readers, so the decoding task is never held up, whatever core the readers run on, and
+// readers never take a lock either. An entry has a single writer: the task that decodes the message of the signal.
+// The writer runs at the lowest priority (sendCanDataMCP2515()), so a reader on its core could preempt it halfway
+// through an entry and spin on an odd sequence that never changes. A message is therefore written in a critical
+// section (a few dozen instructions), and a reader that still finds the entry busy after SIGNAL_CACHE_SPIN_RETRIES
+// sleeps a tick between the next attempts instead of spinning.
+#pragma once
+#include "vehicle_signals.h"
+#include "esp_timer.h"
+
+#define SIGNAL_CACHE_SPIN_RETRIES 64
+
+typedef struct
+{
+    uint32_t sequence; // Odd while the entry is being written.
+    int64_t value;     // Q.16, see canSignalDecodeFixed().
+    int64_t time_us;   // esp_timer_get_time() of the update, 0 if the signal was never received.
+} signal_cache_entry_t;
+
+typedef enum
+{
+    SIGNAL_NEVER_RECEIVED,
+    SIGNAL_STALE, // Older than the age asked by the reader.
+    SIGNAL_FRESH
+} signal_freshness_t;
+
+static signal_cache_entry_t signal_cache[SIG_COUNT];
+static portMUX_TYPE signal_cache_lock = portMUX_INITIALIZER_UNLOCKED; // Held by the writer only.
+
+static inline void signalCacheWrite(vehicle_signal_id_t signal_id, int64_t value, int64_t time_us)
+{
+    signal_cache_entry_t *entry = &signal_cache[signal_id];
+    uint32_t sequence = entry->sequence;
+
+    __atomic_store_n(&entry->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE); // The odd sequence is visible before any of the data.
+    entry->value = value;
+    entry->time_us = time_us;
+    __atomic_store_n(&entry->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+/// @brief Update the cache with all signals of a decoded message (values indexed by vehicle_signal_id_t, as filled by
+/// decodeVehicleFrameFixed()).
+void signalCacheUpdateMessage(const can_message_def_t *message, const int64_t values[SIG_COUNT], int64_t time_us)
+{
+    size_t first = message->signals - vehicle_signals;
+    portENTER_CRITICAL(&signal_cache_lock);
+    for (size_t i = first; i < first + message->signal_count; i++)
+        signalCacheWrite(i, values[i], time_us);
+    portEXIT_CRITICAL(&signal_cache_lock);
+}
+
+/// @brief Read the latest value of a signal, never blocks the writer.
+/// @param max_age_us age above which the value is reported as stale.
+/// @param value Q.16 value, left untouched if the signal was never received.
+/// @param time_us time of the value, may be NULL.
+signal_freshness_t signalCacheRead(vehicle_signal_id_t signal_id, int64_t max_age_us, int64_t *value, int64_t *time_us)
+{
+    const signal_cache_entry_t *entry = &signal_cache[signal_id];
+    uint32_t before, after;
+    int64_t read_value, read_time_us;
+    uint32_t attempts = 0;
+
+    do
+    {
+        if (attempts++ >= SIGNAL_CACHE_SPIN_RETRIES)
+            vTaskDelay(1); // Lets the writer finish whatever its priority.
+        before = __atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE);
+        read_value = entry->value;
+        read_time_us = entry->time_us;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE); // The data is read before the sequence is checked again.
+        after = __atomic_load_n(&entry->sequence, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+
+    if (read_time_us == 0)
+        return SIGNAL_NEVER_RECEIVED;
+    *value = read_value;
+    if (time_us)
+        *time_us = read_time_us;
+    return esp_timer_get_time() - read_time_us > max_age_us ? SIGNAL_STALE : SIGNAL_FRESH;
+}
+
+/// @brief signalCacheRead() for readers that want a physical value as a float.
+signal_freshness_t signalCacheReadFloat(vehicle_signal_id_t signal_id, int64_t max_age_us, float *value)
+{
+    int64_t fixed_value;
+    signal_freshness_t freshness = signalCacheRead(signal_id, max_age_us, &fixed_value, NULL);
+    if (freshness != SIGNAL_NEVER_RECEIVED)
+        *value = canFixedToFloat(fixed_value);
+    return freshness;
+}
@@ -0,0 +1,344 @@
+// Decoded signal store: a small time-series store for the signals of vehicle_signals.h, so that "State of Charge over
+// the last hour" can be read back without decoding the raw .asc logs again.
+
+// Layout (columnar): every signal fills its own chunk in RAM. A chunk holds samples of one signal only, each sample
+// being two zigzag LEB128 varints: the time delta (us) and the value delta (Q.16, see canSignalDecodeFixed()) from the
+// previous sample. Slow moving signals typically take 2 bytes per sample.
+// A sample is only stored when the value changes, or every SIGNAL_STORE_KEEPALIVE_US to show the signal is alive.
+
+// A chunk is sealed when its payload is full or older than SIGNAL_STORE_CHUNK_AGE_US, on the next sample of its
+// signal or at the latest when the decoding task sweeps the columns (signalStoreSealIdleChunks(), every
+// AGGREGATE_SWEEP_US) so that the samples of a signal that went silent reach the card too. It is handed over through
+// signal_chunk_queue to writeSignalStore (core 1). That task packs chunks into a SIGNAL_STORE_BLOCK_SIZE buffer and
+// writes the whole block at once, then syncs the file: FAT only updates the size of a file in its directory entry on
+// f_sync/f_close, and the logger is normally switched off by cutting the ignition.
+// RAM used is bounded: one chunk per signal, the queue, and one block.
+// On the card the store is split into segments of SIG_FS (t_<n>.dat, a new one every SIGNAL_STORE_SEGMENT_US) that
+// are uploaded and evicted like the logs. A segment is a plain sequence of [signal_chunk_header_t][payload] records.
+// Sample times are local (µs since boot, time_base.h): every segment starts with a time base record (signal_id
+// SIGNAL_STORE_TIME_BASE_ID, payload signal_store_time_base_t) and has one more every time the model changes, so
+// that every chunk converts to UTC with the last model above it. Readers looking for a signal skip them like the
+// chunks of the other signals.
+
+// The decoding task (producer) never blocks on the store: if the queue is full the chunk is dropped and counted.
+#pragma once
+#include <unistd.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/queue.h"
+#include "vehicle_signals.h"
+#include "file_handle.h"
+
+#define SIGNAL_STORE_DIRECTORY "SIG_FS"
+#define SIGNAL_STORE_SEGMENT_US (15 * 60 * 1000000LL)
+#define SIGNAL_CHUNK_PAYLOAD_SIZE 240
+#define SIGNAL_CHUNK_QUEUE_LENGTH 16
+#define SIGNAL_STORE_BLOCK_SIZE 4096
+#define SIGNAL_STORE_KEEPALIVE_US (10 * 1000000LL)
+#define SIGNAL_STORE_CHUNK_AGE_US (60 * 1000000LL)
+#define SIGNAL_STORE_FLUSH_TICKS pdMS_TO_TICKS(30000)
+#define SIGNAL_CHUNK_MAGIC 0x4B434753 // "SGCK" on the card.
+#define SIGNAL_STORE_TIME_BASE_ID 0xFFFF // signal_id of the time base records.
+
+// Worst case of a sample: two 10 byte varints.
+#define SIGNAL_SAMPLE_MAX_SIZE 20
+
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;
+    uint16_t signal_id;     // vehicle_signal_id_t.
+    uint16_t sample_count;
+    uint16_t payload_size;
+    int64_t first_time_us;  // Time of the first sample, the deltas start from it and first_value.
+    int64_t last_time_us;
+    int64_t first_value;    // Q.16.
+} signal_chunk_header_t;
+
+typedef struct
+{
+    signal_chunk_header_t header;
+    uint8_t payload[SIGNAL_CHUNK_PAYLOAD_SIZE];
+} signal_chunk_t;
+
+// Payload of a time base record: the time base model (time_base_model_t) in force for the chunks that follow. The
+// times of its header are ref_local_us, sample_count is 0.
+typedef struct __attribute__((packed))
+{
+    int64_t ref_local_us;
+    int64_t ref_utc_us;
+    int32_t drift_ppb;
+    uint32_t version;
+    uint8_t synced; // 0 until a time source disciplined the clock: the other fields are then meaningless.
+} signal_store_time_base_t;
+
+typedef struct
+{
+    signal_chunk_t chunk;
+    int64_t last_value; // Last value stored, to compute the next delta.
+} signal_column_t;
+
+static signal_column_t signal_columns[SIG_COUNT];
+static QueueHandle_t signal_chunk_queue = NULL;
+static uint32_t signal_chunks_dropped = 0;
+
+void createSignalStoreQueue()
+{
+    signal_chunk_queue = xQueueCreate(SIGNAL_CHUNK_QUEUE_LENGTH, sizeof(signal_chunk_t));
+    if (!signal_chunk_queue)
+    {
+        ESP_LOGE("SIGNAL_STORE_H", "Error Creating Signal Chunk Queue");
+    } else {
+        ESP_LOGI("SIGNAL_STORE_H", "Signal Chunk Queue created succesfully");
+    }
+}
+
+static inline uint8_t *putVarint(uint8_t *out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+static inline const uint8_t *getVarint(const uint8_t *in, const uint8_t *end, uint64_t *value)
+{
+    uint64_t result = 0;
+    for (uint8_t shift = 0; in < end && shift < 64; shift += 7)
+    {
+        uint8_t byte = *in++;
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            *value = result;
+            return in;
+        }
+    }
+    return NULL; // Truncated or corrupted.
+}
+
+static inline uint64_t zigzagEncode(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t zigzagDecode(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/// @brief Hand the chunk of a column over to the writer task, and start an empty one.
+void sealSignalChunk(signal_column_t *column)
+{
+    if (column->chunk.header.sample_count == 0)
+        return;
+    if (xQueueSend(signal_chunk_queue, &column->chunk, 0) != pdPASS)
+        signal_chunks_dropped++;
+    column->chunk.header.sample_count = 0;
+    column->chunk.header.payload_size = 0;
+}
+
+/// @brief Seal the chunks older than SIGNAL_STORE_CHUNK_AGE_US by now_us. Called by the decoding task every
+/// AGGREGATE_SWEEP_US, whether frames come or not, so that a silent signal does not keep its last samples in RAM.
+/// INT64_MAX seals every chunk.
+void signalStoreSealIdleChunks(int64_t now_us)
+{
+    for (int signal_id = 0; signal_id < SIG_COUNT; signal_id++)
+    {
+        signal_column_t *column = &signal_columns[signal_id];
+        if (column->chunk.header.sample_count &&
+            column->chunk.header.first_time_us <= now_us - SIGNAL_STORE_CHUNK_AGE_US)
+            sealSignalChunk(column);
+    }
+}
+
+/// @brief Append a sample of a signal to its column.
+/// @param value physical value in Q.16.
+void signalStoreAppend(vehicle_signal_id_t signal_id, int64_t time_us, int64_t value)
+{
+    signal_column_t *column = &signal_columns[signal_id];
+    signal_chunk_header_t *header = &column->chunk.header;
+
+    if (header->sample_count)
+    {
+        if (value == column->last_value && time_us - header->last_time_us < SIGNAL_STORE_KEEPALIVE_US)
+            return;
+        if (header->payload_size + SIGNAL_SAMPLE_MAX_SIZE > SIGNAL_CHUNK_PAYLOAD_SIZE ||
+            time_us - header->first_time_us >= SIGNAL_STORE_CHUNK_AGE_US)
+            sealSignalChunk(column);
+    }
+
+    if (header->sample_count == 0)
+    {
+        header->magic = SIGNAL_CHUNK_MAGIC;
+        header->signal_id = signal_id;
+        header->first_time_us = time_us;
+        header->first_value = value;
+        header->last_time_us = time_us;
+        column->last_value = value;
+    }
+
+    uint8_t *out = &column->chunk.payload[header->payload_size];
+    out = putVarint(out, zigzagEncode(time_us - header->last_time_us));
+    out = putVarint(out, zigzagEncode(value - column->last_value));
+    header->payload_size = out - column->chunk.payload;
+    header->sample_count++;
+    header->last_time_us = time_us;
+    column->last_value = value;
+}
+
+/// @brief Append all signals of a decoded message (values indexed by vehicle_signal_id_t, as filled by
+/// decodeVehicleFrameFixed()).
+void signalStoreAppendMessage(const can_message_def_t *message, const int64_t values[SIG_COUNT], int64_t time_us)
+{
+    size_t first = message->signals - vehicle_signals;
+    for (size_t i = first; i < first + message->signal_count; i++)
+        signalStoreAppend(i, time_us, values[i]);
+}
+
+/// @brief Read back the samples of one signal between two times from a segment. Chunks of other signals, or outside
+/// the time range, are skipped without reading their payload.
+/// @param on_sample called for every sample in [from_us, to_us], value in Q.16.
+/// @return number of samples reported, -1 if the file cannot be opened.
+int signalStoreQuery(const char *file_name, vehicle_signal_id_t signal_id, int64_t from_us, int64_t to_us,
+                     void (*on_sample)(int64_t time_us, int64_t value, void *context), void *context)
+{
+    FILE *store_f = fopen(file_name, "r");
+    if (!store_f)
+        return -1;
+
+    int samples = 0;
+    signal_chunk_header_t header;
+    uint8_t payload[SIGNAL_CHUNK_PAYLOAD_SIZE];
+    while (fread(&header, sizeof(header), 1, store_f) == 1)
+    {
+        if (header.magic != SIGNAL_CHUNK_MAGIC || header.payload_size > SIGNAL_CHUNK_PAYLOAD_SIZE)
+            break; // Torn write at the end of the file (power cut).
+        if (header.signal_id != signal_id || header.last_time_us < from_us || header.first_time_us > to_us)
+        {
+            fseek(store_f, header.payload_size, SEEK_CUR);
+            continue;
+        }
+        if (fread(payload, 1, header.payload_size, store_f) != header.payload_size)
+            break;
+
+        const uint8_t *in = payload;
+        const uint8_t *end = payload + header.payload_size;
+        int64_t time_us = header.first_time_us;
+        int64_t value = header.first_value;
+        for (uint16_t i = 0; i < header.sample_count && in; i++)
+        {
+            uint64_t time_delta, value_delta;
+            in = getVarint(in, end, &time_delta);
+            if (in)
+                in = getVarint(in, end, &value_delta);
+            if (!in)
+                break;
+            time_us += zigzagDecode(time_delta);
+            value += zigzagDecode(value_delta);
+            if (time_us >= from_us && time_us <= to_us)
+            {
+                on_sample(time_us, value, context);
+                samples++;
+            }
+        }
+    }
+    fclose(store_f);
+    return samples;
+}
+
+static void flushSignalStoreBlock(FILE *store_f, const uint8_t *block, size_t *block_size)
+{
+    if (!*block_size)
+        return;
+    if (file_mutex)
+        xSemaphoreTake(file_mutex, portMAX_DELAY);
+    if (fwrite(block, 1, *block_size, store_f) != *block_size || fflush(store_f) != 0 || fsync(fileno(store_f)) != 0)
+        ESP_LOGE("SIGNAL_STORE_H", "Failed to write %u bytes to the signal store", (unsigned)*block_size);
+    if (file_mutex)
+        xSemaphoreGive(file_mutex);
+    *block_size = 0;
+}
+
+/// @brief Append a chunk to the block, which has room for it.
+static void appendSignalStoreChunk(uint8_t *block, size_t *block_size, const signal_chunk_t *chunk)
+{
+    size_t chunk_size = sizeof(chunk->header) + chunk->header.payload_size;
+    memcpy(&block[*block_size], chunk, chunk_size);
+    *block_size += chunk_size;
+}
+
+/// @brief Append a time base record of the current model to the block, which has room for it.
+/// @return version of the model appended.
+static uint32_t appendSignalStoreTimeBase(uint8_t *block, size_t *block_size)
+{
+    time_base_model_t model;
+    timeBaseGetModel(&model);
+    signal_chunk_header_t header = {
+        .magic = SIGNAL_CHUNK_MAGIC,
+        .signal_id = SIGNAL_STORE_TIME_BASE_ID,
+        .payload_size = sizeof(signal_store_time_base_t),
+        .first_time_us = model.ref_local_us,
+        .last_time_us = model.ref_local_us,
+    };
+    signal_store_time_base_t record = {
+        .ref_local_us = model.ref_local_us,
+        .ref_utc_us = model.ref_utc_us,
+        .drift_ppb = model.drift_ppb,
+        .version = model.version,
+        .synced = model.synced,
+    };
+    memcpy(&block[*block_size], &header, sizeof(header));
+    memcpy(&block[*block_size + sizeof(header)], &record, sizeof(record));
+    *block_size += sizeof(header) + sizeof(record);
+    return model.version;
+}
+
+/// @brief Task: pack sealed chunks into a block and write it to the card when full, or every SIGNAL_STORE_FLUSH_TICKS
+/// when the vehicle is quiet, and start a new segment every SIGNAL_STORE_SEGMENT_US once the current one holds chunks.
+void writeSignalStore(void *pvParameter)
+{
+    static uint8_t block[SIGNAL_STORE_BLOCK_SIZE];
+    static signal_chunk_t chunk;
+    static char file_name[LOG_NAME_SIZE];
+    size_t block_size = 0;
+    bool segment_used = false;
+    unsigned long index = nextLogSegmentIndex(SIGNAL_STORE_DIRECTORY, 't');
+    int64_t segment_start_us = esp_timer_get_time();
+
+    FILE *store_f = openLogSegment(NULL, SIGNAL_STORE_DIRECTORY, 't', "dat", file_name, &index);
+    if (!store_f)
+        vTaskDelete(NULL);
+    uint32_t time_base_version = appendSignalStoreTimeBase(block, &block_size);
+    while (true)
+    {
+        if (xQueueReceive(signal_chunk_queue, &chunk, SIGNAL_STORE_FLUSH_TICKS) != pdPASS)
+            flushSignalStoreBlock(store_f, block, &block_size);
+        else
+        {
+            // Room for the chunk and a time base record.
+            size_t chunk_size = sizeof(chunk.header) + chunk.header.payload_size;
+            if (block_size + chunk_size + sizeof(chunk.header) + sizeof(signal_store_time_base_t) >
+                SIGNAL_STORE_BLOCK_SIZE)
+                flushSignalStoreBlock(store_f, block, &block_size);
+            if (timeBaseVersion() != time_base_version)
+                time_base_version = appendSignalStoreTimeBase(block, &block_size);
+            appendSignalStoreChunk(block, &block_size, &chunk);
+            segment_used = true;
+        }
+
+        if (segment_used && esp_timer_get_time() - segment_start_us >= SIGNAL_STORE_SEGMENT_US)
+        {
+            flushSignalStoreBlock(store_f, block, &block_size);
+            store_f = openLogSegment(store_f, SIGNAL_STORE_DIRECTORY, 't', "dat", file_name, &index);
+            if (!store_f)
+                break;
+            time_base_version = appendSignalStoreTimeBase(block, &block_size);
+            segment_used = false;
+            segment_start_us = esp_timer_get_time();
+        }
+    }
+    vTaskDelete(NULL);
+}
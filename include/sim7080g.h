@@ -0,0 +1,325 @@
+// SIM7080G driver (cellular and GNSS module, see README): an AT-command engine on a UART, run by one task (runModem).
+// Other tasks never talk to the UART: they queue commands (modemSubmit() and helpers) without blocking and get the
+// outcome through callbacks run by the modem task, so logging is never held up by the network.
+
+// The modem executes one command at a time, so queued commands go on the wire one after the other, the next one as soon
+// as the final result of the previous one is parsed (no fixed delays between commands).
+// Reception: the UART driver's interrupt moves the RX FIFO into a ring buffer and posts events (the ESP32 UART has no
+// RX DMA), the task reads whatever arrived and feeds the parser state machine:
+//   MODEM_STATE_IDLE          no command in flight, every line is an unsolicited result code (URC).
+//   MODEM_STATE_WAIT_PROMPT   command with a payload sent, waiting for the '>' prompt to write the payload.
+//   MODEM_STATE_WAIT_RESPONSE waiting for the final result (OK, ERROR, +CME ERROR...), other lines are the response.
+// While a command is in flight, a line starting with its own name (+CASTATE: for AT+CASTATE?) belongs to it, other
+// lines matching a registered URC prefix (modemRegisterUrc()) go to the URC handler.
+// Bulk transfers use the prompt: the payload of a command (AT+CASEND, AT+CFTPPUT...) is written right after the '>'.
+#pragma once
+#include "driver/uart.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+
+#define MODEM_UART UART_NUM_2
+#define MODEM_TX_PIN 17
+#define MODEM_RX_PIN 16
+#define MODEM_BAUD_RATE 115200
+#define MODEM_RX_BUFFER_SIZE 4096
+#define MODEM_TX_BUFFER_SIZE 2048
+#define MODEM_UART_QUEUE_LENGTH 16
+#define MODEM_COMMAND_QUEUE_LENGTH 8
+#define MODEM_COMMAND_SIZE 128
+#define MODEM_LINE_SIZE 256
+#define MODEM_MAX_URC_HANDLERS 8
+#define MODEM_POLL_MS 10 // Longest time a queued command waits while the modem is idle.
+#define MODEM_DEFAULT_TIMEOUT_MS 5000
+#define MODEM_CASEND_MAX_LENGTH 1460 // Largest payload of one AT+CASEND.
+
+typedef enum
+{
+    MODEM_RESULT_OK,
+    MODEM_RESULT_ERROR, // ERROR, +CME ERROR or +CMS ERROR, the line is passed to the callback.
+    MODEM_RESULT_TIMEOUT
+} modem_result_t;
+
+typedef enum
+{
+    MODEM_STATE_IDLE,
+    MODEM_STATE_WAIT_PROMPT,
+    MODEM_STATE_WAIT_RESPONSE
+} modem_state_t;
+
+// Called by the modem task for every response line of a command, and for URCs.
+typedef void (*modem_line_cb_t)(const char *line, void *context);
+// Called by the modem task once a command is over. final_line is the final result, "" on timeout.
+typedef void (*modem_done_cb_t)(modem_result_t result, const char *final_line, void *context);
+
+typedef struct
+{
+    char text[MODEM_COMMAND_SIZE]; // Without the trailing "\r".
+    const uint8_t *data;           // Payload written after the '>' prompt, must stay valid until on_done. May be NULL.
+    size_t data_length;
+    uint32_t timeout_ms;
+    modem_line_cb_t on_line; // May be NULL.
+    modem_done_cb_t on_done; // May be NULL.
+    void *context;
+} modem_command_t;
+
+typedef struct
+{
+    const char *prefix;
+    modem_line_cb_t handler;
+    void *context;
+} modem_urc_handler_t;
+
+static QueueHandle_t modem_command_queue = NULL;
+static QueueHandle_t modem_uart_queue = NULL;
+static modem_urc_handler_t modem_urc_handlers[MODEM_MAX_URC_HANDLERS];
+static uint8_t modem_urc_handler_count = 0;
+
+// Parser state, only touched by the modem task.
+static modem_state_t modem_state = MODEM_STATE_IDLE;
+static modem_command_t modem_current;
+static size_t modem_current_name_length; // Length of the +NAME the responses of the current command start with.
+static int64_t modem_deadline_us;
+static char modem_line[MODEM_LINE_SIZE];
+static size_t modem_line_length = 0;
+static bool modem_line_truncated = false;
+static uint32_t modem_rx_overflows = 0;
+
+/// @brief Queue a command, never blocks.
+/// @return false if the command queue is full (or the modem is not initialised).
+bool modemSubmit(const modem_command_t *command)
+{
+    if (!modem_command_queue)
+        return false;
+    return xQueueSend(modem_command_queue, command, 0) == pdPASS;
+}
+
+/// @brief Queue a command without payload.
+bool modemSendCommand(const char *text, uint32_t timeout_ms, modem_line_cb_t on_line, modem_done_cb_t on_done,
+                      void *context)
+{
+    modem_command_t command = {
+        .timeout_ms = timeout_ms,
+        .on_line = on_line,
+        .on_done = on_done,
+        .context = context,
+    };
+    if ((size_t)snprintf(command.text, sizeof(command.text), "%s", text) >= sizeof(command.text))
+        return false;
+    return modemSubmit(&command);
+}
+
+/// @brief Queue the opening of a TCP connection (AT+CAOPEN), its outcome comes with the +CAOPEN: <cid>,<result> line.
+bool modemOpenTcp(uint8_t cid, const char *host, uint16_t port, modem_line_cb_t on_line, modem_done_cb_t on_done,
+                  void *context)
+{
+    modem_command_t command = {
+        .timeout_ms = 30000,
+        .on_line = on_line,
+        .on_done = on_done,
+        .context = context,
+    };
+    if ((size_t)snprintf(command.text, sizeof(command.text), "AT+CAOPEN=%u,0,\"TCP\",\"%s\",%u", cid, host, port) >=
+        sizeof(command.text))
+        return false;
+    return modemSubmit(&command);
+}
+
+/// @brief Queue data to send on an open connection (AT+CASEND), at most MODEM_CASEND_MAX_LENGTH bytes.
+/// @param data must stay valid until on_done is called.
+bool modemSendTcp(uint8_t cid, const uint8_t *data, size_t length, modem_done_cb_t on_done, void *context)
+{
+    if (length == 0 || length > MODEM_CASEND_MAX_LENGTH)
+        return false;
+    modem_command_t command = {
+        .data = data,
+        .data_length = length,
+        .timeout_ms = 10000,
+        .on_done = on_done,
+        .context = context,
+    };
+    snprintf(command.text, sizeof(command.text), "AT+CASEND=%u,%u", cid, (unsigned)length);
+    return modemSubmit(&command);
+}
+
+/// @brief Route the unsolicited lines starting with prefix (e.g. "+CADATAIND", "+APP PDP") to handler, which runs on
+/// the modem task. To be called before runModem() starts.
+bool modemRegisterUrc(const char *prefix, modem_line_cb_t handler, void *context)
+{
+    if (modem_urc_handler_count == MODEM_MAX_URC_HANDLERS)
+        return false;
+    modem_urc_handlers[modem_urc_handler_count++] = (modem_urc_handler_t){prefix, handler, context};
+    return true;
+}
+
+static bool isModemFinalResult(const char *line, modem_result_t *result)
+{
+    if (strcmp(line, "OK") == 0)
+        *result = MODEM_RESULT_OK;
+    else if (strcmp(line, "ERROR") == 0 || strncmp(line, "+CME ERROR", 10) == 0 || strncmp(line, "+CMS ERROR", 10) == 0)
+        *result = MODEM_RESULT_ERROR;
+    else
+        return false;
+    return true;
+}
+
+static void completeModemCommand(modem_result_t result, const char *final_line)
+{
+    modem_state = MODEM_STATE_IDLE;
+    if (modem_current.on_done)
+        modem_current.on_done(result, final_line, modem_current.context);
+}
+
+static void startModemCommand()
+{
+    // The responses of AT+NAME=..., AT+NAME? and AT+NAME start with +NAME.
+    const char *name = modem_current.text + 2;
+    modem_current_name_length = strcspn(name, "=?");
+
+    uart_write_bytes(MODEM_UART, modem_current.text, strlen(modem_current.text));
+    uart_write_bytes(MODEM_UART, "\r", 1);
+    modem_state = modem_current.data ? MODEM_STATE_WAIT_PROMPT : MODEM_STATE_WAIT_RESPONSE;
+    modem_deadline_us = esp_timer_get_time() +
+        1000LL * (modem_current.timeout_ms ? modem_current.timeout_ms : MODEM_DEFAULT_TIMEOUT_MS);
+}
+
+static void dispatchModemLine(const char *line)
+{
+    modem_result_t result;
+
+    if (modem_state != MODEM_STATE_IDLE)
+    {
+        if (isModemFinalResult(line, &result))
+        {
+            completeModemCommand(result, line);
+            return;
+        }
+        if (modem_current_name_length > 1 && line[0] == '+' &&
+            strncmp(line, modem_current.text + 2, modem_current_name_length) == 0)
+        {
+            if (modem_current.on_line)
+                modem_current.on_line(line, modem_current.context);
+            return;
+        }
+    }
+    for (uint8_t i = 0; i < modem_urc_handler_count; i++)
+    {
+        if (strncmp(line, modem_urc_handlers[i].prefix, strlen(modem_urc_handlers[i].prefix)) == 0)
+        {
+            modem_urc_handlers[i].handler(line, modem_urc_handlers[i].context);
+            return;
+        }
+    }
+    if (modem_state != MODEM_STATE_IDLE && modem_current.on_line)
+        modem_current.on_line(line, modem_current.context); // Plain response (AT+GSN...).
+    else if (modem_state == MODEM_STATE_IDLE)
+        ESP_LOGD("SIM7080G_H", "Unhandled line: %s", line);
+}
+
+/// @brief Parser: split the received bytes into lines and catch the payload prompt.
+static void parseModemBytes(const uint8_t *bytes, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        char c = bytes[i];
+        if (c == '\r')
+            continue;
+        if (c == '\n')
+        {
+            if (modem_line_length)
+            {
+                modem_line[modem_line_length] = '\0';
+                if (modem_line_truncated)
+                    ESP_LOGW("SIM7080G_H", "Line truncated: %s", modem_line);
+                dispatchModemLine(modem_line);
+            }
+            modem_line_length = 0;
+            modem_line_truncated = false;
+            continue;
+        }
+        if (modem_line_length == 0 && c == ' ')
+            continue;
+        if (modem_line_length == 0 && c == '>' && modem_state == MODEM_STATE_WAIT_PROMPT)
+        {
+            uart_write_bytes(MODEM_UART, modem_current.data, modem_current.data_length);
+            modem_state = MODEM_STATE_WAIT_RESPONSE;
+            continue;
+        }
+        if (modem_line_length < MODEM_LINE_SIZE - 1)
+            modem_line[modem_line_length++] = c;
+        else
+            modem_line_truncated = true;
+    }
+}
+
+/// @brief Install the UART driver and create the command queue. Echo is turned off by the first command.
+bool initModem()
+{
+    uart_config_t uart_config = {
+        .baud_rate = MODEM_BAUD_RATE,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .source_clk = UART_SCLK_DEFAULT,
+    };
+    if (uart_driver_install(MODEM_UART, MODEM_RX_BUFFER_SIZE, MODEM_TX_BUFFER_SIZE, MODEM_UART_QUEUE_LENGTH,
+                            &modem_uart_queue, 0) != ESP_OK ||
+        uart_param_config(MODEM_UART, &uart_config) != ESP_OK ||
+        uart_set_pin(MODEM_UART, MODEM_TX_PIN, MODEM_RX_PIN, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE) != ESP_OK)
+    {
+        ESP_LOGE("SIM7080G_H", "Failed to set up the modem UART");
+        return false;
+    }
+    modem_command_queue = xQueueCreate(MODEM_COMMAND_QUEUE_LENGTH, sizeof(modem_command_t));
+    if (!modem_command_queue)
+    {
+        ESP_LOGE("SIM7080G_H", "Error Creating Modem Command Queue");
+        return false;
+    }
+    ESP_LOGI("SIM7080G_H", "Modem Command Queue created succesfully");
+    return modemSendCommand("ATE0", 0, NULL, NULL, NULL);
+}
+
+/// @brief One round of the modem task: start the next queued command if none is in flight, parse what the modem sent
+/// within wait_ticks, and time out the command in flight.
+static void serviceModem(TickType_t wait_ticks)
+{
+    static uint8_t rx_buffer[256];
+    uart_event_t event;
+
+    if (modem_state == MODEM_STATE_IDLE && xQueueReceive(modem_command_queue, &modem_current, 0) == pdPASS)
+        startModemCommand();
+
+    if (xQueueReceive(modem_uart_queue, &event, wait_ticks) == pdPASS)
+    {
+        if (event.type == UART_DATA)
+        {
+            int length;
+            while ((length = uart_read_bytes(MODEM_UART, rx_buffer, sizeof(rx_buffer), 0)) > 0)
+                parseModemBytes(rx_buffer, length);
+        }
+        else if (event.type == UART_FIFO_OVF || event.type == UART_BUFFER_FULL)
+        {
+            // Bytes were lost, the current line cannot be trusted.
+            modem_rx_overflows++;
+            uart_flush_input(MODEM_UART);
+            xQueueReset(modem_uart_queue);
+            modem_line_length = 0;
+            ESP_LOGW("SIM7080G_H", "Modem RX overflow (%lu)", (unsigned long)modem_rx_overflows);
+        }
+    }
+
+    if (modem_state != MODEM_STATE_IDLE && esp_timer_get_time() > modem_deadline_us)
+    {
+        ESP_LOGW("SIM7080G_H", "Timeout on %s", modem_current.text);
+        completeModemCommand(MODEM_RESULT_TIMEOUT, "");
+    }
+}
+
+/// @brief Task: send the queued commands one at a time and parse everything the modem sends back.
+void runModem(void *pvParameter)
+{
+    while (true)
+        serviceModem(pdMS_TO_TICKS(MODEM_POLL_MS));
+    vTaskDelete(NULL);
+}
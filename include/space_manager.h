@@ -0,0 +1,203 @@
+// Card space manager (core 1): keeps free space on the card so that the writers never hit a full card, where fprintf
+// fails silently and frames are lost.
+// Free space comes from f_getfree(), called by this task only: the first call scans the FAT, after that FatFs keeps the
+// free cluster count up to date on every allocation and release, and f_getfree() only returns it. Nothing is added to
+// the writers' path.
+// Below SPACE_LOW_PERCENT of the card free, files are deleted oldest first (sequence order of their path, see
+// compareSegmentNames()) until SPACE_HIGH_PERCENT is free again, tier after tier (space_tiers):
+//   latency statistics (diagnostics only, never uploaded), uploaded raw logs, uploaded decoded signals, uploaded
+//   summaries, raw logs not uploaded, decoded signals not uploaded, summaries not uploaded, uploaded fault captures,
+//   fault captures not uploaded.
+// Files still being written or being uploaded (isUploadSegmentOpen()) are never deleted, and directories left empty
+// are removed (unless logs will still be created in them). A pass over a tier that deletes nothing (every candidate
+// locked, or gone) ends the tier instead of walking it again.
+#pragma once
+#include "uploader.h"
+#include "log_naming.h"
+
+#define SPACE_LOW_PERCENT 10  // Eviction starts below this share of the card free.
+#define SPACE_HIGH_PERCENT 15 // and stops above this one.
+#define SPACE_CHECK_MS 10000
+#define SPACE_EVICT_BATCH 16  // Files deleted per walk of a tier.
+#define SPACE_MAX_DEPTH 6
+
+typedef struct
+{
+    const char *directory;
+    bool uploaded_only; // Only files whose archive attribute is cleared (see uploader.h).
+} space_tier_t;
+
+static const space_tier_t space_tiers[] = {
+    {"STAT_FS", false}, // Never uploaded, the archive attribute stays set.
+    {"LOG_FS", true},
+    {"SIG_FS", true},
+    {"SUM_FS", true},
+    {"LOG_FS", false},
+    {"SIG_FS", false},
+    {"SUM_FS", false},
+    {"ERR_FS", true},
+    {"ERR_FS", false},
+};
+
+typedef struct
+{
+    char name[LOG_NAME_SIZE]; // FAT path.
+    uint32_t size;
+} space_candidate_t;
+
+typedef struct
+{
+    bool uploaded_only;
+    uint8_t count;
+    space_candidate_t candidates[SPACE_EVICT_BATCH]; // Oldest first.
+} space_walk_t;
+
+static volatile uint32_t card_free_kib = 0;
+static volatile uint32_t card_total_kib = 0;
+static volatile uint32_t evicted_files = 0;
+static volatile uint32_t evicted_kib = 0;
+
+/// @brief Free and total space of the card, in KiB.
+static bool getCardSpace(uint32_t *free_kib, uint32_t *total_kib)
+{
+    FATFS *fs;
+    DWORD free_clusters;
+    if (f_getfree("", &free_clusters, &fs) != FR_OK)
+        return false;
+    uint32_t cluster_kib = fs->csize * fs->ssize / 1024;
+    *free_kib = free_clusters * cluster_kib;
+    *total_kib = (fs->n_fatent - 2) * cluster_kib;
+    return true;
+}
+
+static void insertEvictionCandidate(space_walk_t *walk, const char *name, uint32_t size)
+{
+    uint8_t position = walk->count;
+    while (position && compareSegmentNames(name, walk->candidates[position - 1].name) < 0)
+        position--;
+    if (position == SPACE_EVICT_BATCH)
+        return;
+    if (walk->count < SPACE_EVICT_BATCH)
+        walk->count++;
+    memmove(&walk->candidates[position + 1], &walk->candidates[position],
+            (walk->count - 1 - position) * sizeof(space_candidate_t));
+    snprintf(walk->candidates[position].name, LOG_NAME_SIZE, "%s", name);
+    walk->candidates[position].size = size;
+}
+
+/// @brief Collect the oldest files of a directory tree, removing the empty subdirectories met on the way.
+/// @param path FAT path of the directory, in a buffer of LOG_NAME_SIZE bytes used for the walk.
+/// @return number of entries left in the directory.
+static uint32_t walkEvictionCandidates(space_walk_t *walk, char *path, uint8_t depth)
+{
+    FF_DIR dir;
+    FILINFO info;
+    char full_path[LOG_NAME_SIZE + sizeof(MOUNT_POINT) + 1];
+    size_t length = strlen(path);
+    uint32_t entries = 0;
+
+    if (f_opendir(&dir, path) != FR_OK)
+        return 1;
+    while (f_readdir(&dir, &info) == FR_OK && info.fname[0])
+    {
+        entries++;
+        if ((size_t)snprintf(path + length, LOG_NAME_SIZE - length, "/%s", info.fname) >= LOG_NAME_SIZE - length)
+        {
+            path[length] = '\0';
+            continue;
+        }
+        if (info.fattrib & AM_DIR)
+        {
+            if (depth < SPACE_MAX_DEPTH && walkEvictionCandidates(walk, path, depth + 1) == 0 &&
+                !isLogDirectoryActive(path) && f_unlink(path) == FR_OK)
+                entries--;
+        }
+        else if (!walk->uploaded_only || !(info.fattrib & AM_ARC))
+        {
+            snprintf(full_path, sizeof(full_path), MOUNT_POINT"/%s", path);
+            if (!isLogFileOpen(full_path) && !isUploadSegmentOpen(path))
+                insertEvictionCandidate(walk, path, info.fsize);
+        }
+        path[length] = '\0';
+    }
+    f_closedir(&dir);
+    return entries;
+}
+
+/// @brief Delete files tier after tier until target_kib is free.
+static void evictFiles(uint32_t target_kib)
+{
+    static space_walk_t walk;
+    char path[LOG_NAME_SIZE];
+    uint32_t free_kib = card_free_kib, total_kib;
+    uint8_t freed;
+
+    for (size_t tier = 0; tier < sizeof(space_tiers) / sizeof(space_tiers[0]) && free_kib < target_kib; tier++)
+    {
+        do
+        {
+            walk.uploaded_only = space_tiers[tier].uploaded_only;
+            walk.count = 0;
+            snprintf(path, sizeof(path), "%s", space_tiers[tier].directory);
+            walkEvictionCandidates(&walk, path, 0);
+
+            freed = 0;
+            for (uint8_t i = 0; i < walk.count && free_kib < target_kib; i++)
+            {
+                if (f_unlink(walk.candidates[i].name) != FR_OK)
+                    continue;
+                freed++;
+                evicted_files++;
+                evicted_kib += walk.candidates[i].size / 1024;
+                ESP_LOGW("SPACE_MANAGER_H", "Evicted %s (%lu bytes)", walk.candidates[i].name,
+                         (unsigned long)walk.candidates[i].size);
+                if (getCardSpace(&free_kib, &total_kib))
+                    card_free_kib = free_kib;
+            }
+        } while (freed && free_kib < target_kib);
+    }
+    if (free_kib < target_kib)
+        ESP_LOGE("SPACE_MANAGER_H", "Card still short of space after eviction: %lu KiB free", (unsigned long)free_kib);
+}
+
+/// @brief {"free_kib":..,"total_kib":..,"evicted":..,"evicted_kib":..}, for the heartbeat.
+void jsonWriterCardSpace(json_writer_t *writer)
+{
+    jsonWriterBeginObject(writer);
+    jsonWriterKey(writer, "free_kib");
+    jsonWriterInt(writer, card_free_kib);
+    jsonWriterKey(writer, "total_kib");
+    jsonWriterInt(writer, card_total_kib);
+    jsonWriterKey(writer, "evicted");
+    jsonWriterInt(writer, evicted_files);
+    jsonWriterKey(writer, "evicted_kib");
+    jsonWriterInt(writer, evicted_kib);
+    jsonWriterEndObject(writer);
+}
+
+/// @brief Task: check the free space every SPACE_CHECK_MS and evict files below SPACE_LOW_PERCENT.
+void manageCardSpace(void *pvParameter)
+{
+    uint32_t free_kib, total_kib;
+
+    while (true)
+    {
+        if (getCardSpace(&free_kib, &total_kib))
+        {
+            card_free_kib = free_kib;
+            card_total_kib = total_kib;
+            if ((uint64_t)free_kib * 100 < (uint64_t)total_kib * SPACE_LOW_PERCENT)
+            {
+                ESP_LOGW("SPACE_MANAGER_H", "Card low on space: %lu/%lu KiB free", (unsigned long)free_kib,
+                         (unsigned long)total_kib);
+                evictFiles((uint64_t)total_kib * SPACE_HIGH_PERCENT / 100);
+            }
+        }
+        else
+        {
+            ESP_LOGE("SPACE_MANAGER_H", "Failed to get the free space of the card");
+        }
+        vTaskDelay(SPACE_CHECK_MS / portTICK_PERIOD_MS);
+    }
+    vTaskDelete(NULL);
+}
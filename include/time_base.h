@@ -0,0 +1,158 @@
+// Time base: frames are stamped at reception with the local monotonic clock (esp_timer, integer µs since boot), and a
+// model maps that clock to UTC once a time source (GNSS, see gnss_time.h) has disciplined it:
+//   utc_us = ref_utc_us + elapsed + elapsed * drift_ppb / 1e9,   elapsed = local_us - ref_local_us
+// Fixes are noisy (tens of ms for a polled GNSS time), so the model is a weighted least-squares line through the fixes
+// since the last reset, older fixes weighing less and less (TIME_BASE_FORGET_FACTOR, so that the drift follows the
+// temperature of the crystal). A fix too far from the prediction (first fix, or a jump) resets the fit.
+// Log files keep local times (exact, never jump) and carry the model in comment lines: one when the file is created,
+// then one more every time the model changes, so that every line converts to UTC with the last model above it.
+// Stamping happens in the receiving tasks (SendCANData, sendCanDataMCP2515), the frames travel with their stamp
+// (timed_twai_message_t, timed_can_frame_t), queueing delay no longer shows in the logs.
+#pragma once
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "driver/twai.h"
+#include "mcp2515.h"
+#include "esp_timer.h"
+
+#define TIME_BASE_STEP_US 1000000LL           // Prediction error above which the model is reset.
+#define TIME_BASE_MIN_SPAN_US 10000000LL      // Shortest time span of the fit before the drift is estimated.
+#define TIME_BASE_MAX_DRIFT_PPB 200000        // 200 ppm, way beyond any crystal: anything above is a bad fit.
+#define TIME_BASE_FORGET_FACTOR 0.98          // Weight left to the previous fixes at each new fix.
+
+// Frames carried by the queues with their reception time.
+typedef struct
+{
+    twai_message_t frame;
+    int64_t rx_time_us; // esp_timer_get_time() when the frame was received.
+    uint32_t sequence;  // Frames received on the bus before this one (frame_loss.h).
+    bool error_frame;   // Error frame seen on the bus at rx_time_us: frame and sequence are unused.
+} timed_twai_message_t;
+
+// MCP2515 error frames are entries whose frame.can_id carries CAN_ERR_FLAG (SocketCAN convention), sequence unused.
+
+typedef struct
+{
+    struct can_frame frame;
+    int64_t rx_time_us;
+    uint32_t sequence;
+} timed_can_frame_t;
+
+typedef struct
+{
+    bool synced;
+    int64_t ref_local_us; // Local time of the last fix.
+    int64_t ref_utc_us;   // UTC (µs since 1970-01-01) of the last fix.
+    int32_t drift_ppb;    // UTC advances by 1 + drift_ppb / 1e9 µs per local µs.
+    uint32_t version;     // Incremented every time the model changes.
+} time_base_model_t;
+
+// Weighted sums of the fit of offset = a + b * x, x being the local time since the anchor (first fix since the reset),
+// offset the UTC time minus the local time since the anchor. Only touched by the task feeding the fixes.
+typedef struct
+{
+    int64_t anchor_local_us;
+    int64_t anchor_utc_us;
+    double w, wx, wy, wxx, wxy;
+} time_base_fit_t;
+
+static time_base_model_t time_base_model;
+static time_base_fit_t time_base_fit;
+static portMUX_TYPE time_base_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/// @brief Local time, integer µs since boot. What frames are stamped with.
+static inline int64_t timeBaseNow()
+{
+    return esp_timer_get_time();
+}
+
+static inline int64_t timeBaseToUtc(const time_base_model_t *model, int64_t local_us)
+{
+    int64_t elapsed = local_us - model->ref_local_us;
+    return model->ref_utc_us + elapsed + elapsed * model->drift_ppb / 1000000000LL;
+}
+
+void timeBaseGetModel(time_base_model_t *model)
+{
+    portENTER_CRITICAL(&time_base_lock);
+    *model = time_base_model;
+    portEXIT_CRITICAL(&time_base_lock);
+}
+
+/// @brief Version of the model, to check cheaply whether it changed.
+static inline uint32_t timeBaseVersion()
+{
+    return __atomic_load_n(&time_base_model.version, __ATOMIC_RELAXED);
+}
+
+/// @brief UTC time of a local time.
+/// @return false if the time base was never disciplined.
+bool timeBaseLocalToUtc(int64_t local_us, int64_t *utc_us)
+{
+    time_base_model_t model;
+    timeBaseGetModel(&model);
+    if (model.synced)
+        *utc_us = timeBaseToUtc(&model, local_us);
+    return model.synced;
+}
+
+/// @brief Feed a fix of the time source. Fixes must come from a single task.
+/// @param local_us local time at which the source was at utc_us, the accuracy of the model is the accuracy of this pair.
+void timeBaseDiscipline(int64_t local_us, int64_t utc_us)
+{
+    time_base_fit_t *fit = &time_base_fit;
+    time_base_model_t model;
+
+    timeBaseGetModel(&model);
+    int64_t error = model.synced ? utc_us - timeBaseToUtc(&model, local_us) : 0;
+    if (!model.synced || error > TIME_BASE_STEP_US || error < -TIME_BASE_STEP_US)
+    {
+        // Reset, the drift of the previous fit (if any) is kept until the new one spans enough time.
+        memset(fit, 0, sizeof(*fit));
+        fit->anchor_local_us = local_us;
+        fit->anchor_utc_us = utc_us;
+    }
+
+    double x = local_us - fit->anchor_local_us;
+    double offset = (double)(utc_us - fit->anchor_utc_us) - x;
+    fit->w = fit->w * TIME_BASE_FORGET_FACTOR + 1;
+    fit->wx = fit->wx * TIME_BASE_FORGET_FACTOR + x;
+    fit->wy = fit->wy * TIME_BASE_FORGET_FACTOR + offset;
+    fit->wxx = fit->wxx * TIME_BASE_FORGET_FACTOR + x * x;
+    fit->wxy = fit->wxy * TIME_BASE_FORGET_FACTOR + x * offset;
+
+    double slope = model.drift_ppb * 1e-9;
+    double determinant = fit->w * fit->wxx - fit->wx * fit->wx;
+    if (x >= TIME_BASE_MIN_SPAN_US && determinant > 0)
+        slope = (fit->w * fit->wxy - fit->wx * fit->wy) / determinant;
+    if (slope > TIME_BASE_MAX_DRIFT_PPB * 1e-9)
+        slope = TIME_BASE_MAX_DRIFT_PPB * 1e-9;
+    if (slope < -TIME_BASE_MAX_DRIFT_PPB * 1e-9)
+        slope = -TIME_BASE_MAX_DRIFT_PPB * 1e-9;
+    double intercept = (fit->wy - slope * fit->wx) / fit->w;
+
+    portENTER_CRITICAL(&time_base_lock);
+    time_base_model.synced = true;
+    time_base_model.ref_local_us = local_us;
+    time_base_model.ref_utc_us = fit->anchor_utc_us + (int64_t)x + (int64_t)(intercept + slope * x);
+    time_base_model.drift_ppb = slope * 1e9;
+    time_base_model.version++;
+    portEXIT_CRITICAL(&time_base_lock);
+}
+
+/// @brief Write the model as a log comment line.
+/// @param origin_us local time the times of the file are relative to: a line at t s was received at
+/// origin_us + t * 1e6 local µs.
+/// @return version of the model written.
+uint32_t writeTimeBaseComment(FILE *file, int64_t origin_us)
+{
+    time_base_model_t model;
+    timeBaseGetModel(&model);
+    if (model.synced)
+        fprintf(file, "// time base: origin_local_us=%" PRId64 " ref_local_us=%" PRId64 " ref_utc_us=%" PRId64
+                " drift_ppb=%" PRId32 "\n", origin_us, model.ref_local_us, model.ref_utc_us, model.drift_ppb);
+    else
+        fprintf(file, "// time base: origin_local_us=%" PRId64 " unsynced\n", origin_us);
+    return model.version;
+}
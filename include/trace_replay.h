@@ -0,0 +1,351 @@
+// Trace replay: frames read from a recorded trace are fed to the logger as if they came from the buses, to reproduce
+// field issues and to benchmark the pipeline with a known load.
+// Formats (one frame per line, anything else is skipped):
+// - Vector ASC, which is what the logger writes: "<time s> <channel> <id>[x] Rx|Tx d|r <dlc> <bytes>...", with the
+//   "base dec" and "timestamps relative" header lines honoured. Error frames, statistics and CAN FD lines are skipped.
+// - candump -l: "(<time s>) can<n> <id>#<bytes>" or "<id>#R[<dlc>]", can0 being channel 1.
+// Channel 1 is the TWAI controller, channel 2 the MCP2515, as in the logs. Our own logs keep one file per controller:
+// concatenate them (cat 000.ASC 001.ASC) to replay both, each channel is paced on its own.
+// Timing: speed_percent 100 replays at the original pace, 200 twice as fast, 0 as fast as the logger reads.
+// On target (CONFIG_DATAFLY_REPLAY_ENABLED), replayTrace() tasks read the trace from the card and replace the live
+// receivers, frames go through the same queues and decoding (waiting for room: a replay loses nothing); on host,
+// nextReplayFrame() is the source of a virtual bus. The parsers are checked by the host check trace_parse
+// (host_checks.h), the replay through the logger by pytest_host_sim.py.
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define TRACE_LINE_SIZE 256
+
+typedef struct
+{
+    int64_t time_us; // Time in the trace.
+    uint8_t channel;
+    uint32_t identifier;
+    bool extended;
+    bool rtr;
+    uint8_t dlc;
+    uint8_t data[8];
+} trace_frame_t;
+
+typedef struct
+{
+    FILE *file;
+    uint8_t channel;        // Frames of other channels are skipped.
+    uint32_t speed_percent; // 0: as fast as possible.
+    bool decimal_ids;       // "base dec".
+    bool relative_times;    // "timestamps relative": each time is the delay from the previous line.
+    int64_t last_time_us;
+    bool started;
+    int64_t first_time_us; // Trace time of the first frame replayed.
+    int64_t start_us;      // Local time the first frame is due at.
+    uint32_t frames;       // Frames replayed.
+    uint32_t skipped;      // Lines neither frames nor known headers (other channels aside).
+} trace_replay_t;
+
+/// @brief Read "<seconds>[.<fraction>]" into µs, without rounding through a double.
+static bool parseTraceTime(const char **cursor, int64_t *time_us)
+{
+    const char *p = *cursor;
+    int64_t seconds = 0, fraction = 0, scale = 1000000;
+    if (!isdigit((unsigned char)*p))
+        return false;
+    while (isdigit((unsigned char)*p))
+        seconds = seconds * 10 + (*p++ - '0');
+    if (*p == '.')
+    {
+        for (p++; isdigit((unsigned char)*p); p++)
+        {
+            if (scale > 1)
+            {
+                scale /= 10;
+                fraction += (*p - '0') * scale;
+            }
+        }
+    }
+    *time_us = seconds * 1000000 + fraction;
+    *cursor = p;
+    return true;
+}
+
+/// @brief Next whitespace separated token, *length 0 at the end of the line.
+static const char *nextTraceToken(const char **cursor, size_t *length)
+{
+    const char *token = *cursor + strspn(*cursor, " \t");
+    *length = strcspn(token, " \t\r\n");
+    *cursor = token + *length;
+    return token;
+}
+
+static bool parseTraceNumber(const char *token, size_t length, int base, uint32_t *value)
+{
+    char *end;
+    if (!length)
+        return false;
+    *value = strtoul(token, &end, base);
+    return end == token + length;
+}
+
+static bool parseAscFrame(trace_replay_t *replay, const char *line, trace_frame_t *frame)
+{
+    const char *cursor = line + strspn(line, " \t");
+    const char *token;
+    size_t length;
+    uint32_t value;
+
+    if (!parseTraceTime(&cursor, &frame->time_us))
+    {
+        // Header lines.
+        if (strncmp(cursor, "base", 4) == 0)
+        {
+            replay->decimal_ids = strstr(cursor, "base dec") != NULL;
+            replay->relative_times = strstr(cursor, "timestamps relative") != NULL;
+        }
+        return false;
+    }
+    if (replay->relative_times)
+        frame->time_us = replay->last_time_us += frame->time_us;
+
+    token = nextTraceToken(&cursor, &length);
+    if (!parseTraceNumber(token, length, 10, &value) || value > UINT8_MAX)
+        return false; // CANFD, Statistic...
+    frame->channel = value;
+
+    token = nextTraceToken(&cursor, &length);
+    frame->extended = length > 1 && (token[length - 1] == 'x' || token[length - 1] == 'X');
+    if (!parseTraceNumber(token, length - frame->extended, replay->decimal_ids ? 10 : 16, &frame->identifier))
+        return false; // ErrorFrame...
+
+    token = nextTraceToken(&cursor, &length); // Rx or Tx.
+    token = nextTraceToken(&cursor, &length);
+    if (length != 1 || (*token != 'd' && *token != 'r'))
+        return false;
+    frame->rtr = *token == 'r';
+
+    token = nextTraceToken(&cursor, &length);
+    frame->dlc = 0;
+    if (parseTraceNumber(token, length, 16, &value))
+        frame->dlc = value > 8 ? 8 : value;
+    else if (!frame->rtr)
+        return false;
+    for (int i = 0; !frame->rtr && i < frame->dlc; i++)
+    {
+        token = nextTraceToken(&cursor, &length);
+        if (length != 2 || !parseTraceNumber(token, length, 16, &value))
+            return false;
+        frame->data[i] = value;
+    }
+    return true;
+}
+
+static bool parseCandumpFrame(const char *line, trace_frame_t *frame)
+{
+    const char *cursor = line + 1;
+    const char *token;
+    size_t length;
+    uint32_t value;
+
+    if (!parseTraceTime(&cursor, &frame->time_us) || *cursor != ')')
+        return false;
+    cursor++;
+
+    // can<n>, vcan<n>...: channel n + 1.
+    token = nextTraceToken(&cursor, &length);
+    while (length && !isdigit((unsigned char)*token))
+    {
+        token++;
+        length--;
+    }
+    if (!parseTraceNumber(token, length, 10, &value) || value >= UINT8_MAX)
+        return false;
+    frame->channel = value + 1;
+
+    token = nextTraceToken(&cursor, &length);
+    const char *separator = memchr(token, '#', length);
+    if (!separator || separator[1] == '#')
+        return false; // CAN FD.
+    frame->extended = separator - token > 3;
+    if (!parseTraceNumber(token, separator - token, 16, &frame->identifier))
+        return false;
+
+    const char *payload = separator + 1;
+    size_t payload_length = token + length - payload;
+    frame->rtr = payload_length && (*payload == 'R' || *payload == 'r');
+    frame->dlc = 0;
+    if (frame->rtr)
+    {
+        if (payload_length == 2 && parseTraceNumber(payload + 1, 1, 16, &value))
+            frame->dlc = value > 8 ? 8 : value;
+        return true;
+    }
+    if (payload_length % 2 || payload_length > 16)
+        return false;
+    for (size_t i = 0; i < payload_length; i += 2)
+    {
+        char byte[3] = {payload[i], payload[i + 1], '\0'};
+        if (!parseTraceNumber(byte, 2, 16, &value))
+            return false;
+        frame->data[frame->dlc++] = value;
+    }
+    return true;
+}
+
+/// @brief Open a trace to replay the frames of one channel.
+/// @param start_us local time the first frame is due at (with speed_percent != 0).
+bool traceReplayOpen(trace_replay_t *replay, const char *path, uint8_t channel, uint32_t speed_percent,
+                     int64_t start_us)
+{
+    memset(replay, 0, sizeof(*replay));
+    replay->file = fopen(path, "r");
+    if (!replay->file)
+    {
+        ESP_LOGE("TRACE_REPLAY_H", "Failed to open trace %s", path);
+        return false;
+    }
+    replay->channel = channel;
+    replay->speed_percent = speed_percent;
+    replay->start_us = start_us;
+    return true;
+}
+
+/// @brief Next frame of the channel.
+/// @return false at the end of the trace, the file is then closed.
+bool traceReplayNext(trace_replay_t *replay, trace_frame_t *frame)
+{
+    char line[TRACE_LINE_SIZE];
+
+    while (replay->file && fgets(line, sizeof(line), replay->file))
+    {
+        memset(frame, 0, sizeof(*frame));
+        bool parsed = line[0] == '(' ? parseCandumpFrame(line, frame) : parseAscFrame(replay, line, frame);
+        if (!parsed)
+        {
+            const char *text = line + strspn(line, " \t");
+            if (isdigit((unsigned char)*text) || *text == '(')
+                replay->skipped++;
+            continue;
+        }
+        if (frame->channel != replay->channel)
+            continue;
+        if (!replay->started)
+        {
+            replay->started = true;
+            replay->first_time_us = frame->time_us;
+        }
+        replay->frames++;
+        return true;
+    }
+    if (replay->file)
+    {
+        ESP_LOGI("TRACE_REPLAY_H", "Channel %d: %lu frames replayed, %lu lines skipped", replay->channel,
+                 (unsigned long)replay->frames, (unsigned long)replay->skipped);
+        fclose(replay->file);
+        replay->file = NULL;
+    }
+    return false;
+}
+
+/// @brief Local time a frame is due at, 0 when replaying as fast as possible.
+static inline int64_t traceReplayDueUs(const trace_replay_t *replay, const trace_frame_t *frame)
+{
+    if (!replay->speed_percent)
+        return 0;
+    int64_t elapsed_us = frame->time_us - replay->first_time_us;
+    if (elapsed_us < 0)
+        elapsed_us = 0; // Out of order lines are due at once.
+    return replay->start_us + elapsed_us * 100 / replay->speed_percent;
+}
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+#include "host_sim.h"
+
+/// @brief virtual_can_source_t replaying a trace (context: trace_replay_t).
+static bool nextReplayFrame(void *context, virtual_can_frame_t *frame)
+{
+    trace_replay_t *replay = context;
+    trace_frame_t trace_frame;
+
+    if (!traceReplayNext(replay, &trace_frame))
+        return false;
+    memset(frame, 0, sizeof(*frame));
+    frame->identifier = trace_frame.identifier;
+    frame->extended = trace_frame.extended;
+    frame->rtr = trace_frame.rtr;
+    frame->dlc = trace_frame.dlc;
+    memcpy(frame->data, trace_frame.data, sizeof(frame->data));
+    // 0 would mean "as soon as there is room", the first frame of a timed replay is due 1 µs later.
+    frame->due_us = traceReplayDueUs(replay, &trace_frame);
+    if (replay->speed_percent && !frame->due_us)
+        frame->due_us = 1;
+    return true;
+}
+
+#elif defined(CONFIG_DATAFLY_REPLAY_ENABLED)
+
+/// @brief Task: replay the frames of one channel of CONFIG_DATAFLY_REPLAY_FILE in place of its receiver (SendCANData
+/// for channel 1, sendCanDataMCP2515 for channel 2).
+/// @param pvParameter channel, cast to a pointer.
+void replayTrace(void *pvParameter)
+{
+    uint8_t channel = (uintptr_t)pvParameter;
+    trace_replay_t replay;
+    trace_frame_t frame;
+    int64_t signal_fixed_values[SIG_COUNT] = {0};
+    int64_t last_sweep_us = 0;
+
+    // Let the writers open their files first, frames are stamped relative to the log start.
+    vTaskDelay(pdMS_TO_TICKS(1000));
+    if (channel == 2)
+        vehicleSignalsInit();
+    if (!traceReplayOpen(&replay, CONFIG_DATAFLY_REPLAY_FILE, channel, CONFIG_DATAFLY_REPLAY_SPEED_PERCENT,
+                         timeBaseNow()))
+        vTaskDelete(NULL);
+
+    while (traceReplayNext(&replay, &frame))
+    {
+        // Frames less than a tick ahead go at once: at most a tick of them comes in a burst, the queues absorb it.
+        int64_t wait_us = traceReplayDueUs(&replay, &frame) - timeBaseNow();
+        if (wait_us >= portTICK_PERIOD_MS * 1000)
+            vTaskDelay(wait_us / (portTICK_PERIOD_MS * 1000));
+        if (channel == 1)
+        {
+            timed_twai_message_t message = {0};
+            message.frame.extd = frame.extended;
+            message.frame.rtr = frame.rtr;
+            message.frame.identifier = frame.identifier;
+            message.frame.data_length_code = frame.dlc;
+            memcpy(message.frame.data, frame.data, sizeof(frame.data));
+            message.rx_time_us = timeBaseNow();
+            ingestFrameTwai(&message, portMAX_DELAY);
+        }
+        else
+        {
+            timed_can_frame_t can_message = {0};
+            can_message.frame.can_id = frame.identifier | (frame.extended ? CAN_EFF_FLAG : 0) |
+                                       (frame.rtr ? CAN_RTR_FLAG : 0);
+            can_message.frame.can_dlc = frame.dlc;
+            memcpy(can_message.frame.data, frame.data, sizeof(frame.data));
+            can_message.rx_time_us = timeBaseNow();
+            ingestFrameMCP2515(&can_message, signal_fixed_values, portMAX_DELAY);
+            if (can_message.rx_time_us - last_sweep_us >= AGGREGATE_SWEEP_US)
+            {
+                signalAggregateCloseWindows(can_message.rx_time_us);
+                signalStoreSealIdleChunks(can_message.rx_time_us);
+                last_sweep_us = can_message.rx_time_us;
+            }
+        }
+        if (!replay.speed_percent)
+            vTaskDelay(0);
+    }
+    if (channel == 2)
+    {
+        // End of the trace: the open windows are complete, the chunks go to the card.
+        signalAggregateCloseWindows(INT64_MAX);
+        signalStoreSealIdleChunks(INT64_MAX);
+    }
+    vTaskDelete(NULL);
+}
+
+#endif
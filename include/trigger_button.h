@@ -11,6 +11,7 @@
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "driver/gpio.h"
+#include "time_base.h"
 
 #define INPUT_PIN 25
 #define BUZZER_PIN 32
@@ -18,7 +19,7 @@
 
 // getting data from ISR and notice user.
 static QueueHandle_t trigger_interrupt_queue = NULL;
-// Notifying the writeDataToFile task.
+// Notifying the log writers (either one takes it, see takeErrorCaptureTrigger()).
 static QueueHandle_t trigger_listen_queue = NULL;
 // TWAI Controller Error data queue. 
 static QueueHandle_t trigger_err_data_queue = NULL;
@@ -31,8 +32,8 @@ void createInterruptQueues()
 {
     trigger_interrupt_queue = xQueueCreate(1, sizeof(int));
     trigger_listen_queue = xQueueCreate(1, sizeof(int));
-    trigger_err_data_queue = xQueueCreate(100, sizeof(twai_message_t));
-    trigger_err_data_queue_mcp2515 = xQueueCreate(100, sizeof(struct can_frame));
+    trigger_err_data_queue = xQueueCreate(100, sizeof(timed_twai_message_t));
+    trigger_err_data_queue_mcp2515 = xQueueCreate(100, sizeof(timed_can_frame_t));
     if (!(trigger_err_data_queue && trigger_interrupt_queue))
     {
         err_trigger = ESP_FAIL;
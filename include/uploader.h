@@ -0,0 +1,591 @@
+// Offline-first uploader: sends closed log segments to the back end in fixed-size, checksummed chunks, and resumes
+// after a network drop or a reboot at the last byte the server acknowledged instead of sending whole files again.
+
+// Segments are the files that are not being written anymore (see isLogFileOpen()) of four classes, in priority order
+// (upload_classes): fault captures (ERR_FS), signal summaries (SUM_FS), decoded signals (SIG_FS), raw logs (LOG_FS).
+// Within a class they are taken in sequence order of their path (compareSegmentNames()): component by component,
+// numbers by value (s_99.bin before s_100.bin, 00041_1 before 00050), UNDATED before the dates, which puts the
+// layout of log_naming.h in date, cycle, part and file order.
+// Higher classes are checked again between two chunks once a writer closed a file (logFilesClosed()): a capture
+// closed while a large raw log is on its way goes out before the next chunk of the log, which resumes afterwards. Each class has a byte budget per UPLOAD_BUDGET_PERIOD_US
+// (0: unlimited) so that raw logs cannot eat all the cellular data, a class over budget waits for the next period.
+// Queue depth (pending segments and bytes) and the age of the oldest pending segment of every class are kept in
+// upload_metrics, and published with the MQTT heartbeat (jsonWriterUploadMetrics()).
+// A segment is marked uploaded by clearing its FAT archive attribute (AM_ARC), which FAT sets again if the file is
+// ever modified. No extra file per segment is needed, and the space manager can tell uploaded files apart.
+// A directory whose segments are all uploaded, and where no more logs will be created (isLogDirectoryActive()), gets
+// its archive attribute cleared as well: scans skip it, and keep a constant cost as the card fills up.
+// The progress of the segment in flight of a class is saved after every acknowledged chunk in its state file.
+
+// HTTP protocol (upload_http_transport), one request per chunk:
+//   PUT <CONFIG_DATAFLY_UPLOAD_URL>/<segment path>
+//   Content-Range: bytes <first>-<last>/<file size>
+//   X-Chunk-CRC32: <crc32 of the chunk, 8 hex digits>
+// The server answers with the number of contiguous bytes it holds for the file in X-Acked-Offset:
+//   2xx/308 chunk stored; 409/416 offset or crc rejected, the uploader carries on from X-Acked-Offset.
+// Any server implementing this can stand in for the back end, such as tools/upload_server.py (bench runs and
+// pytest_host_upload.py, where the host simulation uploads its logs to it).
+#pragma once
+#include <ctype.h>
+#include <strings.h>
+#include "esp_rom_crc.h"
+#ifdef CONFIG_DATAFLY_UPLOAD_URL
+#include "esp_http_client.h"
+#endif
+#include "json_writer.h"
+
+#define UPLOAD_CHUNK_SIZE 8192
+#define UPLOAD_NAME_SIZE 64
+#define UPLOAD_MAX_DEPTH 6 // Directory levels below a class directory (log_naming.h uses 4).
+#define UPLOAD_STATE_MAGIC 0x55504C44 // "UPLD"
+#define UPLOAD_RETRY_MIN_MS 5000
+#define UPLOAD_RETRY_MAX_MS (5 * 60 * 1000)
+#define UPLOAD_IDLE_MS 60000 // Time between two scans when everything is uploaded.
+#define UPLOAD_IDLE_POLL_MS 1000 // A writer closing a file ends the wait early, checked this often.
+#define UPLOAD_HTTP_TIMEOUT_MS 30000
+#define UPLOAD_BUDGET_PERIOD_US (60 * 60 * 1000000LL)
+#define UPLOAD_BUDGET_SUMMARY_BYTES (1024 * 1024)
+#define UPLOAD_BUDGET_SIGNAL_BYTES (4 * 1024 * 1024)
+#define UPLOAD_BUDGET_RAW_BYTES (16 * 1024 * 1024)
+
+typedef struct
+{
+    uint32_t magic;
+    char name[UPLOAD_NAME_SIZE]; // FAT path of the segment, relative to the card root (LOG_FS/log_5000.asc).
+    uint32_t size;
+    uint32_t acked_offset;
+} upload_state_t;
+
+typedef enum
+{
+    UPLOAD_CLASS_CAPTURE,
+    UPLOAD_CLASS_SUMMARY,
+    UPLOAD_CLASS_SIGNAL,
+    UPLOAD_CLASS_RAW,
+    UPLOAD_CLASS_COUNT
+} upload_class_id_t;
+
+typedef struct
+{
+    const char *directory; // FAT path relative to the card root.
+    const char *state_file;
+    uint32_t budget_bytes; // Per UPLOAD_BUDGET_PERIOD_US, 0 for no limit.
+} upload_class_t;
+
+// In priority order. The raw logs keep the state file of the single-class uploader, so an upload in flight resumes.
+static const upload_class_t upload_classes[UPLOAD_CLASS_COUNT] = {
+    [UPLOAD_CLASS_CAPTURE] = {"ERR_FS", MOUNT_POINT"/UPLOAD_E.ST", 0},
+    [UPLOAD_CLASS_SUMMARY] = {"SUM_FS", MOUNT_POINT"/UPLOAD_S.ST", UPLOAD_BUDGET_SUMMARY_BYTES},
+    [UPLOAD_CLASS_SIGNAL] = {"SIG_FS", MOUNT_POINT"/UPLOAD_G.ST", UPLOAD_BUDGET_SIGNAL_BYTES},
+    [UPLOAD_CLASS_RAW] = {"LOG_FS", MOUNT_POINT"/UPLOAD.ST", UPLOAD_BUDGET_RAW_BYTES},
+};
+
+typedef struct
+{
+    uint32_t pending_segments;
+    uint64_t pending_bytes;
+    uint32_t budget_used;   // Bytes acknowledged in the current budget period.
+    uint64_t uploaded_bytes; // Since boot.
+    int64_t head_seen_us;   // When the oldest pending segment was first seen, 0 if none is pending.
+    char head_name[UPLOAD_NAME_SIZE];
+} upload_metrics_t;
+
+static upload_metrics_t upload_metrics[UPLOAD_CLASS_COUNT];
+static int64_t upload_budget_period_start_us = 0;
+static uint32_t upload_scan_closed = 0; // logFilesClosed() when the classes were last scanned.
+static bool upload_all_sent = false;     // The last full scan found no segment pending in any class.
+static uint32_t upload_all_sent_closed = 0; // logFilesClosed() at that scan.
+static portMUX_TYPE upload_metrics_lock = portMUX_INITIALIZER_UNLOCKED;
+// FAT path of the segment the uploader has open, "" when none: the space manager must not delete it under the upload.
+static char upload_open_segment[UPLOAD_NAME_SIZE] = "";
+static portMUX_TYPE upload_open_segment_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Transport of the chunks. send_chunk returns ESP_OK when the server answered, acked_offset being the number of
+// contiguous bytes of the file the server holds (which may be less than offset + length if the chunk was rejected).
+typedef struct
+{
+    esp_err_t (*send_chunk)(const char *name, uint32_t offset, const uint8_t *data, size_t length, uint32_t crc,
+                            uint32_t size, uint32_t *acked_offset);
+} upload_transport_t;
+
+/// @brief Compare one component of two paths (up to '/' or the end), runs of digits by value, the rest without case.
+static int compareSegmentComponents(const char **a, const char **b)
+{
+    const char *p = *a, *q = *b;
+    int result = 0;
+
+    // Files of cycles that never got a date were logged before the dated ones of the same boot, if anything.
+    bool undated_p = strncasecmp(p, LOG_UNDATED_DIRECTORY"/", sizeof(LOG_UNDATED_DIRECTORY)) == 0;
+    bool undated_q = strncasecmp(q, LOG_UNDATED_DIRECTORY"/", sizeof(LOG_UNDATED_DIRECTORY)) == 0;
+    if (undated_p != undated_q)
+        result = undated_p ? -1 : 1;
+    while (!result && *p && *p != '/' && *q && *q != '/')
+    {
+        if (isdigit((unsigned char)*p) && isdigit((unsigned char)*q))
+        {
+            while (*p == '0')
+                p++;
+            while (*q == '0')
+                q++;
+            const char *start_p = p, *start_q = q;
+            while (isdigit((unsigned char)*p))
+                p++;
+            while (isdigit((unsigned char)*q))
+                q++;
+            if (p - start_p != q - start_q)
+                result = p - start_p < q - start_q ? -1 : 1;
+            else
+                result = strncmp(start_p, start_q, p - start_p);
+            continue;
+        }
+        result = tolower((unsigned char)*p) - tolower((unsigned char)*q);
+        p++;
+        q++;
+    }
+    if (!result)
+    {
+        bool end_p = !*p || *p == '/', end_q = !*q || *q == '/';
+        if (end_p != end_q)
+            result = end_p ? -1 : 1; // 00041 before 00041_1.
+    }
+    *a = strchr(p, '/');
+    *b = strchr(q, '/');
+    return result;
+}
+
+/// @brief Compare two segment names in sequence order, component by component (see the top of the file).
+static int compareSegmentNames(const char *a, const char *b)
+{
+    while (true)
+    {
+        int result = compareSegmentComponents(&a, &b);
+        if (result)
+            return result < 0 ? -1 : 1;
+        if (!a || !b)
+            return a ? 1 : b ? -1 : 0; // A directory after the files next to it.
+        a++;
+        b++;
+    }
+}
+
+typedef struct
+{
+    upload_state_t *state;
+    bool found;
+    uint32_t pending_segments;
+    uint64_t pending_bytes;
+} upload_walk_t;
+
+/// @brief Walk a directory and its subdirectories for segments to upload, clearing the archive attribute of the
+/// subdirectories found done.
+/// @param path FAT path of the directory, in a buffer of UPLOAD_NAME_SIZE bytes used for the walk.
+/// @return true if the directory still holds segments to upload or being written.
+static bool walkUploadDirectory(upload_walk_t *walk, char *path, uint8_t depth)
+{
+    FF_DIR dir;
+    FILINFO info;
+    char full_path[UPLOAD_NAME_SIZE + sizeof(MOUNT_POINT) + 1];
+    size_t length = strlen(path);
+    bool pending = false;
+
+    if (f_opendir(&dir, path) != FR_OK)
+        return true;
+    while (f_readdir(&dir, &info) == FR_OK && info.fname[0])
+    {
+        if (!(info.fattrib & AM_ARC))
+            continue;
+        if ((size_t)snprintf(path + length, UPLOAD_NAME_SIZE - length, "/%s", info.fname) >= UPLOAD_NAME_SIZE - length)
+        {
+            path[length] = '\0';
+            continue;
+        }
+        if (info.fattrib & AM_DIR)
+        {
+            if (depth >= UPLOAD_MAX_DEPTH || walkUploadDirectory(walk, path, depth + 1) || isLogDirectoryActive(path))
+                pending = true;
+            else
+                f_chmod(path, 0, AM_ARC);
+        }
+        else
+        {
+            pending = true;
+            snprintf(full_path, sizeof(full_path), MOUNT_POINT"/%s", path);
+            if (!isLogFileOpen(full_path))
+            {
+                walk->pending_segments++;
+                walk->pending_bytes += info.fsize;
+                if (!walk->found || compareSegmentNames(path, walk->state->name) < 0)
+                {
+                    memcpy(walk->state->name, path, UPLOAD_NAME_SIZE);
+                    walk->state->size = info.fsize;
+                    walk->found = true;
+                }
+            }
+        }
+        path[length] = '\0';
+    }
+    f_closedir(&dir);
+    return pending;
+}
+
+/// @brief Find the oldest segment of a class directory (and its subdirectories) that is closed and not uploaded yet.
+/// @param directory FAT path relative to the card root (LOG_FS).
+/// @param pending_segments, pending_bytes filled with the count and total size of such segments, may be NULL.
+/// @return true if one was found, state then holds its name and size (acked_offset is reset).
+bool findNextUploadSegment(const char *directory, upload_state_t *state, uint32_t *pending_segments,
+                           uint64_t *pending_bytes)
+{
+    char path[UPLOAD_NAME_SIZE];
+    upload_walk_t walk = {.state = state};
+
+    snprintf(path, sizeof(path), "%s", directory);
+    walkUploadDirectory(&walk, path, 0);
+    if (pending_segments)
+        *pending_segments = walk.pending_segments;
+    if (pending_bytes)
+        *pending_bytes = walk.pending_bytes;
+    state->magic = UPLOAD_STATE_MAGIC;
+    state->acked_offset = 0;
+    return walk.found;
+}
+
+/// @brief Scan the directory of a class, updating its metrics.
+/// @return true if a segment is pending, state then holds the oldest one.
+static bool scanUploadClass(upload_class_id_t class_id, upload_state_t *state)
+{
+    uint32_t pending_segments;
+    uint64_t pending_bytes;
+    bool found = findNextUploadSegment(upload_classes[class_id].directory, state, &pending_segments, &pending_bytes);
+    upload_metrics_t *metrics = &upload_metrics[class_id];
+
+    portENTER_CRITICAL(&upload_metrics_lock);
+    metrics->pending_segments = pending_segments;
+    metrics->pending_bytes = pending_bytes;
+    if (!found)
+    {
+        metrics->head_seen_us = 0;
+        metrics->head_name[0] = '\0';
+    }
+    else if (strcmp(metrics->head_name, state->name) != 0)
+    {
+        metrics->head_seen_us = esp_timer_get_time();
+        memcpy(metrics->head_name, state->name, sizeof(metrics->head_name));
+    }
+    portEXIT_CRITICAL(&upload_metrics_lock);
+    return found;
+}
+
+static bool isUploadBudgetSpent(upload_class_id_t class_id)
+{
+    return upload_classes[class_id].budget_bytes &&
+           upload_metrics[class_id].budget_used >= upload_classes[class_id].budget_bytes;
+}
+
+/// @brief Whether a class of higher priority than class_id has a segment waiting and budget left. Nothing can have
+/// changed, and nothing is scanned, until a writer closes a file.
+static bool isUploadPreempted(upload_class_id_t class_id)
+{
+    upload_state_t state;
+    uint32_t closed = logFilesClosed();
+    if (closed == upload_scan_closed)
+        return false;
+    upload_scan_closed = closed;
+    for (int higher = 0; higher < class_id; higher++)
+    {
+        if (!isUploadBudgetSpent(higher) && scanUploadClass(higher, &state))
+            return true;
+    }
+    return false;
+}
+
+static bool loadUploadState(const char *state_file, upload_state_t *state)
+{
+    FILE *state_f = fopen(state_file, "r");
+    if (!state_f)
+        return false;
+    bool loaded = fread(state, sizeof(*state), 1, state_f) == 1 && state->magic == UPLOAD_STATE_MAGIC;
+    fclose(state_f);
+    state->name[UPLOAD_NAME_SIZE - 1] = '\0';
+    return loaded;
+}
+
+static void setUploadOpenSegment(const char *name)
+{
+    portENTER_CRITICAL(&upload_open_segment_lock);
+    snprintf(upload_open_segment, sizeof(upload_open_segment), "%s", name);
+    portEXIT_CRITICAL(&upload_open_segment_lock);
+}
+
+/// @brief Whether the uploader has a segment open.
+/// @param name FAT path, relative to the card root, compared without case as FAT does.
+bool isUploadSegmentOpen(const char *name)
+{
+    portENTER_CRITICAL(&upload_open_segment_lock);
+    bool is_open = upload_open_segment[0] && strcasecmp(upload_open_segment, name) == 0;
+    portEXIT_CRITICAL(&upload_open_segment_lock);
+    return is_open;
+}
+
+static void saveUploadState(const char *state_file, const upload_state_t *state)
+{
+    FILE *state_f = fopen(state_file, "w");
+    if (!state_f || fwrite(state, sizeof(*state), 1, state_f) != 1)
+        ESP_LOGE("UPLOADER_H", "Failed to save the upload progress");
+    if (state_f)
+        fclose(state_f);
+}
+
+/// @brief Upload one segment of a class from its last acknowledged byte to its end, and mark it uploaded.
+/// @param chunk buffer of UPLOAD_CHUNK_SIZE bytes.
+/// @return ESP_ERR_NOT_FINISHED if the upload was set aside for a class of higher priority or because the budget of
+/// the class is spent, its progress is saved and it resumes next time.
+esp_err_t uploadSegment(const upload_transport_t *transport, upload_class_id_t class_id, upload_state_t *state,
+                        uint8_t *chunk)
+{
+    const char *state_file = upload_classes[class_id].state_file;
+    upload_state_t saved;
+    char path[UPLOAD_NAME_SIZE + sizeof(MOUNT_POINT) + 1];
+    esp_err_t err = ESP_OK;
+
+    if (loadUploadState(state_file, &saved) && strcmp(saved.name, state->name) == 0 &&
+        saved.acked_offset <= state->size)
+    {
+        state->acked_offset = saved.acked_offset;
+        ESP_LOGI("UPLOADER_H", "Resuming %s at %lu/%lu", state->name, (unsigned long)state->acked_offset,
+                 (unsigned long)state->size);
+    }
+
+    snprintf(path, sizeof(path), MOUNT_POINT"/%s", state->name);
+    setUploadOpenSegment(state->name);
+    FILE *segment_f = fopen(path, "r");
+    if (!segment_f)
+    {
+        setUploadOpenSegment("");
+        ESP_LOGE("UPLOADER_H", "Failed to open %s", path);
+        return ESP_FAIL;
+    }
+    while (state->acked_offset < state->size)
+    {
+        if (isUploadBudgetSpent(class_id) || isUploadPreempted(class_id))
+        {
+            err = ESP_ERR_NOT_FINISHED;
+            break;
+        }
+
+        size_t length = state->size - state->acked_offset;
+        if (length > UPLOAD_CHUNK_SIZE)
+            length = UPLOAD_CHUNK_SIZE;
+        if (fseek(segment_f, state->acked_offset, SEEK_SET) != 0 || fread(chunk, 1, length, segment_f) != length)
+        {
+            err = ESP_FAIL;
+            break;
+        }
+
+        uint32_t acked_offset;
+        uint32_t crc = esp_rom_crc32_le(0, chunk, length);
+        err = transport->send_chunk(state->name, state->acked_offset, chunk, length, crc, state->size, &acked_offset);
+        if (err == ESP_OK && (acked_offset > state->size || acked_offset == state->acked_offset))
+            err = ESP_ERR_INVALID_RESPONSE; // No progress, or the server holds more than the file: back off.
+        if (err != ESP_OK)
+            break;
+        if (acked_offset > state->acked_offset)
+        {
+            portENTER_CRITICAL(&upload_metrics_lock);
+            upload_metrics[class_id].budget_used += acked_offset - state->acked_offset;
+            upload_metrics[class_id].uploaded_bytes += acked_offset - state->acked_offset;
+            portEXIT_CRITICAL(&upload_metrics_lock);
+        }
+        state->acked_offset = acked_offset;
+        saveUploadState(state_file, state);
+    }
+    fclose(segment_f);
+    setUploadOpenSegment("");
+
+    if (err == ESP_OK)
+    {
+        f_chmod(state->name, 0, AM_ARC);
+        remove(state_file);
+        ESP_LOGI("UPLOADER_H", "Uploaded %s (%lu bytes)", state->name, (unsigned long)state->size);
+    }
+    return err;
+}
+
+/// @brief Whether every segment closed so far is uploaded: the last full scan of the uploader, started after the last
+/// file was closed, found nothing pending in any class.
+bool isUploadDone()
+{
+    portENTER_CRITICAL(&upload_metrics_lock);
+    bool done = upload_all_sent && upload_all_sent_closed == logFilesClosed();
+    portEXIT_CRITICAL(&upload_metrics_lock);
+    return done;
+}
+
+/// @brief Write the upload metrics as a value of a larger document:
+/// {"<directory>":{"pending":n,"bytes":n,"age":s,"budget":n,"sent":n},...}.
+void jsonWriterUploadMetrics(json_writer_t *writer)
+{
+    upload_metrics_t metrics[UPLOAD_CLASS_COUNT];
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&upload_metrics_lock);
+    memcpy(metrics, upload_metrics, sizeof(metrics));
+    portEXIT_CRITICAL(&upload_metrics_lock);
+
+    jsonWriterBeginObject(writer);
+    for (int class_id = 0; class_id < UPLOAD_CLASS_COUNT; class_id++)
+    {
+        jsonWriterKey(writer, upload_classes[class_id].directory);
+        jsonWriterBeginObject(writer);
+        jsonWriterKey(writer, "pending");
+        jsonWriterInt(writer, metrics[class_id].pending_segments);
+        jsonWriterKey(writer, "bytes");
+        jsonWriterInt(writer, metrics[class_id].pending_bytes);
+        jsonWriterKey(writer, "age");
+        jsonWriterInt(writer, metrics[class_id].head_seen_us ? (now - metrics[class_id].head_seen_us) / 1000000 : 0);
+        jsonWriterKey(writer, "budget");
+        jsonWriterInt(writer, metrics[class_id].budget_used);
+        jsonWriterKey(writer, "sent");
+        jsonWriterInt(writer, metrics[class_id].uploaded_bytes);
+        jsonWriterEndObject(writer);
+    }
+    jsonWriterEndObject(writer);
+}
+
+// ------------------------------ HTTP transport ------------------------------ //
+
+#ifdef CONFIG_DATAFLY_UPLOAD_URL
+
+static esp_http_client_handle_t upload_http_client = NULL;
+static char upload_acked_header[16];
+
+static esp_err_t uploadHttpEvent(esp_http_client_event_t *event)
+{
+    if (event->event_id == HTTP_EVENT_ON_HEADER && strcasecmp(event->header_key, "X-Acked-Offset") == 0)
+        snprintf(upload_acked_header, sizeof(upload_acked_header), "%s", event->header_value);
+    return ESP_OK;
+}
+
+static esp_err_t sendChunkHttp(const char *name, uint32_t offset, const uint8_t *data, size_t length, uint32_t crc,
+                               uint32_t size, uint32_t *acked_offset)
+{
+    char url[sizeof(CONFIG_DATAFLY_UPLOAD_URL) + UPLOAD_NAME_SIZE + 1];
+    char content_range[48];
+    char crc_text[12];
+
+    if (!upload_http_client)
+    {
+        esp_http_client_config_t config = {
+            .url = CONFIG_DATAFLY_UPLOAD_URL,
+            .timeout_ms = UPLOAD_HTTP_TIMEOUT_MS,
+            .keep_alive_enable = true,
+            .event_handler = uploadHttpEvent,
+        };
+        upload_http_client = esp_http_client_init(&config);
+        if (!upload_http_client)
+            return ESP_ERR_NO_MEM;
+    }
+
+    snprintf(url, sizeof(url), "%s/%s", CONFIG_DATAFLY_UPLOAD_URL, name);
+    snprintf(content_range, sizeof(content_range), "bytes %lu-%lu/%lu", (unsigned long)offset,
+             (unsigned long)(offset + length - 1), (unsigned long)size);
+    snprintf(crc_text, sizeof(crc_text), "%08lx", (unsigned long)crc);
+    esp_http_client_set_url(upload_http_client, url);
+    esp_http_client_set_method(upload_http_client, HTTP_METHOD_PUT);
+    esp_http_client_set_header(upload_http_client, "Content-Range", content_range);
+    esp_http_client_set_header(upload_http_client, "X-Chunk-CRC32", crc_text);
+    esp_http_client_set_post_field(upload_http_client, (const char *)data, length);
+
+    upload_acked_header[0] = '\0';
+    esp_err_t err = esp_http_client_perform(upload_http_client);
+    if (err != ESP_OK)
+        return err;
+
+    int status = esp_http_client_get_status_code(upload_http_client);
+    if (!upload_acked_header[0] || !((status >= 200 && status < 300) || status == 308 || status == 409 || status == 416))
+    {
+        ESP_LOGW("UPLOADER_H", "Unexpected answer %d for %s", status, name);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    *acked_offset = strtoul(upload_acked_header, NULL, 10);
+    return ESP_OK;
+}
+
+static const upload_transport_t upload_http_transport = {
+    .send_chunk = sendChunkHttp,
+};
+
+#endif // CONFIG_DATAFLY_UPLOAD_URL
+
+/// @brief Task: upload closed segments one after the other, highest class first, backing off exponentially while the
+/// network is down.
+/// @param pvParameter upload_transport_t to use, NULL for the HTTP transport.
+void uploadLogSegments(void *pvParameter)
+{
+    static uint8_t chunk[UPLOAD_CHUNK_SIZE];
+    const upload_transport_t *transport = pvParameter;
+    upload_state_t state, next_state;
+    uint32_t retry_ms = UPLOAD_RETRY_MIN_MS;
+
+#ifdef CONFIG_DATAFLY_UPLOAD_URL
+    if (!transport)
+        transport = &upload_http_transport;
+#endif
+    if (!transport)
+    {
+        ESP_LOGE("UPLOADER_H", "No upload transport");
+        vTaskDelete(NULL);
+    }
+    upload_budget_period_start_us = esp_timer_get_time();
+    while (true)
+    {
+        if (esp_timer_get_time() - upload_budget_period_start_us >= UPLOAD_BUDGET_PERIOD_US)
+        {
+            portENTER_CRITICAL(&upload_metrics_lock);
+            for (int class_id = 0; class_id < UPLOAD_CLASS_COUNT; class_id++)
+                upload_metrics[class_id].budget_used = 0;
+            portEXIT_CRITICAL(&upload_metrics_lock);
+            upload_budget_period_start_us = esp_timer_get_time();
+        }
+
+        // Every class is scanned to keep its metrics up to date, the first one with work and budget goes.
+        int next_class = -1;
+        bool pending = false;
+        upload_scan_closed = logFilesClosed();
+        for (int class_id = 0; class_id < UPLOAD_CLASS_COUNT; class_id++)
+        {
+            if (scanUploadClass(class_id, &next_state))
+            {
+                pending = true;
+                if (next_class < 0 && !isUploadBudgetSpent(class_id))
+                {
+                    next_class = class_id;
+                    state = next_state;
+                }
+            }
+        }
+        portENTER_CRITICAL(&upload_metrics_lock);
+        upload_all_sent = !pending;
+        upload_all_sent_closed = upload_scan_closed;
+        portEXIT_CRITICAL(&upload_metrics_lock);
+        if (next_class < 0)
+        {
+            // Nothing can be sent before a writer closes a file or the budget period ends.
+            for (uint32_t waited = 0; waited < UPLOAD_IDLE_MS && logFilesClosed() == upload_scan_closed;
+                 waited += UPLOAD_IDLE_POLL_MS)
+                vTaskDelay(UPLOAD_IDLE_POLL_MS / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        esp_err_t err = uploadSegment(transport, next_class, &state, chunk);
+        if (err == ESP_OK || err == ESP_ERR_NOT_FINISHED)
+        {
+            retry_ms = UPLOAD_RETRY_MIN_MS;
+            continue;
+        }
+        ESP_LOGW("UPLOADER_H", "Upload of %s stopped at %lu (%s), retrying in %lu ms", state.name,
+                 (unsigned long)state.acked_offset, esp_err_to_name(err), (unsigned long)retry_ms);
+        vTaskDelay(retry_ms / portTICK_PERIOD_MS);
+        retry_ms = retry_ms * 2 > UPLOAD_RETRY_MAX_MS ? UPLOAD_RETRY_MAX_MS : retry_ms * 2;
+    }
+    vTaskDelete(NULL);
+}
@@ -0,0 +1,135 @@
+// Signal database of the vehicle (what a .dbc file would hold), compiled into extraction kernels at start up.
+// Signals of one message are contiguous in the table, so a whole frame decodes straight into a slice of a
+// float[SIG_COUNT] array indexed by vehicle_signal_id_t.
+// To add a message: append its signals to the enum and the names, compile them in vehicleSignalsInit(),
+// and add an entry to vehicle_messages, which is kept in identifier order (findVehicleMessage() is a binary search).
+// The receiving task resolves the identifier of a frame once, then decodes it with the definition it got.
+#pragma once
+#include "can_encoder_decoder.h"
+
+typedef enum
+{
+    // 0x500 Cluster display.
+    SIG_READY_LCD,
+    SIG_AUTONOMY_ICON_LCD,
+    SIG_CHARGE_ICON_LCD,
+    SIG_DRIVE_MODE_SELECTOR_LCD,
+    SIG_BATTERY_STATE_BARS,
+    SIG_VEHICLE_SPEED,
+    SIG_STATE_OF_CHARGE,
+    SIG_ODOMETER,
+    SIG_REMAINING_CHARGE_TIME,
+    // 0x510 Cluster warnings.
+    SIG_RIGHT_INDICATOR,
+    SIG_LEFT_INDICATOR,
+    SIG_BRAKE_SYSTEM_PROBLEM,
+    SIG_STOP,
+    SIG_BATTERY_TEMPERATURE,
+    SIG_TURTLE_MODE,
+    SIG_REMAINING_AUTONOMY,
+    SIG_COUNT
+} vehicle_signal_id_t;
+
+static const char *const vehicle_signal_names[SIG_COUNT] = {
+    [SIG_READY_LCD] = "Ready LCD",
+    [SIG_AUTONOMY_ICON_LCD] = "Autonomy Icon LCD",
+    [SIG_CHARGE_ICON_LCD] = "Charge Icon LCD",
+    [SIG_DRIVE_MODE_SELECTOR_LCD] = "Drive Mode Selector LCD",
+    [SIG_BATTERY_STATE_BARS] = "Battery State Bars",
+    [SIG_VEHICLE_SPEED] = "Vehicle Speed",
+    [SIG_STATE_OF_CHARGE] = "State of Charge",
+    [SIG_ODOMETER] = "Odometer",
+    [SIG_REMAINING_CHARGE_TIME] = "Remaining Charge Time",
+    [SIG_RIGHT_INDICATOR] = "Right Indicator",
+    [SIG_LEFT_INDICATOR] = "Left Indicator",
+    [SIG_BRAKE_SYSTEM_PROBLEM] = "Brake System Problem",
+    [SIG_STOP] = "Stop",
+    [SIG_BATTERY_TEMPERATURE] = "Battery Temperature",
+    [SIG_TURTLE_MODE] = "Turtle Mode",
+    [SIG_REMAINING_AUTONOMY] = "Remaining Autonomy",
+};
+
+static can_signal_t vehicle_signals[SIG_COUNT];
+
+static const can_message_def_t vehicle_messages[] = {
+    {0x500, SIG_RIGHT_INDICATOR - SIG_READY_LCD, &vehicle_signals[SIG_READY_LCD]},
+    {0x510, SIG_COUNT - SIG_RIGHT_INDICATOR, &vehicle_signals[SIG_RIGHT_INDICATOR]},
+};
+
+#define VEHICLE_MESSAGE_COUNT (sizeof(vehicle_messages) / sizeof(vehicle_messages[0]))
+
+/// @brief Compile the signal table, call once before decoding any frame.
+void vehicleSignalsInit()
+{
+    for (size_t i = 1; i < VEHICLE_MESSAGE_COUNT; i++)
+        assert(vehicle_messages[i - 1].id < vehicle_messages[i].id);
+    vehicle_signals[SIG_READY_LCD] = canSignalCompile(0, 1, false, false, 1, 0);
+    vehicle_signals[SIG_AUTONOMY_ICON_LCD] = canSignalCompile(1, 2, false, false, 1, 0);
+    vehicle_signals[SIG_CHARGE_ICON_LCD] = canSignalCompile(3, 2, false, false, 1, 0);
+    vehicle_signals[SIG_DRIVE_MODE_SELECTOR_LCD] = canSignalCompile(5, 2, false, false, 1, 0);
+    vehicle_signals[SIG_BATTERY_STATE_BARS] = canSignalCompile(7, 4, false, false, 1, 0);
+    vehicle_signals[SIG_VEHICLE_SPEED] = canSignalCompile(11, 7, false, false, 1, 0);
+    vehicle_signals[SIG_STATE_OF_CHARGE] = canSignalCompile(18, 7, false, false, 0.5, 0);
+    vehicle_signals[SIG_ODOMETER] = canSignalCompile(25, 24, false, false, 0.1, 0);
+    vehicle_signals[SIG_REMAINING_CHARGE_TIME] = canSignalCompile(49, 8, false, false, 2, 0);
+
+    vehicle_signals[SIG_RIGHT_INDICATOR] = canSignalCompile(0, 2, false, false, 1, 0);
+    vehicle_signals[SIG_LEFT_INDICATOR] = canSignalCompile(2, 2, false, false, 1, 0);
+    vehicle_signals[SIG_BRAKE_SYSTEM_PROBLEM] = canSignalCompile(6, 2, false, false, 1, 0);
+    vehicle_signals[SIG_STOP] = canSignalCompile(10, 2, false, false, 1, 0);
+    vehicle_signals[SIG_BATTERY_TEMPERATURE] = canSignalCompile(14, 2, false, false, 1, 0);
+    vehicle_signals[SIG_TURTLE_MODE] = canSignalCompile(18, 2, false, false, 1, 0);
+    vehicle_signals[SIG_REMAINING_AUTONOMY] = canSignalCompile(34, 8, false, false, 1, 0);
+}
+
+/// @brief Find the definition of a CAN identifier, binary search of vehicle_messages.
+/// @return NULL if the identifier is not part of the database.
+const can_message_def_t *findVehicleMessage(uint32_t can_id)
+{
+    size_t low = 0, high = VEHICLE_MESSAGE_COUNT;
+    while (low < high)
+    {
+        size_t middle = (low + high) / 2;
+        if (vehicle_messages[middle].id < can_id)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if (low < VEHICLE_MESSAGE_COUNT && vehicle_messages[low].id == can_id)
+        return &vehicle_messages[low];
+    return NULL;
+}
+
+/// @brief Decode all signals of a message into their slots of values (indexed by vehicle_signal_id_t).
+/// Slots of other messages are left untouched.
+static inline void decodeVehicleMessage(const can_message_def_t *message, const uint8_t *frame,
+                                        float values[SIG_COUNT])
+{
+    canDecodeFrame(message, frame, &values[message->signals - vehicle_signals]);
+}
+
+/// @brief Integer-only decodeVehicleMessage(), values in Q.16 (see canSignalDecodeFixed()).
+static inline void decodeVehicleMessageFixed(const can_message_def_t *message, const uint8_t *frame,
+                                             int64_t values[SIG_COUNT])
+{
+    canDecodeFrameFixed(message, frame, &values[message->signals - vehicle_signals]);
+}
+
+/// @brief Look up and decode a frame, see decodeVehicleMessage().
+/// @return the message definition, NULL if the frame is not part of the database (nothing decoded).
+const can_message_def_t *decodeVehicleFrame(uint32_t can_id, const uint8_t *frame, float values[SIG_COUNT])
+{
+    const can_message_def_t *message = findVehicleMessage(can_id);
+    if (message)
+        decodeVehicleMessage(message, frame, values);
+    return message;
+}
+
+/// @brief Integer-only decodeVehicleFrame(), values in Q.16 (see canSignalDecodeFixed()).
+const can_message_def_t *decodeVehicleFrameFixed(uint32_t can_id, const uint8_t *frame, int64_t values[SIG_COUNT])
+{
+    const can_message_def_t *message = findVehicleMessage(can_id);
+    if (message)
+        decodeVehicleMessageFixed(message, frame, values);
+    return message;
+}
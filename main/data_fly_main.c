@@ -52,7 +52,28 @@
 #include "trigger_button.h"
 #include "file_handle.h"
 #include "can_node.h"
+#include "signal_store.h"
+#include "signal_aggregate.h"
+#include "uploader.h"
+#include "space_manager.h"
+#include "runtime_stats.h"
+#ifdef CONFIG_DATAFLY_MQTT_ENABLED
+#include "mqtt_publisher.h"
+#endif
+#ifdef CONFIG_DATAFLY_MODEM_ENABLED
+#include "sim7080g.h"
+#include "gnss_time.h"
+#endif
 #include "can_node_mcp2515.h"
+#include "trace_replay.h"
+#ifdef CONFIG_IDF_TARGET_LINUX
+#include "host_simulation.h"
+#endif
+#ifdef CONFIG_DATAFLY_LOAD_TEST_ENABLED
+#include "load_generator.h"
+#endif
+#include "kernel_benchmark.h"
+#include "host_checks.h"
 
 
 static const char *TAG = "DATA_FLY_MAIN_C";
@@ -63,6 +84,13 @@ void app_main(void)
 {
     esp_err_t ret;
 
+#ifdef CONFIG_DATAFLY_HOST_CHECKS
+    runHostChecks();
+#endif
+#ifdef CONFIG_DATAFLY_BENCHMARK_ENABLED
+    runKernelBenchmarks();
+#endif
+
     // SD-card and SPI Initialisation.
     esp_vfs_fat_sdmmc_mount_config_t mount_config = mountConfig();
     sdmmc_card_t *card;
@@ -137,18 +165,79 @@ void app_main(void)
     createFileErrQueue();
     createFileDataQueues();
     createFileNameQueue();
+    createSignalStoreQueue();
+    createSummaryQueue();
 
     createDirectory("Log_Fs");
     createDirectory("Err_fs");
+    createDirectory("Sig_fs");
+    createDirectory("Sum_fs");
+#ifdef CONFIG_DATAFLY_LATENCY_STATS
+    createDirectory("Stat_fs");
+#endif
+
+    // NVS keeps the ignition cycle counter used in the log directory names.
+    ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND)
+    {
+        nvs_flash_erase();
+        ret = nvs_flash_init();
+    }
+    if (ret != ESP_OK)
+        ESP_LOGE(TAG, "Failed to initialise NVS (%s)", esp_err_to_name(ret));
+    initLogNaming();
+#ifdef CONFIG_DATAFLY_LOG_FORMAT_MF4
+    recoverMf4Logs();
+#endif
 
     xTaskCreatePinnedToCore(&blinkFileErrorLED, "Blinking error led", 2048, NULL, 1, NULL, 1);
+    startLogClock(); // Before the writers: the logs of both buses share their start.
     xTaskCreatePinnedToCore(&writeDataToFile, "Writing data to file", 8192, NULL, 10, NULL, 1);
+#ifdef CONFIG_DATAFLY_REPLAY_ENABLED
+    xTaskCreatePinnedToCore(&replayTrace, "Replay TWAI trace", 3072, (void *)1, 8, NULL, 1);
+#else
     xTaskCreatePinnedToCore(&SendCANData, "Send CAN data to file", 2048, NULL, 8, NULL, 1); 
+#endif
 
     xTaskCreatePinnedToCore(&writeDataToErrorFiles, "Write CAN data to Error files", 8192, NULL, 0, NULL, 0);
-
-    xTaskCreatePinnedToCore(&sendCanDataMCP2515, "Send MCP CAN data to be written", 2048, NULL, 0, NULL, 0); /// !!!!!!!ALWAYS KEEP THE PRIORITY OF THIS TASK AS 0!!!!!!!!!! ///
+    // Background tasks: idle priority on core 1. On core 0 they would preempt the MCP2515 receiver, which polls the
+    // controller at priority 0 and decodes and stores the signals of every frame; on core 1 they only take the time
+    // the TWAI receiver and writer (priorities 8 and 10) leave.
+    xTaskCreatePinnedToCore(&writeSignalStore, "Write decoded signals store", 4096, NULL, 0, NULL, 1);
+    xTaskCreatePinnedToCore(&writeSignalSummaries, "Write signal summaries", 3072, NULL, 0, NULL, 1);
+    xTaskCreatePinnedToCore(&publishClusterState, "Publish cluster state", 3072, NULL, 0, NULL, 1);
+    xTaskCreatePinnedToCore(&manageCardSpace, "Manage card space", 4096, NULL, 0, NULL, 1);
+#ifdef CONFIG_DATAFLY_RUNTIME_STATS
+    xTaskCreatePinnedToCore(&reportRuntimeStats, "Report runtime stats", 3072, NULL, 0, NULL, 1);
+#endif
+#ifdef CONFIG_DATAFLY_LATENCY_STATS
+    xTaskCreatePinnedToCore(&reportLatencyStats, "Report latency stats", 3072, NULL, 0, NULL, 1);
+#endif
+#ifdef CONFIG_DATAFLY_UPLOAD_ENABLED
+    xTaskCreatePinnedToCore(&uploadLogSegments, "Upload log segments", 6144, NULL, 0, NULL, 1);
+#endif
+#ifdef CONFIG_DATAFLY_MODEM_ENABLED
+    if (initModem())
+    {
+        xTaskCreatePinnedToCore(&runModem, "SIM7080G modem", 4096, NULL, 0, NULL, 1);
+        xTaskCreatePinnedToCore(&disciplineTimeFromGnss, "GNSS time discipline", 2560, NULL, 0, NULL, 1);
+    }
+#endif
+#ifdef CONFIG_DATAFLY_MQTT_ENABLED
+    xTaskCreatePinnedToCore(&publishTelemetry, "Publish MQTT telemetry", 4096, NULL, 0, NULL, 1);
+#endif
+
+#ifdef CONFIG_DATAFLY_REPLAY_ENABLED
+    xTaskCreatePinnedToCore(&replayTrace, "Replay MCP2515 trace", 4096, (void *)2, 0, NULL, 0);
+#else
+    xTaskCreatePinnedToCore(&sendCanDataMCP2515, "Send MCP CAN data to be written", 4096, NULL, 0, NULL, 0); /// !!!!!!!ALWAYS KEEP THE PRIORITY OF THIS TASK AS 0!!!!!!!!!! ///
+#endif
     xTaskCreatePinnedToCore(&writeDataToFileMCP, "Write MCP data to file", 8192, NULL, 10, NULL, 0);
+#if defined(CONFIG_DATAFLY_LOAD_TEST_ENABLED)
+    xTaskCreatePinnedToCore(&runLoadTest, "CAN load test", 4096, NULL, 1, NULL, 1);
+#elif defined(CONFIG_IDF_TARGET_LINUX)
+    xTaskCreatePinnedToCore(&runHostSimulation, "Host simulation", 4096, NULL, 2, NULL, 0);
+#endif
     
     // Don't use any file operation after this point. 
     // All done, unmount partition and disable SPI peripheral
@@ -0,0 +1,10 @@
+# Host checks of the DataFLY kernels (include/host_checks.h), on the linux target.
+import pytest
+from pytest_embedded import Dut
+
+
+@pytest.mark.linux
+@pytest.mark.host_test
+@pytest.mark.parametrize('config', ['host_checks'], indirect=True)
+def test_host_checks(dut: Dut) -> None:
+    dut.expect_exact('host checks: all passed', timeout=300)
@@ -0,0 +1,148 @@
+# Host simulation with the MQTT publisher (sdkconfig.ci.host_mqtt), against a mosquitto broker started on the host:
+# the retained QoS 1 heartbeat, the telemetry batches (one every TELEMETRY_PERIOD_S, at most TELEMETRY_MAX_BYTES), the
+# backlog kept while the broker is down and flushed once it is back, and the last will once the logger is gone.
+# Skipped when mosquitto or paho-mqtt are not installed. Takes about four minutes: the broker stays down long enough
+# for the backlog to overflow.
+import json
+import os
+import shutil
+import socket
+import subprocess
+import threading
+import time
+from typing import Any, Callable, List, Optional
+
+import pytest
+from pytest_embedded_idf.app import IdfApp
+
+mqtt = pytest.importorskip('paho.mqtt.client')
+
+BROKER_PORT = 1884  # CONFIG_DATAFLY_MQTT_BROKER_URI of sdkconfig.ci.host_mqtt.
+TELEMETRY_PERIOD_S = 10  # include/mqtt_publisher.h
+TELEMETRY_MAX_BYTES = 512
+TELEMETRY_BACKLOG_LENGTH = 16
+
+
+class Broker:
+    def __init__(self, tmp_path: str) -> None:
+        self.log_path = os.path.join(tmp_path, 'mosquitto.log')
+        self.process: Optional[subprocess.Popen] = None
+
+    def start(self) -> None:
+        self.process = subprocess.Popen(['mosquitto', '-p', str(BROKER_PORT)], stdout=open(self.log_path, 'ab'),
+                                        stderr=subprocess.STDOUT)
+        deadline = time.monotonic() + 10
+        while time.monotonic() < deadline:
+            try:
+                socket.create_connection(('127.0.0.1', BROKER_PORT), timeout=1).close()
+                return
+            except OSError:
+                time.sleep(0.05)
+        raise RuntimeError('mosquitto did not start')
+
+    def stop(self) -> None:
+        if self.process:
+            self.process.terminate()
+            self.process.wait(timeout=10)
+            self.process = None
+
+
+class Subscriber:
+    """Records every message of datafly/# as (arrival time, topic, payload, qos, retain)."""
+
+    def __init__(self) -> None:
+        self.messages: List[Any] = []
+        self.lock = threading.Lock()
+        self.client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2)
+        self.client.on_message = self.on_message
+        self.client.connect('127.0.0.1', BROKER_PORT)
+        self.client.subscribe('datafly/#', qos=1)
+        self.client.loop_start()
+
+    def on_message(self, client: Any, userdata: Any, message: Any) -> None:
+        with self.lock:
+            self.messages.append((time.monotonic(), message.topic, message.payload, message.qos, message.retain))
+
+    def wait_for(self, predicate: Callable[[List[Any]], Any], timeout: float) -> Any:
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            with self.lock:
+                result = predicate(list(self.messages))
+            if result:
+                return result
+            time.sleep(0.1)
+        raise TimeoutError('{} messages: {}'.format(len(self.messages), self.messages[-3:]))
+
+    def stop(self) -> None:
+        self.client.loop_stop()
+        self.client.disconnect()
+
+
+def heartbeats(messages: List[Any], status: str) -> List[Any]:
+    return [m for m in messages if m[1].endswith('/heartbeat') and json.loads(m[2])['status'] == status]
+
+
+def telemetry(messages: List[Any]) -> List[Any]:
+    return [m for m in messages if m[1].endswith('/telemetry')]
+
+
+@pytest.mark.linux
+@pytest.mark.host_test
+@pytest.mark.parametrize('config', ['host_mqtt'], indirect=True)
+def test_host_mqtt(app: IdfApp, tmp_path: str) -> None:
+    if not shutil.which('mosquitto'):
+        pytest.skip('mosquitto is not installed')
+    broker = Broker(str(tmp_path))
+    broker.start()
+    subscriber = Subscriber()
+    logger_output = open(os.path.join(str(tmp_path), 'datafly.log'), 'wb')
+    logger = subprocess.Popen([app.elf_file], cwd=str(tmp_path), stdout=logger_output, stderr=subprocess.STDOUT)
+    try:
+        # Heartbeat: QoS 1, and retained for the subscribers that come later.
+        online = subscriber.wait_for(lambda m: heartbeats(m, 'online'), 30)[0]
+        assert online[3] == 1
+        late = Subscriber()
+        retained = late.wait_for(lambda m: heartbeats(m, 'online'), 10)[0]
+        assert retained[4]
+        late.stop()
+
+        # Telemetry: one batch per period, within the byte budget.
+        batches = subscriber.wait_for(lambda m: len(telemetry(m)) >= 3 and telemetry(m), 4 * TELEMETRY_PERIOD_S + 10)
+        for message in batches:
+            assert len(message[2]) <= TELEMETRY_MAX_BYTES
+            assert json.loads(message[2])['s']
+        for previous, message in zip(batches, batches[1:]):
+            assert abs(message[0] - previous[0] - TELEMETRY_PERIOD_S) < 1.5
+            assert abs(json.loads(message[2])['t'] - json.loads(previous[2])['t'] - TELEMETRY_PERIOD_S) <= 1
+        last_t = json.loads(batches[-1][2])['t']
+
+        # Broker down for more batches than the backlog holds: the oldest are dropped, the others sent oldest first
+        # once it is back, followed by the batch of the period.
+        subscriber.stop()
+        broker.stop()
+        time.sleep((TELEMETRY_BACKLOG_LENGTH + 2) * TELEMETRY_PERIOD_S)
+        broker.start()
+        subscriber = Subscriber()
+        status = json.loads(subscriber.wait_for(lambda m: heartbeats(m, 'online'), 30)[0][2])
+        assert status['backlog'] == TELEMETRY_BACKLOG_LENGTH
+        assert status['dropped'] >= 1
+        flushed = subscriber.wait_for(lambda m: len(telemetry(m)) > TELEMETRY_BACKLOG_LENGTH and telemetry(m),
+                                      2 * TELEMETRY_PERIOD_S + 10)[:TELEMETRY_BACKLOG_LENGTH + 1]
+        assert flushed[-1][0] - flushed[0][0] < 2
+        times = [json.loads(message[2])['t'] for message in flushed]
+        assert times[0] - last_t > 2 * TELEMETRY_PERIOD_S
+        for previous, current in zip(times, times[1:]):
+            assert abs(current - previous - TELEMETRY_PERIOD_S) <= 1
+
+        # Last will: the broker publishes the offline status, retained, once the connection is gone.
+        logger.kill()
+        logger.wait()
+        subscriber.wait_for(lambda m: heartbeats(m, 'offline'), 10)
+        late = Subscriber()
+        assert late.wait_for(lambda m: heartbeats(m, 'offline'), 10)[0][4]
+        late.stop()
+    finally:
+        if logger.poll() is None:
+            logger.kill()
+        subscriber.stop()
+        broker.stop()
@@ -0,0 +1,110 @@
+# Host simulation of the logger.
+# - sdkconfig.ci.host_sim: both virtual buses run flat out, the run must end on its own with every frame delivered and
+#   written once to the LOG_FS logs of its bus, each log closed with its footer.
+# - sdkconfig.ci.host_replay: a trace (include/trace_replay.h) is replayed on both buses, the logs must give back its
+#   frames, channel by channel and in order; the error frames and malformed lines of the trace are skipped.
+import glob
+import os
+import random
+import re
+import subprocess
+from typing import Dict, List, Tuple
+
+import pytest
+from pytest_embedded_idf.app import IdfApp
+
+BUS_LINE = re.compile(r'bus (\d): (\d+) frames delivered, (\d+) lost')
+THROUGHPUT_LINE = re.compile(r'(\d+) frames in ([\d.]+) s, (\d+) frames/s')
+# <time> <channel> <id>[x] Rx d|r <dlc> <bytes>, as formatAscFrameLine() writes them (include/asc_format.h).
+FRAME_LINE = re.compile(r' *\d+\.\d+ (\d) +([0-9A-F]+)(x?) +Rx +([dr]) (\d+)((?: [0-9A-F]{2})*)$')
+ASC_CHANNELS = (1, 2)  # ASC_CHANNEL_TWAI, ASC_CHANNEL_MCP2515, the channels of the buses 0 and 1.
+REPLAY_FRAMES = 2000  # Per channel.
+REPLAY_SEED = 0x2545F491
+
+Frame = Tuple[int, bool, bool, int, str]  # Identifier, extended, remote, DLC, data bytes.
+
+
+def run_simulation(app: IdfApp, tmp_path: str) -> str:
+    run = subprocess.run([app.elf_file], cwd=tmp_path, stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                         timeout=300)
+    output = run.stdout.decode(errors='replace')
+    assert run.returncode == 0, output
+    return output
+
+
+def read_logs(app: IdfApp, tmp_path: str) -> Dict[int, List[Frame]]:
+    """Frames of the LOG_FS logs by channel, in the order of the logs."""
+    card = os.path.join(tmp_path, app.sdkconfig.get('DATAFLY_HOST_CARD_DIR', 'sdcard'))
+    logs = sorted(glob.glob(os.path.join(card, 'LOG_FS', '**', '*.asc'), recursive=True))
+    assert logs, 'no log was written'
+    frames: Dict[int, List[Frame]] = {channel: [] for channel in ASC_CHANNELS}
+    for log in logs:
+        with open(log) as log_file:
+            lines = log_file.read().splitlines()
+        assert lines[-1] == 'End TriggerBlock', log
+        for line in lines:
+            match = FRAME_LINE.match(line)
+            if match:
+                channel, identifier, extended, kind, dlc, data = match.groups()
+                frames[int(channel)].append((int(identifier, 16), extended == 'x', kind == 'r', int(dlc),
+                                             data.strip()))
+    return frames
+
+
+@pytest.mark.linux
+@pytest.mark.host_test
+@pytest.mark.parametrize('config', ['host_sim'], indirect=True)
+def test_host_sim(app: IdfApp, tmp_path: str) -> None:
+    output = run_simulation(app, str(tmp_path))
+
+    frames = int(app.sdkconfig.get('DATAFLY_HOST_FRAMES'))
+    buses = {int(bus): (int(delivered), int(lost)) for bus, delivered, lost in BUS_LINE.findall(output)}
+    assert buses == {0: (frames, 0), 1: (frames, 0)}, output
+    throughput = THROUGHPUT_LINE.search(output)
+    assert throughput, output
+    assert int(throughput.group(1)) == 2 * frames
+    assert float(throughput.group(2)) > 0 and int(throughput.group(3)) > 0
+
+    written = read_logs(app, str(tmp_path))
+    assert [len(written[channel]) for channel in ASC_CHANNELS] == [frames, frames]
+
+
+def write_trace(path: str) -> Dict[int, List[Frame]]:
+    """An ASC trace of both channels interleaved: 11 and 29-bit identifiers, remote frames, every DLC, with error
+    frames and malformed lines in between."""
+    rng = random.Random(REPLAY_SEED)
+    frames: Dict[int, List[Frame]] = {channel: [] for channel in ASC_CHANNELS}
+    with open(path, 'w') as trace:
+        trace.write('date Thu Jan 01 12:00:00.000 am 1970\nbase hex  timestamps absolute\n'
+                    'Begin Triggerblock Thu Jan 01 12:00:00.000 am 1970\n')
+        for i in range(2 * REPLAY_FRAMES):
+            channel = ASC_CHANNELS[i % 2]
+            extended = rng.random() < 0.3
+            identifier = rng.randrange(1 << 29) if extended else rng.randrange(1 << 11)
+            remote = rng.random() < 0.1
+            dlc = rng.randrange(9)
+            data = '' if remote else ' '.join('{:02X}'.format(rng.randrange(256)) for _ in range(dlc))
+            time_s = i * 0.0005
+            trace.write(' {:.6f} {}  {:X}{}  Rx   {} {}{}\n'.format(time_s, channel, identifier, 'x' if extended else '',
+                                                                    'r' if remote else 'd', dlc,
+                                                                    ' ' + data if data else ''))
+            frames[channel].append((identifier, extended, remote, dlc, data))
+            if i % 97 == 0:
+                trace.write(' {:.6f} {}  ErrorFrame\n'.format(time_s, channel))
+                trace.write(' {:.6f} {}  123  Rx   d 2 00\n'.format(time_s, channel))
+        trace.write('End TriggerBlock\n')
+    return frames
+
+
+@pytest.mark.linux
+@pytest.mark.host_test
+@pytest.mark.parametrize('config', ['host_replay'], indirect=True)
+def test_host_replay(app: IdfApp, tmp_path: str) -> None:
+    replayed = write_trace(os.path.join(str(tmp_path), app.sdkconfig.get('DATAFLY_HOST_REPLAY_FILE')))
+    output = run_simulation(app, str(tmp_path))
+
+    buses = {int(bus): (int(delivered), int(lost)) for bus, delivered, lost in BUS_LINE.findall(output)}
+    assert buses == {0: (REPLAY_FRAMES, 0), 1: (REPLAY_FRAMES, 0)}, output
+    written = read_logs(app, str(tmp_path))
+    for channel in ASC_CHANNELS:
+        assert written[channel] == replayed[channel], 'channel {}'.format(channel)
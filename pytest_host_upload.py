@@ -0,0 +1,57 @@
+# Host simulation with the uploader (sdkconfig.ci.host_upload): the logs of the run are sent to tools/upload_server.py
+# with a dropped connection, a chunk damaged in transit and a chunk only half acknowledged on the way, and must all end
+# up on the server, byte for byte.
+import os
+import subprocess
+import sys
+import threading
+
+import pytest
+from pytest_embedded_idf.app import IdfApp
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), 'tools'))
+from upload_server import UploadServer  # noqa: E402
+
+# The logs closed by the end of the run: the summary and signal segments in progress stay open, and are not sent.
+LOG_CLASSES = ('ERR_FS', 'LOG_FS')
+DROP_AT = 3
+CORRUPT_AT = 6
+PARTIAL_AT = 9
+
+
+@pytest.mark.linux
+@pytest.mark.host_test
+@pytest.mark.parametrize('config', ['host_upload'], indirect=True)
+def test_host_upload(app: IdfApp, tmp_path: str) -> None:
+    received = os.path.join(str(tmp_path), 'received')
+    server = UploadServer(('127.0.0.1', 8070), received, '/upload', {DROP_AT}, {CORRUPT_AT}, {PARTIAL_AT})
+    thread = threading.Thread(target=server.serve_forever, daemon=True)
+    thread.start()
+    try:
+        run = subprocess.run([app.elf_file], cwd=str(tmp_path), stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                             timeout=300)
+    finally:
+        server.shutdown()
+        server.server_close()
+    output = run.stdout.decode(errors='replace')
+    assert run.returncode == 0, output
+    assert 'uploads: done' in output
+
+    card = os.path.join(str(tmp_path), app.sdkconfig.get('DATAFLY_HOST_CARD_DIR', 'sdcard'))
+    segments = []
+    for class_directory in LOG_CLASSES:
+        for directory, _, files in os.walk(os.path.join(card, class_directory)):
+            segments += [os.path.relpath(os.path.join(directory, name), card) for name in files]
+    assert any(segment.startswith('ERR_FS') for segment in segments), 'no capture was written'
+    assert any(segment.startswith('LOG_FS') for segment in segments), 'no log was written'
+    for segment in segments:
+        with open(os.path.join(card, segment), 'rb') as card_file, open(os.path.join(received, segment), 'rb') as sent:
+            assert card_file.read() == sent.read(), segment
+
+    events = {request: event for request, _, _, event in server.events}
+    assert events.get(DROP_AT) == 'dropped'
+    assert events.get(CORRUPT_AT) == 'crc rejected'
+    assert events.get(PARTIAL_AT) == 'partial'
+    # Each fault is followed by the chunk sent again from the bytes the server holds.
+    for fault in (DROP_AT, CORRUPT_AT, PARTIAL_AT):
+        assert events.get(fault + 1) == 'stored'
@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+# Stand-in for the upload back end of include/uploader.h, for bench runs and the host tests.
+#   PUT <prefix>/<segment path>, Content-Range: bytes <first>-<last>/<size>, X-Chunk-CRC32: <8 hex digits>
+# The contiguous bytes held for a segment are the size of its file under the root directory. A chunk starting
+# within them is checked against its CRC and stored; the answer carries X-Acked-Offset, the bytes now held:
+#   200 segment complete, 308 more to come, 409 CRC rejected, 416 chunk beyond the bytes held.
+# Faults can be injected on given requests (numbered from 1, across segments) to exercise the resume logic:
+#   --drop-at N     half the chunk is stored and the connection is closed without an answer
+#   --corrupt-at N  the chunk is taken as damaged in transit: CRC rejected
+#   --partial-at N  only the first half of the chunk is stored and acknowledged
+# Usage: python tools/upload_server.py --port 8070 --root received --drop-at 3 --corrupt-at 5
+import argparse
+import binascii
+import os
+import re
+import socket
+import threading
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from typing import List, Optional, Set, Tuple
+
+CONTENT_RANGE = re.compile(r'bytes (\d+)-(\d+)/(\d+)$')
+
+
+class UploadServer(ThreadingHTTPServer):
+    daemon_threads = True
+
+    def __init__(self, address: Tuple[str, int], root: str, prefix: str = '/upload',
+                 drop_at: Optional[Set[int]] = None, corrupt_at: Optional[Set[int]] = None,
+                 partial_at: Optional[Set[int]] = None) -> None:
+        super().__init__(address, UploadHandler)
+        self.root = root
+        self.prefix = prefix.rstrip('/')
+        self.drop_at = drop_at or set()
+        self.corrupt_at = corrupt_at or set()
+        self.partial_at = partial_at or set()
+        self.requests = 0
+        # (request number, segment path, first byte, what happened), for the tests to look at.
+        self.events: List[Tuple[int, str, int, str]] = []
+        self.lock = threading.Lock()
+
+    def segment_path(self, url_path: str) -> Optional[str]:
+        if not url_path.startswith(self.prefix + '/'):
+            return None
+        name = url_path[len(self.prefix) + 1:]
+        if not name or any(part in ('', '.', '..') for part in name.split('/')):
+            return None
+        return name
+
+
+class UploadHandler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'  # Keep-alive, as the uploader asks for.
+    server: UploadServer
+
+    def log_message(self, format: str, *args: object) -> None:
+        pass
+
+    def answer(self, status: int, acked: int) -> None:
+        self.send_response(status)
+        self.send_header('X-Acked-Offset', str(acked))
+        self.send_header('Content-Length', '0')
+        self.end_headers()
+
+    def do_PUT(self) -> None:
+        server = self.server
+        name = server.segment_path(self.path)
+        match = CONTENT_RANGE.match(self.headers.get('Content-Range', ''))
+        length = int(self.headers.get('Content-Length', '0'))
+        if not name or not match:
+            self.rfile.read(length)
+            self.send_error(400)
+            return
+        first, last, size = (int(group) for group in match.groups())
+        path = os.path.join(server.root, *name.split('/'))
+
+        with server.lock:
+            server.requests += 1
+            request = server.requests
+            os.makedirs(os.path.dirname(path), exist_ok=True)
+            held = os.path.getsize(path) if os.path.exists(path) else 0
+
+            if request in server.drop_at:
+                data = self.rfile.read(length // 2)
+                if first <= held:
+                    self.store(path, first, data)
+                server.events.append((request, name, first, 'dropped'))
+                self.close_connection = True
+                self.connection.shutdown(socket.SHUT_RDWR)
+                return
+
+            data = self.rfile.read(length)
+            crc = binascii.crc32(data) if request not in server.corrupt_at else binascii.crc32(data) ^ 1
+            if first > held:
+                event, status = 'beyond', 416
+            elif last - first + 1 != len(data) or crc != int(self.headers.get('X-Chunk-CRC32', ''), 16):
+                event, status = 'crc rejected', 409
+            else:
+                if request in server.partial_at:
+                    data = data[:len(data) // 2]
+                held = self.store(path, first, data)
+                event, status = 'partial' if request in server.partial_at else 'stored', 200 if held >= size else 308
+            server.events.append((request, name, first, event))
+        self.answer(status, held)
+
+    @staticmethod
+    def store(path: str, first: int, data: bytes) -> int:
+        with open(path, 'r+b' if os.path.exists(path) else 'wb') as segment:
+            segment.seek(first)
+            segment.write(data)
+            segment.seek(0, os.SEEK_END)
+            return segment.tell()
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description='Stand-in upload back end (see include/uploader.h).')
+    parser.add_argument('--host', default='0.0.0.0')
+    parser.add_argument('--port', type=int, default=8080)
+    parser.add_argument('--root', default='received', help='directory the segments are stored in')
+    parser.add_argument('--prefix', default='/upload', help='path of CONFIG_DATAFLY_UPLOAD_URL')
+    parser.add_argument('--drop-at', type=int, action='append', default=[])
+    parser.add_argument('--corrupt-at', type=int, action='append', default=[])
+    parser.add_argument('--partial-at', type=int, action='append', default=[])
+    args = parser.parse_args()
+
+    server = UploadServer((args.host, args.port), args.root, args.prefix, set(args.drop_at), set(args.corrupt_at),
+                          set(args.partial_at))
+    print('Upload server on {}:{}{}, storing in {}'.format(args.host, args.port, args.prefix, args.root))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()